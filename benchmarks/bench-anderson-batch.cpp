@@ -0,0 +1,102 @@
+/**
+ * @file
+ * Compares a batch of independent @ref quala::AndersonAccel objects to a
+ * single @ref quala::AndersonAccelBatch, which stores all instances in one
+ * allocation with the index of the instance innermost, for many small
+ * problems. The batch only vectorizes across instances, so its advantage
+ * grows with the vector width of the target (e.g. `-march=native`), while the
+ * separate instances vectorize along the (short) vectors of size n.
+ *
+ * Usage: `bench-anderson-batch [memory] [batch-size] [n...]`
+ */
+
+#include <quala/anderson-batch.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench-util.hpp"
+
+using quala::index_t;
+using quala::length_t;
+using quala::mat;
+
+int main(int argc, char *argv[]) {
+    length_t m = argc > 1 ? std::atol(argv[1]) : 5;
+    length_t B = argc > 2 ? std::atol(argv[2]) : 8192;
+    std::vector<length_t> sizes;
+    for (int i = 3; i < argc; ++i)
+        sizes.push_back(std::atol(argv[i]));
+    if (sizes.empty())
+        sizes = {8, 16, 32, 64};
+
+    std::printf("%6s %4s %8s %14s %14s %8s\n", "n", "m", "B", "separate",
+                "batch", "speedup");
+    for (length_t n : sizes) {
+        quala::AndersonAccelParams params;
+        params.memory = m;
+        std::vector<quala::AndersonAccel> aa(B,
+                                             quala::AndersonAccel(params, n));
+        quala::AndersonAccelBatch batch(params, n, B);
+        std::srand(1);
+        // Cheap stand-in for the evaluation of the function values and the
+        // residuals of all instances: combinations of a pool of random
+        // vectors, large enough for the differences of the residuals in the
+        // history to be linearly independent. The separate instances use one
+        // column per instance, the batch one row per instance.
+        const length_t pool = m + 2;
+        std::vector<mat> P(pool), Pᵀ(pool);
+        for (index_t i = 0; i < pool; ++i) {
+            P[i]  = mat::Random(n, B);
+            Pᵀ[i] = P[i].transpose();
+        }
+        mat g(n, B), r(n, B), x(n, B);
+        mat gᵀ(B, n), rᵀ(B, n), xᵀ(B, n);
+        index_t k       = 0;
+        double c        = 0;
+        const auto next = [&] {
+            c = std::rand() / double(RAND_MAX);
+            ++k;
+        };
+        const auto eval = [&] {
+            const auto i = k % pool, j = (k + 1) % pool;
+            g            = P[i] + c * P[j];
+            r            = c * P[i] - P[j];
+        };
+        const auto eval_batch = [&] {
+            const auto i = k % pool, j = (k + 1) % pool;
+            gᵀ           = Pᵀ[i] + c * Pᵀ[j];
+            rᵀ           = c * Pᵀ[i] - Pᵀ[j];
+        };
+        eval();
+        eval_batch();
+        for (index_t b = 0; b < B; ++b)
+            aa[b].initialize(g.col(b), r.col(b));
+        batch.initialize(gᵀ, rᵀ);
+        // Fill the history, so every step removes a column
+        for (index_t i = 0; i < m; ++i) {
+            next();
+            eval();
+            eval_batch();
+            for (index_t b = 0; b < B; ++b)
+                aa[b].compute(g.col(b), quala::crvec(r.col(b)), x.col(b));
+            batch.compute(gᵀ, rᵀ, xᵀ);
+        }
+        double t_sep = median_time([&] {
+            next();
+            eval();
+            for (index_t b = 0; b < B; ++b)
+                aa[b].compute(g.col(b), quala::crvec(r.col(b)), x.col(b));
+            do_not_optimize(x);
+        });
+        double t_batch = median_time([&] {
+            next();
+            eval_batch();
+            batch.compute(gᵀ, rᵀ, xᵀ);
+            do_not_optimize(xᵀ);
+        });
+        std::printf("%6ld %4ld %8ld %11.3f ms %11.3f ms %8.3f\n", n, m, B,
+                    t_sep * 1e3, t_batch * 1e3, t_sep / t_batch);
+    }
+}
@@ -0,0 +1,103 @@
+/**
+ * @file
+ * Compares Anderson acceleration with a dynamic history length to Anderson
+ * acceleration with the history length fixed at compile time (see
+ * @ref quala::StaticHistoryAndersonAccel). Reports the run time of the
+ * operations on the m×m matrix R only (@ref quala::LimitedMemoryQR::solve_col
+ * and @ref quala::LimitedMemoryQR::remove_column), and of a full
+ * @ref quala::AndersonAccel::compute step.
+ *
+ * Usage: `bench-anderson-history [n...]`
+ */
+
+#include <quala/anderson-acceleration.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "bench-util.hpp"
+
+using quala::index_t;
+using quala::length_t;
+using quala::real_t;
+using quala::vec;
+
+/// Median time of solve_col and remove_column + add_column on a full
+/// factorization.
+template <class QR>
+std::pair<double, double> time_qr(QR &qr, length_t n) {
+    std::srand(1);
+    for (index_t i = 0; i < qr.m(); ++i)
+        qr.add_column(vec::Random(n));
+    vec b = vec::Random(n), x(qr.m());
+    vec v = vec::Random(n);
+    double t_solve = median_time(
+        [&] {
+            for (unsigned i = 0; i < 100; ++i)
+                qr.solve_col(b, x), do_not_optimize(x);
+        },
+        31);
+    double t_rm = median_time(
+        [&] {
+            for (unsigned i = 0; i < 100; ++i) {
+                qr.remove_column();
+                qr.add_column(v);
+            }
+        },
+        31);
+    return {t_solve / 100, t_rm / 100};
+}
+
+/// Median time of a single Anderson step with a full history.
+template <class AA>
+double time_compute(AA &aa, length_t n) {
+    std::srand(2);
+    vec x = vec::Random(n), g = vec::Random(n), r = g - x, x_aa(n);
+    aa.initialize(g, r);
+    for (index_t i = 0; i < aa.history(); ++i) {
+        g = vec::Random(n);
+        r = g - x;
+        aa.compute(g, r, x_aa);
+    }
+    return median_time([&] {
+        for (unsigned i = 0; i < 10; ++i)
+            aa.compute(g, r, x_aa), do_not_optimize(x_aa);
+    }) / 10;
+}
+
+template <length_t M>
+void run(length_t n) {
+    quala::AndersonAccelParams params;
+    params.memory = M;
+    quala::LimitedMemoryQR qr_d(n, M);
+    quala::StaticHistoryLimitedMemoryQR<M> qr_s(n, M);
+    auto [t_solve_d, t_rm_d] = time_qr(qr_d, n);
+    auto [t_solve_s, t_rm_s] = time_qr(qr_s, n);
+    quala::AndersonAccel aa_d(params, n);
+    quala::StaticHistoryAndersonAccel<M> aa_s(params, n);
+    double t_aa_d = time_compute(aa_d, n);
+    double t_aa_s = time_compute(aa_s, n);
+    std::printf("%9ld %3ld | %9.3f %9.3f %6.2f | %9.3f %9.3f %6.2f"
+                " | %9.3f %9.3f %6.2f\n",
+                n, M, t_solve_d * 1e6, t_solve_s * 1e6, t_solve_d / t_solve_s,
+                t_rm_d * 1e6, t_rm_s * 1e6, t_rm_d / t_rm_s, t_aa_d * 1e6,
+                t_aa_s * 1e6, t_aa_d / t_aa_s);
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<length_t> sizes;
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(std::atol(argv[i]));
+    if (sizes.empty())
+        sizes = {100, 10'000, 1'000'000};
+
+    std::printf("Times in µs, dynamic vs. static history length\n");
+    std::printf("%9s %3s | %9s %9s %6s | %9s %9s %6s | %9s %9s %6s\n", "n", "m",
+                "solve", "static", "", "rm+add", "static", "", "compute",
+                "static", "");
+    for (length_t n : sizes) {
+        run<3>(n);
+        run<5>(n);
+        run<10>(n);
+    }
+}
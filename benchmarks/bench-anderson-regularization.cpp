@@ -0,0 +1,143 @@
+/**
+ * @file
+ * Compares the number of Anderson iterations needed to solve the fixed-point
+ * problems of the tests, with and without the Tikhonov regularization of the
+ * least squares problem (see
+ * @ref quala::AndersonAccelParams::regularization), for different levels of
+ * noise on the function values. Also reports the time per iteration
+ * (including the evaluation of the function).
+ *
+ * Usage: `bench-anderson-regularization [max-iter]`
+ */
+
+#include <quala/anderson-acceleration.hpp>
+
+#include <Eigen/QR>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+using quala::index_t;
+using quala::length_t;
+using quala::mat;
+using quala::real_t;
+using quala::vec;
+
+/// Fixed-point problem x = g(x), with a starting point and a history length.
+struct Problem {
+    const char *name;
+    length_t memory;
+    vec x0;
+    std::function<vec(const vec &)> g;
+};
+
+/// The problems of test-anderson-acceleration.cpp and test-static.cpp.
+std::vector<Problem> problems() {
+    std::vector<Problem> p;
+    { // Anderson.matrix
+        mat A(2, 2);
+        A << 20, -10, -10, 30;
+        vec b(2);
+        b << 9, 19;
+        p.push_back({"matrix", 2, -b, [=](const vec &x) -> vec {
+                         return A * x - b;
+                     }});
+    }
+    { // StaticHistory.AndersonAccel
+        const length_t n = 20;
+        std::srand(1);
+        mat A = mat::Random(n, n) / (4 * n);
+        vec b = vec::Random(n);
+        p.push_back({"linear-20", 3, vec::Zero(n),
+                     [=](const vec &x) -> vec { return A * x - b; }});
+    }
+    { // Anderson.memoryLargerThanDim
+        const length_t n = 4;
+        std::srand(8642);
+        mat A = mat::Random(n, n);
+        A     = 0.95 * A / A.norm();
+        vec b = vec::Random(n);
+        p.push_back({"nonlinear-4", 9, vec::Zero(n), [=](const vec &x) -> vec {
+                         return A * x + 0.05 * x.array().sin().matrix() + b;
+                     }});
+    }
+    { // Stiff linear problem, not from the tests: gradient steps on a badly
+      // conditioned quadratic, with a long history
+        const length_t n = 50;
+        std::srand(2);
+        mat V = mat::Random(n, n).householderQr().householderQ();
+        vec d = (vec::LinSpaced(n, -4, 0) * std::log(10.)).array().exp();
+        mat H = V * d.asDiagonal() * V.transpose();
+        vec b = vec::Random(n);
+        p.push_back({"stiff-50", 20, vec::Zero(n), [=](const vec &x) -> vec {
+                         return x - (H * x - b);
+                     }});
+    }
+    return p;
+}
+
+/// Number of iterations until the residual drops below @p tol (or
+/// @p max_iter), with noise of standard deviation @p σ added to all function
+/// values. Also returns the time per iteration.
+std::pair<index_t, double> solve(const Problem &p, real_t λ, real_t σ,
+                                 real_t tol, index_t max_iter) {
+    quala::AndersonAccelParams params;
+    params.memory         = p.memory;
+    params.regularization = λ;
+    const length_t n      = p.x0.size();
+    quala::AndersonAccel aa(params, n);
+    std::mt19937 rng(12345);
+    std::normal_distribution<real_t> noise(0, σ);
+    const auto g = [&](const vec &x) -> vec {
+        vec gx = p.g(x);
+        if (σ > 0)
+            for (auto &gi : gx)
+                gi += noise(rng);
+        return gx;
+    };
+    vec x = p.x0, gₖ = g(x), x_aa(n);
+    aa.initialize(gₖ, gₖ - x);
+    x = gₖ;
+    using clock = std::chrono::steady_clock;
+    auto t0     = clock::now();
+    index_t k   = 0;
+    for (; k < max_iter; ++k) {
+        gₖ     = g(x);
+        vec rₖ = gₖ - x;
+        if (rₖ.norm() < tol)
+            break;
+        aa.compute(gₖ, rₖ, x_aa);
+        x = x_aa;
+    }
+    double t = std::chrono::duration<double>(clock::now() - t0).count();
+    return {k, t / std::max<index_t>(k, 1)};
+}
+
+int main(int argc, char *argv[]) {
+    const index_t max_iter = argc > 1 ? std::atol(argv[1]) : 500;
+    const real_t λs[]      = {0, 1e-12, 1e-8, 1e-4, 1e-2};
+    // Noise level and the corresponding tolerance on the residual
+    const std::pair<real_t, real_t> noise[] = {
+        {0, 1e-10}, {1e-9, 1e-7}, {1e-6, 1e-4}};
+
+    std::printf("%-12s %8s %8s", "problem", "noise", "tol");
+    for (real_t λ : λs)
+        std::printf(" | λ=%-8.0e", λ);
+    std::printf("\n");
+    for (const auto &p : problems()) {
+        for (auto [σ, tol] : noise) {
+            std::printf("%-12s %8.0e %8.0e", p.name, σ, tol);
+            for (real_t λ : λs) {
+                auto [k, t] = solve(p, λ, σ, tol, max_iter);
+                std::printf(" | %4ld %5.2fµs", k, t * 1e6);
+            }
+            std::printf("\n");
+        }
+    }
+}
@@ -0,0 +1,75 @@
+/**
+ * @file
+ * Compares @ref quala::AndersonAccel::compute, which copies the function
+ * value and the residual into the history, to
+ * @ref quala::AndersonAccel::compute_swap, which swaps them with the buffers
+ * of the caller instead.
+ *
+ * Usage: `bench-anderson-swap [memory] [n...]`
+ */
+
+#include <quala/anderson-acceleration.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench-util.hpp"
+
+using quala::index_t;
+using quala::length_t;
+using quala::vec;
+
+int main(int argc, char *argv[]) {
+    length_t m = argc > 1 ? std::atol(argv[1]) : 10;
+    std::vector<length_t> sizes;
+    for (int i = 2; i < argc; ++i)
+        sizes.push_back(std::atol(argv[i]));
+    if (sizes.empty())
+        sizes = {10'000, 100'000, 1'000'000};
+
+    std::printf("%10s %4s %12s %12s %8s\n", "n", "m", "compute", "swap",
+                "speedup");
+    for (length_t n : sizes) {
+        quala::AndersonAccelParams params;
+        params.memory = m;
+        quala::AndersonAccel aa_copy(params, n), aa_swap(params, n);
+        std::srand(1);
+        // Cheap stand-in for the evaluation of the function value and the
+        // residual, which write into the caller's buffers: combinations of a
+        // pool of random vectors, large enough for the differences of the
+        // residuals in the history to be linearly independent
+        const length_t pool = m + 2;
+        quala::mat P        = quala::mat::Random(n, pool);
+        vec g(n), r(n), x(n);
+        index_t k       = 0;
+        const auto eval = [&] {
+            const double c = std::rand() / double(RAND_MAX);
+            const auto i   = k % pool, j = (k + 1) % pool;
+            g              = P.col(i) + c * P.col(j);
+            r              = c * P.col(i) - P.col(j);
+            ++k;
+        };
+        eval();
+        aa_copy.initialize(g, r);
+        aa_swap.initialize(g, r);
+        // Fill the history, so every step removes a column
+        for (index_t i = 0; i < m; ++i) {
+            eval();
+            aa_copy.compute(g, r, x);
+            aa_swap.compute(g, r, x);
+        }
+        double t_copy = median_time([&] {
+            eval();
+            aa_copy.compute(g, r, x);
+            do_not_optimize(x);
+        });
+        double t_swap = median_time([&] {
+            eval();
+            aa_swap.compute_swap(g, r, x);
+            do_not_optimize(x);
+        });
+        std::printf("%10ld %4ld %9.3f ms %9.3f ms %8.3f\n", n, m, t_copy * 1e3,
+                    t_swap * 1e3, t_copy / t_swap);
+    }
+}
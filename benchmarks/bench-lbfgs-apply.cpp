@@ -0,0 +1,82 @@
+/**
+ * @file
+ * Compares the fused two-loop recursion of @ref quala::LBFGS::apply to the
+ * straightforward implementation, where each iteration computes the dot
+ * product and the update of q separately.
+ *
+ * Usage: `bench-lbfgs-apply [memory] [n...]`
+ */
+
+#include <quala/lbfgs.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "bench-util.hpp"
+
+using quala::index_t;
+using quala::length_t;
+using quala::real_t;
+using quala::vec;
+
+/// Reference implementation without fusion of the dot products and updates.
+void apply_unfused(const quala::LBFGS &lbfgs, quala::rvec q, real_t γ,
+                   quala::rvec α) {
+    lbfgs.foreach_rev([&](index_t i) {
+        α(i) = lbfgs.ρ(i) * lbfgs.s(i).dot(q);
+        q -= α(i) * lbfgs.y(i);
+    });
+    q *= γ;
+    lbfgs.foreach_fwd([&](index_t i) {
+        real_t β = lbfgs.ρ(i) * lbfgs.y(i).dot(q);
+        q -= (β - α(i)) * lbfgs.s(i);
+    });
+}
+
+int main(int argc, char *argv[]) {
+    length_t m = argc > 1 ? std::atol(argv[1]) : 20;
+    std::vector<length_t> sizes;
+    for (int i = 2; i < argc; ++i)
+        sizes.push_back(std::atol(argv[i]));
+    if (sizes.empty())
+        sizes = {1'000, 10'000, 100'000, 1'000'000, 4'000'000};
+
+    std::printf("%10s %4s %12s %12s %12s %12s %8s\n", "n", "m", "unfused [ms]",
+                "fused [ms]", "unfused [MB]", "fused [MB]", "speedup");
+    for (length_t n : sizes) {
+        quala::LBFGSParams params;
+        params.memory = m;
+        quala::LBFGS lbfgs(params, n);
+        for (index_t i = 0; i < m; ++i) {
+            vec s = vec::Random(n);
+            vec y = s + 0.1 * vec::Random(n);
+            lbfgs.update_sy(s, y, 0, true);
+        }
+        vec q0 = vec::Random(n), q(n), α(m);
+        const real_t γ = 0.5;
+
+        double t_copy = median_time([&] { q = q0, do_not_optimize(q); });
+        double t_unfused = median_time([&] {
+            q = q0;
+            apply_unfused(lbfgs, q, γ, α);
+            do_not_optimize(q);
+        });
+        double t_fused = median_time([&] {
+            q = q0;
+            lbfgs.apply(q, γ);
+            do_not_optimize(q);
+        });
+        t_unfused -= t_copy;
+        t_fused -= t_copy;
+
+        // Number of vectors of length n that are read or written:
+        //   unfused: (2 + 3) m for each loop, 2 for the scaling
+        //   fused: 2 for the first dot product, 4 for each fused update and
+        //          dot product, 3 for the fused scaling, 3 for the final update
+        double b_unfused = double(10 * m + 2) * n * sizeof(real_t) / 1e6;
+        double b_fused   = double(8 * m) * n * sizeof(real_t) / 1e6;
+        std::printf("%10ld %4ld %12.4f %12.4f %12.1f %12.1f %8.3f\n", n, m,
+                    t_unfused * 1e3, t_fused * 1e3, b_unfused, b_fused,
+                    t_unfused / t_fused);
+    }
+}
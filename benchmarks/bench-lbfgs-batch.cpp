@@ -0,0 +1,88 @@
+/**
+ * @file
+ * Compares a batch of independent @ref quala::LBFGS objects to a single
+ * @ref quala::LBFGSBatch, which stores all histories in one allocation with
+ * the index of the instance innermost, for many small problems. Every
+ * iteration consists of an update of the inverse Hessian approximations of
+ * all instances, followed by their application (as when the gradients of all
+ * instances are evaluated in lockstep). As for
+ * @ref quala::AndersonAccelBatch, the batch only vectorizes across instances,
+ * so its advantage grows with the vector width of the target, while the
+ * separate instances vectorize along the (short) vectors of size n. Once the
+ * histories of all instances no longer fit in the cache, both versions are
+ * limited by the memory bandwidth.
+ *
+ * Usage: `bench-lbfgs-batch [memory] [batch-size] [n...]`
+ */
+
+#include <quala/lbfgs-batch.hpp>
+#include <quala/lbfgs.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench-util.hpp"
+
+using quala::index_t;
+using quala::length_t;
+using quala::mat;
+using quala::vec;
+
+int main(int argc, char *argv[]) {
+    length_t m = argc > 1 ? std::atol(argv[1]) : 5;
+    length_t B = argc > 2 ? std::atol(argv[2]) : 4096;
+    std::vector<length_t> sizes;
+    for (int i = 3; i < argc; ++i)
+        sizes.push_back(std::atol(argv[i]));
+    if (sizes.empty())
+        sizes = {10, 25, 50, 100, 200};
+
+    std::printf("%6s %4s %8s %14s %14s %8s\n", "n", "m", "B", "separate",
+                "batch", "speedup");
+    for (length_t n : sizes) {
+        quala::LBFGSParams params;
+        params.memory = m;
+        std::vector<quala::LBFGS> lbfgs(B, quala::LBFGS(params, n));
+        quala::LBFGSBatch batch(params, n, B);
+        std::srand(1);
+        // Cheap stand-in for the steps and the differences of the gradients
+        // of all instances: a pool of random steps s and positive diagonal
+        // Hessians D, with y = D s. The separate instances use one column
+        // per instance, the batch one row per instance.
+        const length_t pool = m + 2;
+        std::vector<mat> S(pool), Y(pool), Sᵀ(pool), Yᵀ(pool);
+        for (index_t i = 0; i < pool; ++i) {
+            S[i]  = mat::Random(n, B);
+            Y[i]  = S[i].cwiseProduct(mat::Random(n, B).cwiseAbs());
+            Y[i] += 0.1 * S[i];
+            Sᵀ[i] = S[i].transpose();
+            Yᵀ[i] = Y[i].transpose();
+        }
+        mat q = mat::Random(n, B), qᵀ = q.transpose();
+        vec pᵀp = vec::Zero(B);
+        index_t k = 0;
+        // Fill the history, so every update overwrites the oldest pair
+        for (; k < m; ++k) {
+            for (index_t b = 0; b < B; ++b)
+                lbfgs[b].update_sy(S[k % pool].col(b), Y[k % pool].col(b), 0);
+            batch.update_sy(Sᵀ[k % pool], Yᵀ[k % pool], pᵀp);
+        }
+        double t_sep = median_time([&] {
+            const auto i = k++ % pool;
+            for (index_t b = 0; b < B; ++b)
+                lbfgs[b].update_sy(S[i].col(b), Y[i].col(b), 0);
+            for (index_t b = 0; b < B; ++b)
+                lbfgs[b].apply(q.col(b));
+            do_not_optimize(q);
+        });
+        double t_batch = median_time([&] {
+            const auto i = k++ % pool;
+            batch.update_sy(Sᵀ[i], Yᵀ[i], pᵀp);
+            batch.apply(qᵀ);
+            do_not_optimize(qᵀ);
+        });
+        std::printf("%6ld %4ld %8ld %11.3f ms %11.3f ms %8.3f\n", n, m, B,
+                    t_sep * 1e3, t_batch * 1e3, t_sep / t_batch);
+    }
+}
@@ -0,0 +1,70 @@
+/**
+ * @file
+ * Compares L-BFGS with the history stored in memory to L-BFGS with the
+ * history stored in a memory mapped temporary file (see
+ * @ref quala::LBFGSParams::storage_dir). Reports the run time of
+ * @ref quala::LBFGS::apply.
+ *
+ * Usage: `bench-lbfgs-mapped [directory] [memory] [n...]`
+ */
+
+#include <quala/lbfgs.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "bench-util.hpp"
+
+using quala::index_t;
+using quala::length_t;
+using quala::real_t;
+using quala::vec;
+
+/// Median time of a single call to apply with a full history.
+double time_apply(length_t n, length_t m, quala::LBFGSApplyMethod method,
+                  const std::string &dir) {
+    quala::LBFGSParams params;
+    params.memory       = m;
+    params.apply_method = method;
+    params.storage_dir  = dir;
+    quala::LBFGS lbfgs(params, n);
+    std::srand(1);
+    for (index_t i = 0; i < m; ++i) {
+        vec s = vec::Random(n);
+        vec y = s + 0.1 * vec::Random(n);
+        lbfgs.update_sy(s, y, 0, true);
+    }
+    vec q0 = vec::Random(n), q(n);
+    double t_copy = median_time([&] { q = q0, do_not_optimize(q); });
+    double t      = median_time([&] {
+        q = q0;
+        lbfgs.apply(q, 0.5);
+        do_not_optimize(q);
+    });
+    return t - t_copy;
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    length_t m      = argc > 2 ? std::atol(argv[2]) : 20;
+    std::vector<length_t> sizes;
+    for (int i = 3; i < argc; ++i)
+        sizes.push_back(std::atol(argv[i]));
+    if (sizes.empty())
+        sizes = {10'000, 100'000, 1'000'000, 4'000'000};
+
+    using Method = quala::LBFGSApplyMethod;
+    for (auto method : {Method::TwoLoop, Method::Compact}) {
+        std::printf("\n%s\n", method == Method::TwoLoop ? "Two-loop recursion"
+                                                        : "Compact");
+        std::printf("%10s %4s %12s %12s %8s\n", "n", "m", "memory [ms]",
+                    "mapped [ms]", "ratio");
+        for (length_t n : sizes) {
+            double t_mem = time_apply(n, m, method, {});
+            double t_map = time_apply(n, m, method, dir);
+            std::printf("%10ld %4ld %12.4f %12.4f %8.3f\n", n, m, t_mem * 1e3,
+                        t_map * 1e3, t_map / t_mem);
+        }
+    }
+}
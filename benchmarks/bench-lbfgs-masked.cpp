@@ -0,0 +1,117 @@
+/**
+ * @file
+ * Compares the masked @ref quala::LBFGS::apply with an index vector to the
+ * version with a run-length compressed @ref quala::IndexRanges, and to a
+ * reference implementation with element-wise gathers, for dense, sparse and
+ * run-structured index sets.
+ *
+ * Usage: `bench-lbfgs-masked [memory] [n...]`
+ */
+
+#include <quala/lbfgs.hpp>
+#include <quala/util/index-ranges.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bench-util.hpp"
+
+using quala::index_t;
+using quala::length_t;
+using quala::real_t;
+using quala::vec;
+
+/// Reference implementation of the masked two-loop recursion, element by
+/// element.
+void apply_elementwise(const quala::LBFGS &lbfgs, quala::rvec q, real_t γ,
+                       const std::vector<index_t> &J, quala::rvec α,
+                       quala::rvec ρ) {
+    auto dotJ = [&](const auto &a, const auto &b) {
+        real_t acc = 0;
+        for (auto j : J)
+            acc += a(j) * b(j);
+        return acc;
+    };
+    lbfgs.foreach_rev([&](index_t i) {
+        ρ(i) = 1 / dotJ(lbfgs.s(i), lbfgs.y(i));
+        α(i) = ρ(i) * dotJ(lbfgs.s(i), q);
+        for (auto j : J)
+            q(j) -= α(i) * lbfgs.y(i)(j);
+    });
+    for (auto j : J)
+        q(j) *= γ;
+    lbfgs.foreach_fwd([&](index_t i) {
+        real_t β = ρ(i) * dotJ(lbfgs.y(i), q);
+        for (auto j : J)
+            q(j) -= (β - α(i)) * lbfgs.s(i)(j);
+    });
+}
+
+int main(int argc, char *argv[]) {
+    length_t m = argc > 1 ? std::atol(argv[1]) : 20;
+    std::vector<length_t> sizes;
+    for (int i = 2; i < argc; ++i)
+        sizes.push_back(std::atol(argv[i]));
+    if (sizes.empty())
+        sizes = {10'000, 100'000, 1'000'000};
+
+    std::printf("%10s %6s %8s %10s %14s %12s %14s %8s\n", "n", "mask", "|J|",
+                "ranges", "elementwise", "index vec", "IndexRanges",
+                "speedup");
+    for (length_t n : sizes) {
+        quala::LBFGSParams params;
+        params.memory = m;
+        quala::LBFGS lbfgs(params, n);
+        for (index_t i = 0; i < m; ++i) {
+            vec s = vec::Random(n);
+            vec y = s + 0.1 * vec::Random(n);
+            lbfgs.update_sy(s, y, 0, true);
+        }
+        vec q0 = vec::Random(n), q(n), α(m), ρ(m);
+        const real_t γ = 0.5;
+
+        // Dense: all but a few indices, sparse: random 5 %, runs: alternating
+        // blocks of 1000 free and 500 fixed indices
+        std::srand(1);
+        std::vector<std::pair<std::string, std::vector<index_t>>> masks(3);
+        masks[0].first = "dense";
+        masks[1].first = "sparse";
+        masks[2].first = "runs";
+        for (index_t i = 0; i < n; ++i) {
+            if (i % 997 != 0)
+                masks[0].second.push_back(i);
+            if (std::rand() % 20 == 0)
+                masks[1].second.push_back(i);
+            if (i % 1500 < 1000)
+                masks[2].second.push_back(i);
+        }
+
+        for (auto &[name, J] : masks) {
+            quala::IndexRanges R = J;
+            double t_copy = median_time([&] { q = q0, do_not_optimize(q); });
+            double t_elem = median_time([&] {
+                q = q0;
+                apply_elementwise(lbfgs, q, γ, J, α, ρ);
+                do_not_optimize(q);
+            });
+            double t_vec = median_time([&] {
+                q = q0;
+                lbfgs.apply(q, γ, J);
+                do_not_optimize(q);
+            });
+            double t_ranges = median_time([&] {
+                q = q0;
+                lbfgs.apply(q, γ, R);
+                do_not_optimize(q);
+            });
+            t_elem -= t_copy, t_vec -= t_copy, t_ranges -= t_copy;
+            std::printf("%10ld %6s %8zu %10ld %11.4f ms %9.4f ms %11.4f ms "
+                        "%8.3f\n",
+                        n, name.c_str(), J.size(), R.num_ranges(),
+                        t_elem * 1e3, t_vec * 1e3, t_ranges * 1e3,
+                        t_elem / t_ranges);
+        }
+    }
+}
@@ -0,0 +1,141 @@
+/**
+ * @file
+ * Compares L-BFGS with the history stored in double precision to L-BFGS with
+ * the history stored in single precision and bfloat16 (see
+ * @ref quala::BasicLBFGS). Reports the run time of @ref quala::LBFGS::apply and
+ * the number of iterations needed to solve some quadratic test problems.
+ *
+ * Usage: `bench-lbfgs-mixed [memory] [n...]`
+ */
+
+#include <quala/lbfgs.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#include "bench-util.hpp"
+
+using quala::index_t;
+using quala::length_t;
+using quala::mat;
+using quala::real_t;
+using quala::vec;
+
+/// Median time of a single call to apply with a full history.
+template <class StorageReal>
+double time_apply(length_t n, length_t m, quala::LBFGSApplyMethod method) {
+    quala::LBFGSParams params;
+    params.memory       = m;
+    params.apply_method = method;
+    quala::BasicLBFGS<real_t, StorageReal> lbfgs(params, n);
+    std::srand(1);
+    for (index_t i = 0; i < m; ++i) {
+        vec s = vec::Random(n);
+        vec y = s + 0.1 * vec::Random(n);
+        lbfgs.update_sy(s, y, 0, true);
+    }
+    vec q0 = vec::Random(n), q(n);
+    double t_copy = median_time([&] { q = q0, do_not_optimize(q); });
+    double t      = median_time([&] {
+        q = q0;
+        lbfgs.apply(q, 0.5);
+        do_not_optimize(q);
+    });
+    return t - t_copy;
+}
+
+/// Minimize ½ xᵀAx - bᵀx using L-BFGS with an exact line search, and return
+/// the number of iterations until the gradient is reduced by a factor
+/// @p tol (or @p max_iter if it didn't converge).
+template <class StorageReal>
+unsigned count_iterations(const std::function<vec(const vec &)> &A,
+                          const vec &b, length_t m, real_t tol,
+                          unsigned max_iter = 1000) {
+    quala::LBFGSParams params;
+    params.memory = m;
+    quala::BasicLBFGS<real_t, StorageReal> lbfgs(params, b.size());
+    vec x = vec::Zero(b.size());
+    vec g = A(x) - b;
+    const real_t g0 = g.norm();
+    for (unsigned k = 0; k < max_iter; ++k) {
+        if (g.norm() <= tol * g0)
+            return k;
+        vec d = g;
+        if (not lbfgs.apply(d, -1))
+            d *= 1 / g0;
+        const vec Ad = A(d);
+        const real_t t = g.dot(d) / d.dot(Ad);
+        vec x_new      = x - t * d;
+        vec g_new      = g - t * Ad;
+        lbfgs.update(x, x_new, g, g_new);
+        x = std::move(x_new);
+        g = std::move(g_new);
+    }
+    return max_iter;
+}
+
+int main(int argc, char *argv[]) {
+    length_t m = argc > 1 ? std::atol(argv[1]) : 20;
+    std::vector<length_t> sizes;
+    for (int i = 2; i < argc; ++i)
+        sizes.push_back(std::atol(argv[i]));
+    if (sizes.empty())
+        sizes = {10'000, 100'000, 1'000'000, 4'000'000};
+
+    using Method = quala::LBFGSApplyMethod;
+    for (auto method : {Method::TwoLoop, Method::Compact}) {
+        std::printf("\n%s\n", method == Method::TwoLoop ? "Two-loop recursion"
+                                                        : "Compact");
+        std::printf("%10s %4s %12s %12s %12s %8s %8s\n", "n", "m",
+                    "double [ms]", "float [ms]", "bf16 [ms]", "float", "bf16");
+        for (length_t n : sizes) {
+            double t_d  = time_apply<double>(n, m, method);
+            double t_f  = time_apply<float>(n, m, method);
+            double t_bf = time_apply<Eigen::bfloat16>(n, m, method);
+            std::printf("%10ld %4ld %12.4f %12.4f %12.4f %8.3f %8.3f\n", n, m,
+                        t_d * 1e3, t_f * 1e3, t_bf * 1e3, t_d / t_f,
+                        t_d / t_bf);
+        }
+    }
+
+    // Test problems: the small systems from the unit tests, and a large
+    // diagonal problem with logarithmically spaced eigenvalues.
+    mat H_quad(2, 2), A_mat(2, 2);
+    H_quad << 2, -1, -1, 3;
+    A_mat << 20, -10, -10, 30;
+    vec b_quad(2), b_mat(2);
+    b_quad << 10, -5;
+    b_mat << 10, 20;
+    const length_t n_diag = 100'000;
+    vec λ(n_diag);
+    for (index_t i = 0; i < n_diag; ++i)
+        λ(i) = std::pow(1e4, real_t(i) / real_t(n_diag - 1));
+    std::srand(2);
+    vec b_diag = vec::Random(n_diag);
+    struct Problem {
+        const char *name;
+        std::function<vec(const vec &)> A;
+        vec b;
+    } problems[]{
+        {"LBFGS.quadratic", [&](const vec &x) { return vec(H_quad * x); },
+         b_quad},
+        {"BFGS.matrix", [&](const vec &x) { return vec(A_mat * x); }, b_mat},
+        {"diag(1..1e4)", [&](const vec &x) { return vec(λ.cwiseProduct(x)); },
+         b_diag},
+    };
+
+    std::printf("\nIterations until ‖∇f‖ ≤ tol ‖∇f₀‖ (m = %ld)\n", m);
+    std::printf("%16s %8s %8s %8s %8s\n", "problem", "tol", "double", "float",
+                "bf16");
+    for (auto &p : problems) {
+        for (real_t tol : {1e-4, 1e-8}) {
+            unsigned k_d  = count_iterations<double>(p.A, p.b, m, tol);
+            unsigned k_f  = count_iterations<float>(p.A, p.b, m, tol);
+            unsigned k_bf = count_iterations<Eigen::bfloat16>(p.A, p.b, m, tol);
+            std::printf("%16s %8.0e %8u %8u %8u\n", p.name, tol, k_d, k_f,
+                        k_bf);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/**
+ * @file
+ * Scaling of @ref quala::LBFGS::apply, @ref quala::LBFGS::update_sy and
+ * @ref quala::LBFGS::scale_y with the number of threads
+ * (see @ref quala::LBFGSParams::num_threads). The first row uses the serial
+ * implementation (zero threads), the speedups are relative to this row.
+ *
+ * Usage: `bench-lbfgs-parallel [n] [memory] [threads...]`
+ */
+
+#include <quala/lbfgs.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "bench-util.hpp"
+
+using quala::index_t;
+using quala::length_t;
+using quala::real_t;
+using quala::vec;
+
+int main(int argc, char *argv[]) {
+    length_t n = argc > 1 ? std::atol(argv[1]) : 10'000'000;
+    length_t m = argc > 2 ? std::atol(argv[2]) : 10;
+    std::vector<length_t> threads{0};
+    for (int i = 3; i < argc; ++i)
+        threads.push_back(std::atol(argv[i]));
+    if (threads.size() == 1)
+        for (length_t t = 1; t <= std::thread::hardware_concurrency(); t *= 2)
+            threads.push_back(t);
+
+    std::srand(1);
+    vec s0 = vec::Random(n), y0 = s0 + 0.1 * vec::Random(n);
+    vec q0 = vec::Random(n), q(n);
+
+    std::printf("n = %ld, m = %ld\n", n, m);
+    std::printf("%7s %12s %8s %12s %8s %12s %8s\n", "threads", "apply [ms]",
+                "speedup", "update [ms]", "speedup", "scale [ms]", "speedup");
+    double t_apply_0 = 0, t_update_0 = 0, t_scale_0 = 0;
+    for (length_t num_threads : threads) {
+        quala::LBFGSParams params;
+        params.memory      = m;
+        params.num_threads = num_threads;
+        quala::LBFGS lbfgs(params, n);
+        for (index_t i = 0; i < m; ++i)
+            lbfgs.update_sy(s0, y0, 0, true);
+
+        double t_update =
+            median_time([&] { lbfgs.update_sy(s0, y0, 0, false); }, 5);
+        double t_scale = median_time([&] { lbfgs.scale_y(1); }, 5);
+        double t_copy  = median_time([&] { q = q0, do_not_optimize(q); }, 5);
+        double t_apply = median_time(
+                             [&] {
+                                 q = q0;
+                                 lbfgs.apply(q, 0.5);
+                                 do_not_optimize(q);
+                             },
+                             5) -
+                         t_copy;
+        if (num_threads == 0) {
+            t_apply_0  = t_apply;
+            t_update_0 = t_update;
+            t_scale_0  = t_scale;
+        }
+        std::printf("%7ld %12.3f %8.2f %12.3f %8.2f %12.3f %8.2f\n",
+                    num_threads, t_apply * 1e3, t_apply_0 / t_apply,
+                    t_update * 1e3, t_update_0 / t_update, t_scale * 1e3,
+                    t_scale_0 / t_scale);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+/// @file
+/// Minimal timing utilities for the benchmarks.
+
+/// Run @p f @p reps times (after one warm-up run) and return the median run
+/// time in seconds.
+template <class F>
+double median_time(F &&f, unsigned reps = 15) {
+    using clock = std::chrono::steady_clock;
+    std::vector<double> times(reps);
+    f(); // warm-up
+    for (auto &t : times) {
+        auto t0 = clock::now();
+        f();
+        auto t1 = clock::now();
+        t       = std::chrono::duration<double>(t1 - t0).count();
+    }
+    std::nth_element(times.begin(), times.begin() + reps / 2, times.end());
+    return times[reps / 2];
+}
+
+/// Prevent the compiler from optimizing away the computation of @p v.
+template <class T>
+void do_not_optimize(const T &v) {
+    asm volatile("" : : "r"(&v) : "memory");
+}
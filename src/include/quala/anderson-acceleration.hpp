@@ -2,21 +2,44 @@
 
 #include <quala/detail/anderson-helpers.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <limits>
 #include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 namespace quala {
 
-/// Parameters for the @ref AndersonAccel class.
-struct AndersonAccelParams {
+/// Parameters for the @ref BasicAndersonAccel class.
+/// @tparam Real
+///         Floating point type.
+template <class Real>
+struct BasicAndersonAccelParams {
+    USING_QUALA_TYPES(Real);
+
     /// Length of the history to keep (the number of columns in the QR
     /// factorization).
-    /// If this number is greater than the problem dimension, the memory is set
-    /// to the problem dimension (otherwise the system is underdetermined).
+    /// If this number is greater than the problem dimension, the least squares
+    /// problem is underdetermined once the history is full, and its
+    /// minimum-norm solution is used.
+    /// Ignored if the memory is fixed at compile time.
     length_t memory = 10;
     /// Minimum divisor when solving close to singular systems,
     /// scaled by the maximum eigenvalue of R.
     real_t min_div = 1e2 * std::numeric_limits<real_t>::epsilon();
+    /// Regularization λ of the least squares problem
+    /// @f$ \min_\gamma \|\Delta R\,\gamma - r_k\|^2 + \lambda \sum_i
+    /// \|\Delta r_i\|^2 \gamma_i^2 @f$, which gives extrapolation
+    /// coefficients that depend continuously on the residuals, instead of
+    /// skipping small diagonal elements of R (see @ref min_div). Each
+    /// coefficient is penalized relative to the size of its residual
+    /// difference, so λ is dimensionless and does not need to be adapted as
+    /// the residuals converge. It should be well above the machine precision
+    /// (e.g. 1e-8), since RᵀR is singular if the memory is larger than the
+    /// problem dimension. Zero disables the regularization.
+    real_t regularization = 0;
 };
 
 /**
@@ -28,75 +51,237 @@ struct AndersonAccelParams {
  *
  * @todo   Condition estimation of the QR factorization.
  *
+ * @tparam  Real
+ *          Floating point type.
+ * @tparam  N
+ *          Compile-time problem dimension, or `Eigen::Dynamic`.
+ * @tparam  M
+ *          Compile-time length of the history, or `Eigen::Dynamic`. If both
+ *          dimensions are fixed, no memory is allocated on the heap.
+ *
  * @ingroup accelerators-grp
  */
-class AndersonAccel {
+template <class Real, length_t N = Eigen::Dynamic, length_t M = Eigen::Dynamic>
+class BasicAndersonAccel {
   public:
-    using Params = AndersonAccelParams;
+    USING_QUALA_TYPES(Real);
+    using Params = BasicAndersonAccelParams<real_t>;
+    /// Vector of size n.
+    using vec_n = Eigen::Matrix<real_t, N, 1>;
 
     /// @param  params
     ///         Parameters.
-    AndersonAccel(Params params) : params(params) {}
+    BasicAndersonAccel(Params params) : params(params) {
+        if constexpr (N != Eigen::Dynamic)
+            resize(N);
+    }
     /// @param  params
     ///         Parameters.
     /// @param  n
     ///         Problem dimension (size of the vectors).
-    AndersonAccel(Params params, length_t n) : params(params) { resize(n); }
+    BasicAndersonAccel(Params params, length_t n) : params(params) {
+        resize(n);
+    }
 
     /// Change the problem dimension. Flushes the history.
     /// @param  n
     ///         Problem dimension (size of the vectors).
     void resize(length_t n) {
-        length_t m_AA = std::min(n, params.memory); // TODO: support m > n?
+        if (N != Eigen::Dynamic && n != N)
+            throw std::invalid_argument("AndersonAccel: dimension mismatch");
+        if constexpr (M != Eigen::Dynamic)
+            params.memory = M;
+        const length_t m_AA = params.memory;
         qr.resize(n, m_AA);
-        G.resize(n, m_AA);
+        qr.set_regularization(params.regularization);
+        if constexpr (M == Eigen::Dynamic)
+            G.resize(m_AA);
+        for (auto &g : G)
+            g.resize(n);
         rₗₐₛₜ.resize(n);
         γ_LS.resize(m_AA);
         initialized = false;
+        commit();
+    }
+
+    /// Change the history length to @p m without a @ref reset: the newest
+    /// columns of the QR factorization are kept (the oldest ones are removed
+    /// using Givens rotations), together with the corresponding function
+    /// values. Shrinking is done in place, the storage is only re-allocated if
+    /// @p m exceeds the largest history length used so far.
+    /// When growing a full buffer, the oldest column is dropped as well,
+    /// because its function value has already been overwritten.
+    void set_memory(length_t m) {
+        if constexpr (M != Eigen::Dynamic)
+            if (m != M)
+                throw std::invalid_argument("AndersonAccel: memory must be "
+                                            "equal to the compile-time "
+                                            "history length M");
+        if (m < 1)
+            throw std::invalid_argument("AndersonAccel: memory must be >= 1");
+        commit();
+        params.memory        = m;
+        const length_t m_AA  = m;
+        const length_t m_old = history();
+        const index_t newest = qr.ring_tail();
+        length_t p           = std::min(qr.num_columns(), m_AA);
+        if (p < m_AA && p == m_old)
+            --p; // g_{k-p} was overwritten by g_k
+        while (qr.num_columns() > p)
+            qr.remove_column();
+        // Function values g_{k-j}, j = 0...J, are needed, and g_{k-j} is
+        // stored in column (newest - j) mod m_old. Move them to the start of
+        // the buffer, oldest first. If the new buffer is full, g_k takes the
+        // place of g_{k-p} in the first column.
+        if (initialized) {
+            const length_t J = p < m_AA ? p : p - 1;
+            const index_t s  = (newest - J + m_old) % m_old;
+            std::rotate(G.begin(), G.begin() + s, G.begin() + m_old);
+            if (p == m_AA)
+                std::rotate(G.begin(), G.begin() + p - 1, G.begin() + p);
+        }
+        qr.set_history(m_AA);
+        if constexpr (M == Eigen::Dynamic) {
+            if (m_AA > static_cast<length_t>(G.size())) {
+                G.resize(m_AA);
+                for (auto &g : G)
+                    g.resize(n());
+            }
+        }
+        γ_LS.resize(m_AA);
     }
 
     /// Call this function on the first iteration to initialize the accelerator.
-    void initialize(crvec g_0, vec r_0) {
-        assert(g_0.size() == vec::Index(n()));
-        assert(r_0.size() == vec::Index(n()));
-        G.col(0) = g_0;
-        rₗₐₛₜ    = std::move(r_0);
+    void initialize(crvec g_0, vec_n r_0) {
+        assert(g_0.size() == n());
+        assert(r_0.size() == n());
+        G[0]  = g_0;
+        rₗₐₛₜ = std::move(r_0);
         qr.reset();
         initialized = true;
+        commit();
     }
 
     /// Compute the accelerated iterate @f$ x^k_\text{AA} @f$, given the
     /// function value at the current iterate @f$ g^k = g(x^k) @f$ and the
     /// corresponding residual @f$ r^k = g^k - x^k @f$.
     void compute(crvec gₖ, crvec rₖ, rvec xₖ_aa) {
-        if (!initialized)
-            throw std::logic_error("AndersonAccel::compute() called before "
-                                   "AndersonAccel::initialize()");
-        minimize_update_anderson(qr, G,                         // inout
-                                 rₖ, rₗₐₛₜ, gₖ, params.min_div, // in
-                                 γ_LS, xₖ_aa);                  // out
-        rₗₐₛₜ = rₖ;
+        QUALA_STATS(OpTimer timer(stats.update); Counts counts(*this));
+        minimize_update(gₖ, rₖ, xₖ_aa);
+        G[qr.ring_tail()] = gₖ;
+        rₗₐₛₜ             = rₖ;
     }
     /// @copydoc compute(crvec, crvec, rvec)
-    void compute(crvec gₖ, vec &&rₖ, rvec xₖ_aa) {
-        if (!initialized)
-            throw std::logic_error("AndersonAccel::compute() called before "
-                                   "AndersonAccel::initialize()");
-        minimize_update_anderson(qr, G,                         // inout
-                                 rₖ, rₗₐₛₜ, gₖ, params.min_div, // in
-                                 γ_LS, xₖ_aa);                  // out
-        rₗₐₛₜ = std::move(rₖ);
+    void compute(crvec gₖ, vec_n &&rₖ, rvec xₖ_aa) {
+        QUALA_STATS(OpTimer timer(stats.update); Counts counts(*this));
+        minimize_update(gₖ, rₖ, xₖ_aa);
+        G[qr.ring_tail()] = gₖ;
+        rₗₐₛₜ             = std::move(rₖ);
+    }
+    /// Same as @ref compute, but instead of copying @p gₖ and @p rₖ into the
+    /// history, they are swapped with the internal buffers of the function
+    /// value and the residual that are no longer needed. On return, @p gₖ and
+    /// @p rₖ contain stale data, but have the right size, so the caller can
+    /// overwrite them with the next function value and residual, and no
+    /// vectors of size n are copied or allocated.
+    void compute_swap(vec_n &gₖ, vec_n &rₖ, rvec xₖ_aa) {
+        if (gₖ.size() != n() || rₖ.size() != n())
+            throw std::invalid_argument("AndersonAccel::compute_swap: "
+                                        "dimension mismatch");
+        QUALA_STATS(OpTimer timer(stats.update); Counts counts(*this));
+        minimize_update(gₖ, rₖ, xₖ_aa);
+        G[qr.ring_tail()].swap(gₖ);
+        rₗₐₛₜ.swap(rₖ);
     }
 
     /// Reset the accelerator (but keep the last function value and residual, so
     /// calling @ref initialize is not necessary).
     void reset() {
+        commit();
         index_t newest_g_idx = qr.ring_tail();
         if (newest_g_idx != 0)
-            G.col(0) = G.col(newest_g_idx);
+            G[0].swap(G[newest_g_idx]);
         qr.reset();
     }
 
+    /// Start recording the changes made by @ref compute, so that they can be
+    /// undone by @ref rollback. Each call to @ref compute then saves the
+    /// previous residual, the function value it overwrites and, if the
+    /// history is full, the column of R and the Givens rotations of the
+    /// column it removes from the QR factorization, all of which is O(n).
+    /// Rolling back reapplies the rotations in reverse, which costs O(n m) per
+    /// call, and restores the factorization up to rounding errors.
+    /// @ref initialize, @ref reset, @ref resize, @ref set_memory and
+    /// @ref load end the transaction, as if @ref commit was called.
+    /// @throws std::logic_error if a transaction is already in progress.
+    void begin_transaction() {
+        if (undo_active)
+            throw std::logic_error("AndersonAccel::begin_transaction: "
+                                   "transaction already in progress");
+        undo_active = true;
+        undo_count  = 0;
+    }
+    /// Keep the results of @ref compute since @ref begin_transaction and stop
+    /// recording.
+    void commit() {
+        undo_active = false;
+        undo_count  = 0;
+    }
+    /// Undo all calls to @ref compute since @ref begin_transaction, newest
+    /// first, and stop recording.
+    /// @throws std::logic_error if no transaction is in progress.
+    void rollback() {
+        if (not undo_active)
+            throw std::logic_error("AndersonAccel::rollback: no transaction "
+                                   "in progress");
+        while (undo_count > 0) {
+            auto &u = undo_log[--undo_count];
+            qr.undo(u.qr);
+            G[u.g_idx].swap(u.g);
+            rₗₐₛₜ.swap(u.r);
+        }
+        commit();
+    }
+    /// Check whether a transaction was started by @ref begin_transaction.
+    bool in_transaction() const { return undo_active; }
+
+    /// Use local shards of distributed vectors: all inner products are summed
+    /// over the processes by @p all_reduce. Each call to @ref compute needs
+    /// three reductions (plus one per reorthogonalization).
+    /// @see @ref BasicAllReduce
+    void set_all_reduce(BasicAllReduce<real_t> all_reduce) {
+        qr.set_all_reduce(std::move(all_reduce));
+    }
+
+    /// Write the history (the QR factorization of the differences of the
+    /// residuals, the previous function values and the last residual) to a
+    /// checkpoint.
+    void save(CheckpointWriter &w) const {
+        w.header(CheckpointKind::AndersonAccel, sizeof(real_t), sizeof(real_t));
+        w.scalar<std::uint8_t>(initialized);
+        if (not initialized)
+            return;
+        qr.save(w);
+        w.matrix(rₗₐₛₜ);
+        // The columns of G in use start at the head of the circular buffer,
+        // and include the newest function value at its tail
+        foreach_g([&](index_t c) { w.matrix(G[c]); });
+    }
+    /// Restore the history from a checkpoint written by @ref save. The
+    /// dimensions and the floating point type have to match. Calling
+    /// @ref initialize afterwards is not necessary.
+    void load(CheckpointReader &r) {
+        r.header(CheckpointKind::AndersonAccel, sizeof(real_t), sizeof(real_t));
+        commit();
+        initialized = false;
+        if (r.scalar<std::uint8_t>() == 0)
+            return qr.reset();
+        qr.load(r);
+        r.matrix(rₗₐₛₜ);
+        foreach_g([&](index_t c) { r.matrix(G[c]); });
+        initialized = true;
+    }
+
     /// Get the problem dimension.
     length_t n() const { return qr.n(); }
     /// Get the maximum number of stored columns.
@@ -107,13 +292,119 @@ class AndersonAccel {
     /// Get the parameters.
     const Params &get_params() const { return params; }
 
+    /// Get the performance counters. They are only updated if the library was
+    /// compiled with @ref QUALA_WITH_STATS. Every call to @ref compute counts
+    /// as an accepted update.
+    const AccelStats &get_stats() const { return stats; }
+    /// Set all performance counters to zero.
+    void reset_stats() { stats.reset(); }
+
+  private:
+    /// Update the QR factorization and compute the accelerated iterate, see
+    /// @ref minimize_update_anderson. The caller still has to store the new
+    /// function value at index `qr.ring_tail()` and the new residual.
+    void minimize_update(crvec gₖ, crvec rₖ, rvec xₖ_aa) {
+        if (!initialized)
+            throw std::logic_error("AndersonAccel::compute() called before "
+                                   "AndersonAccel::initialize()");
+        const auto G̃ = [this](index_t i) -> const vec_n & { return G[i]; };
+        minimize_update_anderson_ring(qr, G̃,                         // inout
+                                      rₖ, rₗₐₛₜ, gₖ, params.min_div, // in
+                                      γ_LS, xₖ_aa,                   // out
+                                      save_undo());
+    }
+
+    /// Adds the reorthogonalizations and skipped diagonal elements of the QR
+    /// factorization during its lifetime, and the estimated cost of
+    /// @ref compute, to the performance counters.
+    struct Counts {
+        Counts(BasicAndersonAccel &aa)
+            : aa(aa), reorth(aa.qr.get_reorth_count()),
+              skip(aa.qr.get_skip_count()) {}
+        ~Counts() {
+            auto &st = aa.stats;
+            st.reorthogonalizations += aa.qr.get_reorth_count() - reorth;
+            st.skipped_diagonals += aa.qr.get_skip_count() - skip;
+            st.count(UpdateStatus::Accepted);
+            // Givens rotations of Q, Gram-Schmidt, solving and combining the
+            // function values, every step streams Q or G once
+            const double n = aa.n(), q = aa.qr.num_columns();
+            st.update.add_cost(14 * n * q, (4 * q + 3) * n * sizeof(real_t));
+        }
+        Counts(const Counts &)            = delete;
+        Counts &operator=(const Counts &) = delete;
+
+        BasicAndersonAccel &aa;
+        unsigned long reorth, skip;
+    };
+
+    /// Changes made by a single call to @ref compute, see @ref rollback.
+    struct UndoRecord {
+        typename BasicLimitedMemoryQR<real_t, N, M>::UndoRecord qr;
+        /// Index of the column of G that was overwritten.
+        index_t g_idx;
+        /// Previous contents of that column.
+        vec_n g;
+        /// Previous residual.
+        vec_n r;
+    };
+
+    /// If a transaction is in progress, save the function value that will be
+    /// overwritten by @ref compute and the previous residual, and return the
+    /// record for the undo information of the QR factorization.
+    typename BasicLimitedMemoryQR<real_t, N, M>::UndoRecord *save_undo() {
+        if (not undo_active)
+            return nullptr;
+        if (undo_count == static_cast<length_t>(undo_log.size()))
+            undo_log.emplace_back();
+        auto &u = undo_log[undo_count++];
+        // The new function value is stored after the newest column
+        u.g_idx = qr.ring_next(qr.ring_tail());
+        u.g     = G[u.g_idx];
+        u.r     = rₗₐₛₜ;
+        return &u.qr;
+    }
+
+    /// Call `f(c)` for the indices c of the columns of G that are in use,
+    /// oldest first.
+    template <class F>
+    void foreach_g(const F &f) const {
+        const length_t k = std::min(qr.num_columns() + 1, history());
+        index_t c        = qr.ring_head();
+        for (index_t i = 0; i < k; ++i, c = qr.ring_next(c))
+            f(c);
+    }
+
   private:
     Params params;
-    LimitedMemoryQR qr;
-    mat G;
-    vec rₗₐₛₜ;
-    vec γ_LS;
+    BasicLimitedMemoryQR<real_t, N, M> qr;
+    /// Previous function values, stored as a circular buffer with the same
+    /// indices as @ref qr. Separate vectors rather than the columns of a
+    /// matrix, so they can be swapped with the caller's buffers, see
+    /// @ref compute_swap.
+    std::conditional_t<M == Eigen::Dynamic, std::vector<vec_n>,
+                       std::array<vec_n, M == Eigen::Dynamic ? 1 : M>>
+        G;
+    vec_n rₗₐₛₜ;
+    Eigen::Matrix<real_t, M, 1> γ_LS;
     bool initialized = false;
+    /// Records of the calls to @ref compute since @ref begin_transaction.
+    std::vector<UndoRecord> undo_log;
+    length_t undo_count = 0;
+    bool undo_active    = false;
+    AccelStats stats;
 };
 
+/// @ref BasicAndersonAccelParams for the default floating point type.
+using AndersonAccelParams = BasicAndersonAccelParams<real_t>;
+/// @ref BasicAndersonAccel for the default floating point type.
+using AndersonAccel = BasicAndersonAccel<real_t>;
+/// @ref BasicAndersonAccel with compile-time dimensions.
+template <length_t N, length_t M, class Real = real_t>
+using StaticAndersonAccel = BasicAndersonAccel<Real, N, M>;
+/// @ref BasicAndersonAccel with a compile-time history length, but a dynamic
+/// problem dimension.
+template <length_t M, class Real = real_t>
+using StaticHistoryAndersonAccel = BasicAndersonAccel<Real, Eigen::Dynamic, M>;
+
 } // namespace quala
\ No newline at end of file
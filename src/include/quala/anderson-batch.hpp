@@ -0,0 +1,479 @@
+#pragma once
+
+#include <quala/anderson-acceleration.hpp>
+#include <quala/detail/batch-kernels.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace quala {
+
+/**
+ * Anderson acceleration of a batch of independent fixed-point problems of the
+ * same dimension, which are advanced in lockstep.
+ *
+ * Uses the same algorithm as @ref BasicAndersonAccel, but the QR
+ * factorizations, the previous function values and the previous residuals of
+ * all B instances are stored in a single allocation, in structure-of-arrays
+ * layout: the instances are grouped in blocks of at most @ref block_size, and
+ * within a block, every vector of size n is stored as a column-major matrix
+ * with one row per instance, so the index of the instance is the innermost
+ * one. The vectors passed to and returned by @ref compute are B×n matrices
+ * (row b belongs to instance b). The updates of the QR factorizations, the
+ * solution of the least squares problems and the combination of the function
+ * values then operate on contiguous arrays of instances, which are
+ * vectorized, and the data of a block stays in the cache.
+ *
+ * The instances do not have to be in the same state: each one has its own
+ * number of columns in the QR factorization and its own circular buffer of
+ * function values (e.g. because it was initialized or reset at a different
+ * iteration), and each call to @ref compute can be restricted to a subset of
+ * the instances. Where the instances diverge, the work is masked rather than
+ * branched, so it costs as much as for the instance with the longest history.
+ *
+ * Unlike @ref BasicAndersonAccel, the history length cannot be larger than the
+ * problem dimension, and the regularization of the least squares problem is
+ * not supported.
+ *
+ * @tparam  Real
+ *          Floating point type.
+ *
+ * @ingroup accelerators-grp
+ */
+template <class Real>
+class BasicAndersonAccelBatch {
+  public:
+    USING_QUALA_TYPES(Real);
+    using Params = BasicAndersonAccelParams<real_t>;
+
+    /// Maximum number of instances that are stored and processed together, so
+    /// that their vectors stay in the cache during a call to @ref compute.
+    static constexpr length_t block_size = 64;
+
+    /// @param  params
+    ///         Parameters.
+    /// @param  n
+    ///         Problem dimension (size of the vectors).
+    /// @param  batch_size
+    ///         Number of instances B.
+    BasicAndersonAccelBatch(Params params, length_t n, length_t batch_size)
+        : params(params) {
+        resize(n, batch_size);
+    }
+
+    /// Change the problem dimension and the number of instances. Flushes the
+    /// history of all instances.
+    void resize(length_t n, length_t batch_size) {
+        const length_t m = params.memory;
+        if (m < 1)
+            throw std::invalid_argument("AndersonAccelBatch: memory must be "
+                                        ">= 1");
+        if (m > n)
+            throw std::invalid_argument("AndersonAccelBatch: memory must not "
+                                        "be larger than the dimension");
+        if (params.regularization != 0)
+            throw std::invalid_argument("AndersonAccelBatch: regularization "
+                                        "is not supported");
+        this->n_ = n;
+        this->B  = batch_size;
+        this->S  = std::max(std::min(block_size, B), length_t{1});
+        // Layout of each block of S instances in the arena, in units of S (the
+        // index of the instance is innermost): Q (m×n), R (m×m), the
+        // projections, γ_LS and the weights of the function values (m each),
+        // a workspace (n), G (m×n), rₗₐₛₜ (n), and the scalars.
+        off_R     = m * n * S;
+        off_P     = off_R + m * m * S;
+        off_γ     = off_P + m * S;
+        off_β     = off_γ + m * S;
+        off_W     = off_β + m * S;
+        off_G     = off_W + n * S;
+        off_r     = off_G + m * n * S;
+        off_eig   = off_r + n * S;
+        block_len = off_eig + num_scalars * S;
+        arena.resize(((B + S - 1) / S) * block_len);
+        num_cols.resize(B);
+        head.resize(B);
+        slot.setZero(B);
+        initialized.setConstant(B, false);
+        active.setConstant(B, false);
+        clear();
+    }
+
+    /// Call this function on the first iteration to initialize all instances.
+    /// @param  g_0
+    ///         Function values of all instances (B×n).
+    /// @param  r_0
+    ///         Residuals of all instances (B×n).
+    void initialize(crmat g_0, crmat r_0) {
+        check_dims(g_0, "initialize");
+        check_dims(r_0, "initialize");
+        clear();
+        for (index_t b0 = 0; b0 < B; b0 += S) {
+            const length_t nb    = std::min(S, B - b0);
+            block(off_G, b0, nb) = g_0.middleRows(b0, nb);
+            block(off_r, b0, nb) = r_0.middleRows(b0, nb);
+        }
+        initialized.setConstant(true);
+    }
+    /// Initialize (or re-initialize) instance @p b only, flushing its history.
+    void initialize(index_t b, crvec g_0, crvec r_0) {
+        assert(g_0.size() == n());
+        assert(r_0.size() == n());
+        clear_lane(b, 0, block_len);
+        block(off_G, b, 1) = g_0.transpose();
+        block(off_r, b, 1) = r_0.transpose();
+        initialized(b)     = true;
+    }
+
+    /// Compute the accelerated iterates @f$ x^k_\text{AA} @f$ of all instances,
+    /// given the function values at the current iterates
+    /// @f$ g^k = g(x^k) @f$ and the corresponding residuals
+    /// @f$ r^k = g^k - x^k @f$. All arguments are B×n matrices.
+    /// @throws std::logic_error if an instance was not initialized.
+    void compute(crmat gₖ, crmat rₖ, rmat xₖ_aa) {
+        if (not initialized.all())
+            throw std::logic_error("AndersonAccelBatch::compute() called "
+                                   "before AndersonAccelBatch::initialize()");
+        active = initialized;
+        compute_active(gₖ, rₖ, xₖ_aa);
+    }
+    /// Same as @ref compute(crmat, crmat, rmat), but only for the instances
+    /// whose flag in @p mask is set. The history and the rows of @p xₖ_aa of
+    /// the other instances are not changed.
+    /// @throws std::logic_error if an instance in @p mask was not initialized.
+    void compute(crmat gₖ, crmat rₖ, rmat xₖ_aa, crboolvec mask) {
+        if (mask.size() != B)
+            throw std::invalid_argument("AndersonAccelBatch::compute: "
+                                        "mask size mismatch");
+        if ((mask && !initialized).any())
+            throw std::logic_error("AndersonAccelBatch::compute() called "
+                                   "before AndersonAccelBatch::initialize()");
+        active = mask;
+        compute_active(gₖ, rₖ, xₖ_aa);
+    }
+
+    /// Reset all instances (but keep their last function values and residuals,
+    /// so calling @ref initialize is not necessary).
+    void reset() {
+        for (index_t b = 0; b < B; ++b)
+            reset(b);
+    }
+    /// Reset instance @p b only, see @ref reset().
+    void reset(index_t b) {
+        if (not initialized(b))
+            return;
+        // Move the newest function value to the start of the buffer
+        const length_t m  = history();
+        const index_t c   = (head(b) + stored_g(b) - 1) % m;
+        if (c != 0)
+            block(off_G, b, 1) = block(off_G + c * n() * S, b, 1);
+        // Clear everything else but rₗₐₛₜ
+        clear_lane(b, 0, off_G);
+        clear_lane(b, off_G + n() * S, off_r);
+        clear_lane(b, off_eig, block_len);
+    }
+
+    /// Get the problem dimension.
+    length_t n() const { return n_; }
+    /// Get the number of instances.
+    length_t batch_size() const { return B; }
+    /// Get the maximum number of stored columns.
+    length_t history() const { return params.memory; }
+    /// Get the number of columns currently stored in the buffer of instance
+    /// @p b.
+    length_t current_history(index_t b) const { return num_cols(b); }
+
+    /// Get the parameters.
+    const Params &get_params() const { return params; }
+
+  private:
+    using block_t = Eigen::Map<mat, 0, Eigen::OuterStride<>>;
+    using lanes_t = Eigen::Map<Eigen::Array<real_t, Eigen::Dynamic, 1>>;
+
+    /// Index in the arena of instance @p b, at offset zero of its block.
+    index_t lane_index(index_t b) const {
+        return (b / S) * block_len + b % S;
+    }
+    /// Mutable view of the instances b0 to b0+nb (which have to belong to the
+    /// same block) of the vectors of size n at offset @p off of the blocks.
+    block_t block(index_t off, index_t b0, length_t nb) {
+        return {arena.data() + lane_index(b0) + off, nb, n_,
+                Eigen::OuterStride<>(S)};
+    }
+    /// Mutable view of the instances b0 to b0+nb (which have to belong to the
+    /// same block) of the scalars at offset @p off of the blocks.
+    lanes_t lanes(index_t off, index_t b0, length_t nb) {
+        return {arena.data() + lane_index(b0) + off, nb};
+    }
+
+    /// Clear the history of all instances.
+    void clear() {
+        arena.setZero();
+        for (index_t b0 = 0; b0 < B; b0 += S)
+            lanes(off_eig, b0, std::min(S, B - b0)).setConstant(-inf);
+        num_cols.setZero();
+        head.setZero();
+    }
+    /// Set the elements of instance @p b at offsets [@p begin, @p end) of its
+    /// block to zero, restore its scalars if they are in that range, and
+    /// clear its history.
+    void clear_lane(index_t b, index_t begin, index_t end) {
+        const index_t i0 = lane_index(b);
+        for (index_t i = begin; i < end; i += S)
+            arena(i0 + i) = 0;
+        if (end > off_eig)
+            arena(i0 + off_eig) = -inf;
+        num_cols(b) = 0;
+        head(b)     = 0;
+    }
+
+    /// Number of function values in the circular buffer of instance @p b.
+    length_t stored_g(index_t b) const {
+        return std::min(num_cols(b) + 1, history());
+    }
+
+    void check_dims(crmat v, const char *func) const {
+        if (v.rows() != B || v.cols() != n_)
+            throw std::invalid_argument(std::string("AndersonAccelBatch::") +
+                                        func + ": dimension mismatch");
+    }
+
+    void compute_active(crmat gₖ, crmat rₖ, rmat xₖ_aa) {
+        check_dims(gₖ, "compute");
+        check_dims(rₖ, "compute");
+        check_dims(xₖ_aa, "compute");
+        for (index_t b0 = 0; b0 < B; b0 += S) {
+            const length_t nb = std::min(S, B - b0);
+            if (active.segment(b0, nb).any())
+                compute_block(b0, nb, gₖ.middleRows(b0, nb),
+                              rₖ.middleRows(b0, nb),
+                              xₖ_aa.middleRows(b0, nb));
+        }
+    }
+
+    /// @ref compute for the instances b0 to b0+nb, which belong to the same
+    /// block, see @ref minimize_update_anderson.
+    template <class MatG, class MatR, class MatX>
+    void compute_block(index_t b0, length_t nb, const MatG &gₖ,
+                       const MatR &rₖ, MatX &&xₖ_aa) {
+        const length_t n = n_, m = history(), S = this->S;
+        const auto act   = active.segment(b0, nb);
+        auto q           = num_cols.segment(b0, nb).array();
+        const auto Q     = [&](index_t j) { return block(j * n * S, b0, nb); };
+        const auto G     = [&](index_t j) {
+            return block(off_G + j * n * S, b0, nb);
+        };
+        const auto R = [&](index_t r, index_t c) {
+            return lanes(off_R + (c * m + r) * S, b0, nb);
+        };
+        const auto P = [&](index_t j) { return lanes(off_P + j * S, b0, nb); };
+        const auto γ = [&](index_t j) { return lanes(off_γ + j * S, b0, nb); };
+        const auto β = [&](index_t j) { return lanes(off_β + j * S, b0, nb); };
+        const auto scalar = [&](index_t k) {
+            return lanes(off_eig + k * S, b0, nb);
+        };
+        auto max_eig = scalar(0), norm_q = scalar(1), norm_v = scalar(2);
+        auto cs = scalar(3), sn = scalar(4), w = scalar(5);
+        auto W = block(off_W, b0, nb), rₗₐₛₜ = block(off_r, b0, nb);
+
+        // Apply the Givens rotation (cs, sn) of each instance to x and y
+        const auto rotate = [&](real_t *x, real_t *y) {
+            const real_t *c = cs.data(), *s = sn.data();
+            for (index_t k = 0; k < nb; ++k) {
+                const real_t xk = x[k], yk = y[k];
+                x[k]            = c[k] * xk - s[k] * yk;
+                y[k]            = s[k] * xk + c[k] * yk;
+            }
+        };
+        // Copy y to x for the instances where w is nonzero
+        const auto blend = [&](real_t *x, const real_t *y) {
+            batch_blend(x, y, w.data(), nb);
+        };
+
+        // Remove the oldest column of the instances with a full history: after
+        // removing the first column of R, it becomes upper Hessenberg, and
+        // Givens rotations are used to make it triangular again (the rotations
+        // of the other instances are the identity).
+        w = (act && (q == m)).template cast<real_t>();
+        if ((w != 0).any()) {
+            for (index_t c = 0; c + 1 < m; ++c)
+                for (index_t r = 0; r <= c + 1; ++r)
+                    blend(R(r, c).data(), R(r, c + 1).data());
+            for (index_t r = 0; r + 1 < m; ++r) {
+                auto d   = R(r, r), e = R(r + 1, r);
+                norm_q   = (d.square() + e.square()).sqrt();
+                auto rot = (w != 0) && (norm_q != 0);
+                cs       = rot.select(d / norm_q, 1);
+                sn       = rot.select(-e / norm_q, 0);
+                blend(d.data(), norm_q.data());
+                for (index_t c = r + 1; c < m; ++c)
+                    rotate(R(r, c).data(), R(r + 1, c).data());
+                auto Qr = Q(r), Qs = Q(r + 1);
+                for (index_t i = 0; i < n; ++i)
+                    rotate(Qr.col(i).data(), Qs.col(i).data());
+                max_eig = (w != 0).select(max_eig.max(d), max_eig);
+            }
+            q -= (w != 0).template cast<index_t>();
+        }
+
+        // Modified Gram-Schmidt to make Δr = rₖ - rₗₐₛₜ orthogonal to Q
+        auto v       = W;
+        v            = rₖ - rₗₐₛₜ;
+        index_t qmax = act.select(q, index_t{0}).maxCoeff();
+        batch_dot(norm_v, v, v);
+        norm_v = norm_v.sqrt();
+        for (index_t j = 0; j < qmax; ++j) {
+            auto Qj = Q(j);
+            auto s  = P(j);
+            batch_dot(s, Qj, v);
+            s = (act && (q > j)).select(s, 0);
+            for (index_t i = 0; i < n; ++i)
+                v.col(i).array() -= s * Qj.col(i).array();
+        }
+        batch_dot(norm_q, v, v);
+        norm_q = norm_q.sqrt();
+        // If ‖q‖ is significantly smaller than ‖v‖, perform
+        // reorthogonalization
+        const real_t η = 0.7;
+        while (true) {
+            const auto reorth = act && (norm_q < η * norm_v);
+            if (not reorth.any())
+                break;
+            for (index_t j = 0; j < qmax; ++j) {
+                auto Qj = Q(j);
+                batch_dot(cs, Qj, v);
+                cs = (reorth && (q > j)).select(cs, 0);
+                P(j) += cs;
+                for (index_t i = 0; i < n; ++i)
+                    v.col(i).array() -= cs * Qj.col(i).array();
+            }
+            norm_v = reorth.select(norm_q, norm_v);
+            batch_dot(norm_q, v, v);
+            norm_q = norm_q.sqrt();
+        }
+        // Normalize q and add it to Q and R, the index of the new column
+        // depends on the instance. If Δr is zero (a repeated residual), the
+        // new column of Q is zero as well, rather than NaN.
+        cs = (norm_q > 0).select(norm_q.inverse(), 0);
+        for (index_t i = 0; i < n; ++i)
+            v.col(i).array() *= cs;
+        for (index_t j = 0; j <= qmax; ++j) {
+            w = (act && (q == j)).template cast<real_t>();
+            if (not(w != 0).any())
+                continue;
+            for (index_t r = 0; r < j; ++r)
+                blend(R(r, j).data(), P(r).data());
+            blend(R(j, j).data(), norm_q.data());
+            auto Qj = Q(j);
+            for (index_t i = 0; i < n; ++i)
+                blend(Qj.col(i).data(), v.col(i).data());
+        }
+        max_eig = act.select(max_eig.max(norm_q), max_eig);
+        q += act.template cast<index_t>();
+
+        // Solve least squares problem Anderson acceleration
+        // γ = argmin ‖ ΔR γ - rₖ ‖², using back substitution, without dividing
+        // by very small diagonal elements
+        qmax = act.select(q, index_t{0}).maxCoeff();
+        for (index_t j = 0; j < qmax; ++j) {
+            batch_dot(γ(j), Q(j), rₖ);
+            γ(j) = (act && (q > j)).select(γ(j), 0);
+        }
+        sn = max_eig * params.min_div;
+        for (index_t r = qmax; r-- > 0;) {
+            auto γr = γ(r);
+            for (index_t c = r + 1; c < qmax; ++c)
+                γr -= R(r, c) * γ(c);
+            const auto Rrr = R(r, r);
+            γr = (act && (q > r) && (Rrr.abs() >= sn) && (Rrr != 0))
+                     .select(γr / Rrr, 0);
+        }
+
+        // Weights αᵢ of the function values, at their indices in the circular
+        // buffers, which depend on the instance (the weight of gₖ is stored
+        // in cs)
+        // α₀ = γ₀             if n = 0
+        // αₙ = γₙ - γₙ₋₁      if 0 < n < mₖ
+        // αₘ = 1 - γₘ₋₁       if n = mₖ
+        for (index_t k = 0; k < nb; ++k) {
+            const index_t b = b0 + k;
+            for (index_t j = 0; j < m; ++j)
+                β(j)(k) = 0;
+            if (not act(k))
+                continue;
+            const length_t mₖ = num_cols(b);
+            for (index_t j = 0; j < mₖ; ++j)
+                β((head(b) + j) % m)(k) =
+                    γ(j)(k) - (j > 0 ? γ(j - 1)(k) : real_t{0});
+            cs(k) = 1 - γ(mₖ - 1)(k);
+            // gₖ is stored after the newest function value, overwriting the
+            // oldest one if the buffer is full
+            slot(b) = (head(b) + mₖ) % m;
+            if (mₖ == m)
+                head(b) = (head(b) + 1) % m;
+        }
+
+        // Compute Anderson acceleration next iterate yₑₓₜ = ∑ₙ₌₀ αₙ gₙ, and
+        // store gₖ in the circular buffers
+        auto x = W;
+        for (index_t i = 0; i < n; ++i)
+            x.col(i).array() = cs * gₖ.col(i).array();
+        const auto slot_b = slot.segment(b0, nb).array();
+        for (index_t j = 0; j < m; ++j) {
+            const auto βj = β(j);
+            w = (act && (slot_b == j)).template cast<real_t>();
+            const bool use = (βj != 0).any(), write = (w != 0).any();
+            auto Gj        = G(j);
+            for (index_t i = 0; i < n; ++i) {
+                if (use)
+                    x.col(i).array() += βj * Gj.col(i).array();
+                if (write)
+                    blend(Gj.col(i).data(), gₖ.col(i).data());
+            }
+        }
+        w = act.template cast<real_t>();
+        for (index_t i = 0; i < n; ++i) {
+            blend(xₖ_aa.col(i).data(), x.col(i).data());
+            blend(rₗₐₛₜ.col(i).data(), rₖ.col(i).data());
+        }
+    }
+
+  private:
+    Params params;
+    length_t n_ = 0;
+    length_t B  = 0;
+    /// Number of instances per block of the arena.
+    length_t S = 1;
+    /// Number of scalars per instance at the end of each block: the maximum
+    /// eigenvalue of R, and five workspaces.
+    static constexpr length_t num_scalars = 6;
+    /// Storage for the QR factorizations, the previous function values and
+    /// residuals, and the workspaces of all instances, in consecutive blocks
+    /// of @ref S instances, so that the data of the instances that are
+    /// processed together is contiguous. The columns of R are stored in
+    /// order, while the function values are stored in a circular buffer per
+    /// instance.
+    vec arena;
+    /// Offsets of the different parts of a block of @ref arena.
+    index_t off_R, off_P, off_γ, off_β, off_W, off_G, off_r, off_eig;
+    /// Size of a block of @ref arena.
+    length_t block_len;
+    /// Number of columns in the QR factorization of each instance.
+    idvec num_cols;
+    /// Index of the oldest function value in the circular buffer of each
+    /// instance.
+    idvec head;
+    /// Index in the circular buffer where the current function value is
+    /// stored, for each instance.
+    idvec slot;
+    /// Whether each instance was initialized.
+    boolvec initialized;
+    /// Instances updated by the current call to @ref compute.
+    boolvec active;
+};
+
+/// @ref BasicAndersonAccelBatch for the default floating point type.
+using AndersonAccelBatch = BasicAndersonAccelBatch<real_t>;
+
+} // namespace quala
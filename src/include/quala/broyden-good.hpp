@@ -1,7 +1,21 @@
 #pragma once
 
+#include <quala/detail/diagonal-h0.hpp>
+#include <quala/detail/history-undo.hpp>
+#include <quala/detail/lbfgs-helpers.hpp>
+#include <quala/detail/sparse-pairs.hpp>
+#include <quala/util/all-reduce.hpp>
+#include <quala/util/checkpoint.hpp>
+#include <quala/util/mapped-matrix.hpp>
+#include <quala/util/stats.hpp>
 #include <quala/util/vec.hpp>
 
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
 namespace quala {
 
 /// Layout:
@@ -13,33 +27,66 @@ namespace quala {
 ///     │ │   │   │   │   │   │
 ///     └ └───┴───┴───┴───┴───┘
 /// ~~~
-struct BroydenStorage {
-    /// Re-allocate storage for a problem with a different size.
-    void resize(length_t n, length_t history);
+/// @tparam Real
+///         Floating point type.
+template <class Real>
+struct BasicBroydenStorage {
+    USING_QUALA_TYPES(Real);
+
+    /// Re-allocate storage for a problem with a different size. If @p dir is
+    /// nonempty, the vectors are stored in a memory mapped temporary file in
+    /// that directory.
+    void resize(length_t n, length_t history, const std::string &dir = {});
+    /// Change the history length, keeping the first @p keep pairs. The
+    /// storage is only re-allocated if it is too small.
+    void set_history(length_t history, length_t keep,
+                     const std::string &dir = {});
 
     /// Get the size of the s and s̃ vectors in the buffer.
     length_t n() const { return sto.rows(); }
     /// Get the number of previous vectors s and s̃ stored in the buffer.
-    length_t history() const { return (sto.cols() - 1) / 2; }
+    /// After shrinking the history, the storage may have more columns.
+    length_t history() const { return hist; }
 
-    auto s(index_t i) { return sto.col(2 * i); }
-    auto s(index_t i) const { return sto.col(2 * i); }
-    auto s̃(index_t i) { return sto.col(2 * i + 1); }
-    auto s̃(index_t i) const { return sto.col(2 * i + 1); }
-    auto work() { return sto.col(2 * history()); }
-    auto work() const { return sto.col(2 * history()); }
+    auto s(index_t i) { return sto.map().col(2 * i); }
+    auto s(index_t i) const { return sto.map().col(2 * i); }
+    auto s̃(index_t i) { return sto.map().col(2 * i + 1); }
+    auto s̃(index_t i) const { return sto.map().col(2 * i + 1); }
+    auto work() { return sto.map().col(2 * history()); }
+    auto work() const { return sto.map().col(2 * history()); }
 
     using storage_t =
         Eigen::Matrix<real_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor>;
-    storage_t sto;
+    MappableMatrix<storage_t> sto;
+    length_t hist = 0;
 };
 
-inline void BroydenStorage::resize(length_t n, length_t history) {
-    sto.resize(n, history * 2 + 1);
+template <class Real>
+void BasicBroydenStorage<Real>::resize(length_t n, length_t history,
+                                       const std::string &dir) {
+    sto.resize(n, history * 2 + 1, dir);
+    hist = history;
+}
+
+template <class Real>
+void BasicBroydenStorage<Real>::set_history(length_t history, length_t keep,
+                                            const std::string &dir) {
+    if (2 * history + 1 > sto.cols()) {
+        MappableMatrix<storage_t> grown;
+        grown.resize(n(), 2 * history + 1, dir);
+        grown.map().leftCols(2 * keep) = sto.map().leftCols(2 * keep);
+        sto = std::move(grown);
+    }
+    hist = history;
 }
 
-/// Parameters for the @ref BroydenGood class.
-struct BroydenGoodParams {
+/// Parameters for the @ref BasicBroydenGood class.
+/// @tparam Real
+///         Floating point type.
+template <class Real>
+struct BasicBroydenGoodParams {
+    USING_QUALA_TYPES(Real);
+
     /// Length of the history to keep.
     length_t memory = 10;
     /// Reject update if @f$ s^\top Hy \le \text{min_div_fac} @f$.
@@ -58,6 +105,24 @@ struct BroydenGoodParams {
     /// Minimum automatic step size. If @f$ \frac{s^\top y}{y^\top y} @f$ is
     /// smaller than this setting, use this as the step size instead.
     real_t min_stepsize = 1e-10;
+    /// If nonempty, the vectors s and s̃ are not stored in memory, but in a
+    /// memory mapped temporary file in this directory, for problems where the
+    /// history doesn't fit in memory. The file is removed automatically.
+    /// @see @ref MappedBuffer
+    std::string storage_dir;
+    /// Estimate a diagonal initial inverse Jacobian approximation
+    /// @f$ H_0 = \mathrm{diag}(d) @f$ from the vectors s and y, and use it in
+    /// @ref BasicBroydenGood::apply if @f$ \gamma @f$ is negative, instead of
+    /// @f$ H_0 = \frac{s^\top y}{y^\top y} I @f$.
+    /// @see @ref BasicDiagonalH0
+    bool diagonal_h0 = false;
+    /// Bound on the ratio between the elements of the diagonal @f$ H_0 @f$
+    /// and the scalar step size, see @ref diagonal_h0.
+    real_t diagonal_h0_bound = 1e2;
+    /// Pairs passed to @ref BasicBroydenGood::update_sy_sparse are only stored
+    /// sparsely if the number of nonzeros of s and s̃ is at most this fraction
+    /// of n, otherwise they are stored as dense vectors.
+    real_t sparse_max_density = 0.1;
 };
 
 /**
@@ -78,14 +143,19 @@ struct BroydenGoodParams {
  *
  * @todo    Damping.
  *
+ * @tparam  Real
+ *          Floating point type.
+ *
  * @ingroup accelerators-grp
  */
-class BroydenGood {
+template <class Real>
+class BasicBroydenGood {
   public:
-    using Params = BroydenGoodParams;
+    USING_QUALA_TYPES(Real);
+    using Params = BasicBroydenGoodParams<real_t>;
 
-    BroydenGood(Params params) : params(params) {}
-    BroydenGood(Params params, length_t n) : params(params) { resize(n); }
+    BasicBroydenGood(Params params) : params(params) {}
+    BasicBroydenGood(Params params, length_t n) : params(params) { resize(n); }
 
     /// Update the inverse Jacobian approximation using the new vectors
     /// sₖ = xₖ₊₁ - xₖ and yₖ = pₖ₊₁ - pₖ.
@@ -93,6 +163,25 @@ class BroydenGood {
     bool update_sy(const anymat<VecS> &s, const anymat<VecY> &y,
                    bool forced = false);
 
+    /// Update the inverse Jacobian approximation using sparse vectors sₖ and
+    /// yₖ, given by their values @p s_J and @p y_J at the indices @p J (the
+    /// union of the sparsity patterns of sₖ and yₖ).
+    /// If all pairs in use are stored sparsely, @f$ H_k y_k @f$ is computed
+    /// using sparse kernels, and the new pair is stored compactly, with the
+    /// pattern of s̃ (the union of J and the patterns of the previous s̃).
+    /// If that pattern becomes too dense (see
+    /// @ref BasicBroydenGoodParams::sparse_max_density), if a previous pair
+    /// is dense, or if @ref BasicBroydenGoodParams::diagonal_h0, a
+    /// transaction or distributed vectors are used, the pair is scattered
+    /// into dense vectors and @ref update_sy is used.
+    /// @throws std::invalid_argument if the indices in @p J are not sorted,
+    /// unique and in the range [0, n).
+    bool update_sy_sparse(cridvec J, crvec s_J, crvec y_J,
+                          bool forced = false);
+    /// @ref update_sy_sparse with Eigen sparse vectors.
+    bool update_sy(const Eigen::SparseVector<real_t> &s,
+                   const Eigen::SparseVector<real_t> &y, bool forced = false);
+
     /// Update the inverse Jacobian approximation using the new vectors xₖ₊₁
     /// and pₖ₊₁.
     bool update(crvec xₖ, crvec xₙₑₓₜ, crvec pₖ, crvec pₙₑₓₜ,
@@ -102,18 +191,84 @@ class BroydenGood {
     /// @f$ q \leftarrow H_k q @f$.
     /// Initial inverse Hessian approximation is set to @f$ H_0 = \gamma I @f$.
     /// The result is scaled by a factor @p γ. If @p γ is negative, the result
-    /// is scaled by @f$ \frac{s^\top y}{y^\top y} @f$.
+    /// is scaled by @f$ \frac{s^\top y}{y^\top y} @f$, or by the diagonal
+    /// estimate if @ref BasicBroydenGoodParams::diagonal_h0 is set.
     bool apply(rvec q, real_t γ);
 
+    /// Apply the inverse Jacobian approximation to the given vector q, with
+    /// the diagonal initial inverse Jacobian approximation
+    /// @f$ H_0 = \mathrm{diag}(d) @f$.
+    bool apply(rvec q, crvec d);
+
+    /// Get the diagonal estimate of the initial inverse Jacobian
+    /// approximation, see @ref BasicBroydenGoodParams::diagonal_h0.
+    crvec diagonal_h0() const { return diag.d; }
+
     /// Throw away the approximation and all previous vectors s and y.
     void reset();
     /// Re-allocate storage for a problem with a different size. Causes
     /// a @ref reset.
     void resize(length_t n);
+    /// Change the history length to @p m without a @ref reset: the newest
+    /// min(m, @ref current_history()) pairs are kept, in chronological order.
+    /// The storage is only re-allocated if @p m exceeds the largest history
+    /// length used so far. Like the circular buffer used when
+    /// @ref BasicBroydenGoodParams::restarted is false, the vectors s̃ of the
+    /// remaining pairs are not updated when older pairs are dropped.
+    void set_memory(length_t m);
+
+    /// Scatter all pairs stored by @ref update_sy_sparse into the dense
+    /// storage. Called automatically by @ref set_memory and
+    /// @ref begin_transaction.
+    void densify();
+    /// Get the number of pairs in the history that are stored sparsely, see
+    /// @ref update_sy_sparse.
+    length_t num_sparse() const { return sparse.count; }
+
+    /// Start recording the changes made by @ref update and @ref update_sy, so
+    /// that they can be undone by @ref rollback. The position in the circular
+    /// buffer and the latest step size are saved, and each pair of vectors s
+    /// and s̃ is copied the first time it is overwritten, so rolling back k
+    /// updates costs O(min(k, m) n). The diagonal estimate of @f$ H_0 @f$ is
+    /// copied when the transaction starts (if enabled).
+    /// @ref reset, @ref resize, @ref set_memory and @ref load end the
+    /// transaction, as if @ref commit was called.
+    /// @throws std::logic_error if a transaction is already in progress.
+    void begin_transaction();
+    /// Keep the updates since @ref begin_transaction and stop recording.
+    void commit() { undo.end(); }
+    /// Undo all updates since @ref begin_transaction and stop recording.
+    /// @throws std::logic_error if no transaction is in progress.
+    void rollback();
+    /// Check whether a transaction was started by @ref begin_transaction.
+    bool in_transaction() const { return undo.active; }
+
+    /// Use local shards of distributed vectors s, y and q: all inner products
+    /// are summed over the processes by @p all_reduce.
+    /// @ref update_sy needs m + 1 reductions, @ref apply needs m.
+    /// @see @ref BasicAllReduce
+    void set_all_reduce(BasicAllReduce<real_t> all_reduce) {
+        this->all_reduce = std::move(all_reduce);
+    }
+
+    /// Write the history (the vectors s and s̃, the indices of the circular
+    /// buffer and the latest step size) to a checkpoint.
+    void save(CheckpointWriter &w) const;
+    /// Restore the history from a checkpoint written by @ref save. The problem
+    /// dimension, the history length and the floating point type have to
+    /// match. The diagonal estimate of @f$ H_0 @f$ (if enabled) is not part of
+    /// the checkpoint, it restarts from the latest scalar step size.
+    void load(CheckpointReader &r);
 
     /// Get the parameters.
     const Params &get_params() const { return params; }
 
+    /// Get the performance counters. They are only updated if the library was
+    /// compiled with @ref QUALA_WITH_STATS.
+    const AccelStats &get_stats() const { return stats; }
+    /// Set all performance counters to zero.
+    void reset_stats() { stats.reset(); }
+
     /// Get the size of the s and y vectors in the buffer.
     length_t n() const { return sto.n(); }
     /// Get the number of previous vectors s and y stored in the buffer.
@@ -126,6 +281,8 @@ class BroydenGood {
     /// buffer.
     length_t current_history() const { return full ? history() : idx; }
 
+    /// Get the dense storage of the vectors s and s̃ of pair @p i. Pairs that
+    /// are stored sparsely are only written to it by @ref densify.
     auto s(index_t i) { return sto.s(i); }
     auto s(index_t i) const { return sto.s(i); }
     auto s̃(index_t i) { return sto.s̃(i); }
@@ -154,65 +311,159 @@ class BroydenGood {
     }
 
   private:
-    BroydenStorage sto;
+    /// @ref apply with @f$ H_0 = h_0 I @f$ if @p h0 is a scalar, or
+    /// @f$ H_0 = \mathrm{diag}(h_0) @f$ if it is a vector.
+    template <class H0>
+    bool apply_impl(rvec q, H0 h0);
+    /// Compute the scaling factor of the vector s̃ of a new pair, including
+    /// Powell's damping, see
+    /// @ref BasicBroydenGoodParams::powell_damping_factor.
+    real_t scaling_factor(real_t sᵀHy, real_t sᵀs) const;
+    /// Check whether @ref update_sy_sparse may store pairs sparsely.
+    bool supports_sparse() const {
+        return not params.diagonal_h0 && not undo.active && not all_reduce;
+    }
+    /// Hint that the pair with index @p i will be accessed soon, if the
+    /// history is stored in a file, see @ref BasicBroydenGoodParams::storage_dir.
+    void prefetch(index_t i) const { sto.sto.will_need(2 * i, 2); }
+    /// Sum the local partial results in @p data over all processes (no-op if
+    /// the vectors are not distributed).
+    void global_sum(real_t *data, length_t count) const {
+        if (all_reduce)
+            all_reduce(data, count);
+    }
+
+  private:
+    BasicBroydenStorage<real_t> sto;
+    BasicDiagonalH0<real_t> diag;
     index_t idx = 0;
     bool full   = false;
     Params params;
     real_t latest_γ = NaN;
+    /// Pairs stored by @ref update_sy_sparse.
+    BasicSparsePairs<real_t> sparse;
+    /// Workspace for @f$ H_k y_k @f$ in @ref update_sy_sparse.
+    BasicSparseAccumulator<real_t> sparse_acc;
+    /// Workspace for the new pair in @ref update_sy_sparse.
+    mat sparse_work;
+    /// Pairs and ring position saved by @ref begin_transaction.
+    BasicHistoryUndoLog<real_t> undo;
+    /// Latest step size saved by @ref begin_transaction.
+    real_t undo_γ = NaN;
+    /// Diagonal estimate of @f$ H_0 @f$ saved by @ref begin_transaction.
+    BasicDiagonalH0<real_t> undo_diag;
+    /// Sum over all processes, empty if the vectors are not distributed.
+    BasicAllReduce<real_t> all_reduce;
+    AccelStats stats;
 };
 
-inline void BroydenGood::reset() {
+template <class Real>
+void BasicBroydenGood<Real>::reset() {
     idx  = 0;
     full = false;
+    undo.end();
+    sparse.clear();
+    if (params.diagonal_h0)
+        diag.reset();
 }
 
-inline void BroydenGood::resize(length_t n) {
+template <class Real>
+void BasicBroydenGood<Real>::resize(length_t n) {
     if (params.memory < 1)
         throw std::invalid_argument("BroydenGood::Params::memory must be >= 1");
-    sto.resize(n, params.memory);
+    sto.resize(n, params.memory, params.storage_dir);
+    sparse.resize(params.memory);
+    if (params.diagonal_h0)
+        diag.resize(n);
     reset();
 }
 
+template <class Real>
+void BasicBroydenGood<Real>::set_memory(length_t m) {
+    if (m < 1)
+        throw std::invalid_argument("BroydenGood::Params::memory must be >= 1");
+    undo.end();
+    densify();
+    // Rotate the pairs in use such that the newest k_new ones come first,
+    // oldest first
+    const length_t k = current_history(), k_new = std::min(k, m);
+    if (k > 0) {
+        const index_t r = ((full ? idx : 0) + k - k_new) % k;
+        vec_util::rotate_cols(sto.sto.map(), 2 * k, 2 * r);
+    }
+    params.memory = m;
+    sto.set_history(m, k_new, params.storage_dir);
+    sparse.resize(m);
+    idx  = k_new == m ? 0 : k_new;
+    full = k_new == m;
+}
+
+template <class Real>
 template <class VecS, class VecY>
-bool BroydenGood::update_sy(const anymat<VecS> &sₖ, const anymat<VecY> &yₖ,
-                            bool forced) {
+bool BasicBroydenGood<Real>::update_sy(const anymat<VecS> &sₖ,
+                                       const anymat<VecY> &yₖ, bool forced) {
+    QUALA_STATS(OpTimer timer(stats.update));
     // Restart if the buffer is full
     if (full && params.restarted) {
         full = false;
+        sparse.clear();
         assert(idx == 0);
     }
 
     auto &&r = sto.work();
     // Compute r = r₍ₘ₋₁₎ = Hₖ yₖ
     r = yₖ; // r₍₋₁₎ = yₖ
+    // If the history is stored in a file, the next pair is prefetched
+    const index_t newest = pred(idx);
     foreach_fwd([&](index_t i) {
-        r += s̃(i) * r.dot(s(i)); // r₍ᵢ₎ = r₍ᵢ₋₁₎ + s̃₍ᵢ₎〈r₍ᵢ₋₁₎, s₍ᵢ₎〉
+        if (i != newest)
+            prefetch(succ(i));
+        real_t rᵀs = sparse.is_sparse(i) ? sparse.dot(i, 0, r) : r.dot(s(i));
+        global_sum(&rᵀs, 1);
+        // r₍ᵢ₎ = r₍ᵢ₋₁₎ + s̃₍ᵢ₎〈r₍ᵢ₋₁₎, s₍ᵢ₎〉
+        if (sparse.is_sparse(i))
+            sparse.axpy(i, 1, rᵀs, r);
+        else
+            r += s̃(i) * rᵀs;
     });
-    const real_t sᵀHy   = sₖ.dot(r);
+    // All other inner products in a single reduction
+    const real_t θ̅ = params.powell_damping_factor;
+    real_t dots[4];
+    dots[0] = sₖ.dot(r);
+    dots[1] = sₖ.dot(yₖ);
+    dots[2] = yₖ.squaredNorm();
+    dots[3] = θ̅ ? sₖ.squaredNorm() : 0;
+    global_sum(dots, θ̅ ? 4 : 3);
+    const real_t sᵀHy   = dots[0];
     const real_t a_sᵀHy = params.force_pos_def ? sᵀHy : std::abs(sᵀHy);
 
     // Check if update is accepted
-    if (!forced && a_sᵀHy < params.min_div_abs)
+    QUALA_STATS({
+        // Applying Hₖ to y, the other inner products and the new vectors
+        const double n = this->n(), k = current_history();
+        stats.update.add_cost((4 * k + 10) * n,
+                              (5 * k + 15) * n * sizeof(real_t));
+    });
+    if (!forced && a_sᵀHy < params.min_div_abs) {
+        QUALA_STATS(stats.count(UpdateStatus::Curvature));
         return false;
-
-    // Compute damping
-    real_t damp = 1 / sᵀHy;
-    if (real_t θ̅ = params.powell_damping_factor) {
-        real_t γ     = sᵀHy / sₖ.squaredNorm();
-        real_t sgn_γ = γ >= 0 ? 1 : -1;
-        real_t γθ̅    = params.force_pos_def ? γ * θ̅ : sgn_γ * θ̅;
-        real_t a_γ   = params.force_pos_def ? γ : std::abs(γ);
-        real_t θ     = a_γ >= θ̅ ? 1 // no damping
-                                : (1 - γθ̅) / (1 - γ);
-        damp         = θ / (sₖ.squaredNorm() * (1 - θ + θ * γ));
     }
+    QUALA_STATS(stats.count(UpdateStatus::Accepted));
+
+    const real_t damp = scaling_factor(sᵀHy, dots[3]);
 
     // Store the new vectors
+    if (undo.needs_save(idx))
+        undo.save(idx, sto.s(idx), sto.s̃(idx), 0);
+    sparse.set_dense(idx);
     sto.s(idx) = sₖ;
     sto.s̃(idx) = damp * (sₖ - r);
-    latest_γ = sₖ.dot(yₖ) / yₖ.squaredNorm();
+    latest_γ   = dots[1] / dots[2];
     if (std::abs(latest_γ) < params.min_stepsize)
         latest_γ = std::copysign(params.min_stepsize, latest_γ);
+    if (params.diagonal_h0)
+        diag.update(0, n(), sₖ, yₖ, 1 - real_t(1) / history(), latest_γ,
+                    params.diagonal_h0_bound);
 
     // Increment the index in the circular buffer
     idx = succ(idx);
@@ -221,30 +472,293 @@ bool BroydenGood::update_sy(const anymat<VecS> &sₖ, const anymat<VecY> &yₖ,
     return true;
 }
 
-inline bool BroydenGood::apply(rvec q, real_t γ) {
+template <class Real>
+auto BasicBroydenGood<Real>::scaling_factor(real_t sᵀHy, real_t sᵀs) const
+    -> real_t {
+    const real_t θ̅ = params.powell_damping_factor;
+    if (not θ̅)
+        return 1 / sᵀHy;
+    // Compute damping
+    real_t γ     = sᵀHy / sᵀs;
+    real_t sgn_γ = γ >= 0 ? 1 : -1;
+    real_t γθ̅    = params.force_pos_def ? γ * θ̅ : sgn_γ * θ̅;
+    real_t a_γ   = params.force_pos_def ? γ : std::abs(γ);
+    real_t θ     = a_γ >= θ̅ ? 1 // no damping
+                            : (1 - γθ̅) / (1 - γ);
+    return θ / (sᵀs * (1 - θ + θ * γ));
+}
+
+template <class Real>
+bool BasicBroydenGood<Real>::update_sy_sparse(cridvec J, crvec s_J,
+                                              crvec y_J, bool forced) {
+    if (s_J.size() != J.size() || y_J.size() != J.size())
+        throw std::invalid_argument("BroydenGood::update_sy_sparse: values "
+                                    "must have the same size as the indices");
+    if (not valid_sparse_pattern(J, n()))
+        throw std::invalid_argument("BroydenGood::update_sy_sparse: indices "
+                                    "must be sorted, unique and smaller than "
+                                    "n");
+    // Restart if the buffer is full
+    if (full && params.restarted) {
+        full = false;
+        sparse.clear();
+        assert(idx == 0);
+    }
+    const real_t max_nnz = params.sparse_max_density * n();
+    // Hₖ yₖ can only be sparse if all pairs in use are sparse
+    bool use_sparse = supports_sparse() && J.size() <= max_nnz;
+    foreach_fwd([&](index_t i) { use_sparse &= sparse.is_sparse(i); });
+    if (sparse_work.rows() != n())
+        sparse_work.resize(n(), 2);
+    if (use_sparse) {
+        // Only counted once the fill-in is known to be small enough,
+        // otherwise the dense update_sy below counts the update
+        QUALA_STATS(OpTimer timer(stats.update, false));
+        if (sparse_acc.x.size() != n())
+            sparse_acc.resize(n());
+        // Compute r = r₍ₘ₋₁₎ = Hₖ yₖ in the sparse accumulator, its pattern
+        // P is J followed by the fill-in of the vectors s̃
+        auto &r = sparse_acc;
+        for (index_t k = 0; k < J.size(); ++k) {
+            r.add(J(k));
+            r.x(J(k)) = y_J(k);
+        }
+        foreach_fwd([&](index_t i) {
+            if (r.size() > max_nnz)
+                return;
+            real_t rᵀs = sparse.dot(i, 0, r.x);
+            // r₍ᵢ₎ = r₍ᵢ₋₁₎ + s̃₍ᵢ₎〈r₍ᵢ₋₁₎, s₍ᵢ₎〉
+            for (index_t k = 0; k < sparse.J[i].size(); ++k)
+                r.add(sparse.J[i](k));
+            sparse.axpy(i, 1, rᵀs, r.x);
+        });
+        if (r.size() <= max_nnz) {
+            QUALA_STATS(++stats.update.count);
+            // Gather s and r at the indices P, s is zero outside of J
+            const length_t nJ = J.size(), nP = r.size();
+            auto s_P = sparse_work.col(0).head(nP);
+            auto r_P = sparse_work.col(1).head(nP);
+            s_P.head(nJ) = s_J;
+            s_P.tail(nP - nJ).setZero();
+            for (index_t k = 0; k < nP; ++k)
+                r_P(k) = r.x(r.pattern[k]);
+            const real_t sᵀHy   = s_J.dot(r_P.head(nJ));
+            const real_t a_sᵀHy = params.force_pos_def ? sᵀHy : std::abs(sᵀHy);
+            QUALA_STATS({
+                const double n = nP, k = current_history();
+                stats.update.add_cost((4 * k + 10) * n,
+                                      (5 * k + 15) * n * sizeof(real_t));
+            });
+            if (!forced && a_sᵀHy < params.min_div_abs) {
+                QUALA_STATS(stats.count(UpdateStatus::Curvature));
+                r.clear();
+                return false;
+            }
+            QUALA_STATS(stats.count(UpdateStatus::Accepted));
+
+            // Store the new vectors
+            const real_t damp = scaling_factor(sᵀHy, s_J.squaredNorm());
+            r_P               = damp * (s_P - r_P);
+            sparse.store(idx, Eigen::Map<const idvec>(r.pattern.data(), nP),
+                         s_P, r_P);
+            r.clear();
+            latest_γ = s_J.dot(y_J) / y_J.squaredNorm();
+            if (std::abs(latest_γ) < params.min_stepsize)
+                latest_γ = std::copysign(params.min_stepsize, latest_γ);
+
+            // Increment the index in the circular buffer
+            idx = succ(idx);
+            full |= idx == 0;
+
+            return true;
+        }
+        // Too much fill-in, fall back to dense vectors
+        r.clear();
+    }
+    // Scatter the pair into dense vectors
+    sparse_work.setZero();
+    for (index_t k = 0; k < J.size(); ++k) {
+        sparse_work(J(k), 0) = s_J(k);
+        sparse_work(J(k), 1) = y_J(k);
+    }
+    return update_sy(sparse_work.col(0), sparse_work.col(1), forced);
+}
+
+template <class Real>
+bool BasicBroydenGood<Real>::update_sy(const Eigen::SparseVector<real_t> &s,
+                                       const Eigen::SparseVector<real_t> &y,
+                                       bool forced) {
+    if (s.size() != n() || y.size() != n())
+        throw std::invalid_argument("BroydenGood::update_sy: vectors must "
+                                    "have size n");
+    idvec J;
+    vec s_J, y_J;
+    sparse_union(s, y, J, s_J, y_J);
+    return update_sy_sparse(J, s_J, y_J, forced);
+}
+
+template <class Real>
+bool BasicBroydenGood<Real>::apply(rvec q, real_t γ) {
+    QUALA_STATS(OpTimer timer(stats.apply));
     // Only apply if we have previous vectors s and y
     if (idx == 0 && not full)
         return false;
 
+    if (γ < 0 && params.diagonal_h0)
+        return apply_impl(q, crvec(diag.d));
     if (γ < 0)
         γ = latest_γ;
-    if (γ != 1)
-        q *= γ;
+    return apply_impl(q, γ);
+}
+
+template <class Real>
+bool BasicBroydenGood<Real>::apply(rvec q, crvec d) {
+    if (d.size() != n())
+        throw std::invalid_argument("BroydenGood::apply: diagonal of H₀ must "
+                                    "have size n");
+    QUALA_STATS(OpTimer timer(stats.apply));
+    // Only apply if we have previous vectors s and y
+    if (idx == 0 && not full)
+        return false;
+    return apply_impl(q, d);
+}
+
+template <class Real>
+template <class H0>
+bool BasicBroydenGood<Real>::apply_impl(rvec q, H0 h0) {
+    QUALA_STATS({
+        // An inner product and an update per pair
+        const double n = this->n(), k = current_history();
+        stats.apply.add_cost((4 * k + 1) * n, (5 * k + 2) * n * sizeof(real_t));
+    });
+    // q₍₋₁₎ = H₀ q. A diagonal H₀ is applied together with the first inner
+    // product, so q is only read once for both.
+    bool scaled = false;
+    if constexpr (std::is_arithmetic_v<H0>) {
+        if (h0 != 1)
+            q *= h0;
+        scaled = true;
+    } else if (sparse.count > 0) {
+        q      = h0.cwiseProduct(q);
+        scaled = true;
+    }
 
     // Compute q = q₍ₘ₋₁₎ = Hₖ q
-    // q₍₋₁₎ = q
+    const index_t newest = pred(idx);
     foreach_fwd([&](index_t i) {
-        q += s̃(i) * q.dot(s(i)); // q₍ᵢ₎ = q₍ᵢ₋₁₎ + s̃₍ᵢ₎〈q₍ᵢ₋₁₎, s₍ᵢ₎〉
+        if (i != newest)
+            prefetch(succ(i));
+        if (sparse.is_sparse(i)) {
+            // q₍ᵢ₎ = q₍ᵢ₋₁₎ + s̃₍ᵢ₎〈q₍ᵢ₋₁₎, s₍ᵢ₎〉
+            sparse.axpy(i, 1, sparse.dot(i, 0, q), q);
+            return;
+        }
+        real_t qᵀs = scaled ? q.dot(s(i))
+                            : fused_axpy_dot<real_t>(0, s(i), q, h0, s(i));
+        scaled     = true;
+        global_sum(&qᵀs, 1);
+        q += s̃(i) * qᵀs; // q₍ᵢ₎ = q₍ᵢ₋₁₎ + s̃₍ᵢ₎〈q₍ᵢ₋₁₎, s₍ᵢ₎〉
     });
 
     return true;
 }
 
-inline bool BroydenGood::update(crvec xₖ, crvec xₙₑₓₜ, crvec pₖ, crvec pₙₑₓₜ,
-                                bool forced) {
+template <class Real>
+void BasicBroydenGood<Real>::densify() {
+    if (sparse.count == 0)
+        return;
+    foreach_fwd([&](index_t i) {
+        if (sparse.is_sparse(i))
+            sparse.densify(i, sto.s(i), sto.s̃(i));
+    });
+    sparse.clear();
+}
+
+template <class Real>
+void BasicBroydenGood<Real>::begin_transaction() {
+    if (undo.active)
+        throw std::logic_error("BroydenGood::begin_transaction: transaction "
+                               "already in progress");
+    // Only dense pairs are saved when they are overwritten
+    densify();
+    undo.begin(idx, full, history());
+    undo_γ = latest_γ;
+    if (params.diagonal_h0)
+        undo_diag = diag;
+}
+
+template <class Real>
+void BasicBroydenGood<Real>::rollback() {
+    if (not undo.active)
+        throw std::logic_error("BroydenGood::rollback: no transaction in "
+                               "progress");
+    undo.foreach_saved([&](index_t i, auto s, auto s̃, real_t) {
+        sto.s(i) = s;
+        sto.s̃(i) = s̃;
+    });
+    idx      = undo.idx;
+    full     = undo.full;
+    latest_γ = undo_γ;
+    undo.end();
+    if (params.diagonal_h0)
+        diag = undo_diag;
+}
+
+template <class Real>
+bool BasicBroydenGood<Real>::update(crvec xₖ, crvec xₙₑₓₜ, crvec pₖ,
+                                    crvec pₙₑₓₜ, bool forced) {
     const auto s = xₙₑₓₜ - xₖ;
     const auto y = pₙₑₓₜ - pₖ;
     return update_sy(s, y, forced);
 }
 
+template <class Real>
+void BasicBroydenGood<Real>::save(CheckpointWriter &w) const {
+    const length_t k = current_history();
+    w.header(CheckpointKind::BroydenGood, sizeof(real_t), sizeof(real_t));
+    w.scalar<std::int64_t>(n());
+    w.scalar<std::int64_t>(history());
+    w.scalar<std::int64_t>(idx);
+    w.scalar<std::uint8_t>(full);
+    w.scalar(latest_γ);
+    // Only the first k pairs are in use
+    if (sparse.count > 0) {
+        // Sparse pairs are written as dense vectors
+        mat W = sto.sto.map().leftCols(2 * k);
+        for (index_t i = 0; i < k; ++i)
+            if (sparse.is_sparse(i))
+                sparse.scatter(i, W.col(2 * i), W.col(2 * i + 1));
+        w.matrix(W);
+    } else {
+        w.matrix(sto.sto.map().leftCols(2 * k));
+    }
+}
+
+template <class Real>
+void BasicBroydenGood<Real>::load(CheckpointReader &r) {
+    r.header(CheckpointKind::BroydenGood, sizeof(real_t), sizeof(real_t));
+    if (r.scalar<std::int64_t>() != n())
+        throw std::invalid_argument("BroydenGood::load: dimension mismatch");
+    if (r.scalar<std::int64_t>() != history())
+        throw std::invalid_argument("BroydenGood::load: history length "
+                                    "mismatch");
+    reset();
+    const index_t new_idx = r.index(history() - 1);
+    const bool new_full   = r.scalar<std::uint8_t>() != 0;
+    const length_t k      = new_full ? history() : new_idx;
+    latest_γ              = r.scalar<real_t>();
+    r.matrix(sto.sto.map().leftCols(2 * k));
+    idx  = new_idx;
+    full = new_full;
+    if (params.diagonal_h0)
+        diag.d.setConstant(latest_γ);
+}
+
+/// @ref BasicBroydenGoodParams for the default floating point type.
+using BroydenGoodParams = BasicBroydenGoodParams<real_t>;
+/// @ref BasicBroydenStorage for the default floating point type.
+using BroydenStorage = BasicBroydenStorage<real_t>;
+/// @ref BasicBroydenGood for the default floating point type.
+using BroydenGood = BasicBroydenGood<real_t>;
+
 } // namespace quala
\ No newline at end of file
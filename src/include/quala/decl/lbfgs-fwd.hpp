@@ -1,6 +1,11 @@
 #pragma once
 
+#include <quala/util/vec.hpp>
+
 namespace quala {
-struct LBFGSParams;
-class LBFGS;
-}
\ No newline at end of file
+template <class Real>
+struct BasicLBFGSParams;
+template <class Real, class StorageReal = Real, length_t N = Eigen::Dynamic,
+          length_t M = Eigen::Dynamic>
+class BasicLBFGS;
+} // namespace quala
\ No newline at end of file
@@ -1,12 +1,62 @@
 #pragma once
 
 #include <quala/decl/lbfgs-fwd.hpp>
+#include <quala/detail/diagonal-h0.hpp>
+#include <quala/detail/history-undo.hpp>
+#include <quala/detail/parallel-kernels.hpp>
+#include <quala/detail/sparse-pairs.hpp>
+#include <quala/util/checkpoint.hpp>
+#include <quala/util/index-ranges.hpp>
+#include <quala/util/mapped-matrix.hpp>
+#include <quala/util/stats.hpp>
+#include <quala/util/unroll.hpp>
 #include <quala/util/vec.hpp>
 
+#include <Eigen/Cholesky>
+
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <vector>
+
 namespace quala {
 
-/// Parameters for the @ref LBFGS class.
-struct LBFGSParams {
+/// Algorithm used by @ref BasicLBFGS::apply.
+enum class LBFGSApplyMethod {
+    /// Classic two-loop recursion. Streams all vectors s and y twice,
+    /// with 2 m dependent dot products and updates.
+    TwoLoop,
+    /// Compact representation by Byrd, Nocedal and Schnabel. Keeps the
+    /// small Gram matrices @f$ S^\top Y @f$ and @f$ Y^\top Y @f$ up to
+    /// date in @ref BasicLBFGS::update_sy, so applying the inverse Hessian
+    /// estimate only requires two tall-skinny matrix-vector products.
+    /// @see https://doi.org/10.1007/BF01582063
+    Compact,
+};
+
+/// The sign of the vectors @f$ p @f$ passed to the @ref BasicLBFGS::update
+/// method.
+enum class LBFGSSign {
+    Positive, ///< @f$ p \sim \nabla \psi(x) @f$
+    Negative, ///< @f$ p \sim -\nabla \psi(x) @f$
+};
+
+/// Parameters for the cautious BFGS update, see
+/// @ref BasicLBFGSParams::cbfgs.
+template <class Real>
+struct BasicCBFGSParams {
+    Real α = 1;
+    Real ϵ = 0; ///< Set to zero to disable CBFGS check.
+    explicit operator bool() const { return ϵ > 0; }
+};
+
+/// Parameters for the @ref BasicLBFGS class.
+/// @tparam Real
+///         Floating point type.
+template <class Real>
+struct BasicLBFGSParams {
+    USING_QUALA_TYPES(Real);
+
     /// Length of the history to keep.
     length_t memory = 10;
     /// Reject update if @f$ y^\top s \le \text{min_div_fac} \cdot s^\top s @f$.
@@ -15,11 +65,7 @@ struct LBFGSParams {
     real_t min_abs_s = 1e-32;
     /// Cautious BFGS update.
     /// @see @ref cbfgs
-    struct CBFGSParams {
-        real_t α = 1;
-        real_t ϵ = 0; ///< Set to zero to disable CBFGS check.
-        explicit operator bool() const { return ϵ > 0; }
-    };
+    using CBFGSParams = BasicCBFGSParams<real_t>;
     /// Parameters in the cautious BFGS update condition
     /// @f[ \frac{y^\top s}{s^\top s} \ge \epsilon \| g \|^\alpha @f]
     /// @see https://epubs.siam.org/doi/10.1137/S1052623499354242
@@ -31,6 +77,55 @@ struct LBFGSParams {
     /// update if
     /// @f$ \left| y^\top s \right| \le \text{min_div_fac} \cdot s^\top s @f$.
     bool force_pos_def = true;
+    /// Algorithm used by @ref BasicLBFGS::apply.
+    using ApplyMethod = LBFGSApplyMethod;
+    /// Algorithm used by @ref BasicLBFGS::apply.
+    /// The masked version of @ref BasicLBFGS::apply and the version with a
+    /// diagonal initial inverse Hessian approximation always use the two-loop
+    /// recursion.
+    ApplyMethod apply_method = ApplyMethod::TwoLoop;
+    /// Cache the rows in the index set J of the vectors s and y in a packed
+    /// buffer, together with the J-restricted values of ρ, between calls to
+    /// the masked version of @ref BasicLBFGS::apply. As long as J doesn't
+    /// change, only the newest pairs have to be gathered, and the recursion
+    /// itself operates on contiguous vectors. Changing J invalidates the cache.
+    bool cache_masked_apply = false;
+    /// Number of threads used by @ref BasicLBFGS::apply,
+    /// @ref BasicLBFGS::update_sy and @ref BasicLBFGS::scale_y, including the
+    /// calling thread. If nonzero, the vectors are split into chunks of
+    /// @ref chunk_size elements, which are divided over a thread pool owned by
+    /// the @ref BasicLBFGS instance. The partial inner products of the chunks
+    /// are always summed in the same order, so the results don't depend on
+    /// the number of threads. Zero disables the chunked execution.
+    /// The masked version of @ref BasicLBFGS::apply is always serial.
+    length_t num_threads = 0;
+    /// Number of elements per chunk when @ref num_threads is nonzero.
+    /// The default keeps the chunks of a few vectors in the L2 cache.
+    length_t chunk_size = 1 << 14;
+    /// If nonempty, the vectors s and y are not stored in memory, but in a
+    /// memory mapped temporary file in this directory, for problems where the
+    /// history doesn't fit in memory. The file is removed automatically.
+    /// @see @ref MappedBuffer
+    std::string storage_dir;
+    /// Keep the Gram matrix of the compact representation up to date, even if
+    /// @ref apply_method is not @ref LBFGSApplyMethod::Compact, so that
+    /// @ref BasicLBFGS::apply_hessian can be used.
+    bool hessian_products = false;
+    /// Estimate a diagonal initial inverse Hessian approximation
+    /// @f$ H_0 = \mathrm{diag}(d) @f$ from the history, and use it in
+    /// @ref BasicLBFGS::apply if @f$ \gamma @f$ is negative, instead of
+    /// @f$ H_0 = \frac{s^\top y}{y^\top y} I @f$. This helps for badly scaled
+    /// problems. The estimate is updated in @ref BasicLBFGS::update_sy.
+    /// @see @ref BasicDiagonalH0
+    bool diagonal_h0 = false;
+    /// Bound on the ratio between the elements of the diagonal @f$ H_0 @f$
+    /// and the scalar @f$ \frac{s^\top y}{y^\top y} @f$, see
+    /// @ref diagonal_h0.
+    real_t diagonal_h0_bound = 1e2;
+    /// Pairs passed to @ref BasicLBFGS::update_sy_sparse are only stored
+    /// sparsely if the number of nonzeros is at most this fraction of n,
+    /// otherwise they are scattered into the dense storage.
+    real_t sparse_max_density = 0.1;
 };
 
 /// Layout:
@@ -38,55 +133,245 @@ struct LBFGSParams {
 ///       ┌───── 2 m ─────┐
 ///     ┌ ┌───┬───┬───┬───┐
 ///     │ │   │   │   │   │
-///     │ │ s │ y │ s │ y │
-/// n+1 │ │   │   │   │   │
-///     │ ├───┼───┼───┼───┤
-///     │ │ ρ │ α │ ρ │ α │
+///   n │ │ s │ y │ s │ y │  sto (StorageReal)
+///     │ │   │   │   │   │
+///     └ └───┴───┴───┴───┘
+///     ┌ ┌───┬───┬───┬───┐
+///   2 │ │ ρ │ ρ │ ρ │ ρ │  ρα (Real)
+///     │ │ α │ α │ α │ α │
 ///     └ └───┴───┴───┴───┘
+///       └───── m ─────┘
 /// ~~~
-struct LBFGSStorage {
-    /// Re-allocate storage for a problem with a different size.
-    void resize(length_t n, length_t history);
+/// @tparam Real
+///         Floating point type used for the scalars ρ and α and for all
+///         computations.
+/// @tparam StorageReal
+///         Floating point type used for storing the vectors s and y.
+/// @tparam N
+///         Compile-time size of the vectors s and y, or `Eigen::Dynamic`.
+/// @tparam M
+///         Compile-time history length, or `Eigen::Dynamic`.
+template <class Real, class StorageReal = Real, length_t N = Eigen::Dynamic,
+          length_t M = Eigen::Dynamic>
+struct BasicLBFGSStorage {
+    USING_QUALA_TYPES(Real);
+    using storage_real_t = StorageReal;
+
+    /// Re-allocate storage for a problem with a different size. If @p dir is
+    /// nonempty, the vectors s and y are stored in a memory mapped temporary
+    /// file in that directory.
+    void resize(length_t n, length_t history, const std::string &dir = {});
+    /// Change the history length, keeping the first @p keep pairs. The
+    /// storage is only re-allocated if it is too small, see
+    /// @ref BasicLBFGS::set_memory.
+    void set_history(length_t history, length_t keep,
+                     const std::string &dir = {});
 
     /// Get the size of the s and y vectors in the buffer.
-    length_t n() const { return sto.rows() - 1; }
+    length_t n() const { return sto.rows(); }
     /// Get the number of previous vectors s and y stored in the buffer.
-    length_t history() const { return sto.cols() / 2; }
+    /// After shrinking the history, the storage may have more columns.
+    length_t history() const { return hist; }
 
-    auto s(index_t i) { return sto.col(2 * i).topRows(n()); }
-    auto s(index_t i) const { return sto.col(2 * i).topRows(n()); }
-    auto y(index_t i) { return sto.col(2 * i + 1).topRows(n()); }
-    auto y(index_t i) const { return sto.col(2 * i + 1).topRows(n()); }
-    real_t &ρ(index_t i) { return sto.coeffRef(n(), 2 * i); }
-    const real_t &ρ(index_t i) const { return sto.coeff(n(), 2 * i); }
-    real_t &α(index_t i) { return sto.coeffRef(n(), 2 * i + 1); }
-    const real_t &α(index_t i) const { return sto.coeff(n(), 2 * i + 1); }
+    auto s(index_t i) { return sto.map().col(2 * i); }
+    auto s(index_t i) const { return sto.map().col(2 * i); }
+    auto y(index_t i) { return sto.map().col(2 * i + 1); }
+    auto y(index_t i) const { return sto.map().col(2 * i + 1); }
+    real_t &ρ(index_t i) { return ρα.coeffRef(0, i); }
+    const real_t &ρ(index_t i) const { return ρα.coeff(0, i); }
+    real_t &α(index_t i) { return ρα.coeffRef(1, i); }
+    const real_t &α(index_t i) const { return ρα.coeff(1, i); }
 
     using storage_t =
-        Eigen::Matrix<real_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor>;
-    storage_t sto;
+        Eigen::Matrix<storage_real_t, N, M == Eigen::Dynamic ? M : 2 * M,
+                      Eigen::ColMajor>;
+    MappableMatrix<storage_t> sto;
+    Eigen::Matrix<real_t, 2, M> ρα;
+    length_t hist = M == Eigen::Dynamic ? 0 : M;
+};
+
+/// Storage for the compact representation of the L-BFGS inverse Hessian
+/// estimate, see @ref LBFGSApplyMethod::Compact.
+///
+/// The Gram matrix @f$ W^\top W @f$ of the matrix
+/// @f$ W = \begin{pmatrix} s_0 & y_0 & \dots & s_{m-1} & y_{m-1}
+/// \end{pmatrix} @f$ (i.e. @ref BasicLBFGSStorage::sto) is
+/// updated incrementally. Its columns are in the same order as the columns of
+/// @ref BasicLBFGSStorage::sto (i.e. in the order of the circular buffer, not
+/// in chronological order).
+template <class Real>
+struct BasicLBFGSCompactStorage {
+    USING_QUALA_TYPES(Real);
+
+    /// Re-allocate storage for a different history length.
+    void resize(length_t history);
+    /// Change the history length, keeping the top left block of the Gram
+    /// matrix. The storage is only re-allocated if it is too small.
+    void set_history(length_t history);
+    /// Re-allocate the workspaces for at least @p num_rhs right-hand sides.
+    /// Only the first columns are used for fewer right-hand sides.
+    void resize_rhs(length_t history, length_t num_rhs);
+
+    /// @f$ s_i^\top y_j @f$
+    real_t sᵀy(index_t i, index_t j) const { return gram(2 * i, 2 * j + 1); }
+    /// @f$ y_i^\top y_j @f$
+    real_t yᵀy(index_t i, index_t j) const {
+        return gram(2 * i + 1, 2 * j + 1);
+    }
+    /// @f$ s_i^\top s_j @f$
+    real_t sᵀs(index_t i, index_t j) const { return gram(2 * i, 2 * j); }
+    /// Mark the factorization used by @ref BasicLBFGS::apply_hessian as
+    /// stale.
+    void invalidate_hessian() { C_γ = NaN; }
+
+    /// Gram matrix @f$ W^\top W @f$.
+    mat gram;
+    /// Workspace for @f$ W^\top Q @f$ and the coefficients of the result.
+    /// Has at least as many columns as the largest number of right-hand sides
+    /// so far.
+    mat WᵀQ;
+    /// Workspace for the upper triangular part of @f$ S^\top Y @f$ in
+    /// chronological order.
+    mat R;
+    /// Workspace for @f$ D + \gamma Y^\top Y @f$ in chronological order.
+    mat DγYᵀY;
+    /// Workspace for @f$ R^{-1} S^\top Q @f$ and @f$ Y^\top Q @f$.
+    mat U, YᵀQ;
+    /// Strictly lower triangular part @f$ L @f$ of @f$ S^\top Y @f$ in
+    /// chronological order, used by @ref BasicLBFGS::apply_hessian.
+    mat L;
+    /// Diagonal @f$ D @f$ of @f$ S^\top Y @f$ in chronological order.
+    vec D;
+    /// Factorization of @f$ \gamma^{-1} S^\top S + L D^{-1} L^\top @f$.
+    Eigen::LDLT<mat> C;
+    /// Value of γ for which @ref C was computed, NaN if it is stale.
+    real_t C_γ = NaN;
+};
+
+/// Packed copies of the rows in the index set J of the vectors s and y, used
+/// by the masked version of @ref BasicLBFGS::apply, see
+/// @ref BasicLBFGSParams::cache_masked_apply.
+///
+/// Layout:
+/// ~~~
+///        ┌───── 2 m ─────┐
+///      ┌ ┌───┬───┬───┬───┐
+///      │ │   │   │   │   │
+///  |J| │ │s_J│y_J│s_J│y_J│
+///      │ │   │   │   │   │
+///      └ └───┴───┴───┴───┘
+/// ~~~
+template <class Real>
+struct BasicLBFGSMaskedCache {
+    USING_QUALA_TYPES(Real);
+
+    /// Re-allocate storage for a different history length, and clear the
+    /// cache.
+    void resize(length_t history);
+    /// Change the history length, and mark all cached pairs as stale. The
+    /// storage is only re-allocated if it is too small.
+    void set_history(length_t history);
+    /// Mark all cached pairs as stale.
+    void invalidate() { std::fill(valid.begin(), valid.end(), false); }
+
+    auto s(index_t i) { return sto.col(2 * i); }
+    auto s(index_t i) const { return sto.col(2 * i); }
+    auto y(index_t i) { return sto.col(2 * i + 1); }
+    auto y(index_t i) const { return sto.col(2 * i + 1); }
+
+    /// Index set J for which the cache was built.
+    idvec J;
+    /// Packed storage for the rows J of the vectors s and y.
+    mat sto;
+    /// Values of ρ for the vectors s(J) and y(J), NaN if the pair is rejected.
+    vec ρ;
+    /// Values of @f$ y(J)^\top y(J) @f$.
+    vec yᵀy;
+    /// Values of α.
+    vec α;
+    /// Workspace for q(J).
+    vec q;
+    /// Workspace for the inner products @f$ y^\top s @f$, @f$ s^\top s @f$ and
+    /// @f$ y^\top y @f$ of the newly gathered pairs.
+    mat dots;
+    /// Whether the packed pair with the given index is up to date.
+    std::vector<bool> valid;
+};
+
+/// Scratch space for the `const` versions of @ref BasicLBFGS::apply. Each
+/// thread that applies the same approximation concurrently needs its own
+/// workspace. It is resized automatically, so a default-constructed workspace
+/// can be used, but it can be allocated up front to avoid allocations in
+/// @ref BasicLBFGS::apply.
+template <class Real>
+struct BasicLBFGSWorkspace {
+    USING_QUALA_TYPES(Real);
+
+    BasicLBFGSWorkspace() = default;
+    BasicLBFGSWorkspace(length_t history) { resize(history); }
+
+    /// Allocate storage for the given history length.
+    void resize(length_t history) {
+        α.resize(history);
+        ρ.resize(history);
+    }
+
+    /// Values of α.
+    vec α;
+    /// Values of ρ for the vectors s(J) and y(J) of the masked apply, NaN if
+    /// the pair is rejected.
+    vec ρ;
+    /// Run-length compressed index set of the masked apply.
+    IndexRanges J;
+    /// Whether each index is in the index set of the masked apply, only
+    /// allocated if the history contains sparse pairs.
+    std::vector<bool> in_J;
 };
 
 /// Limited memory Broyden–Fletcher–Goldfarb–Shanno (L-BFGS) algorithm
+/// @tparam Real
+///         Floating point type used for all computations.
+/// @tparam StorageReal
+///         Floating point type used for storing the history of vectors s and
+///         y. A lower precision type (e.g. `float` or `Eigen::bfloat16` with
+///         `Real = double`) reduces the memory usage and bandwidth of
+///         @ref apply, while the scalars ρ and α and all inner products are
+///         still kept and accumulated in @p Real.
+/// @tparam N
+///         Compile-time problem dimension, or `Eigen::Dynamic`.
+/// @tparam M
+///         Compile-time history length, or `Eigen::Dynamic`. If fixed,
+///         @ref BasicLBFGSParams::memory is ignored, and the loops over the
+///         history are fully unrolled.
+///
+/// If both @p N and @p M are fixed, the history is stored in fixed-size
+/// matrices, and @ref update and the two-loop recursion of @ref apply don't
+/// allocate any memory, see @ref StaticLBFGS.
 /// @ingroup accelerators-grp
-class LBFGS {
+template <class Real, class StorageReal, length_t N, length_t M>
+class BasicLBFGS {
   public:
-    using Params = LBFGSParams;
-
-    /// The sign of the vectors @f$ p @f$ passed to the @ref LBFGS::update
-    /// method.
-    enum class Sign {
-        Positive, ///< @f$ p \sim \nabla \psi(x) @f$
-        Negative, ///< @f$ p \sim -\nabla \psi(x) @f$
-    };
+    USING_QUALA_TYPES(Real);
+    using storage_real_t = StorageReal;
+    using Params         = BasicLBFGSParams<real_t>;
+    using Sign           = LBFGSSign;
+    using Workspace      = BasicLBFGSWorkspace<real_t>;
 
-    LBFGS(Params params) : params(params) {}
-    LBFGS(Params params, length_t n) : params(params) { resize(n); }
+    /// If the dimension @p N is fixed, the storage is allocated immediately.
+    BasicLBFGS(Params params) : params(params) {
+        if constexpr (N != Eigen::Dynamic)
+            resize(N);
+    }
+    BasicLBFGS(Params params, length_t n) : params(params) { resize(n); }
 
     /// Check if the new vectors s and y allow for a valid BFGS update that
     /// preserves the positive definiteness of the Hessian approximation.
-    static bool update_valid(const LBFGSParams &params, real_t yᵀs, real_t sᵀs,
+    static bool update_valid(const Params &params, real_t yᵀs, real_t sᵀs,
                              real_t pᵀp);
+    /// Same as @ref update_valid, but returns the reason why the update is
+    /// rejected.
+    static UpdateStatus update_status(const Params &params, real_t yᵀs,
+                                      real_t sᵀs, real_t pᵀp);
 
     /// Update the inverse Hessian approximation using the new vectors
     /// sₖ = xₖ₊₁ - xₖ and yₖ = pₖ₊₁ - pₖ.
@@ -94,6 +379,28 @@ class LBFGS {
     bool update_sy(const anymat<VecS> &s, const anymat<VecY> &y,
                    real_t pₙₑₓₜᵀpₙₑₓₜ, bool forced = false);
 
+    /// Update the inverse Hessian approximation using sparse vectors
+    /// sₖ and yₖ, given by their values @p s_J and @p y_J at the indices
+    /// @p J (the union of the sparsity patterns of sₖ and yₖ).
+    /// The pair is stored compactly, and @ref apply uses sparse-dense kernels
+    /// for it. If the pair is too dense (see
+    /// @ref BasicLBFGSParams::sparse_max_density), or if the configuration
+    /// requires dense vectors (the compact representation,
+    /// @ref BasicLBFGSParams::hessian_products,
+    /// @ref BasicLBFGSParams::diagonal_h0,
+    /// @ref BasicLBFGSParams::cache_masked_apply,
+    /// @ref BasicLBFGSParams::num_threads, distributed vectors, or a
+    /// transaction in progress), the pair is scattered into the dense storage
+    /// and @ref update_sy is used.
+    /// @throws std::invalid_argument if the indices in @p J are not sorted,
+    /// unique and in the range [0, n).
+    bool update_sy_sparse(cridvec J, crvec s_J, crvec y_J,
+                          real_t pₙₑₓₜᵀpₙₑₓₜ, bool forced = false);
+    /// @ref update_sy_sparse with Eigen sparse vectors.
+    bool update_sy(const Eigen::SparseVector<real_t> &s,
+                   const Eigen::SparseVector<real_t> &y, real_t pₙₑₓₜᵀpₙₑₓₜ,
+                   bool forced = false);
+
     /// Update the inverse Hessian approximation using the new vectors xₖ₊₁
     /// and pₖ₊₁.
     bool update(crvec xₖ, crvec xₙₑₓₜ, crvec pₖ, crvec pₙₑₓₜ,
@@ -101,26 +408,160 @@ class LBFGS {
 
     /// Apply the inverse Hessian approximation to the given vector q.
     /// Initial inverse Hessian approximation is set to @f$ H_0 = \gamma I @f$.
-    /// If @p γ is negative, @f$ H_0 = \frac{s^\top y}{y^\top y} I @f$.
+    /// If @p γ is negative, @f$ H_0 = \frac{s^\top y}{y^\top y} I @f$, or
+    /// the diagonal estimate if @ref BasicLBFGSParams::diagonal_h0 is set.
+    /// The algorithm is selected by @ref BasicLBFGSParams::apply_method.
     bool apply(rvec q, real_t γ = -1);
 
+    /// Apply the inverse Hessian approximation to the given vector q, with
+    /// the diagonal initial inverse Hessian approximation
+    /// @f$ H_0 = \mathrm{diag}(d) @f$. The scaling by @f$ H_0 @f$ is fused
+    /// with the two-loop recursion.
+    bool apply(rvec q, crvec d);
+
+    /// Apply the inverse Hessian approximation to each column of the given
+    /// n×k matrix Q.
+    /// The history is read only once for all columns, the dot products and
+    /// updates of the individual columns become matrix-vector products and
+    /// rank-one updates. Results are the same as calling
+    /// @ref apply(rvec, real_t) for each column.
+    template <class Derived>
+    std::enable_if_t<Derived::ColsAtCompileTime != 1, bool>
+    apply(const Eigen::MatrixBase<Derived> &Q, real_t γ = -1) {
+        return apply_mat(Q.const_cast_derived(), γ);
+    }
+
+    /// Apply the Hessian approximation (i.e. the inverse of the inverse Hessian
+    /// approximation used by @ref apply) to each column of the given n×k
+    /// matrix V, using the compact representation by Byrd, Nocedal and
+    /// Schnabel, with the initial Hessian approximation
+    /// @f$ B_0 = \gamma^{-1} I @f$. If @p γ is negative,
+    /// @f$ B_0 = \frac{y^\top y}{s^\top y} I @f$. Using the same value of
+    /// @p γ, this is the inverse of @ref apply.
+    ///
+    /// Requires @ref BasicLBFGSParams::hessian_products or
+    /// @ref LBFGSApplyMethod::Compact, so that the Gram matrix of the history
+    /// is updated in @ref update_sy. Apart from two passes over the history,
+    /// only a small factorization of size m×m is needed, which is reused as
+    /// long as the history and @p γ don't change.
+    /// @see https://doi.org/10.1007/BF01582063
+    bool apply_hessian(rmat V, real_t γ = -1);
+
     /// Apply the inverse Hessian approximation to the given vector q, applying
     /// only the columns and rows of the Hessian in the index set J.
-    template <class IndexVec>
+    /// If J is an @ref IndexRanges, or if it consists of long runs of
+    /// consecutive indices (in which case it is converted automatically),
+    /// each run is processed using vectorized segment operations.
+    /// @see @ref BasicLBFGSParams::cache_masked_apply
+    template <class IndexVec, class = std::enable_if_t<
+                                  not std::is_same_v<IndexVec, Workspace>>>
     bool apply(rvec q, real_t γ, const IndexVec &J);
 
+    /// Masked @ref apply with the diagonal initial inverse Hessian
+    /// approximation @f$ H_0 = \mathrm{diag}(d) @f$. Only the elements of
+    /// @p d in the index set J are used.
+    template <class IndexVec>
+    bool apply(rvec q, crvec d, const IndexVec &J);
+
+    /// Thread-safe version of @ref apply(rvec, real_t): the values of α are
+    /// stored in the caller-provided workspace @p ws instead of in the
+    /// history, so multiple threads can apply the same approximation at the
+    /// same time, as long as no other member functions are called
+    /// concurrently. Always uses the serial two-loop recursion, i.e.
+    /// @ref BasicLBFGSParams::apply_method and
+    /// @ref BasicLBFGSParams::num_threads are ignored, and the performance
+    /// counters are not updated.
+    bool apply(rvec q, real_t γ, Workspace &ws) const;
+
+    /// Thread-safe version of the masked @ref apply: the values of ρ for the
+    /// index set J are kept in the workspace @p ws, so the history is not
+    /// modified, and calls with different index sets and calls to
+    /// @ref apply(rvec, real_t, Workspace &) can be alternated freely.
+    /// @ref BasicLBFGSParams::cache_masked_apply is ignored.
+    template <class IndexVec>
+    bool apply(rvec q, real_t γ, const IndexVec &J, Workspace &ws) const;
+
+    /// Get the diagonal estimate of the initial inverse Hessian approximation,
+    /// see @ref BasicLBFGSParams::diagonal_h0.
+    crvec diagonal_h0() const { return diag.d; }
+
     /// Throw away the approximation and all previous vectors s and y.
     void reset();
     /// Re-allocate storage for a problem with a different size. Causes
     /// a @ref reset.
     void resize(length_t n);
+    /// Change the history length to @p m without a @ref reset: the newest
+    /// min(m, @ref current_history()) pairs are kept, in chronological order.
+    /// The vectors s and y are rotated in place, and the storage is only
+    /// re-allocated if @p m exceeds the largest history length used so far,
+    /// so shrinking costs at most one pass over the history. The Gram matrix
+    /// of the compact representation and the diagonal estimate of
+    /// @f$ H_0 @f$ are kept as well, only the cache of the masked
+    /// @ref apply is cleared.
+    void set_memory(length_t m);
 
     /// Scale the stored y vectors by the given factor.
     void scale_y(real_t factor);
 
+    /// Scatter all pairs stored by @ref update_sy_sparse into the dense
+    /// storage. Called automatically by the version of @ref apply for
+    /// matrices, @ref set_memory and @ref begin_transaction.
+    void densify();
+    /// Get the number of pairs in the history that are stored sparsely, see
+    /// @ref update_sy_sparse.
+    length_t num_sparse() const { return sparse.count; }
+
+    /// Start recording the changes made by @ref update and @ref update_sy, so
+    /// that they can be undone by @ref rollback, e.g. when a line search
+    /// rejects a step after speculatively updating the approximation.
+    /// The position in the circular buffer is saved, and each pair of vectors
+    /// s and y is copied the first time it is overwritten, so rolling back k
+    /// updates costs O(min(k, m) n), and nothing is copied as long as the
+    /// buffer is not full. The Gram matrix of the compact representation and
+    /// the diagonal estimate of @f$ H_0 @f$ are copied when the transaction
+    /// starts (if enabled).
+    /// @ref reset, @ref resize, @ref set_memory, @ref scale_y and @ref load
+    /// end the transaction, as if @ref commit was called.
+    /// @throws std::logic_error if a transaction is already in progress.
+    void begin_transaction();
+    /// Keep the updates since @ref begin_transaction and stop recording.
+    void commit() { undo.end(); }
+    /// Undo all updates since @ref begin_transaction and stop recording.
+    /// @throws std::logic_error if no transaction is in progress.
+    void rollback();
+    /// Check whether a transaction was started by @ref begin_transaction.
+    bool in_transaction() const { return undo.active; }
+
+    /// Use local shards of distributed vectors s, y and q: all inner products
+    /// are summed over the processes by @p all_reduce.
+    /// @ref update_sy needs two reductions (one if the compact representation
+    /// is not used), @ref apply with @ref LBFGSApplyMethod::Compact needs
+    /// only a single reduction, while the two-loop recursion needs 2 m.
+    /// @see @ref BasicAllReduce
+    void set_all_reduce(BasicAllReduce<real_t> all_reduce) {
+        par.set_all_reduce(std::move(all_reduce));
+    }
+
+    /// Write the history (the vectors s and y, the values of ρ and the indices
+    /// of the circular buffer) to a checkpoint.
+    void save(CheckpointWriter &w) const;
+    /// Restore the history from a checkpoint written by @ref save, e.g. to
+    /// warm-start the solution of a related problem. The problem dimension,
+    /// the history length and the floating point types have to match. The
+    /// Gram matrix of the compact representation is recomputed from the
+    /// restored vectors.
+    void load(CheckpointReader &r);
+
     /// Get the parameters.
     const Params &get_params() const { return params; }
 
+    /// Get the performance counters. They are only updated if the library was
+    /// compiled with @ref QUALA_WITH_STATS. @ref apply_hessian is counted as
+    /// a call to @ref apply.
+    const AccelStats &get_stats() const { return stats; }
+    /// Set all performance counters to zero.
+    void reset_stats() { stats.reset(); }
+
     /// Get the size of the s and y vectors in the buffer.
     length_t n() const { return sto.n(); }
     /// Get the number of previous vectors s and y stored in the buffer.
@@ -133,6 +574,8 @@ class LBFGS {
     /// buffer.
     length_t current_history() const { return full ? history() : idx; }
 
+    /// Get the dense storage of the vectors s and y of pair @p i. Pairs that
+    /// are stored sparsely are only written to it by @ref densify.
     auto s(index_t i) { return sto.s(i); }
     auto s(index_t i) const { return sto.s(i); }
     auto y(index_t i) { return sto.y(i); }
@@ -145,30 +588,157 @@ class LBFGS {
     /// Iterate over the indices in the history buffer, oldest first.
     template <class F>
     void foreach_fwd(const F &fun) const {
-        if (full)
-            for (index_t i = idx; i < history(); ++i)
-                fun(i);
-        if (idx)
-            for (index_t i = 0; i < idx; ++i)
-                fun(i);
+        if constexpr (M != Eigen::Dynamic) {
+            const index_t start = full ? idx : 0;
+            const length_t k    = current_history();
+            static_for<M>([&](index_t j) {
+                if (j < k)
+                    fun(start + j < M ? start + j : start + j - M);
+            });
+        } else {
+            if (full)
+                for (index_t i = idx; i < history(); ++i)
+                    fun(i);
+            if (idx)
+                for (index_t i = 0; i < idx; ++i)
+                    fun(i);
+        }
     }
 
     /// Iterate over the indices in the history buffer, newest first.
     template <class F>
     void foreach_rev(const F &fun) const {
-        if (idx)
-            for (index_t i = idx; i-- > 0;)
-                fun(i);
-        if (full)
-            for (index_t i = history(); i-- > idx;)
-                fun(i);
+        if constexpr (M != Eigen::Dynamic) {
+            const length_t k = current_history();
+            static_for<M>([&](index_t j) {
+                if (j < k)
+                    fun(idx - 1 - j >= 0 ? idx - 1 - j : idx - 1 - j + M);
+            });
+        } else {
+            if (idx)
+                for (index_t i = idx; i-- > 0;)
+                    fun(i);
+            if (full)
+                for (index_t i = history(); i-- > idx;)
+                    fun(i);
+        }
     }
 
   private:
-    LBFGSStorage sto;
+    /// @ref apply for an n×k matrix.
+    bool apply_mat(rmat Q, real_t γ);
+    /// @ref apply using the two-loop recursion, with @f$ H_0 = h_0 I @f$ if
+    /// @p h0 is a scalar, or @f$ H_0 = \mathrm{diag}(h_0) @f$ if it is a
+    /// vector.
+    /// The vector kernels are provided by @p ker, and the values of α are
+    /// stored in @p α.
+    template <class Kernels, class H0, class VecA>
+    bool apply_two_loop(Kernels &&ker, rvec q, H0 h0, VecA &&α) const;
+    /// @ref apply_two_loop if some of the pairs are stored sparsely. Not
+    /// fused, the sparse pairs use sparse-dense kernels.
+    template <class Kernels, class H0, class VecA>
+    bool apply_two_loop_sparse(Kernels &&ker, rvec q, H0 h0, VecA &&α) const;
+    /// @ref apply_mat using the two-loop recursion.
+    template <class H0>
+    bool apply_two_loop(rmat Q, H0 h0);
+    /// Call `f(J)`, with the index set @p J converted to an @ref IndexRanges
+    /// if it consists of long runs of consecutive indices.
+    /// The workspace @p J_ranges is used for the conversion.
+    template <class IndexVec, class F>
+    static bool with_index_ranges(const IndexVec &J, IndexRanges &J_ranges,
+                                  const F &f);
+    /// Masked @ref apply, with a scalar or diagonal @f$ H_0 @f$.
+    template <class H0, class IndexVec>
+    bool apply_masked(rvec q, H0 h0, const IndexVec &J);
+    /// Masked @ref apply using the two-loop recursion, storing the values of ρ
+    /// and α in @p ws.
+    template <class Kernels, class H0, class IndexVec>
+    bool apply_masked_two_loop(Kernels &&ker, rvec q, H0 h0,
+                               const IndexVec &J, Workspace &ws) const;
+    /// @ref apply and @ref apply_mat using the compact representation.
+    bool apply_compact(rmat Q, real_t γ);
+    /// Hint that the pair with index @p i will be accessed soon, if the
+    /// history is stored in a file, see @ref BasicLBFGSParams::storage_dir.
+    void prefetch(index_t i) const { sto.sto.will_need(2 * i, 2); }
+    /// Masked @ref apply using the cached packed vectors s(J) and y(J).
+    template <class H0, class IndexVec>
+    bool apply_masked_cached(rvec q, H0 h0, const IndexVec &J);
+    /// Check whether @ref apply should use the diagonal estimate of
+    /// @f$ H_0 @f$ for the given value of @p γ.
+    bool uses_diagonal_h0(real_t γ) const {
+        return γ < 0 && params.diagonal_h0;
+    }
+    /// Update the Gram matrix of the compact representation after storing
+    /// new vectors s and y at index @p i.
+    void update_gram(index_t i);
+    /// Check whether the history is stored in a different type than the one
+    /// used for the computations.
+    static constexpr bool mixed_precision =
+        not std::is_same_v<real_t, storage_real_t>;
+    /// Check whether @ref apply uses the compact representation.
+    bool uses_compact() const {
+        return params.apply_method == Params::ApplyMethod::Compact;
+    }
+    /// Check whether the Gram matrices of the compact representation should
+    /// be kept up to date.
+    bool keeps_gram() const {
+        return uses_compact() || params.hessian_products;
+    }
+    /// Check whether @ref update_sy_sparse may store pairs sparsely.
+    bool supports_sparse() const {
+        return not keeps_gram() && not params.diagonal_h0 &&
+               not params.cache_masked_apply && not par.reducing() &&
+               not undo.active;
+    }
+    /// Add the estimated cost of applying the approximation to @p num_rhs
+    /// vectors with @p n (unmasked) elements to the counters in @p op.
+    void add_apply_cost(OpStats &op, length_t n, length_t num_rhs) const;
+
+  private:
+    BasicLBFGSStorage<real_t, storage_real_t, N, M> sto;
+    BasicLBFGSCompactStorage<real_t> compact;
+    BasicLBFGSMaskedCache<real_t> masked;
+    BasicDiagonalH0<real_t> diag;
+    mat α_mat; ///< Workspace for the values of α in @ref apply_mat.
+    /// Workspace for the values of ρ and α and for the run-length compressed
+    /// index set of the masked @ref apply.
+    Workspace work;
+    /// Pairs stored by @ref update_sy_sparse.
+    BasicSparsePairs<real_t, storage_real_t> sparse;
+    /// Workspace for pairs passed to @ref update_sy_sparse that are stored
+    /// densely.
+    mat sparse_work;
+    /// Pairs and ring position saved by @ref begin_transaction.
+    BasicHistoryUndoLog<real_t, storage_real_t, N> undo;
+    /// Gram matrix saved by @ref begin_transaction.
+    mat undo_gram;
+    /// Diagonal estimate of @f$ H_0 @f$ saved by @ref begin_transaction.
+    BasicDiagonalH0<real_t> undo_diag;
+    /// Kernels for the long vectors, serial or divided over multiple threads,
+    /// see @ref BasicLBFGSParams::num_threads, and optionally distributed, see
+    /// @ref set_all_reduce.
+    BasicParallelKernels<real_t> par;
     index_t idx = 0;
     bool full   = false;
     Params params;
+    AccelStats stats;
 };
 
+/// @ref BasicLBFGSParams for the default floating point type.
+using LBFGSParams = BasicLBFGSParams<real_t>;
+/// @ref BasicLBFGSStorage for the default floating point type.
+using LBFGSStorage = BasicLBFGSStorage<real_t>;
+/// @ref BasicLBFGSWorkspace for the default floating point type.
+using LBFGSWorkspace = BasicLBFGSWorkspace<real_t>;
+/// @ref BasicLBFGS for the default floating point type.
+using LBFGS = BasicLBFGS<real_t>;
+/// @ref BasicLBFGS with a compile-time problem dimension @p N and history
+/// length @p M, for small problems. @ref BasicLBFGS::update_sy and
+/// @ref BasicLBFGS::apply(rvec, real_t) using the two-loop recursion don't
+/// allocate any memory on the heap. The masked and matrix versions of
+/// @ref BasicLBFGS::apply, the compact representation, transactions and
+/// sparse updates still use dynamic workspaces.
+template <length_t N, length_t M, class Real = real_t>
+using StaticLBFGS = BasicLBFGS<Real, Real, N, M>;
+
 } // namespace quala
\ No newline at end of file
@@ -4,6 +4,78 @@
 
 namespace quala {
 
+/**
+ * @brief   Same as @ref minimize_update_anderson, but without storing the
+ *          current function value @f$ g_k @f$.
+ *
+ * The previous function values are accessed as `G̃(i)`, where `i` is an index
+ * of the circular buffer of `qr`, so they don't have to be the columns of a
+ * single matrix. After the update, @f$ g_k @f$ belongs at index
+ * `qr.ring_tail()` of the circular buffer. If the buffer is full, that index
+ * holds the oldest function value, which is still used by this function.
+ */
+template <class Real, length_t N, length_t M, class GetG>
+void minimize_update_anderson_ring(
+    /// [inout] QR factorization of @f$ \mathcal{R}_k @f$
+    BasicLimitedMemoryQR<Real, N, M> &qr,
+    /// [in]    Previous function values @f$ \tilde G_k @f$, `G̃(i)` returns
+    ///         the function value at index `i` of the circular buffer
+    const GetG &G̃,
+    /// [in]    Current residual @f$ r_k @f$
+    typename EigenConfig<Real>::crvec rₖ,
+    /// [in]    Previous residual @f$ r_{k-1} @f$
+    typename EigenConfig<Real>::crvec rₗₐₛₜ,
+    /// [in]    Current function value @f$ g_k @f$
+    typename EigenConfig<Real>::crvec gₖ,
+    /// [in]    Minimum divisor when solving close to singular systems,
+    ///         scaled by the maximum eigenvalue of R (not used if the
+    ///         regularization of `qr` is enabled, see
+    ///         @ref BasicLimitedMemoryQR::set_regularization)
+    typename EigenConfig<Real>::real_t min_div,
+    /// [out]   Solution to the least squares system
+    typename EigenConfig<Real>::rvec γ_LS,
+    /// [out]   Next Anderson iterate
+    typename EigenConfig<Real>::rvec xₖ_aa,
+    /// [out]   If not null, the information needed to undo the update of the
+    ///         QR factorization, see @ref BasicLimitedMemoryQR::undo
+    typename BasicLimitedMemoryQR<Real, N, M>::UndoRecord *undo = nullptr) {
+    using real_t = Real;
+
+    // Update QR factorization for Anderson acceleration
+    if (undo)
+        qr.begin_undo(*undo);
+    if (qr.num_columns() == qr.m()) // if the history buffer is full
+        qr.remove_column(undo);
+    qr.add_column(rₖ - rₗₐₛₜ);
+
+    // Solve least squares problem Anderson acceleration
+    // γ = argmin ‖ ΔR γ - rₖ ‖² (+ λ ‖ γ ‖²)
+    if (qr.get_regularization() > 0)
+        qr.solve_col_regularized(rₖ, γ_LS);
+    else
+        qr.solve_col(rₖ, γ_LS, qr.get_max_eig() * min_div);
+
+    // Iterate over columns of G, whose indices match the indices of the matrix
+    // R in the QR factorization, stored as a circular buffer.
+    auto g_it  = qr.ring_iter().begin();
+    auto g_end = qr.ring_iter().end();
+    assert(g_it != g_end);
+
+    // Compute Anderson acceleration next iterate yₑₓₜ = ∑ₙ₌₀ αₙ gₙ
+    // α₀ = γ₀             if n = 0
+    // αₙ = γₙ - γₙ₋₁      if 0 < n < mₖ
+    // αₘ = 1 - γₘ₋₁       if n = mₖ
+    real_t α = γ_LS(0);
+    xₖ_aa    = α * G̃((*g_it).circular);
+    while (++g_it != g_end) {
+        auto [i, g_idx] = *g_it; // [zero based index, circular index]
+        α               = γ_LS(i) - γ_LS(i - 1);
+        xₖ_aa += α * G̃(g_idx);
+    }
+    α = 1 - γ_LS(qr.num_columns() - 1);
+    xₖ_aa += α * gₖ;
+}
+
 /**
  * @brief   Solve one step of Anderson acceleration to find a fixed point of a 
  *          function g(x):
@@ -33,57 +105,34 @@ namespace quala {
  * &= G_k \alpha \\
  * \end{aligned} @f]
  */
-inline void minimize_update_anderson(
+template <class Real, length_t N, length_t M>
+void minimize_update_anderson(
     /// [inout] QR factorization of @f$ \mathcal{R}_k @f$
-    LimitedMemoryQR &qr,
+    BasicLimitedMemoryQR<Real, N, M> &qr,
     /// [inout] Matrix of previous function values @f$ \tilde G_k @f$
     ///         (stored as ring buffer with the same indices as `qr`)
-    rmat G̃,
+    typename EigenConfig<Real>::rmat G̃,
     /// [in]    Current residual @f$ r_k @f$
-    crvec rₖ,
+    typename EigenConfig<Real>::crvec rₖ,
     /// [in]    Previous residual @f$ r_{k-1} @f$
-    crvec rₗₐₛₜ,
+    typename EigenConfig<Real>::crvec rₗₐₛₜ,
     /// [in]    Current function value @f$ g_k @f$
-    crvec gₖ,
+    typename EigenConfig<Real>::crvec gₖ,
     /// [in]    Minimum divisor when solving close to singular systems,
     ///         scaled by the maximum eigenvalue of R
-    real_t min_div,
+    typename EigenConfig<Real>::real_t min_div,
     /// [out]   Solution to the least squares system
-    rvec γ_LS,
+    typename EigenConfig<Real>::rvec γ_LS,
     /// [out]   Next Anderson iterate
-    rvec xₖ_aa) {
-
-    // Update QR factorization for Anderson acceleration
-    if (qr.num_columns() == qr.m()) // if the history buffer is full
-        qr.remove_column();
-    qr.add_column(rₖ - rₗₐₛₜ);
-
-    // Solve least squares problem Anderson acceleration
-    // γ = argmin ‖ ΔR γ - rₖ ‖²
-    qr.solve_col(rₖ, γ_LS, qr.get_max_eig() * min_div);
-
-    // Iterate over columns of G, whose indices match the indices of the matrix
-    // R in the QR factorization, stored as a circular buffer.
-    auto g_it  = qr.ring_iter().begin();
-    auto g_end = qr.ring_iter().end();
-    assert(g_it != g_end);
-
-    // Compute Anderson acceleration next iterate yₑₓₜ = ∑ₙ₌₀ αₙ gₙ
-    // α₀ = γ₀             if n = 0
-    // αₙ = γₙ - γₙ₋₁      if 0 < n < mₖ
-    // αₘ = 1 - γₘ₋₁       if n = mₖ
-    real_t α = γ_LS(0);
-    xₖ_aa    = α * G̃.col((*g_it).circular);
-    while (++g_it != g_end) {
-        auto [i, g_idx] = *g_it; // [zero based index, circular index]
-        α               = γ_LS(i) - γ_LS(i - 1);
-        xₖ_aa += α * G̃.col(g_idx);
-    }
-    α = 1 - γ_LS(qr.num_columns() - 1);
-    xₖ_aa += α * gₖ;
-
+    typename EigenConfig<Real>::rvec xₖ_aa,
+    /// [out]   If not null, the information needed to undo the update of the
+    ///         QR factorization, see @ref BasicLimitedMemoryQR::undo
+    typename BasicLimitedMemoryQR<Real, N, M>::UndoRecord *undo = nullptr) {
+    auto G̃_col = [&G̃](index_t i) { return G̃.col(i); };
+    minimize_update_anderson_ring(qr, G̃_col, rₖ, rₗₐₛₜ, gₖ, min_div, γ_LS,
+                                  xₖ_aa, undo);
     // Add the new column to G
-    G̃.col(qr.ring_tail()) = gₖ; // TODO: avoid copy, make G an array of vectors
+    G̃.col(qr.ring_tail()) = gₖ;
 }
 
-} // namespace quala
\ No newline at end of file
+} // namespace quala
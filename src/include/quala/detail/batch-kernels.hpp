@@ -0,0 +1,113 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <algorithm>
+#include <type_traits>
+
+namespace quala {
+
+/// Number of instances whose partial sums are kept in registers by
+/// @ref batch_dot.
+constexpr length_t batch_dot_lanes = 8;
+
+/**
+ * @brief   Inner products of the corresponding rows of two matrices, for a
+ *          block of instances of a batch.
+ *
+ * The matrices @p a and @p b are nb×n views with one row per instance (the
+ * index of the instance is innermost, see @ref BasicAndersonAccelBatch), and
+ * element k of @p out is set to the inner product of row k of @p a and row k
+ * of @p b. The partial sums of @ref batch_dot_lanes instances at a time are
+ * kept in registers, so every column of the views is only read once, and the
+ * loop over these instances is vectorized.
+ */
+template <class Out, class MatA, class MatB>
+void batch_dot(Out &&out, const MatA &a, const MatB &b) {
+    using real_t        = typename MatA::Scalar;
+    constexpr index_t L = batch_dot_lanes;
+    const index_t n = a.cols(), nb = a.rows();
+    const real_t *pa = a.data(), *pb = b.data();
+    const index_t sa = a.outerStride(), sb = b.outerStride();
+    for (index_t k = 0; k < nb; k += L) {
+        const index_t l_end = std::min(L, nb - k);
+        real_t acc[L]{};
+        if (l_end == L)
+            for (index_t i = 0; i < n; ++i)
+                for (index_t l = 0; l < L; ++l)
+                    acc[l] += pa[i * sa + k + l] * pb[i * sb + k + l];
+        else
+            for (index_t i = 0; i < n; ++i)
+                for (index_t l = 0; l < l_end; ++l)
+                    acc[l] += pa[i * sa + k + l] * pb[i * sb + k + l];
+        for (index_t l = 0; l < l_end; ++l)
+            out(k + l) = acc[l];
+    }
+}
+
+/**
+ * @brief   Update the rows of a matrix and compute their inner products with
+ *          the rows of another matrix, in a single pass over the data, for a
+ *          block of instances of a batch:
+ *
+ * @f[ \begin{aligned}
+ * q_k &\leftarrow h_k\,(q_k + a_k\,x_k) \\
+ * \text{out}_k &\leftarrow z_k^\top q_k,
+ * \end{aligned} @f]
+ *
+ * where @f$ q_k @f$ is row k of the nb×n view @p q, and @p a and @p h contain
+ * one scalar per instance. If @p h is null, @f$ h_k = 1 @f$. This is the
+ * batched version of @ref fused_axpy_dot, with the same register blocking
+ * as @ref batch_dot.
+ */
+template <class MatX, class MatQ, class MatZ, class Out>
+void batch_axpy_dot(const typename MatX::Scalar *a, const MatX &x, MatQ &&q,
+                    const typename MatX::Scalar *h, const MatZ &z,
+                    Out &&out) {
+    using Real          = typename MatX::Scalar;
+    constexpr index_t L = batch_dot_lanes;
+    const index_t n = q.cols(), nb = q.rows();
+    const Real *px = x.data(), *pz = z.data();
+    Real *pq         = q.data();
+    const index_t sx = x.outerStride(), sq = q.outerStride(),
+                  sz = z.outerStride();
+    const auto kernel = [&](index_t k, auto l_end, auto scale) {
+        Real acc[L]{};
+        for (index_t i = 0; i < n; ++i)
+            for (index_t l = 0; l < l_end; ++l) {
+                Real qi = pq[i * sq + k + l] + a[k + l] * px[i * sx + k + l];
+                if constexpr (scale)
+                    qi *= h[k + l];
+                pq[i * sq + k + l] = qi;
+                acc[l] += pz[i * sz + k + l] * qi;
+            }
+        for (index_t l = 0; l < l_end; ++l)
+            out(k + l) = acc[l];
+    };
+    const auto run = [&](auto scale) {
+        for (index_t k = 0; k < nb; k += L) {
+            if (k + L <= nb)
+                kernel(k, std::integral_constant<index_t, L>(), scale);
+            else
+                kernel(k, nb - k, scale);
+        }
+    };
+    if (h)
+        run(std::true_type());
+    else
+        run(std::false_type());
+}
+
+/// Copy the first @p nb elements of @p y to @p x where the corresponding
+/// element of @p w is nonzero. Unlike a multiplication by w (or
+/// `Eigen::select`), this does not propagate NaNs of the other elements, and
+/// it is vectorized.
+template <class Real>
+void batch_blend(Real *x, const Real *y, const Real *w, length_t nb) {
+    for (index_t k = 0; k < nb; ++k) {
+        const Real xk = x[k], yk = y[k];
+        x[k]          = w[k] != 0 ? yk : xk;
+    }
+}
+
+} // namespace quala
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <algorithm>
+
+namespace quala {
+
+/// Diagonal estimate of the initial inverse Hessian (or inverse Jacobian)
+/// approximation @f$ H_0 = \mathrm{diag}(d) @f$, see e.g.
+/// @ref BasicLBFGSParams::diagonal_h0.
+///
+/// Each element is a Barzilai–Borwein step size for a single coordinate, i.e.
+/// the least squares solution of the secant equations
+/// @f$ d_j\, (y_k)_j = (s_k)_j @f$ over the recent pairs:
+/// @f[ d_j = \frac{\sum_k \beta^{K-k} (s_k)_j (y_k)_j}
+///               {\sum_k \beta^{K-k} (y_k)_j^2}, @f]
+/// where the forgetting factor @f$ \beta = 1 - 1/m @f$ limits the influence
+/// of the pairs that are no longer in the history of length @f$ m @f$.
+/// To safeguard against coordinates with little or inconsistent curvature
+/// information, the elements are clamped to
+/// @f$ [\gamma / \kappa, \gamma \kappa] @f$, where
+/// @f$ \gamma = \frac{s^\top y}{y^\top y} @f$ is the scalar step size of the
+/// newest pair, and @f$ d_j = \gamma @f$ if
+/// @f$ \sum_k (s_k)_j (y_k)_j \le 0 @f$.
+///
+/// The sums are updated incrementally, so the estimate costs a single pass
+/// over the new pair, which can be fused with storing it.
+template <class Real>
+struct BasicDiagonalH0 {
+    USING_QUALA_TYPES(Real);
+
+    /// Re-allocate storage for a problem with a different size, and clear the
+    /// estimate.
+    void resize(length_t n) {
+        sy.resize(n);
+        yy.resize(n);
+        d.resize(n);
+        reset();
+    }
+    /// Forget all previous pairs.
+    void reset() {
+        sy.setZero();
+        yy.setZero();
+        d.setOnes();
+    }
+
+    /// Add the rows [i, i + bs) of a new pair @p s and @p y, and update the
+    /// corresponding rows of the estimate.
+    /// @param  β
+    ///         Forgetting factor of the previous pairs.
+    /// @param  γ
+    ///         Scalar step size @f$ \frac{s^\top y}{y^\top y} @f$.
+    /// @param  κ
+    ///         Bound on the ratio between @f$ d_j @f$ and @f$ \gamma @f$.
+    template <class VecS, class VecY>
+    void update(index_t i, length_t bs, const VecS &s, const VecY &y, real_t β,
+                real_t γ, real_t κ) {
+        auto syᵢ = sy.segment(i, bs), yyᵢ = yy.segment(i, bs);
+        syᵢ      = β * syᵢ + s.cwiseProduct(y);
+        yyᵢ      = β * yyᵢ + y.cwiseAbs2();
+        const real_t lo = std::min(γ / κ, γ * κ), hi = std::max(γ / κ, γ * κ);
+        d.segment(i, bs) = (syᵢ.array() > 0)
+                               .select((syᵢ.array() / yyᵢ.array())
+                                           .max(lo)
+                                           .min(hi),
+                                       γ)
+                               .matrix();
+    }
+
+    /// Adjust the estimate after all stored vectors y were scaled by
+    /// @p factor.
+    void scale_y(real_t factor) {
+        sy *= factor;
+        yy *= factor * factor;
+        d *= 1 / factor;
+    }
+
+    /// @f$ \sum_k \beta^{K-k} s_k \odot y_k @f$
+    vec sy;
+    /// @f$ \sum_k \beta^{K-k} y_k \odot y_k @f$
+    vec yy;
+    /// Diagonal of the estimate @f$ H_0 @f$.
+    vec d;
+};
+
+} // namespace quala
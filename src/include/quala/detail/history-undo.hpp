@@ -0,0 +1,91 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace quala {
+
+/// Saved state of a circular buffer of pairs of vectors, used to roll back
+/// speculative updates, see @ref BasicLBFGS::rollback and
+/// @ref BasicBroydenGood::rollback.
+///
+/// The position in the circular buffer is saved when the transaction starts.
+/// Pairs that contained data at that time are copied the first time they are
+/// overwritten, so rolling back k updates copies min(k, m) pairs, and nothing
+/// is copied as long as the buffer is not full.
+/// @tparam Real
+///         Floating point type of the scalars associated with each pair.
+/// @tparam StorageReal
+///         Floating point type of the vectors.
+/// @tparam N
+///         Compile-time size of the vectors, or `Eigen::Dynamic`.
+template <class Real, class StorageReal = Real, length_t N = Eigen::Dynamic>
+struct BasicHistoryUndoLog {
+    USING_QUALA_TYPES(Real);
+
+    /// Start a transaction at position @p idx of a circular buffer with
+    /// @p history pairs.
+    void begin(index_t idx, bool full, length_t history) {
+        active     = true;
+        this->idx  = idx;
+        this->full = full;
+        slots.clear();
+        saved.assign(history, false);
+    }
+    /// Stop recording and forget the saved pairs.
+    void end() {
+        active = false;
+        slots.clear();
+    }
+
+    /// Check whether pair @p i has to be saved before it is overwritten, i.e.
+    /// if it contained data when the transaction started, and it wasn't saved
+    /// yet.
+    bool needs_save(index_t i) const {
+        return active && (full || i < idx) && not saved[i];
+    }
+    /// Save the vectors @p s and @p y and the scalar @p c of pair @p i.
+    template <class VecS, class VecY>
+    void save(index_t i, const VecS &s, const VecY &y, real_t c) {
+        const length_t k = static_cast<length_t>(slots.size());
+        // Grow geometrically, at most to the length of the history
+        if (cols.cols() < 2 * (k + 1)) {
+            const length_t m = static_cast<length_t>(saved.size());
+            const length_t c = std::min<length_t>(
+                2 * m, std::max<length_t>(2 * (k + 1), 2 * cols.cols()));
+            cols.conservativeResize(s.rows(), c);
+            scalars.conservativeResize(c / 2);
+        }
+        cols.col(2 * k)     = s;
+        cols.col(2 * k + 1) = y;
+        scalars(k)          = c;
+        slots.push_back(i);
+        saved[i] = true;
+    }
+    /// Call `f(i, s, y, c)` for each saved pair i, with the vectors and the
+    /// scalar as they were when the transaction started.
+    template <class F>
+    void foreach_saved(const F &f) const {
+        for (index_t k = 0; k < static_cast<index_t>(slots.size()); ++k)
+            f(slots[k], cols.col(2 * k), cols.col(2 * k + 1), scalars(k));
+    }
+
+    /// Whether a transaction is in progress.
+    bool active = false;
+    /// Position in the circular buffer when the transaction started.
+    index_t idx = 0;
+    /// Whether the circular buffer was full when the transaction started.
+    bool full = false;
+    /// Indices of the saved pairs.
+    std::vector<index_t> slots;
+    /// Whether each pair has been saved already.
+    std::vector<bool> saved;
+    /// Saved vectors, two columns per saved pair, in the order of @ref slots.
+    Eigen::Matrix<StorageReal, N, Eigen::Dynamic> cols;
+    /// Saved scalars, one per saved pair.
+    vec scalars;
+};
+
+} // namespace quala
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <algorithm>
+#include <type_traits>
+
+namespace quala {
+
+/// Number of elements processed at once by @ref fused_axpy_dot. Small enough
+/// for the blocks of all three vectors to stay in the L1 cache.
+constexpr length_t fused_block_size = 512;
+
+/**
+ * @brief   Update a vector and compute its inner product with another vector,
+ *          in a single pass over the data:
+ *
+ * @f[ \begin{aligned}
+ * q &\leftarrow c\,(q - a\,x) \\
+ * &\text{return}\; z^\top q
+ * \end{aligned} @f]
+ *
+ * The factor @f$ c @f$ is either a scalar or a vector, in which case the
+ * updated vector is scaled elementwise, i.e. by the diagonal matrix
+ * @f$ \mathrm{diag}(c) @f$.
+ *
+ * The vectors are processed in blocks of @ref fused_block_size elements. The
+ * inner product of each updated block is computed while the block is still in
+ * cache, so q is only read from (and written to) memory once, instead of once
+ * for the update and once more for the inner product.
+ *
+ * The vectors x and z may be stored in a lower precision than q, they are
+ * converted to @p Real on the fly.
+ */
+template <class Real, class VecX, class C, class VecZ>
+Real fused_axpy_dot(
+    /// [in]    Scale factor of @f$ x @f$
+    Real a,
+    /// [in]    Vector @f$ x @f$
+    const VecX &x,
+    /// [inout] Vector @f$ q @f$ to update
+    typename EigenConfig<Real>::rvec q,
+    /// [in]    Scale factor for the updated vector (scalar or vector)
+    const C &c,
+    /// [in]    Vector @f$ z @f$
+    const VecZ &z) {
+    // Small fixed-size vectors fit in the cache anyway, and don't need the
+    // runtime loop over the blocks
+    constexpr length_t N = VecX::SizeAtCompileTime;
+    if constexpr (N != Eigen::Dynamic && N <= fused_block_size) {
+        if constexpr (std::is_arithmetic_v<C>)
+            q = static_cast<Real>(c) * (q - a * x.template cast<Real>());
+        else
+            q = c.cwiseProduct(q - a * x.template cast<Real>());
+        return z.template cast<Real>().dot(q);
+    }
+    const length_t n = q.size();
+    Real zᵀq         = 0;
+    for (index_t i = 0; i < n; i += fused_block_size) {
+        const length_t bs = std::min(fused_block_size, n - i);
+        auto qᵢ           = q.segment(i, bs);
+        auto xᵢ           = x.segment(i, bs).template cast<Real>();
+        if constexpr (std::is_arithmetic_v<C>)
+            qᵢ = static_cast<Real>(c) * (qᵢ - a * xᵢ);
+        else
+            qᵢ = c.segment(i, bs).cwiseProduct(qᵢ - a * xᵢ);
+        zᵀq += z.segment(i, bs).template cast<Real>().dot(qᵢ);
+    }
+    return zᵀq;
+}
+
+/**
+ * @brief   Compute the product @f$ A^\top B @f$ in precision @p Real, where
+ *          A and B may be stored in a lower precision.
+ *
+ * If A or B uses a different scalar type, blocks of @ref fused_block_size rows
+ * are converted to @p Real in the workspace @p work before they are
+ * multiplied, so no temporaries of the full size are needed.
+ */
+template <class Real, class MatA, class MatB, class MatOut>
+void cast_matmul_tn(
+    /// [in]    Matrix A
+    const MatA &A,
+    /// [in]    Matrix B
+    const MatB &B,
+    /// [out]   Result @f$ A^\top B @f$
+    MatOut &&out,
+    /// [inout] Workspace
+    typename EigenConfig<Real>::mat &work) {
+    constexpr bool real_A = std::is_same_v<typename MatA::Scalar, Real>;
+    constexpr bool real_B = std::is_same_v<typename MatB::Scalar, Real>;
+    if constexpr (real_A && real_B) {
+        out.noalias() = A.transpose() * B;
+    } else {
+        const length_t n = A.rows(), ka = A.cols(), kb = B.cols();
+        if (work.rows() < fused_block_size || work.cols() < ka + kb)
+            work.resize(fused_block_size, ka + kb);
+        out.setZero();
+        for (index_t i = 0; i < n; i += fused_block_size) {
+            const length_t bs = std::min(fused_block_size, n - i);
+            auto Aᵢ           = work.topLeftCorner(bs, ka);
+            Aᵢ                = A.middleRows(i, bs).template cast<Real>();
+            if constexpr (real_B) {
+                out.noalias() += Aᵢ.transpose() * B.middleRows(i, bs);
+            } else {
+                auto Bᵢ = work.block(0, ka, bs, kb);
+                Bᵢ      = B.middleRows(i, bs).template cast<Real>();
+                out.noalias() += Aᵢ.transpose() * Bᵢ;
+            }
+        }
+    }
+}
+
+/**
+ * @brief   Compute @f$ Q \leftarrow Q + A C @f$ in precision @p Real, where A
+ *          may be stored in a lower precision.
+ *
+ * @see     @ref cast_matmul_tn
+ */
+template <class Real, class MatA, class MatC, class MatQ>
+void cast_matmul_add(
+    /// [in]    Matrix A
+    const MatA &A,
+    /// [in]    Matrix C
+    const MatC &C,
+    /// [inout] Matrix Q
+    MatQ &&Q,
+    /// [inout] Workspace
+    typename EigenConfig<Real>::mat &work) {
+    if constexpr (std::is_same_v<typename MatA::Scalar, Real>) {
+        Q.noalias() += A * C;
+    } else {
+        const length_t n = A.rows(), k = A.cols();
+        if (work.rows() < fused_block_size || work.cols() < k)
+            work.resize(fused_block_size, k);
+        for (index_t i = 0; i < n; i += fused_block_size) {
+            const length_t bs = std::min(fused_block_size, n - i);
+            auto Aᵢ           = work.topLeftCorner(bs, k);
+            Aᵢ                = A.middleRows(i, bs).template cast<Real>();
+            Q.middleRows(i, bs).noalias() += Aᵢ * C;
+        }
+    }
+}
+
+} // namespace quala
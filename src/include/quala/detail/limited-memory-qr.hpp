@@ -1,8 +1,18 @@
+#pragma once
+
 #include <Eigen/Jacobi>
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <quala/util/all-reduce.hpp>
+#include <quala/util/checkpoint.hpp>
 #include <quala/util/ringbuffer.hpp>
+#include <quala/util/stats.hpp>
+#include <quala/util/unroll.hpp>
 #include <quala/util/vec.hpp>
+#include <stdexcept>
 #include <type_traits>
+#include <utility>
 
 namespace quala {
 
@@ -11,9 +21,70 @@ namespace quala {
 ///
 /// Computes A = QR while allowing efficient removal of the first
 /// column of A or adding new columns at the end of A.
-class LimitedMemoryQR {
+///
+/// A may have more columns than rows. Once Q is square, new columns are only
+/// added to R, which then becomes upper trapezoidal, and the least squares
+/// problems are underdetermined, see @ref solve_col.
+///
+/// Optionally, the Cholesky factor of AᵀA + λ diag(AᵀA) is updated together
+/// with R, for regularized least squares problems, see
+/// @ref set_regularization.
+///
+/// If the rows of A are distributed over multiple processes (see
+/// @ref set_all_reduce), classical Gram-Schmidt with reorthogonalization is
+/// used instead, so that all inner products of each orthogonalization pass
+/// can be summed in a single reduction.
+/// @tparam Real
+///         Floating point type.
+/// @tparam N
+///         Compile-time number of rows of A, or `Eigen::Dynamic`.
+/// @tparam M
+///         Compile-time maximum number of columns of A, or `Eigen::Dynamic`.
+template <class Real, length_t N = Eigen::Dynamic, length_t M = Eigen::Dynamic>
+class BasicLimitedMemoryQR {
   public:
-    LimitedMemoryQR() = default;
+    USING_QUALA_TYPES(Real);
+    /// Type of the storage for Q.
+    using mat_Q = Eigen::Matrix<real_t, N, M>;
+    /// Type of the storage for R.
+    using mat_R = Eigen::Matrix<real_t, M, M>;
+    /// Vector of size m.
+    using vec_m = Eigen::Matrix<real_t, M, 1>;
+    /// Vector of size n.
+    using vec_n = Eigen::Matrix<real_t, N, 1>;
+    /// Type of the workspace for the wide R in @ref solve_col, without heap
+    /// allocations if both dimensions are fixed (and never used if A cannot
+    /// have more columns than rows).
+    using mat_W = std::conditional_t<
+        N != Eigen::Dynamic && M != Eigen::Dynamic && M <= N, mat,
+        Eigen::Matrix<real_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor,
+                      N, M>>;
+
+    /// Information needed to undo a call to @ref add_column, and the call to
+    /// @ref remove_column right before it (if any), see @ref undo.
+    struct UndoRecord {
+        index_t q_idx       = 0;
+        index_t r_idx_start = 0;
+        index_t r_idx_end   = 0;
+        real_t min_eig      = +inf;
+        real_t max_eig      = -inf;
+        /// Whether a column was removed.
+        bool removed = false;
+        /// Cosines and sines of the Givens rotations of @ref remove_column.
+        Eigen::Matrix<real_t, 2, M> rot;
+        /// Cosines and sines of the Givens rotations of the Cholesky factor of
+        /// @ref set_regularization.
+        Eigen::Matrix<real_t, 2, M> rot_U;
+        /// Removed diagonal element of the Cholesky factor.
+        real_t u = 0;
+        /// Removed column of R.
+        vec_m r;
+        /// Last column of Q after the removal, overwritten by
+        /// @ref add_column.
+        vec_n q;
+    };
+
+    BasicLimitedMemoryQR() = default;
 
     /// @param  n
     ///         The size of the vectors, the number of rows of A.
@@ -22,10 +93,16 @@ class LimitedMemoryQR {
     ///
     /// The maximum dimensions of Q are n×m and the maximum dimensions of R are
     /// m×m.
-    LimitedMemoryQR(length_t n, length_t m) : Q(n, m), R(m, m) {}
+    BasicLimitedMemoryQR(length_t n, length_t m)
+        : Q(n, m), R(m, m), proj(m), max_cols(m) {
+        wide_solve.work.resize(n);
+        wide_solve.x.resize(m);
+    }
 
     length_t n() const { return Q.rows(); }
-    length_t m() const { return Q.cols(); }
+    /// Get the maximum number of columns of A. After shrinking the history
+    /// using @ref set_history, the storage may have more columns.
+    length_t m() const { return max_cols; }
     length_t size() const { return n(); }
     length_t history() const { return m(); }
 
@@ -33,6 +110,10 @@ class LimitedMemoryQR {
     template <class VecV>
     void add_column(const VecV &v) {
         assert(num_columns() < m());
+        if (all_reduce)
+            return add_column_cgs(v);
+        if (q_idx >= n())
+            return add_column_wide(v);
 
         auto q = Q.col(q_idx);
         auto r = R.col(r_idx_end);
@@ -63,30 +144,73 @@ class LimitedMemoryQR {
             norm_q = q.norm();
         }
 
-        // Normalize q such that new matrix (Q q) remains orthogonal (i.e. has
-        // orthonormal columns)
-        r(q_idx) = norm_q;
-        q /= norm_q;
-        // Keep track of the minimum/maximum diagonal element of R
-        min_eig = std::min(min_eig, norm_q);
-        max_eig = std::max(max_eig, norm_q);
-
-        // Increment indices, add a column to Q and R.
-        ++q_idx;
-        r_idx_end = r_succ(r_idx_end);
+        append_column(norm_q);
     }
 
-    /// Remove the leftmost column.
-    void remove_column() {
+    /// Remove the leftmost column. If @p u is not null, the Givens rotations
+    /// and the columns of Q and R that are needed by @ref undo are saved.
+    void remove_column(UndoRecord *u = nullptr) {
         assert(num_columns() > 0);
+        if (reg_λ > 0)
+            remove_column_reg(u);
+        // Number of columns of Q (and rows of R) in use. If A has more columns
+        // than rows, Q is square, and it stays square after the removal.
+        const length_t k  = q_cols(q_idx);
+        const bool drop_q = q_cols(q_idx - 1) < k;
+        if (u) {
+            if constexpr (M == Eigen::Dynamic) {
+                u->rot.resize(2, m());
+                u->r.resize(m());
+            }
+            u->removed      = true;
+            u->r.topRows(k) = R.col(r_idx_start).topRows(k);
+        }
+        // Save the rotation of row r, and the last column of Q (which is
+        // removed and later overwritten by add_column)
+        const auto save_rot = [u](index_t r, const auto &G) {
+            if (u) {
+                u->rot(0, r) = G.c();
+                u->rot(1, r) = G.s();
+            }
+        };
+        const auto save_q = [this, u, drop_q] {
+            if (u && drop_q)
+                u->q = Q.col(q_idx - 1);
+        };
 
         // After removing the first colomn of the upper triangular matrix R,
         // it becomes upper Hessenberg. Givens rotations are used to make it
         // triangular again.
         Eigen::JacobiRotation<real_t> G;
+        if constexpr (M != Eigen::Dynamic) {
+            // Same as below, but with the loops over the rows and columns
+            // of R fully unrolled (r and cc are compile-time constants).
+            static_for<M - 1>([&](auto r_) {
+                constexpr index_t r = decltype(r_)::value;
+                if (r >= k - 1)
+                    return;
+                index_t c = r_circ(r + 1);
+                G.makeGivens(R(r, c), R(r + 1, c), &R(r, c));
+                static_for<M>([&](auto cc_) {
+                    constexpr index_t cc = decltype(cc_)::value;
+                    if constexpr (cc >= r + 2)
+                        if (cc < q_idx)
+                            R.col(r_circ(cc)).applyOnTheLeft(r, r + 1,
+                                                              G.adjoint());
+                });
+                Q.block(0, 0, Q.rows(), k).applyOnTheRight(r, r + 1, G);
+                min_eig = std::min(min_eig, R(r, c));
+                max_eig = std::max(max_eig, R(r, c));
+                save_rot(r, G);
+            });
+            save_q();
+            --q_idx;
+            r_idx_start = r_succ(r_idx_start);
+            return;
+        }
         index_t r = 0;                   // row index of R
         index_t c = r_succ(r_idx_start); // column index of R in storage
-        while (r < q_idx - 1) {
+        while (r < k - 1) {
             // Compute the Givens rotation that makes the subdiagonal element
             // of column c or R zero.
             G.makeGivens(R(r, c), R(r + 1, c), &R(r, c));
@@ -102,25 +226,120 @@ class LimitedMemoryQR {
             for (index_t cc = r_succ(c); cc != r_idx_end; cc = r_succ(cc))
                 R.col(cc).applyOnTheLeft(r, r + 1, G.adjoint());
             // Apply the inverse of the Givens rotation to Q.
-            Q.block(0, 0, Q.rows(), q_idx).applyOnTheRight(r, r + 1, G);
+            Q.block(0, 0, Q.rows(), k).applyOnTheRight(r, r + 1, G);
             // Keep track of the minimum/maximum diagonal element of R
             min_eig = std::min(min_eig, R(r, c));
             max_eig = std::max(max_eig, R(r, c));
+            save_rot(r, G);
             // Advance indices to next diagonal element of R.
             ++r;
             c = r_succ(c);
         }
         // Remove rightmost column of Q, since it corresponds to the bottom row
-        // of R, which was set to zero by the Givens rotations
+        // of R, which was set to zero by the Givens rotations (unless R is
+        // still trapezoidal, then Q stays square)
+        save_q();
         --q_idx;
         // Remove the first column of R.
         r_idx_start = r_succ(r_idx_start);
     }
 
+    /// Save the current indices and bounds on the eigenvalues to @p u, before
+    /// calling @ref remove_column(UndoRecord *) and/or @ref add_column.
+    void begin_undo(UndoRecord &u) const {
+        u.q_idx       = q_idx;
+        u.r_idx_start = r_idx_start;
+        u.r_idx_end   = r_idx_end;
+        u.min_eig     = min_eig;
+        u.max_eig     = max_eig;
+        u.removed     = false;
+    }
+
+    /// Restore the factorization to the state saved by @ref begin_undo. The
+    /// new column is simply dropped, and the Givens rotations of the removed
+    /// column (if any) are applied in reverse, which costs O(n m), and is
+    /// exact up to rounding errors. The Cholesky factor of
+    /// @ref set_regularization is restored in the same way, in O(m²).
+    void undo(const UndoRecord &u) {
+        if (u.removed) {
+            const length_t k = q_cols(u.q_idx);
+            const auto circ  = [&](index_t i) {
+                return u.r_idx_start + i < m() ? u.r_idx_start + i
+                                                : u.r_idx_start + i - m();
+            };
+            // The new column of R may have replaced the removed one, and the
+            // new column of Q the last one
+            R.col(u.r_idx_start).topRows(k) = u.r.topRows(k);
+            if (q_cols(u.q_idx - 1) < k)
+                Q.col(k - 1) = u.q;
+            for (index_t r = k - 1; r-- > 0;) {
+                const index_t c = circ(r + 1);
+                Eigen::JacobiRotation<real_t> G(u.rot(0, r), u.rot(1, r));
+                Q.block(0, 0, Q.rows(), k).applyOnTheRight(r, r + 1,
+                                                           G.adjoint());
+                for (index_t cc = r_succ(c); cc != u.r_idx_end; cc = r_succ(cc))
+                    R.col(cc).applyOnTheLeft(r, r + 1, G);
+                // The subdiagonal element of column c was not modified
+                Eigen::Matrix<real_t, 2, 1> v(R(r, c), 0);
+                v.applyOnTheLeft(0, 1, G);
+                R(r, c) = v(0);
+            }
+            if (reg_λ > 0)
+                undo_reg(u);
+        }
+        q_idx       = u.q_idx;
+        r_idx_start = u.r_idx_start;
+        r_idx_end   = u.r_idx_end;
+        min_eig     = u.min_eig;
+        max_eig     = u.max_eig;
+    }
+
     /// Solve the least squares problem Ax = b.
     /// Do not divide by elements that are smaller in absolute value than @p tol.
+    /// If A has more columns than rows, the minimum-norm solution is returned
+    /// (if the rows of R are not skipped because of @p tol). This case uses
+    /// an internal workspace, so it cannot be called concurrently.
     template <class VecB, class VecX>
     void solve_col(const VecB &b, VecX &x, real_t tol = 0) const {
+        if (q_cols(q_idx) < q_idx)
+            return solve_col_wide(b, x, tol);
+        // If the rows are distributed, the right-hand side Qᵀb is computed
+        // using a single reduction, and stored in x
+        const bool dist = static_cast<bool>(all_reduce);
+        if (dist) {
+            assert(x.innerStride() == 1);
+            for (index_t i = 0; i < q_idx; ++i)
+                x(i) = Q.col(i).transpose() * b;
+            all_reduce(x.data(), q_idx);
+        }
+        if constexpr (M != Eigen::Dynamic) {
+            // Same as below, but with the loops over the rows and columns
+            // of R fully unrolled (r and c are compile-time constants).
+            static_for<M>([&](auto j) {
+                constexpr index_t r = M - 1 - decltype(j)::value;
+                if (r >= q_idx)
+                    return;
+                const index_t cR = r_circ(r);
+                if (std::abs(R(r, cR)) < tol) {
+                    x(r) = real_t{0};
+                    QUALA_STATS(++skip_count);
+                    return;
+                }
+                real_t xr;
+                if (dist)
+                    xr = x(r);
+                else
+                    xr = Q.col(r).transpose() * b;
+                static_for<M>([&](auto c_) {
+                    constexpr index_t c = decltype(c_)::value;
+                    if constexpr (c > r)
+                        if (c < q_idx)
+                            xr -= R(r, r_circ(c)) * x(c);
+                });
+                x(r) = xr / R(r, cR);
+            });
+            return;
+        }
         // Iterate over the diagonal of R, starting at the bottom right,
         // this is standard back substitution
         // (recall that R is stored in a circular buffer, so R.col(i) is
@@ -134,11 +353,13 @@ class LimitedMemoryQR {
             // Don't divide by very small diagonal elements
             if (std::abs(R(rR, cR)) < tol) {
                 x(rR) = real_t{0};
+                QUALA_STATS(++skip_count);
                 continue;
             }
             // (r is the zero-based mathematical index, c is the index in
             // the circular buffer)
-            x(rR) = Q.col(rR).transpose() * b; // Compute rhs Qᵀb
+            if (not dist)
+                x(rR) = Q.col(rR).transpose() * b; // Compute rhs Qᵀb
             // In the current row of R, iterate over the elements to the
             // right of the diagonal
             // Iterating from left to right seems to give better results
@@ -165,6 +386,47 @@ class LimitedMemoryQR {
         }
     }
 
+    /// Solve the regularized least squares problem
+    /// @f$ \min_x \|Ax - b\|^2 + \lambda \sum_i \|a_i\|^2 x_i^2 @f$,
+    /// where @f$ a_i @f$ are the columns of A, using the Cholesky factor of
+    /// @f$ A^\top\!A + \lambda\,\mathrm{diag}(A^\top\!A) @f$ that is kept
+    /// up to date by
+    /// @ref add_column and @ref remove_column, see @ref set_regularization.
+    /// Only Qᵀb costs O(n m), the rest of the solution costs O(m²).
+    template <class VecB, class VecX>
+    void solve_col_regularized(const VecB &b, VecX &x) const {
+        assert(reg_λ > 0);
+        assert(x.innerStride() == 1);
+        const length_t k = q_cols(q_idx);
+        // Right-hand side Aᵀb = Rᵀ(Qᵀb). Qᵀb is stored in x, and overwritten
+        // by Rᵀ(Qᵀb) starting from the bottom: row i of Rᵀ only uses the
+        // first i + 1 elements of Qᵀb.
+        x.topRows(k).noalias() = Q.leftCols(k).transpose() * b;
+        if (all_reduce)
+            all_reduce(x.data(), k);
+        for (auto it = ring_reverse_iter().begin();
+             it != ring_reverse_iter().end(); ++it) {
+            auto [i, c]        = *it;
+            const length_t len = q_cols(i + 1);
+            x(i) = R.col(c).topRows(len).dot(x.topRows(len));
+        }
+        // Solve UᵀU x = Aᵀb
+        for (auto [i, c] : ring_iter()) {
+            x(i) -= U.col(c).topRows(i).dot(x.topRows(i));
+            x(i) /= U(i, c);
+        }
+        auto fwd_end = ring_iter().end();
+        for (auto it_d = ring_reverse_iter().begin();
+             it_d != ring_reverse_iter().end(); ++it_d) {
+            auto [i, c] = *it_d;
+            for (auto it_c = it_d.forwardit; it_c != fwd_end; ++it_c) {
+                auto [j, c2] = *it_c;
+                x(i) -= U(i, c2) * x(j);
+            }
+            x(i) /= U(i, c);
+        }
+    }
+
     template <class Derived>
     using solve_ret_t = std::conditional_t<
         Eigen::internal::traits<Derived>::ColsAtCompileTime == 1, vec, mat>;
@@ -178,51 +440,62 @@ class LimitedMemoryQR {
     }
 
     /// Get the full, raw storage for the orthogonal matrix Q.
-    const mat &get_raw_Q() const { return Q; }
+    const mat_Q &get_raw_Q() const { return Q; }
     /// Get the full, raw storage for the upper triangular matrix R.
     /// The columns of this matrix are permuted because it's stored as a
     /// circular buffer for efficiently appending columns to the end and
     /// popping columns from the front.
-    const mat &get_raw_R() const { return R; }
+    const mat_R &get_raw_R() const { return R; }
 
     /// Get the full storage for the upper triangular matrix R but with the
     /// columns in the correct order.
     /// @note   Meant for tests only, creates a permuted copy.
     mat get_full_R() const {
         if (r_idx_start == 0)
-            return R;
+            return R.topLeftCorner(m(), m());
         // Using a permutation matrix here isn't as efficient as rotating the
         // matrix manually, but this function is only used in tests, so it
         // shouldn't matter.
-        Eigen::PermutationMatrix<Eigen::Dynamic> P(R.cols());
+        Eigen::PermutationMatrix<Eigen::Dynamic> P(m());
         P.setIdentity();
         std::rotate(P.indices().data(), P.indices().data() + r_idx_start,
                     P.indices().data() + P.size());
-        return R * P;
+        return R.topLeftCorner(m(), m()) * P;
     }
     /// Get the matrix R such that Q times R is the original matrix.
     /// @note   Meant for tests only, creates a permuted copy.
     mat get_R() const {
         return get_full_R()
-            .block(0, 0, q_idx, q_idx)
-            .triangularView<Eigen::Upper>();
+            .block(0, 0, q_cols(q_idx), q_idx)
+            .template triangularView<Eigen::Upper>();
     }
     /// Get the matrix Q such that Q times R is the original matrix.
     /// @note   Meant for tests only, creates a copy.
-    mat get_Q() const { return Q.block(0, 0, n(), q_idx); }
+    mat get_Q() const { return Q.block(0, 0, n(), q_cols(q_idx)); }
 
     /// Multiply the matrix R by a scalar.
     void scale_R(real_t scal) {
         for (auto [i, r_idx] : ring_iter())
-            R.col(r_idx).topRows(i + 1) *= scal;
+            R.col(r_idx).topRows(std::min(i + 1, q_cols(q_idx))) *= scal;
         min_eig *= scal;
         max_eig *= scal;
+        // RᵀR + λ diag(RᵀR) is scaled by scal², so U is scaled by |scal|,
+        // unless all columns of R are now zero
+        if (reg_λ > 0 && scal != 0)
+            for (auto [i, r_idx] : ring_iter())
+                U.col(r_idx).topRows(i + 1) *= std::abs(scal);
+        else if (reg_λ > 0)
+            refactor_reg();
     }
 
     /// Get the number of MGS reorthogonalizations.
     unsigned long get_reorth_count() const { return reorth_count; }
     /// Reset the number of MGS reorthogonalizations.
     void clear_reorth_count() { reorth_count = 0; }
+    /// Get the number of small diagonal elements of R skipped by
+    /// @ref solve_col. Only counted if the library was compiled with
+    /// @ref QUALA_WITH_STATS.
+    unsigned long get_skip_count() const { return skip_count; }
 
     /// Get the minimum eigenvalue of R.
     real_t get_min_eig() const { return min_eig; }
@@ -244,9 +517,124 @@ class LimitedMemoryQR {
     void resize(length_t n, length_t m) {
         Q.resize(n, m);
         R.resize(m, m);
+        proj.resize(m);
+        wide_solve.work.resize(n);
+        wide_solve.x.resize(m);
+        if (reg_λ > 0)
+            U.resize(m, m);
+        max_cols = m;
         reset();
     }
 
+    /// Change the maximum number of columns of A to @p m, keeping the newest
+    /// min(m, @ref num_columns()) columns of A (the oldest ones are removed
+    /// as in @ref remove_column). The columns of R (and of the Cholesky
+    /// factor of @ref set_regularization) are moved to the start of the
+    /// circular buffer. The storage is only re-allocated if @p m exceeds the
+    /// largest number of columns used so far.
+    void set_history(length_t m) {
+        if constexpr (M != Eigen::Dynamic)
+            if (m != M)
+                throw std::invalid_argument("LimitedMemoryQR: history must be "
+                                            "equal to the compile-time size M");
+        while (q_idx > m)
+            remove_column();
+        // Bring the columns of R in order, only the top q_idx rows are in use
+        vec_util::rotate_cols(R, this->m(), r_idx_start);
+        if (reg_λ > 0)
+            vec_util::rotate_cols(U, this->m(), r_idx_start);
+        if constexpr (M == Eigen::Dynamic) {
+            if (m > Q.cols()) {
+                Q.conservativeResize(Eigen::NoChange, m);
+                R.conservativeResize(m, m);
+                proj.resize(m);
+                wide_solve.x.resize(m);
+                if (reg_λ > 0)
+                    U.conservativeResize(m, m);
+            }
+        }
+        max_cols    = m;
+        r_idx_start = 0;
+        r_idx_end   = q_idx == m ? 0 : q_idx;
+    }
+
+    /// Write the factorization (the columns of Q and R that are in use and the
+    /// indices of the circular buffer) to a checkpoint.
+    void save(CheckpointWriter &w) const {
+        w.header(CheckpointKind::LimitedMemoryQR, sizeof(real_t),
+                 sizeof(real_t));
+        w.scalar<std::int64_t>(n());
+        w.scalar<std::int64_t>(m());
+        w.scalar<std::int64_t>(q_idx);
+        w.scalar<std::int64_t>(r_idx_start);
+        w.scalar<std::uint64_t>(reorth_count);
+        w.scalar(min_eig);
+        w.scalar(max_eig);
+        w.matrix(Q.leftCols(q_cols(q_idx)));
+        for (auto [i, r_idx] : ring_iter())
+            w.matrix(R.col(r_idx).topRows(q_cols(q_idx)));
+    }
+
+    /// Restore the factorization from a checkpoint written by @ref save.
+    /// The dimensions and the floating point type have to match.
+    void load(CheckpointReader &r) {
+        r.header(CheckpointKind::LimitedMemoryQR, sizeof(real_t),
+                 sizeof(real_t));
+        if (r.scalar<std::int64_t>() != n())
+            throw std::invalid_argument("LimitedMemoryQR::load: dimension "
+                                        "mismatch");
+        if (r.scalar<std::int64_t>() != m())
+            throw std::invalid_argument("LimitedMemoryQR::load: history "
+                                        "length mismatch");
+        reset();
+        const length_t new_q_idx = r.index(m());
+        const index_t new_start  = r.index(std::max<length_t>(m() - 1, 0));
+        reorth_count             = r.scalar<std::uint64_t>();
+        min_eig                  = r.scalar<real_t>();
+        max_eig                  = r.scalar<real_t>();
+        r.matrix(Q.leftCols(q_cols(new_q_idx)));
+        q_idx       = new_q_idx;
+        r_idx_start = new_start;
+        r_idx_end   = r_circ(q_idx == m() ? 0 : q_idx);
+        for (auto [i, r_idx] : ring_iter())
+            r.matrix(R.col(r_idx).topRows(q_cols(q_idx)));
+        if (reg_λ > 0)
+            refactor_reg();
+    }
+
+    /// Keep the Cholesky factor U of AᵀA + λ diag(AᵀA) = UᵀU up to date when
+    /// adding or removing columns, so that the regularized least squares
+    /// problems of @ref solve_col_regularized can be solved in O(m²) (on top
+    /// of the product Qᵀb). The diagonal scaling makes λ independent of the
+    /// scale of A. Since AᵀA = RᵀR, U is computed from R only. Adding or
+    /// removing a column then costs an additional O(m²). Columns of A that
+    /// are exactly zero (e.g. because of a repeated residual in Anderson
+    /// acceleration) get a unit diagonal element in U, so that their
+    /// coefficient in the solution is zero.
+    /// A value of zero disables the factorization. Recomputes the factor,
+    /// which costs O(m³).
+    void set_regularization(real_t λ) {
+        if (λ < 0)
+            throw std::invalid_argument("LimitedMemoryQR: regularization must "
+                                        "be nonnegative");
+        reg_λ = λ;
+        if (reg_λ > 0) {
+            U.resize(R.rows(), R.cols());
+            refactor_reg();
+        }
+    }
+    /// Get the regularization parameter λ, see @ref set_regularization.
+    real_t get_regularization() const { return reg_λ; }
+
+    /// Use local shards of the distributed rows of A: all inner products are
+    /// summed over the processes by @p all_reduce.
+    /// @ref add_column needs two reductions (plus one per
+    /// reorthogonalization), @ref solve_col needs one.
+    /// @see @ref BasicAllReduce
+    void set_all_reduce(BasicAllReduce<real_t> all_reduce) {
+        this->all_reduce = std::move(all_reduce);
+    }
+
     /// Get the number of columns that are currently stored.
     length_t num_columns() const { return q_idx; }
     /// Get the head index of the circular buffer (points to the oldest
@@ -272,14 +660,247 @@ class LimitedMemoryQR {
     }
 
   private:
-    mat Q; ///< Storage for orthogonal factor Q.
-    mat R; ///< Storage for upper triangular factor R.
+    /// @ref add_column using classical Gram-Schmidt with reorthogonalization,
+    /// for distributed rows.
+    template <class VecV>
+    void add_column_cgs(const VecV &v) {
+        auto q  = Q.col(q_idx);
+        auto r  = R.col(r_idx_end);
+        auto Qₖ = Q.leftCols(q_idx);
+
+        // Project v onto the columns of Q, and compute ‖v‖², in a single
+        // reduction (r(q_idx) is overwritten by ‖q‖ later)
+        r.topRows(q_idx).noalias() = Qₖ.transpose() * v;
+        r(q_idx)                   = v.squaredNorm();
+        all_reduce(r.data(), q_idx + 1);
+        real_t norm_v = std::sqrt(r(q_idx));
+        q             = v;
+        q.noalias() -= Qₖ * r.topRows(q_idx);
+
+        // Compute ‖q‖ together with the projection of q onto the columns of
+        // Q, which is needed for the reorthogonalization if ‖q‖ is
+        // significantly smaller than ‖v‖
+        auto p = proj.topRows(q_idx + 1);
+        real_t η = 0.7, norm_q;
+        while (true) {
+            p.topRows(q_idx).noalias() = Qₖ.transpose() * q;
+            p(q_idx)                   = q.squaredNorm();
+            all_reduce(p.data(), q_idx + 1);
+            norm_q = std::sqrt(p(q_idx));
+            if (norm_q >= η * norm_v)
+                break;
+            ++reorth_count;
+            r.topRows(q_idx) += p.topRows(q_idx);
+            q.noalias() -= Qₖ * p.topRows(q_idx);
+            norm_v = norm_q;
+        }
+
+        append_column(norm_q);
+    }
+
+    /// @ref add_column if Q is already square: the new column of R is the
+    /// projection of v onto the columns of Q, which span the whole space, and
+    /// Q is not modified.
+    template <class VecV>
+    void add_column_wide(const VecV &v) {
+        // Evaluate v first, it may be an expression
+        auto &v_eval = wide_solve.work;
+        v_eval       = v;
+        auto r       = R.col(r_idx_end).topRows(n());
+        r.noalias()  = Q.leftCols(n()).transpose() * v_eval;
+        ++q_idx;
+        r_idx_end = r_succ(r_idx_end);
+        if (reg_λ > 0)
+            factor_column_reg(q_idx - 1);
+    }
+
+    /// @ref solve_col if A has more columns than rows. The system is
+    /// underdetermined, so its minimum-norm solution is computed using a
+    /// complete orthogonal decomposition of the trapezoidal matrix
+    /// R = (T 0) Zᵀ, with T upper triangular and Z orthogonal. This costs
+    /// O(n² m) rather than O(n m), but n is small in this case.
+    template <class VecB, class VecX>
+    void solve_col_wide(const VecB &b, VecX &x, real_t tol) const {
+        const length_t n = this->n(), p = q_idx;
+        auto &W = wide_solve.W, &C = wide_solve.rot_c, &S = wide_solve.rot_s;
+        W.resize(n, p);
+        C.resize(n, p - n);
+        S.resize(n, p - n);
+        for (auto [i, r_idx] : ring_iter())
+            W.col(i) = R.col(r_idx).topRows(n);
+        W.template triangularView<Eigen::StrictlyLower>().setZero();
+        // Givens rotations applied on the right make the last p - n columns
+        // zero. Starting with the bottom row, and rotating each of these
+        // columns into the diagonal element, only affects the rows above it,
+        // so the first n columns stay upper triangular.
+        Eigen::JacobiRotation<real_t> G;
+        for (index_t i = n; i-- > 0;) {
+            for (index_t j = n; j < p; ++j) {
+                G.makeGivens(W(i, i), W(i, j), &W(i, i));
+                W(i, j) = real_t{0};
+                W.topRows(i).applyOnTheRight(i, j, G);
+                C(i, j - n) = G.c();
+                S(i, j - n) = G.s();
+            }
+        }
+        auto &γ = wide_solve.x;
+        // Solve T w = Qᵀb, skipping very small diagonal elements
+        γ.topRows(n).noalias() = Q.leftCols(n).transpose() * b;
+        for (index_t i = n; i-- > 0;) {
+            if (std::abs(W(i, i)) < tol) {
+                γ(i) = real_t{0};
+                QUALA_STATS(++skip_count);
+                continue;
+            }
+            const length_t k = n - i - 1;
+            γ(i) -= W.row(i).segment(i + 1, k).dot(γ.segment(i + 1, k));
+            γ(i) /= W(i, i);
+        }
+        // γ = Z (w 0), applying the rotations in reverse order
+        γ.segment(n, p - n).setZero();
+        for (index_t i = 0; i < n; ++i) {
+            for (index_t j = p; j-- > n;) {
+                G = Eigen::JacobiRotation<real_t>(C(i, j - n), S(i, j - n));
+                γ.applyOnTheLeft(i, j, G);
+            }
+        }
+        x.topRows(p) = γ.topRows(p);
+    }
+
+    /// Normalize the new column q, and add it to Q and R.
+    void append_column(real_t norm_q) {
+        auto q = Q.col(q_idx);
+        auto r = R.col(r_idx_end);
+        // Normalize q such that new matrix (Q q) remains orthogonal (i.e. has
+        // orthonormal columns)
+        r(q_idx) = norm_q;
+        // If the new column of A is zero, the column of Q is zero as well,
+        // rather than NaN, so it doesn't affect the other columns
+        if (norm_q > 0)
+            q /= norm_q;
+        else
+            q.setZero();
+        // Keep track of the minimum/maximum diagonal element of R
+        min_eig = std::min(min_eig, norm_q);
+        max_eig = std::max(max_eig, norm_q);
+
+        // Increment indices, add a column to Q and R.
+        ++q_idx;
+        r_idx_end = r_succ(r_idx_end);
+        if (reg_λ > 0)
+            factor_column_reg(q_idx - 1);
+    }
+
+    /// Compute column @p j of the Cholesky factor U of RᵀR + λ diag(RᵀR),
+    /// given its previous columns. Column j of UᵀU is (Rᵀρ + λ‖ρ‖² eⱼ), where
+    /// ρ is column j
+    /// of R, so the off-diagonal elements u of column j of U satisfy
+    /// Uⱼᵀ u = Rⱼᵀ ρ (forward substitution), where Uⱼ and Rⱼ are the first j
+    /// columns of U and R. This costs O(m²).
+    void factor_column_reg(index_t j) {
+        const index_t c = r_circ(j);
+        auto u          = U.col(c);
+        auto ρ          = R.col(c).topRows(q_cols(j + 1));
+        for (index_t i = 0; i < j; ++i) {
+            const index_t ci   = r_circ(i);
+            const length_t len = q_cols(i + 1);
+            u(i) = R.col(ci).topRows(len).dot(ρ.topRows(len));
+            u(i) -= U.col(ci).topRows(i).dot(u.topRows(i));
+            u(i) /= U(i, ci);
+        }
+        // The diagonal element is at least √λ ‖ρ‖ in exact arithmetic. If ρ
+        // is zero, so is the rest of u, and any positive diagonal element
+        // decouples column j from the others.
+        const real_t ρ² = ρ.squaredNorm();
+        const real_t d  = (1 + reg_λ) * ρ² - u.topRows(j).squaredNorm();
+        u(j) = ρ² > 0 ? std::sqrt(std::max(d, reg_λ * ρ²)) : real_t(1);
+    }
+
+    /// Remove the first column of U, as in @ref remove_column: the remaining
+    /// columns form an upper Hessenberg matrix, which is made triangular
+    /// again using Givens rotations. Call before updating the indices.
+    /// If @p u is not null, the rotations and the removed diagonal element are
+    /// saved for @ref undo_reg.
+    void remove_column_reg(UndoRecord *u) {
+        if (u) {
+            if constexpr (M == Eigen::Dynamic)
+                u->rot_U.resize(2, m());
+            u->u = U(0, r_idx_start);
+        }
+        Eigen::JacobiRotation<real_t> G;
+        index_t c = r_succ(r_idx_start);
+        for (index_t r = 0; r < q_idx - 1; ++r, c = r_succ(c)) {
+            G.makeGivens(U(r, c), U(r + 1, c), &U(r, c));
+            for (index_t cc = r_succ(c); cc != r_idx_end; cc = r_succ(cc))
+                U.col(cc).applyOnTheLeft(r, r + 1, G.adjoint());
+            if (u) {
+                u->rot_U(0, r) = G.c();
+                u->rot_U(1, r) = G.s();
+            }
+        }
+    }
+
+    /// Undo @ref remove_column_reg by applying the saved Givens rotations in
+    /// reverse, as in @ref undo. Costs O(m²). Call before restoring the
+    /// indices.
+    void undo_reg(const UndoRecord &u) {
+        const auto circ = [&](index_t i) {
+            return u.r_idx_start + i < m() ? u.r_idx_start + i
+                                            : u.r_idx_start + i - m();
+        };
+        // The new column may have replaced the removed one
+        U(0, u.r_idx_start) = u.u;
+        for (index_t r = u.q_idx - 1; r-- > 0;) {
+            const index_t c = circ(r + 1);
+            Eigen::JacobiRotation<real_t> G(u.rot_U(0, r), u.rot_U(1, r));
+            for (index_t cc = r_succ(c); cc != u.r_idx_end; cc = r_succ(cc))
+                U.col(cc).applyOnTheLeft(r, r + 1, G);
+            // The subdiagonal element of column c was not modified
+            Eigen::Matrix<real_t, 2, 1> v(U(r, c), 0);
+            v.applyOnTheLeft(0, 1, G);
+            U(r, c) = v(0);
+        }
+    }
+
+    /// Recompute the Cholesky factor U of RᵀR + λ diag(RᵀR) from scratch.
+    void refactor_reg() {
+        for (index_t j = 0; j < q_idx; ++j)
+            factor_column_reg(j);
+    }
+
+  private:
+    mat_Q Q; ///< Storage for orthogonal factor Q.
+    mat_R R; ///< Storage for upper triangular factor R.
+    /// Workspace for the projections in @ref add_column_cgs.
+    vec_m proj;
+    /// Workspace for @ref add_column_wide and @ref solve_col_wide.
+    struct WideSolve {
+        /// Trapezoidal matrix R, reduced to (T 0).
+        mat_W W;
+        /// Cosines and sines of the Givens rotations that form Z.
+        mat_W rot_c, rot_s;
+        vec_n work;
+        vec_m x;
+    };
+    mutable WideSolve wide_solve;
+    /// Regularization parameter, see @ref set_regularization.
+    real_t reg_λ = 0;
+    /// Cholesky factor of RᵀR + λ diag(RᵀR), with the same circular column
+    /// indices as R. Only allocated if @ref reg_λ is positive.
+    mat_R U;
+    /// Sum over all processes, empty if the rows are not distributed.
+    BasicAllReduce<real_t> all_reduce;
+
+    /// Maximum number of columns of A.
+    length_t max_cols = M == Eigen::Dynamic ? 0 : M;
 
     index_t q_idx       = 0; ///< Number of columns of Q being stored.
     index_t r_idx_start = 0; ///< Index of the first column of R.
     index_t r_idx_end   = 0; ///< Index of the one-past-last column of R.
 
     unsigned long reorth_count = 0; ///< Number of MGS reorthogonalizations.
+    /// Number of diagonal elements skipped by @ref solve_col.
+    mutable unsigned long skip_count = 0;
 
     real_t min_eig = +inf; ///< Minimum eigenvalue of R.
     real_t max_eig = -inf; ///< Maximum eigenvalue of R.
@@ -288,6 +909,27 @@ class LimitedMemoryQR {
     index_t r_succ(index_t i) const { return i + 1 < m() ? i + 1 : 0; }
     /// Get the previous index in the circular storage for R.
     index_t r_pred(index_t i) const { return i == 0 ? m() - 1 : i - 1; }
+    /// Get the number of columns of Q (and rows of R) that are in use if A
+    /// has @p p columns. Q is square if A has more columns than rows, unless
+    /// the rows are distributed (each process then only has a few of them).
+    length_t q_cols(length_t p) const {
+        return all_reduce ? p : std::min(p, n());
+    }
+    /// Get the index in the circular storage for R of the i-th column.
+    index_t r_circ(index_t i) const {
+        return r_idx_start + i < m() ? r_idx_start + i : r_idx_start + i - m();
+    }
 };
 
+/// @ref BasicLimitedMemoryQR for the default floating point type.
+using LimitedMemoryQR = BasicLimitedMemoryQR<real_t>;
+/// @ref BasicLimitedMemoryQR with compile-time dimensions.
+template <length_t N, length_t M, class Real = real_t>
+using StaticLimitedMemoryQR = BasicLimitedMemoryQR<Real, N, M>;
+/// @ref BasicLimitedMemoryQR with a compile-time number of columns, but a
+/// dynamic number of rows.
+template <length_t M, class Real = real_t>
+using StaticHistoryLimitedMemoryQR =
+    BasicLimitedMemoryQR<Real, Eigen::Dynamic, M>;
+
 } // namespace quala
\ No newline at end of file
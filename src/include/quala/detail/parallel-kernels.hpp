@@ -0,0 +1,289 @@
+#pragma once
+
+#include <quala/detail/lbfgs-helpers.hpp>
+#include <quala/util/all-reduce.hpp>
+#include <quala/util/thread-pool.hpp>
+#include <quala/util/vec.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace quala {
+
+/// Serial versions of the vector kernels of @ref BasicParallelKernels that
+/// are used by the two-loop recursion. They don't use any workspace or thread
+/// pool, so they can be called from multiple threads at the same time (as long
+/// as the @ref BasicAllReduce function, if any, allows that as well).
+/// @tparam Real
+///         Floating point type used for all computations.
+template <class Real>
+class BasicSerialKernels {
+  public:
+    USING_QUALA_TYPES(Real);
+
+    BasicSerialKernels(const BasicAllReduce<real_t> &all_reduce)
+        : all_reduce(all_reduce) {}
+
+    /// @see @ref BasicParallelKernels::global_sum
+    void global_sum(real_t *data, length_t count) const {
+        if (all_reduce)
+            all_reduce(data, count);
+    }
+
+    /// @see @ref BasicParallelKernels::dot
+    template <class VecX, class VecZ>
+    real_t dot(const VecX &x, const VecZ &z) const {
+        real_t r = x.template cast<real_t>().dot(z.template cast<real_t>());
+        global_sum(&r, 1);
+        return r;
+    }
+
+    /// @see @ref BasicParallelKernels::dot2
+    template <class VecX1, class VecZ1, class VecX2, class VecZ2>
+    std::pair<real_t, real_t> dot2(const VecX1 &x1, const VecZ1 &z1,
+                                   const VecX2 &x2, const VecZ2 &z2) const {
+        real_t r[2]{
+            x1.template cast<real_t>().dot(z1.template cast<real_t>()),
+            x2.template cast<real_t>().dot(z2.template cast<real_t>()),
+        };
+        global_sum(r, 2);
+        return {r[0], r[1]};
+    }
+
+    /// @see @ref BasicParallelKernels::axpy_dot
+    template <class VecX, class C, class VecZ>
+    real_t axpy_dot(real_t a, const VecX &x, rvec q, const C &c,
+                    const VecZ &z) const {
+        real_t r = fused_axpy_dot<real_t>(a, x, q, c, z);
+        global_sum(&r, 1);
+        return r;
+    }
+
+    /// @see @ref BasicParallelKernels::axpy
+    template <class VecX>
+    void axpy(real_t a, const VecX &x, rvec q) const {
+        q += a * x.template cast<real_t>();
+    }
+
+  private:
+    const BasicAllReduce<real_t> &all_reduce;
+};
+
+/// Kernels for long vectors that are optionally split into chunks, which are
+/// then processed by the threads of a @ref ThreadPool.
+///
+/// Inner products are computed per chunk, and the partial results are summed
+/// in chunk order afterwards. The chunks only depend on the size of the
+/// vectors and on the chunk size, so the results don't depend on the number
+/// of threads.
+/// Without a thread pool, the vectors are passed to the serial kernels as a
+/// whole.
+///
+/// If the vectors are local shards of distributed vectors, the local results
+/// of all inner products are summed over all processes by the
+/// @ref BasicAllReduce function set using @ref set_all_reduce, once per
+/// kernel call.
+/// @tparam Real
+///         Floating point type used for all computations.
+template <class Real>
+class BasicParallelKernels {
+  public:
+    USING_QUALA_TYPES(Real);
+
+    /// Prepare for vectors of size @p n, split into chunks of @p chunk_size
+    /// elements and divided over @p num_threads threads. If @p num_threads is
+    /// zero, the vectors are not split.
+    void resize(length_t n, length_t num_threads, length_t chunk_size) {
+        this->n          = n;
+        this->chunk_size = std::max<length_t>(chunk_size, 1);
+        if (num_threads < 1)
+            pool.reset();
+        else if (not pool || pool->num_threads() != num_threads)
+            pool = std::make_shared<ThreadPool>(num_threads);
+        thread_work.resize(std::max<length_t>(num_threads - 1, 0));
+    }
+
+    /// Set the function that sums the results of the inner products over all
+    /// processes, see @ref BasicAllReduce.
+    void set_all_reduce(BasicAllReduce<real_t> all_reduce) {
+        this->all_reduce = std::move(all_reduce);
+    }
+    /// Sum the local partial results in @p data over all processes (no-op if
+    /// the vectors are not distributed).
+    void global_sum(real_t *data, length_t count) const {
+        if (all_reduce)
+            all_reduce(data, count);
+    }
+
+    /// Get the serial versions of the kernels, which can be used concurrently
+    /// by multiple threads.
+    BasicSerialKernels<real_t> serial() const { return {all_reduce}; }
+
+    /// Check whether the vectors are split into chunks.
+    bool parallel() const { return pool != nullptr; }
+    /// Check whether inner products have to go through @ref reduce, i.e.
+    /// whether the vectors are split into chunks or distributed.
+    bool reducing() const { return parallel() || all_reduce; }
+    /// Get the number of chunks the vectors are split into.
+    length_t num_chunks() const {
+        return parallel() ? (n + chunk_size - 1) / chunk_size : 1;
+    }
+
+    /// Call `f(i, bs, work)` for each chunk of rows [i, i + bs), where `work`
+    /// is a workspace matrix that is private to the thread executing `f`.
+    template <class F>
+    void foreach_chunk(const F &f) {
+        foreach_chunk_idx([&](index_t, index_t i, length_t bs, mat &w) {
+            f(i, bs, w);
+        });
+    }
+
+    /// Call `f(i, bs, out, work)` for each chunk of rows [i, i + bs), where
+    /// `out` is a column of @p K partial results of the chunk, and return the
+    /// sum of the partial results of all chunks, in chunk order, and over all
+    /// processes.
+    template <class F>
+    auto reduce(length_t K, const F &f) {
+        const length_t nc = num_chunks();
+        if (partials.rows() < K || partials.cols() < nc)
+            partials.resize(std::max(K, length_t(partials.rows())),
+                            std::max(nc, length_t(partials.cols())));
+        auto P = partials.topLeftCorner(K, nc);
+        foreach_chunk_idx([&](index_t c, index_t i, length_t bs, mat &w) {
+            f(i, bs, P.col(c), w);
+        });
+        for (index_t c = 1; c < nc; ++c)
+            P.col(0) += P.col(c);
+        global_sum(P.col(0).data(), K);
+        return P.col(0);
+    }
+
+    /// Compute @f$ x^\top z @f$.
+    template <class VecX, class VecZ>
+    real_t dot(const VecX &x, const VecZ &z) {
+        if (not reducing())
+            return x.template cast<real_t>().dot(z.template cast<real_t>());
+        return reduce(1, [&](index_t i, length_t bs, auto &&out, mat &) {
+            out(0) = x.segment(i, bs).template cast<real_t>().dot(
+                z.segment(i, bs).template cast<real_t>());
+        })(0);
+    }
+
+    /// Compute @f$ x_1^\top z_1 @f$ and @f$ x_2^\top z_2 @f$, with a single
+    /// reduction.
+    template <class VecX1, class VecZ1, class VecX2, class VecZ2>
+    std::pair<real_t, real_t> dot2(const VecX1 &x1, const VecZ1 &z1,
+                                   const VecX2 &x2, const VecZ2 &z2) {
+        if (not reducing())
+            return {dot(x1, z1), dot(x2, z2)};
+        auto r = reduce(2, [&](index_t i, length_t bs, auto &&out, mat &) {
+            out(0) = x1.segment(i, bs).template cast<real_t>().dot(
+                z1.segment(i, bs).template cast<real_t>());
+            out(1) = x2.segment(i, bs).template cast<real_t>().dot(
+                z2.segment(i, bs).template cast<real_t>());
+        });
+        return {r(0), r(1)};
+    }
+
+    /// @see @ref fused_axpy_dot
+    template <class VecX, class C, class VecZ>
+    real_t axpy_dot(real_t a, const VecX &x, rvec q, const C &c,
+                    const VecZ &z) {
+        if (not reducing())
+            return fused_axpy_dot<real_t>(a, x, q, c, z);
+        return reduce(1, [&](index_t i, length_t bs, auto &&out, mat &) {
+            out(0) = fused_axpy_dot<real_t>(a, x.segment(i, bs),
+                                            q.segment(i, bs),
+                                            segment(c, i, bs),
+                                            z.segment(i, bs));
+        })(0);
+    }
+
+    /// Compute @f$ Q \leftarrow c\,Q @f$, where @p c is either a scalar or a
+    /// vector, in which case the rows of Q are scaled by its elements.
+    template <class C>
+    void scale_rows(const C &c, rmat Q) {
+        foreach_chunk([&](index_t i, length_t bs, mat &) {
+            if constexpr (std::is_arithmetic_v<C>)
+                Q.middleRows(i, bs) *= c;
+            else
+                Q.middleRows(i, bs) =
+                    c.segment(i, bs).asDiagonal() * Q.middleRows(i, bs);
+        });
+    }
+
+    /// Compute @f$ q \leftarrow q + a\,x @f$.
+    template <class VecX>
+    void axpy(real_t a, const VecX &x, rvec q) {
+        if (not parallel())
+            return void(q += a * x.template cast<real_t>());
+        foreach_chunk([&](index_t i, length_t bs, mat &) {
+            q.segment(i, bs) += a * x.segment(i, bs).template cast<real_t>();
+        });
+    }
+
+    /// @see @ref cast_matmul_tn
+    template <class MatA, class MatB, class MatOut>
+    void matmul_tn(const MatA &A, const MatB &B, MatOut &&out) {
+        if (not reducing())
+            return cast_matmul_tn<real_t>(A, B, out, cast_work);
+        const length_t ka = A.cols(), kb = B.cols();
+        auto sum = reduce(ka * kb, [&](index_t i, length_t bs, auto &&part,
+                                       mat &w) {
+            cast_matmul_tn<real_t>(A.middleRows(i, bs), B.middleRows(i, bs),
+                                   Eigen::Map<mat>(part.data(), ka, kb), w);
+        });
+        out = Eigen::Map<const mat>(sum.data(), ka, kb);
+    }
+
+    /// @see @ref cast_matmul_add
+    template <class MatA, class MatC, class MatQ>
+    void matmul_add(const MatA &A, const MatC &C, MatQ &&Q) {
+        if (not parallel())
+            return cast_matmul_add<real_t>(A, C, Q, cast_work);
+        foreach_chunk([&](index_t i, length_t bs, mat &w) {
+            cast_matmul_add<real_t>(A.middleRows(i, bs), C, Q.middleRows(i, bs),
+                                    w);
+        });
+    }
+
+  private:
+    /// Rows [i, i + bs) of @p c, or @p c itself if it is a scalar.
+    template <class C>
+    static auto segment(const C &c, index_t i, length_t bs) {
+        if constexpr (std::is_arithmetic_v<C>)
+            return static_cast<real_t>(c);
+        else
+            return c.segment(i, bs);
+    }
+    /// Call `f(c, i, bs, work)` for each chunk c of rows [i, i + bs).
+    template <class F>
+    void foreach_chunk_idx(const F &f) {
+        if (not parallel())
+            return f(0, 0, n, cast_work);
+        pool->run(num_chunks(), [&](index_t c, index_t t) {
+            const index_t i = c * chunk_size;
+            f(c, i, std::min(chunk_size, n - i),
+              t == 0 ? cast_work : thread_work[t - 1]);
+        });
+    }
+
+    length_t n          = 0;
+    length_t chunk_size = 1;
+    /// Sum over all processes, empty if the vectors are not distributed.
+    BasicAllReduce<real_t> all_reduce;
+    /// Shared between copies, @ref ThreadPool::run serializes concurrent use.
+    std::shared_ptr<ThreadPool> pool;
+    /// Partial results of the chunks in @ref reduce.
+    mat partials;
+    /// Workspace for converting blocks of lower precision, used by the calling
+    /// thread.
+    mat cast_work;
+    /// Workspaces for the other threads of the pool.
+    std::vector<mat> thread_work;
+};
+
+} // namespace quala
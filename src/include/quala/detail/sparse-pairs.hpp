@@ -0,0 +1,237 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <Eigen/SparseCore>
+
+#include <vector>
+
+namespace quala {
+
+/// Pairs of sparse vectors of a circular buffer, see
+/// @ref BasicLBFGS::update_sy_sparse and
+/// @ref BasicBroydenGood::update_sy_sparse. Both vectors of a pair share the
+/// same sparsity pattern (the union of their own patterns), so only a single
+/// index vector is stored per pair.
+/// The pairs that are not stored sparsely are stored as dense columns by the
+/// accelerator itself.
+/// @tparam Real
+///         Floating point type used for the computations.
+/// @tparam StorageReal
+///         Floating point type used for storing the values.
+template <class Real, class StorageReal = Real>
+struct BasicSparsePairs {
+    USING_QUALA_TYPES(Real);
+    using values_t = Eigen::Matrix<StorageReal, Eigen::Dynamic, 2>;
+
+    /// Set the number of pairs to @p history, all of which are dense. The
+    /// storage is only allocated by the first call to @ref store, so
+    /// accelerators that never store sparse pairs don't allocate any memory.
+    void resize(length_t history) {
+        this->history = history;
+        J.clear();
+        vals.clear();
+        sparse.clear();
+        count = 0;
+    }
+    /// Mark all pairs as dense.
+    void clear() {
+        sparse.assign(sparse.size(), false);
+        count = 0;
+    }
+
+    /// Check whether pair @p i is stored sparsely.
+    bool is_sparse(index_t i) const { return count > 0 && sparse[i]; }
+    /// Store the values @p a and @p b at the indices @p Ji as pair @p i.
+    template <class VecJ, class VecA, class VecB>
+    void store(index_t i, const VecJ &Ji, const VecA &a, const VecB &b) {
+        if (sparse.empty()) {
+            J.resize(history);
+            vals.resize(history);
+            sparse.assign(history, false);
+        }
+        J[i] = Ji;
+        vals[i].resize(Ji.size(), 2);
+        vals[i].col(0) = a.template cast<StorageReal>();
+        vals[i].col(1) = b.template cast<StorageReal>();
+        count += not sparse[i];
+        sparse[i] = true;
+    }
+    /// Mark pair @p i as dense (e.g. because it was overwritten by a dense
+    /// pair).
+    void set_dense(index_t i) {
+        if (count == 0)
+            return;
+        count -= sparse[i];
+        sparse[i] = false;
+    }
+    /// Write pair @p i to the dense vectors @p a and @p b.
+    template <class VecA, class VecB>
+    void scatter(index_t i, VecA &&a, VecB &&b) const {
+        a.setZero();
+        b.setZero();
+        for (index_t k = 0; k < J[i].size(); ++k) {
+            a(J[i](k)) = vals[i](k, 0);
+            b(J[i](k)) = vals[i](k, 1);
+        }
+    }
+    /// Write pair @p i to the dense vectors @p a and @p b, and mark it as
+    /// dense.
+    template <class VecA, class VecB>
+    void densify(index_t i, VecA &&a, VecB &&b) {
+        scatter(i, a, b);
+        set_dense(i);
+    }
+
+    /// Compute the inner product of vector @p c (0 or 1) of pair @p i with
+    /// the dense vector @p x.
+    template <class VecX>
+    real_t dot(index_t i, index_t c, const VecX &x) const {
+        real_t acc = 0;
+        for (index_t k = 0; k < J[i].size(); ++k)
+            acc += static_cast<real_t>(vals[i](k, c)) *
+                   static_cast<real_t>(x(J[i](k)));
+        return acc;
+    }
+    /// Compute the inner product of vector @p c of pair @p i with the dense
+    /// vector @p x, only including the indices j for which `in_J(j)` is true.
+    template <class VecX, class InJ>
+    real_t dot(index_t i, index_t c, const VecX &x, const InJ &in_J) const {
+        real_t acc = 0;
+        for (index_t k = 0; k < J[i].size(); ++k)
+            if (in_J(J[i](k)))
+                acc += static_cast<real_t>(vals[i](k, c)) *
+                       static_cast<real_t>(x(J[i](k)));
+        return acc;
+    }
+    /// Compute the inner product of vectors @p c and @p d of pair @p i, only
+    /// including the indices j for which `in_J(j)` is true.
+    template <class InJ>
+    real_t dot_pair(index_t i, index_t c, index_t d, const InJ &in_J) const {
+        real_t acc = 0;
+        for (index_t k = 0; k < J[i].size(); ++k)
+            if (in_J(J[i](k)))
+                acc += static_cast<real_t>(vals[i](k, c)) *
+                       static_cast<real_t>(vals[i](k, d));
+        return acc;
+    }
+    /// Compute the squared norm of vector @p c of pair @p i.
+    real_t squared_norm(index_t i, index_t c) const {
+        return vals[i].col(c).template cast<real_t>().squaredNorm();
+    }
+    /// Compute @f$ x \leftarrow x + a\,v @f$, where @f$ v @f$ is vector @p c
+    /// of pair @p i.
+    template <class VecX>
+    void axpy(index_t i, index_t c, real_t a, VecX &&x) const {
+        for (index_t k = 0; k < J[i].size(); ++k)
+            x(J[i](k)) += a * static_cast<real_t>(vals[i](k, c));
+    }
+    /// Compute @f$ x \leftarrow x + a\,v @f$, where @f$ v @f$ is vector @p c
+    /// of pair @p i, only updating the indices j for which `in_J(j)` is true.
+    template <class VecX, class InJ>
+    void axpy(index_t i, index_t c, real_t a, VecX &&x,
+              const InJ &in_J) const {
+        for (index_t k = 0; k < J[i].size(); ++k)
+            if (in_J(J[i](k)))
+                x(J[i](k)) += a * static_cast<real_t>(vals[i](k, c));
+    }
+    /// Scale vector @p c of pair @p i by @p factor.
+    void scale(index_t i, index_t c, real_t factor) {
+        vals[i].col(c) *= static_cast<StorageReal>(factor);
+    }
+
+    /// Indices of the nonzero elements of each pair.
+    std::vector<idvec> J;
+    /// Values of the two vectors of each pair, at the indices in @ref J.
+    std::vector<values_t> vals;
+    /// Whether each pair is stored sparsely.
+    std::vector<bool> sparse;
+    /// Number of pairs that are stored sparsely.
+    length_t count = 0;
+    /// Number of pairs (the size of @ref J, @ref vals and @ref sparse once
+    /// they are allocated).
+    length_t history = 0;
+};
+
+/// Check that the indices @p J of a sparse vector of size @p n are sorted,
+/// unique and in the range [0, n).
+inline bool valid_sparse_pattern(cridvec J, length_t n) {
+    for (index_t k = 0; k < J.size(); ++k)
+        if (J(k) < 0 || J(k) >= n || (k > 0 && J(k) <= J(k - 1)))
+            return false;
+    return true;
+}
+
+/// Dense workspace for a sparse vector whose sparsity pattern grows as other
+/// sparse vectors are added to it, see
+/// @ref BasicBroydenGood::update_sy_sparse. All elements outside of the
+/// pattern are zero.
+template <class Real>
+struct BasicSparseAccumulator {
+    USING_QUALA_TYPES(Real);
+
+    /// Allocate storage for vectors of size @p n, with an empty pattern.
+    void resize(length_t n) {
+        x.setZero(n);
+        mark.assign(n, false);
+        pattern.clear();
+    }
+    /// Add index @p j to the sparsity pattern.
+    void add(index_t j) {
+        if (not mark[j]) {
+            mark[j] = true;
+            pattern.push_back(j);
+        }
+    }
+    /// Get the number of indices in the sparsity pattern.
+    length_t size() const { return static_cast<length_t>(pattern.size()); }
+    /// Set the elements in the sparsity pattern to zero, and clear it.
+    void clear() {
+        for (index_t j : pattern) {
+            x(j)    = 0;
+            mark[j] = false;
+        }
+        pattern.clear();
+    }
+
+    /// Dense values.
+    vec x;
+    /// Whether each index is in the sparsity pattern.
+    std::vector<bool> mark;
+    /// Indices in the sparsity pattern, in the order they were added.
+    std::vector<index_t> pattern;
+};
+
+/// Get the values of the sparse vectors @p a and @p b at the union @p J of
+/// their sparsity patterns.
+template <class Real, int Options, class StorageIndex>
+void sparse_union(const Eigen::SparseVector<Real, Options, StorageIndex> &a,
+                  const Eigen::SparseVector<Real, Options, StorageIndex> &b,
+                  idvec &J, typename EigenConfig<Real>::vec &a_J,
+                  typename EigenConfig<Real>::vec &b_J) {
+    using It = typename Eigen::SparseVector<Real, Options,
+                                            StorageIndex>::InnerIterator;
+    const length_t max_nnz = a.nonZeros() + b.nonZeros();
+    J.resize(max_nnz);
+    a_J.resize(max_nnz);
+    b_J.resize(max_nnz);
+    // Both patterns are sorted, merge them
+    index_t k = 0;
+    It it_a(a), it_b(b);
+    for (; it_a || it_b; ++k) {
+        const bool take_a = it_a && (!it_b || it_a.index() <= it_b.index());
+        const bool take_b = it_b && (!it_a || it_b.index() <= it_a.index());
+        J(k)              = take_a ? it_a.index() : it_b.index();
+        a_J(k)            = take_a ? it_a.value() : Real(0);
+        b_J(k)            = take_b ? it_b.value() : Real(0);
+        if (take_a)
+            ++it_a;
+        if (take_b)
+            ++it_b;
+    }
+    J.conservativeResize(k);
+    a_J.conservativeResize(k);
+    b_J.conservativeResize(k);
+}
+
+} // namespace quala
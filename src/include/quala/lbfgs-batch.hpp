@@ -0,0 +1,446 @@
+#pragma once
+
+#include <quala/decl/lbfgs.hpp>
+#include <quala/detail/batch-kernels.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace quala {
+
+/**
+ * Limited-memory BFGS for a batch of independent minimization problems of the
+ * same dimension, which are advanced in lockstep.
+ *
+ * Uses the same update rules and the same two-loop recursion as
+ * @ref BasicLBFGS, but the histories of all B instances are stored in a single
+ * allocation, with the same block layout as @ref BasicAndersonAccelBatch: the
+ * instances are grouped in blocks of at most @ref block_size, and within a
+ * block, every vector of size n is stored as a column-major matrix with one
+ * row per instance. The vectors passed to @ref update_sy and @ref apply are
+ * B×n matrices (row b belongs to instance b). The inner products and the
+ * vector updates of the two-loop recursion then operate on contiguous arrays
+ * of instances, which are vectorized.
+ *
+ * Each instance has its own circular buffer index and history length, and
+ * its own acceptance of the updates (see @ref BasicLBFGS::update_status), and
+ * each call can be restricted to a subset of the instances. The instances
+ * that store their pairs in the same slots of their buffers are processed
+ * together: if they all accept the same updates, a single pass over the
+ * history suffices, otherwise the recursion costs one pass per distinct
+ * position in the buffers.
+ *
+ * The diagonal initial inverse Hessian approximation
+ * (@ref BasicLBFGSParams::diagonal_h0) is not supported. The options that
+ * select the algorithm, the threading and the storage of @ref BasicLBFGS are
+ * ignored.
+ *
+ * @tparam  Real
+ *          Floating point type.
+ *
+ * @ingroup accelerators-grp
+ */
+template <class Real>
+class BasicLBFGSBatch {
+  public:
+    USING_QUALA_TYPES(Real);
+    using Params = BasicLBFGSParams<real_t>;
+
+    /// Maximum number of instances that are stored and processed together, so
+    /// that their vectors stay in the cache during a call to @ref apply.
+    static constexpr length_t block_size = 64;
+
+    /// @param  params
+    ///         Parameters.
+    /// @param  n
+    ///         Problem dimension (size of the vectors).
+    /// @param  batch_size
+    ///         Number of instances B.
+    BasicLBFGSBatch(Params params, length_t n, length_t batch_size)
+        : params(params) {
+        resize(n, batch_size);
+    }
+
+    /// Change the problem dimension and the number of instances. Flushes the
+    /// history of all instances.
+    void resize(length_t n, length_t batch_size) {
+        const length_t m = params.memory;
+        if (m < 1)
+            throw std::invalid_argument("LBFGSBatch: memory must be >= 1");
+        if (params.diagonal_h0)
+            throw std::invalid_argument("LBFGSBatch: diagonal_h0 is not "
+                                        "supported");
+        this->n_ = n;
+        this->B  = batch_size;
+        this->S  = std::max(std::min(block_size, B), length_t{1});
+        // Layout of each block of S instances in the arena, in units of S (the
+        // index of the instance is innermost): s and y (m×n each), a
+        // workspace (n), ρ, yᵀy and α (m each), and the scalars.
+        off_y     = m * n * S;
+        off_q     = off_y + m * n * S;
+        off_ρ     = off_q + n * S;
+        off_yᵀy   = off_ρ + m * S;
+        off_α     = off_yᵀy + m * S;
+        off_w     = off_α + m * S;
+        block_len = off_w + num_scalars * S;
+        arena.setZero(((B + S - 1) / S) * block_len);
+        idx.setZero(B);
+        count.setZero(B);
+        slots.resize(B);
+        steps.reserve(m * m);
+        active.setConstant(B, false);
+        result.setConstant(B, false);
+    }
+
+    /// Update the inverse Hessian approximations of all instances using the
+    /// new vectors sₖ = xₖ₊₁ - xₖ and yₖ = pₖ₊₁ - pₖ (B×n matrices).
+    /// @p pₙₑₓₜᵀpₙₑₓₜ contains the squared norms of pₖ₊₁ of the instances,
+    /// which are only used by the cautious BFGS condition.
+    /// @return The instances whose update was accepted (valid until the next
+    ///         call to @ref update_sy or @ref apply).
+    const boolvec &update_sy(crmat s, crmat y, crvec pₙₑₓₜᵀpₙₑₓₜ) {
+        active.setConstant(true);
+        return update_sy_active(s, y, pₙₑₓₜᵀpₙₑₓₜ);
+    }
+    /// Same as @ref update_sy(crmat, crmat, crvec), but only for the instances
+    /// whose flag in @p mask is set.
+    const boolvec &update_sy(crmat s, crmat y, crvec pₙₑₓₜᵀpₙₑₓₜ,
+                             crboolvec mask) {
+        check_mask(mask, "update_sy");
+        active = mask;
+        return update_sy_active(s, y, pₙₑₓₜᵀpₙₑₓₜ);
+    }
+
+    /// Apply the inverse Hessian approximations of all instances to the rows
+    /// of the B×n matrix @p q. The initial inverse Hessian approximation is
+    /// set to @f$ H_0 = \gamma I @f$. If @p γ is negative,
+    /// @f$ H_0 = \frac{s^\top y}{y^\top y} I @f$, using the newest pair of
+    /// each instance.
+    /// @return The instances that have previous vectors s and y, and whose
+    ///         rows of @p q were updated (valid until the next call to
+    ///         @ref update_sy or @ref apply).
+    const boolvec &apply(rmat q, real_t γ = -1) {
+        active.setConstant(true);
+        return apply_active(q, γ);
+    }
+    /// Same as @ref apply(rmat, real_t), but only for the instances whose
+    /// flag in @p mask is set. The rows of @p q of the other instances are not
+    /// changed.
+    const boolvec &apply(rmat q, real_t γ, crboolvec mask) {
+        check_mask(mask, "apply");
+        active = mask;
+        return apply_active(q, γ);
+    }
+
+    /// Throw away the approximations of all instances.
+    void reset() {
+        idx.setZero();
+        count.setZero();
+    }
+    /// Throw away the approximation of instance @p b only.
+    void reset(index_t b) {
+        idx(b)   = 0;
+        count(b) = 0;
+    }
+
+    /// Get the problem dimension.
+    length_t n() const { return n_; }
+    /// Get the number of instances.
+    length_t batch_size() const { return B; }
+    /// Get the size of the s and y buffers.
+    length_t history() const { return params.memory; }
+    /// Get the number of (s, y) pairs currently stored in the buffer of
+    /// instance @p b.
+    length_t current_history(index_t b) const { return count(b); }
+
+    /// Get the parameters.
+    const Params &get_params() const { return params; }
+
+  private:
+    using block_t = Eigen::Map<mat, 0, Eigen::OuterStride<>>;
+    using lanes_t = Eigen::Map<Eigen::Array<real_t, Eigen::Dynamic, 1>>;
+
+    /// Index in the arena of instance @p b, at offset zero of its block.
+    index_t lane_index(index_t b) const {
+        return (b / S) * block_len + b % S;
+    }
+    /// Mutable view of the instances b0 to b0+nb (which have to belong to the
+    /// same block) of the vectors of size n at offset @p off of the blocks.
+    block_t block(index_t off, index_t b0, length_t nb) {
+        return {arena.data() + lane_index(b0) + off, nb, n_,
+                Eigen::OuterStride<>(S)};
+    }
+    /// Mutable view of the instances b0 to b0+nb (which have to belong to the
+    /// same block) of the scalars at offset @p off of the blocks.
+    lanes_t lanes(index_t off, index_t b0, length_t nb) {
+        return {arena.data() + lane_index(b0) + off, nb};
+    }
+
+    void check_dims(crmat v, const char *func) const {
+        if (v.rows() != B || v.cols() != n_)
+            throw std::invalid_argument(std::string("LBFGSBatch::") + func +
+                                        ": dimension mismatch");
+    }
+    void check_mask(crboolvec mask, const char *func) const {
+        if (mask.size() != B)
+            throw std::invalid_argument(std::string("LBFGSBatch::") + func +
+                                        ": mask size mismatch");
+    }
+
+    /// Call @p f(p) for every distinct slot p ≥ 0 in @ref slots of the
+    /// instances b0 to b0+nb, after setting the flags @p w of the instances
+    /// that use slot p.
+    template <class F>
+    void foreach_slot(index_t b0, length_t nb, lanes_t &w, F &&f) {
+        auto sl = slots.segment(b0, nb);
+        for (index_t k0 = 0; k0 < nb; ++k0) {
+            const index_t p = sl(k0);
+            if (p < 0)
+                continue;
+            for (index_t k = 0; k < nb; ++k) {
+                w(k) = k >= k0 && sl(k) == p;
+                if (w(k) != 0)
+                    sl(k) = -1;
+            }
+            f(p);
+        }
+    }
+
+    const boolvec &update_sy_active(crmat s, crmat y, crvec pᵀp) {
+        check_dims(s, "update_sy");
+        check_dims(y, "update_sy");
+        if (pᵀp.size() != B)
+            throw std::invalid_argument("LBFGSBatch::update_sy: dimension "
+                                        "mismatch");
+        result.setConstant(false);
+        for (index_t b0 = 0; b0 < B; b0 += S) {
+            const length_t nb = std::min(S, B - b0);
+            if (active.segment(b0, nb).any())
+                update_sy_block(b0, nb, s.middleRows(b0, nb),
+                                y.middleRows(b0, nb), pᵀp.segment(b0, nb));
+        }
+        return result;
+    }
+
+    const boolvec &apply_active(rmat q, real_t γ) {
+        check_dims(q, "apply");
+        result = active && (count.array() > 0);
+        for (index_t b0 = 0; b0 < B; b0 += S) {
+            const length_t nb = std::min(S, B - b0);
+            if (result.segment(b0, nb).any())
+                apply_block(b0, nb, q.middleRows(b0, nb), γ);
+        }
+        return result;
+    }
+
+    /// @ref update_sy for the instances b0 to b0+nb, which belong to the same
+    /// block.
+    template <class MatS, class MatY, class VecP>
+    void update_sy_block(index_t b0, length_t nb, const MatS &s,
+                         const MatY &y, const VecP &pᵀp) {
+        const length_t n = n_, m = history(), S = this->S;
+        const auto scalar = [&](index_t k) {
+            return lanes(off_w + k * S, b0, nb);
+        };
+        auto w = scalar(0), yᵀs = scalar(1), sᵀs = scalar(2), yᵀy = scalar(3);
+        auto a_yᵀs = scalar(4);
+        // All inner products in a single pass over the columns of s and y,
+        // which are usually far apart (B elements), so they are not
+        // traversed in the order of batch_dot
+        yᵀs.setZero(), sᵀs.setZero(), yᵀy.setZero();
+        for (index_t i = 0; i < n; ++i) {
+            const auto sᵢ = s.col(i).array(), yᵢ = y.col(i).array();
+            yᵀs += yᵢ * sᵢ;
+            sᵀs += sᵢ.square();
+            yᵀy += yᵢ.square();
+        }
+
+        // Check if the updates are accepted, see update_status
+        if (params.force_pos_def)
+            a_yᵀs = yᵀs;
+        else
+            a_yᵀs = yᵀs.abs();
+        auto acc = result.segment(b0, nb);
+        acc      = active.segment(b0, nb) && (sᵀs > params.min_abs_s) &&
+              yᵀs.isFinite() && (a_yᵀs > params.min_div_fac * sᵀs);
+        if (params.cbfgs) {
+            const real_t α = params.cbfgs.α, ϵ = params.cbfgs.ϵ;
+            acc = acc && (a_yᵀs >= sᵀs * ϵ * pᵀp.array().pow(α / 2));
+        }
+
+        // Store the new pairs at the index in the circular buffer of each
+        // instance
+        auto sl = slots.segment(b0, nb);
+        for (index_t k = 0; k < nb; ++k)
+            sl(k) = acc(k) ? idx(b0 + k) : -1;
+        auto ρₖ = scalar(4); // a_yᵀs is no longer needed
+        ρₖ      = yᵀs.inverse();
+        foreach_slot(b0, nb, w, [&](index_t p) {
+            const auto blend = [&](real_t *x, const real_t *v) {
+                batch_blend(x, v, w.data(), nb);
+            };
+            auto sp = block(p * n * S, b0, nb);
+            auto yp = block(off_y + p * n * S, b0, nb);
+            for (index_t i = 0; i < n; ++i) {
+                blend(sp.col(i).data(), s.col(i).data());
+                blend(yp.col(i).data(), y.col(i).data());
+            }
+            blend(lanes(off_ρ + p * S, b0, nb).data(), ρₖ.data());
+            blend(lanes(off_yᵀy + p * S, b0, nb).data(), yᵀy.data());
+        });
+        for (index_t k = 0; k < nb; ++k) {
+            const index_t b = b0 + k;
+            if (not acc(k))
+                continue;
+            idx(b)   = (idx(b) + 1) % m;
+            count(b) = std::min(count(b) + 1, m);
+        }
+    }
+
+    /// @ref apply for the instances b0 to b0+nb, which belong to the same
+    /// block, see @ref BasicLBFGS::apply_two_loop. The pairs are visited in
+    /// order of age, and the slots in the buffers that hold the pair of a
+    /// given age depend on the instance.
+    template <class MatQ>
+    void apply_block(index_t b0, length_t nb, MatQ &&q_out, real_t γ) {
+        const length_t n = n_, m = history(), S = this->S;
+        const auto act   = result.segment(b0, nb);
+        const auto s = [&](index_t p) { return block(p * n * S, b0, nb); };
+        const auto y = [&](index_t p) {
+            return block(off_y + p * n * S, b0, nb);
+        };
+        const auto ρ = [&](index_t p) { return lanes(off_ρ + p * S, b0, nb); };
+        const auto α = [&](index_t j) { return lanes(off_α + j * S, b0, nb); };
+        const auto scalar = [&](index_t k) {
+            return lanes(off_w + k * S, b0, nb);
+        };
+        auto w = scalar(0), t = scalar(1), c = scalar(2), h₀ = scalar(3);
+        const auto blend = [&](real_t *x, const real_t *v) {
+            batch_blend(x, v, w.data(), nb);
+        };
+        // Slot of the pair with age j (zero is the newest pair) of instance b
+        const auto slot = [&](index_t b, index_t j) {
+            return (idx(b) + m - 1 - j) % m;
+        };
+
+        // Each step of the recursion handles the pairs with age j that are
+        // stored in slot p (of the instances that have such a pair), encoded
+        // as j m + p, from the newest to the oldest pairs. If all instances
+        // are in lockstep, there is a single step per age.
+        const index_t jmax =
+            act.select(count.segment(b0, nb).array(), index_t{0}).maxCoeff();
+        steps.clear();
+        auto sl = slots.segment(b0, nb);
+        for (index_t j = 0; j < jmax; ++j) {
+            for (index_t k = 0; k < nb; ++k) {
+                const index_t b = b0 + k;
+                sl(k) = act(k) && j < count(b) ? slot(b, j) : -1;
+            }
+            foreach_slot(b0, nb, w,
+                         [&](index_t p) { steps.push_back(j * m + p); });
+        }
+        // Set the flags w of the instances that participate in a step
+        const auto select = [&](index_t step) {
+            const index_t j = step / m, p = step % m;
+            for (index_t k = 0; k < nb; ++k) {
+                const index_t b = b0 + k;
+                w(k) = act(k) && j < count(b) && slot(b, j) == p;
+            }
+        };
+
+        // Each update of q is fused with the inner product of the next step,
+        // so q is read only once per step (the updates of the instances that
+        // don't participate in a step are zero, and their inner products
+        // are not used).
+        // The rows of q are copied to the workspace, because the columns of
+        // q_out are usually far apart (B elements), which would cause
+        // conflict misses in the cache when they are traversed repeatedly
+        auto q = block(off_q, b0, nb);
+        q      = q_out;
+        const index_t num_steps = steps.size();
+        h₀.setConstant(γ < 0 ? 1 : γ);
+        h₀ = act.select(h₀, 1);
+        batch_dot(t, s(steps[0] % m), q);
+        for (index_t st = 0; st < num_steps; ++st) {
+            // αⱼ = ρⱼ〈sⱼ, q〉, q -= αⱼ yⱼ
+            const index_t j = steps[st] / m, p = steps[st] % m;
+            select(steps[st]);
+            c = (w != 0).select(ρ(p) * t, 0);
+            blend(α(j).data(), c.data());
+            // If the step size is negative, compute it as sᵀy/yᵀy, using
+            // the newest pair
+            if (j == 0 && γ < 0) {
+                t = (ρ(p) * lanes(off_yᵀy + p * S, b0, nb)).inverse();
+                blend(h₀.data(), t.data());
+            }
+            c = -c;
+            // The last update is combined with r ← H₀ q and with the first
+            // inner product of the second loop (of the same pairs)
+            if (st + 1 < num_steps)
+                batch_axpy_dot(c.data(), y(p), q, nullptr,
+                               s(steps[st + 1] % m), t);
+            else
+                batch_axpy_dot(c.data(), y(p), q, h₀.data(), y(p), t);
+        }
+        for (index_t st = num_steps; st-- > 0;) {
+            // βⱼ = ρⱼ〈yⱼ, q〉, q += (αⱼ - βⱼ) sⱼ
+            const index_t j = steps[st] / m, p = steps[st] % m;
+            select(steps[st]);
+            c = (w != 0).select(α(j) - ρ(p) * t, 0);
+            if (st > 0) {
+                batch_axpy_dot(c.data(), s(p), q, nullptr,
+                               y(steps[st - 1] % m), t);
+            } else {
+                auto sp = s(p);
+                for (index_t i = 0; i < n; ++i)
+                    q.col(i).array() += c * sp.col(i).array();
+            }
+        }
+        w = act.template cast<real_t>();
+        for (index_t i = 0; i < n; ++i)
+            blend(q_out.col(i).data(), q.col(i).data());
+    }
+
+  private:
+    Params params;
+    length_t n_ = 0;
+    length_t B  = 0;
+    /// Number of instances per block of the arena.
+    length_t S = 1;
+    /// Number of scalar workspaces per instance at the end of each block.
+    static constexpr length_t num_scalars = 5;
+    /// Storage for the pairs (s, y), the values of ρ = 1/yᵀs and yᵀy, and the
+    /// workspaces of all instances, in consecutive blocks of @ref S
+    /// instances, so that the data of the instances that are processed
+    /// together is contiguous. The pairs of each instance are stored in a
+    /// circular buffer.
+    vec arena;
+    /// Offsets of the different parts of a block of @ref arena.
+    index_t off_y, off_q, off_ρ, off_yᵀy, off_α, off_w;
+    /// Size of a block of @ref arena.
+    length_t block_len;
+    /// Index in the circular buffer where the next pair of each instance is
+    /// stored.
+    idvec idx;
+    /// Number of pairs in the circular buffer of each instance.
+    idvec count;
+    /// Slots in the circular buffers that are accessed by the current step,
+    /// for each instance (-1 if not accessed).
+    idvec slots;
+    /// Steps of the two-loop recursion of the current block, see
+    /// @ref apply_block.
+    std::vector<index_t> steps;
+    /// Instances updated by the current call to @ref update_sy or
+    /// @ref apply.
+    boolvec active;
+    /// Instances whose update was accepted by the last call to
+    /// @ref update_sy, or that were updated by the last call to @ref apply.
+    boolvec result;
+};
+
+/// @ref BasicLBFGSBatch for the default floating point type.
+using LBFGSBatch = BasicLBFGSBatch<real_t>;
+
+} // namespace quala
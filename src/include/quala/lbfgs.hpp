@@ -1,21 +1,32 @@
 #pragma once
 
 #include <quala/decl/lbfgs.hpp>
+#include <quala/detail/lbfgs-helpers.hpp>
+#include <cstdint>
 #include <stdexcept>
+#include <tuple>
 #include <type_traits>
 
 namespace quala {
 
-inline bool LBFGS::update_valid(const LBFGSParams &params, real_t yᵀs,
-                                real_t sᵀs, real_t pᵀp) {
+template <class Real, class StorageReal, length_t N, length_t M>
+bool BasicLBFGS<Real, StorageReal, N, M>::update_valid(const Params &params,
+                                                       real_t yᵀs, real_t sᵀs,
+                                                       real_t pᵀp) {
+    return update_status(params, yᵀs, sᵀs, pᵀp) == UpdateStatus::Accepted;
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+UpdateStatus BasicLBFGS<Real, StorageReal, N, M>::update_status(
+    const Params &params, real_t yᵀs, real_t sᵀs, real_t pᵀp) {
     // Check if this L-BFGS update is accepted
     if (sᵀs <= params.min_abs_s)
-        return false;
+        return UpdateStatus::SmallStep;
     if (not std::isfinite(yᵀs))
-        return false;
+        return UpdateStatus::NonFinite;
     real_t a_yᵀs = params.force_pos_def ? yᵀs : std::abs(yᵀs);
     if (a_yᵀs <= params.min_div_fac * sᵀs)
-        return false;
+        return UpdateStatus::Curvature;
 
     // CBFGS condition: https://epubs.siam.org/doi/10.1137/S1052623499354242
     if (params.cbfgs) {
@@ -24,27 +35,93 @@ inline bool LBFGS::update_valid(const LBFGSParams &params, real_t yᵀs,
         // Condition: yᵀs / sᵀs >= ϵ ‖p‖^α
         bool cbfgs_cond = a_yᵀs >= sᵀs * ϵ * std::pow(pᵀp, α / 2);
         if (not cbfgs_cond)
-            return false;
+            return UpdateStatus::CBFGS;
     }
 
-    return true;
+    return UpdateStatus::Accepted;
 }
 
+template <class Real, class StorageReal, length_t N, length_t M>
 template <class VecS, class VecY>
-inline bool LBFGS::update_sy(const anymat<VecS> &s, const anymat<VecY> &y,
-                             real_t pₙₑₓₜᵀpₙₑₓₜ, bool forced) {
-    real_t yᵀs = y.dot(s);
-    real_t ρ   = 1 / yᵀs;
-    if (not forced) {
-        real_t sᵀs = s.squaredNorm();
-        if (not update_valid(params, yᵀs, sᵀs, pₙₑₓₜᵀpₙₑₓₜ))
-            return false;
+bool BasicLBFGS<Real, StorageReal, N, M>::update_sy(const anymat<VecS> &s,
+                                                    const anymat<VecY> &y,
+                                                    real_t pₙₑₓₜᵀpₙₑₓₜ,
+                                                    bool forced) {
+    QUALA_STATS(OpTimer timer(stats.update));
+    // The update is checked using the vectors as they will be stored, so the
+    // values of ρ remain consistent with the stored vectors if the storage
+    // precision is lower than the precision of the computations.
+    const auto sₛ = s.template cast<storage_real_t>().template cast<real_t>();
+    const auto yₛ = y.template cast<storage_real_t>().template cast<real_t>();
+    // The diagonal estimate of H₀ is safeguarded using sᵀy/yᵀy
+    const bool diag_h0 = params.diagonal_h0;
+    real_t yᵀs, sᵀs = 0, yᵀy = 0;
+    if (par.reducing()) {
+        // All inner products in a single pass over the chunks, and a single
+        // reduction
+        auto dots = par.reduce(diag_h0 ? 3 : 2, [&](index_t i, length_t bs,
+                                                    auto &&out, mat &) {
+            auto sᵢ = sₛ.segment(i, bs), yᵢ = yₛ.segment(i, bs);
+            out(0)  = yᵢ.dot(sᵢ);
+            out(1)  = forced ? real_t(0) : sᵢ.squaredNorm();
+            if (diag_h0)
+                out(2) = yᵢ.squaredNorm();
+        });
+        yᵀs = dots(0);
+        sᵀs = dots(1);
+        if (diag_h0)
+            yᵀy = dots(2);
+    } else {
+        yᵀs = yₛ.dot(sₛ);
+        if (not forced)
+            sᵀs = sₛ.squaredNorm();
+        if (diag_h0)
+            yᵀy = yₛ.squaredNorm();
     }
+    real_t ρ = 1 / yᵀs;
+    const auto status =
+        forced ? UpdateStatus::Accepted
+               : update_status(params, yᵀs, sᵀs, pₙₑₓₜᵀpₙₑₓₜ);
+    QUALA_STATS(stats.count(status));
+    if (status != UpdateStatus::Accepted)
+        return false;
+    if (undo.needs_save(idx))
+        undo.save(idx, sto.s(idx), sto.y(idx), sto.ρ(idx));
+    sparse.set_dense(idx);
 
-    // Store the new s and y vectors
-    sto.s(idx) = s;
-    sto.y(idx) = y;
+    // Store the new s and y vectors, and update the diagonal estimate of H₀
+    // while they are still in cache
+    const real_t β = 1 - real_t(1) / history(), γ = diag_h0 ? yᵀs / yᵀy : 0;
+    const auto store = [&](index_t i, length_t bs) {
+        auto sᵢ = sto.s(idx).segment(i, bs), yᵢ = sto.y(idx).segment(i, bs);
+        sᵢ      = s.segment(i, bs).template cast<storage_real_t>();
+        yᵢ      = y.segment(i, bs).template cast<storage_real_t>();
+        if (diag_h0)
+            diag.update(i, bs, sᵢ.template cast<real_t>(),
+                        yᵢ.template cast<real_t>(), β, γ,
+                        params.diagonal_h0_bound);
+    };
+    if (par.parallel()) {
+        par.foreach_chunk([&](index_t i, length_t bs, mat &) { store(i, bs); });
+    } else if (diag_h0) {
+        store(0, n());
+    } else {
+        sto.s(idx) = s.template cast<storage_real_t>();
+        sto.y(idx) = y.template cast<storage_real_t>();
+    }
     sto.ρ(idx) = ρ;
+    if (keeps_gram())
+        update_gram(idx);
+    QUALA_STATS({
+        // Inner products, storing s and y, and the new columns of WᵀW
+        const double n = this->n();
+        const double k = keeps_gram() ? (full ? history() : idx + 1) : 0;
+        stats.update.add_cost(6 * n + 8 * n * k,
+                              4 * n * sizeof(real_t) +
+                                  (2 + 2 * k) * n * sizeof(storage_real_t));
+    });
+    if (params.cache_masked_apply)
+        masked.valid[idx] = false;
 
     // Increment the index in the circular buffer
     idx = succ(idx);
@@ -53,52 +130,562 @@ inline bool LBFGS::update_sy(const anymat<VecS> &s, const anymat<VecY> &y,
     return true;
 }
 
-inline bool LBFGS::update(crvec xₖ, crvec xₙₑₓₜ, crvec pₖ, crvec pₙₑₓₜ, Sign sign,
-                          bool forced) {
+template <class Real, class StorageReal, length_t N, length_t M>
+bool BasicLBFGS<Real, StorageReal, N, M>::update_sy_sparse(
+    cridvec J, crvec s_J, crvec y_J, real_t pₙₑₓₜᵀpₙₑₓₜ, bool forced) {
+    if (s_J.size() != J.size() || y_J.size() != J.size())
+        throw std::invalid_argument("LBFGS::update_sy_sparse: values must "
+                                    "have the same size as the indices");
+    if (not valid_sparse_pattern(J, n()))
+        throw std::invalid_argument("LBFGS::update_sy_sparse: indices must "
+                                    "be sorted, unique and smaller than n");
+    // Pairs that are too dense are scattered into the dense storage
+    if (not supports_sparse() ||
+        static_cast<real_t>(J.size()) > params.sparse_max_density * n()) {
+        sparse_work.resize(n(), 2);
+        sparse_work.setZero();
+        for (index_t k = 0; k < J.size(); ++k) {
+            sparse_work(J(k), 0) = s_J(k);
+            sparse_work(J(k), 1) = y_J(k);
+        }
+        return update_sy(sparse_work.col(0), sparse_work.col(1),
+                         pₙₑₓₜᵀpₙₑₓₜ, forced);
+    }
+    QUALA_STATS(OpTimer timer(stats.update));
+    // Check the update using the vectors as they will be stored, see
+    // update_sy
+    const auto sₛ = s_J.template cast<storage_real_t>().template cast<real_t>();
+    const auto yₛ = y_J.template cast<storage_real_t>().template cast<real_t>();
+    const real_t yᵀs = yₛ.dot(sₛ);
+    const real_t sᵀs = forced ? real_t(0) : sₛ.squaredNorm();
+    const auto status =
+        forced ? UpdateStatus::Accepted
+               : update_status(params, yᵀs, sᵀs, pₙₑₓₜᵀpₙₑₓₜ);
+    QUALA_STATS(stats.count(status));
+    if (status != UpdateStatus::Accepted)
+        return false;
+
+    sparse.store(idx, J, s_J, y_J);
+    sto.ρ(idx) = 1 / yᵀs;
+    QUALA_STATS({
+        const double nnz = J.size();
+        stats.update.add_cost(4 * nnz, 2 * nnz * sizeof(real_t) +
+                                           nnz * sizeof(index_t) +
+                                           2 * nnz * sizeof(storage_real_t));
+    });
+
+    // Increment the index in the circular buffer
+    idx = succ(idx);
+    full |= idx == 0;
+
+    return true;
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+bool BasicLBFGS<Real, StorageReal, N, M>::update_sy(
+    const Eigen::SparseVector<real_t> &s, const Eigen::SparseVector<real_t> &y,
+    real_t pₙₑₓₜᵀpₙₑₓₜ, bool forced) {
+    if (s.size() != n() || y.size() != n())
+        throw std::invalid_argument("LBFGS::update_sy: vectors must have "
+                                    "size n");
+    idvec J;
+    vec s_J, y_J;
+    sparse_union(s, y, J, s_J, y_J);
+    return update_sy_sparse(J, s_J, y_J, pₙₑₓₜᵀpₙₑₓₜ, forced);
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+bool BasicLBFGS<Real, StorageReal, N, M>::update(crvec xₖ, crvec xₙₑₓₜ,
+                                                 crvec pₖ, crvec pₙₑₓₜ,
+                                                 Sign sign, bool forced) {
     const auto s = xₙₑₓₜ - xₖ;
     const auto y = (sign == Sign::Positive) ? pₙₑₓₜ - pₖ : pₖ - pₙₑₓₜ;
-    real_t pₙₑₓₜᵀpₙₑₓₜ = params.cbfgs ? pₙₑₓₜ.squaredNorm() : 0;
+    real_t pₙₑₓₜᵀpₙₑₓₜ = params.cbfgs ? par.dot(pₙₑₓₜ, pₙₑₓₜ) : 0;
     return update_sy(s, y, pₙₑₓₜᵀpₙₑₓₜ, forced);
 }
 
-inline bool LBFGS::apply(rvec q, real_t γ) {
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::update_gram(index_t i) {
+    // Only the columns of valid pairs (including the new one) are used
+    length_t k = full ? history() : i + 1;
+    auto W     = sto.sto.map().topLeftCorner(n(), 2 * k);
+    auto &G    = compact.gram;
+    // Compute the new columns of WᵀW, [s y]ᵀW is simply their transpose
+    par.matmul_tn(W, W.middleCols(2 * i, 2),
+                  G.middleCols(2 * i, 2).topRows(2 * k));
+    G.middleRows(2 * i, 2).leftCols(2 * k) =
+        G.middleCols(2 * i, 2).topRows(2 * k).transpose().eval();
+    compact.invalidate_hessian();
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply(rvec q, real_t γ) {
+    QUALA_STATS(OpTimer timer(stats.apply));
+    // Only apply if we have previous vectors s and y
+    if (idx == 0 && not full)
+        return false;
+    QUALA_STATS(add_apply_cost(stats.apply, n(), 1));
+    if (uses_diagonal_h0(γ))
+        return apply_two_loop(par, q, crvec(diag.d), sto.ρα.row(1));
+    if (uses_compact())
+        return apply_compact(q, γ);
+    return apply_two_loop(par, q, γ, sto.ρα.row(1));
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply(rvec q, real_t γ,
+                                                Workspace &ws) const {
+    // Only apply if we have previous vectors s and y
+    if (idx == 0 && not full)
+        return false;
+    if (ws.α.size() < history())
+        ws.resize(history());
+    if (uses_diagonal_h0(γ))
+        return apply_two_loop(par.serial(), q, crvec(diag.d), ws.α);
+    return apply_two_loop(par.serial(), q, γ, ws.α);
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply(rvec q, crvec d) {
+    if (d.size() != n())
+        throw std::invalid_argument("LBFGS::apply: diagonal of H₀ must have "
+                                    "size n");
+    QUALA_STATS(OpTimer timer(stats.apply));
+    // Only apply if we have previous vectors s and y
+    if (idx == 0 && not full)
+        return false;
+    QUALA_STATS(add_apply_cost(stats.apply, n(), 1));
+    return apply_two_loop(par, q, d, sto.ρα.row(1));
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+template <class Kernels, class H0, class VecA>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply_two_loop(Kernels &&ker,
+                                                         rvec q, H0 h0,
+                                                         VecA &&α) const {
+    if (sparse.count > 0)
+        return apply_two_loop_sparse(ker, q, h0, α);
+    // Each update of q is fused with the dot product of the next iteration,
+    // so q is read only once per pair of vectors s and y.
+    // If the history is stored in a file, the next pair is prefetched.
+    const index_t oldest = full ? idx : 0, newest = pred(idx);
+    index_t j = -1; // index of the previous pair
+    foreach_rev([&](index_t i) {
+        if (i != oldest)
+            prefetch(pred(i));
+        // q -= αⱼ yⱼ, αᵢ = ρᵢ〈sᵢ, q〉
+        real_t sᵀq;
+        if (j >= 0) {
+            sᵀq = ker.axpy_dot(α(j), y(j), q, 1, s(i));
+        } else if constexpr (std::is_arithmetic_v<H0>) {
+            if (h0 < 0) {
+                // If the step size is negative, compute it as sᵀy/yᵀy, using
+                // the newest pair (the first one in this loop), together with
+                // its first inner product
+                real_t yᵀy;
+                std::tie(sᵀq, yᵀy) = ker.dot2(s(i), q, y(i), y(i));
+                h0                 = 1 / (ρ(i) * yᵀy);
+            } else {
+                sᵀq = ker.dot(s(i), q);
+            }
+        } else {
+            sᵀq = ker.dot(s(i), q);
+        }
+        α(i) = ρ(i) * sᵀq;
+        j    = i;
+    });
+
+    // q -= αⱼ yⱼ, r ← H₀ q, fused with the first dot product of the second
+    // loop (j is the oldest pair, which is also the first one below)
+    real_t yᵀq = ker.axpy_dot(α(j), y(j), q, h0, y(j));
+
+    real_t βmα = 0; // βⱼ - αⱼ
+    foreach_fwd([&](index_t i) {
+        if (i != newest)
+            prefetch(succ(i));
+        // q -= (βⱼ - αⱼ) sⱼ, βᵢ = ρᵢ〈yᵢ, q〉
+        if (i != j)
+            yᵀq = ker.axpy_dot(βmα, s(j), q, 1, y(i));
+        βmα = ρ(i) * yᵀq - α(i);
+        j   = i;
+    });
+    ker.axpy(-βmα, s(j), q);
+
+    return true;
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+template <class Kernels, class H0, class VecA>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply_two_loop_sparse(
+    Kernels &&ker, rvec q, H0 h0, VecA &&α) const {
+    // Inner product of q with s (c = 0) or y (c = 1) of pair i
+    const auto dot = [&](index_t i, index_t c) {
+        if (sparse.is_sparse(i))
+            return sparse.dot(i, c, q);
+        return ker.dot(c == 0 ? s(i) : y(i), q);
+    };
+    // q += a s (c = 0) or q += a y (c = 1) of pair i
+    const auto axpy = [&](index_t i, index_t c, real_t a) {
+        if (sparse.is_sparse(i))
+            sparse.axpy(i, c, a, q);
+        else
+            ker.axpy(a, c == 0 ? s(i) : y(i), q);
+    };
+
+    // If the step size is negative, compute it as sᵀy/yᵀy, using the newest
+    // pair
+    if constexpr (std::is_arithmetic_v<H0>) {
+        if (h0 < 0) {
+            const index_t i  = pred(idx);
+            const real_t yᵀy = sparse.is_sparse(i) ? sparse.squared_norm(i, 1)
+                                                   : ker.dot(y(i), y(i));
+            h0               = 1 / (ρ(i) * yᵀy);
+        }
+    }
+
+    foreach_rev([&](index_t i) {
+        α(i) = ρ(i) * dot(i, 0); // αᵢ = ρᵢ〈sᵢ, q〉
+        axpy(i, 1, -α(i));       // q -= αᵢ yᵢ
+    });
+
+    // r ← H₀ q
+    if constexpr (std::is_arithmetic_v<H0>)
+        q *= h0;
+    else
+        q = h0.cwiseProduct(q);
+
+    foreach_fwd([&](index_t i) {
+        real_t β = ρ(i) * dot(i, 1); // βᵢ = ρᵢ〈yᵢ, q〉
+        axpy(i, 0, α(i) - β);        // q -= (βᵢ - αᵢ) sᵢ
+    });
+
+    return true;
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply_mat(rmat Q, real_t γ) {
+    QUALA_STATS(OpTimer timer(stats.apply));
     // Only apply if we have previous vectors s and y
     if (idx == 0 && not full)
         return false;
+    densify();
+    QUALA_STATS(add_apply_cost(stats.apply, n(), Q.cols()));
+    if (uses_diagonal_h0(γ))
+        return apply_two_loop(Q, crvec(diag.d));
+    if (uses_compact())
+        return apply_compact(Q, γ);
+    return apply_two_loop(Q, γ);
+}
 
+template <class Real, class StorageReal, length_t N, length_t M>
+template <class H0>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply_two_loop(rmat Q, H0 h0) {
+    // If the step size is negative, compute it as sᵀy/yᵀy
+    if constexpr (std::is_arithmetic_v<H0>) {
+        if (h0 < 0) {
+            auto new_idx = pred(idx);
+            real_t yᵀy   = par.dot(y(new_idx), y(new_idx));
+            h0           = 1 / (ρ(new_idx) * yᵀy);
+        }
+    }
+
+    // The scalars α and β of the vector version become rows of length k,
+    // the last row is used for β
+    α_mat.resize(history() + 1, Q.cols());
+    auto β = α_mat.row(history());
+
+    // If the history is stored in a file, the next pair is prefetched
+    const index_t oldest = full ? idx : 0, newest = pred(idx);
+    foreach_rev([&](index_t i) {
+        if (i != oldest)
+            prefetch(pred(i));
+        par.matmul_tn(s(i), Q, α_mat.row(i));
+        α_mat.row(i) *= ρ(i);
+        par.matmul_add(y(i), -α_mat.row(i), Q);
+    });
+
+    // R ← H₀ Q
+    par.scale_rows(h0, Q);
+
+    foreach_fwd([&](index_t i) {
+        if (i != newest)
+            prefetch(succ(i));
+        // Overwrite α by β - α
+        par.matmul_tn(y(i), Q, β);
+        α_mat.row(i) = ρ(i) * β - α_mat.row(i);
+        par.matmul_add(s(i), -α_mat.row(i), Q);
+    });
+
+    return true;
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply_compact(rmat Q, real_t γ) {
     // If the step size is negative, compute it as sᵀy/yᵀy
     if (γ < 0) {
         auto new_idx = pred(idx);
-        real_t yᵀy   = y(new_idx).squaredNorm();
-        γ            = 1 / (ρ(new_idx) * yᵀy);
+        γ = compact.sᵀy(new_idx, new_idx) / compact.yᵀy(new_idx, new_idx);
     }
 
-    foreach_rev([&](index_t i) {
-        α(i) = ρ(i) * s(i).dot(q);
-        q -= α(i) * y(i);
+    // Compact representation (Byrd, Nocedal, Schnabel, 1994, Thm. 2.2):
+    //
+    //   H = γI + [S γY] ⎡ R⁻ᵀ(D + γYᵀY)R⁻¹  -R⁻ᵀ ⎤ ⎡ Sᵀ ⎤
+    //                   ⎣ -R⁻¹               0   ⎦ ⎣γYᵀ ⎦
+    //
+    // where the columns of S and Y are in chronological order, R is the upper
+    // triangular part of SᵀY and D is its diagonal.
+    // With U = R⁻¹ SᵀQ, this gives
+    //
+    //   HQ = γQ + S R⁻ᵀ((D + γYᵀY)U - γYᵀQ) - γY U.
+
+    const length_t k = current_history(), K = Q.cols();
+    // The workspaces only grow, so alternating between vectors and matrices
+    // doesn't reallocate them
+    if (compact.WᵀQ.cols() < K)
+        compact.resize_rhs(compact.D.size(), K);
+
+    // Only the columns of valid pairs are used, which are always the first
+    // 2k columns of the storage (s and y interleaved).
+    auto W        = sto.sto.map().topLeftCorner(n(), 2 * k);
+    auto WᵀQ = compact.WᵀQ.topLeftCorner(2 * k, K);
+    // First pass over the history
+    par.matmul_tn(W, Q, WᵀQ);
+
+    // Gather the small matrices in chronological order
+    auto R     = compact.R.topLeftCorner(k, k);
+    auto DγYᵀY = compact.DγYᵀY.topLeftCorner(k, k);
+    auto U     = compact.U.topLeftCorner(k, K);
+    auto YᵀQ   = compact.YᵀQ.topLeftCorner(k, K);
+    index_t c  = 0;
+    foreach_fwd([&](index_t i) {
+        index_t r = 0;
+        foreach_fwd([&](index_t j) {
+            R(r, c)     = compact.sᵀy(j, i);
+            DγYᵀY(r, c) = γ * compact.yᵀy(j, i);
+            ++r;
+        });
+        DγYᵀY(c, c) += R(c, c);
+        U.row(c)   = WᵀQ.row(2 * i);
+        YᵀQ.row(c) = WᵀQ.row(2 * i + 1);
+        ++c;
     });
 
-    // r ← H₀ q
-    q *= γ;
+    // U = R⁻¹ SᵀQ
+    R.template triangularView<Eigen::Upper>().solveInPlace(U);
+    // Sᵀ coefficients: R⁻ᵀ((D + γYᵀY)U - γYᵀQ)
+    YᵀQ = DγYᵀY * U - γ * YᵀQ;
+    R.template triangularView<Eigen::Upper>().transpose().solveInPlace(YᵀQ);
+
+    // Scatter the coefficients back to the order of the storage
+    c = 0;
+    foreach_fwd([&](index_t i) {
+        WᵀQ.row(2 * i)     = YᵀQ.row(c);
+        WᵀQ.row(2 * i + 1) = -γ * U.row(c);
+        ++c;
+    });
+
+    // Q ← γQ + W [coefficients]
+    par.foreach_chunk(
+        [&](index_t i, length_t bs, mat &) { Q.middleRows(i, bs) *= γ; });
+    // Second pass over the history
+    par.matmul_add(W, WᵀQ, Q);
+
+    return true;
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply_hessian(rmat V, real_t γ) {
+    if (not keeps_gram())
+        throw std::logic_error("LBFGS::apply_hessian() requires "
+                               "LBFGSParams::hessian_products");
+    QUALA_STATS(OpTimer timer(stats.apply));
+    // Only apply if we have previous vectors s and y
+    if (idx == 0 && not full)
+        return false;
+    QUALA_STATS(stats.apply.add_cost(
+        8 * double(n()) * current_history() * V.cols(),
+        4 * double(n()) * current_history() * sizeof(storage_real_t) +
+            3 * double(n()) * V.cols() * sizeof(real_t)));
+    // If the step size is negative, compute it as sᵀy/yᵀy
+    if (γ < 0) {
+        auto new_idx = pred(idx);
+        γ = compact.sᵀy(new_idx, new_idx) / compact.yᵀy(new_idx, new_idx);
+    }
+
+    // Compact representation (Byrd, Nocedal, Schnabel, 1994, Thm. 2.3):
+    //
+    //   B = δI - [δS Y] ⎡ δSᵀS  L ⎤⁻¹ ⎡δSᵀ⎤
+    //                   ⎣ Lᵀ   -D ⎦   ⎣ Yᵀ⎦
+    //
+    // where δ = 1/γ, the columns of S and Y are in chronological order, L is
+    // the strictly lower triangular part of SᵀY and D is its diagonal.
+    // Eliminating the second block row gives the symmetric m×m system
+    //
+    //   (δSᵀS + L D⁻¹ Lᵀ) P = δSᵀV + L D⁻¹ YᵀV,   Z = D⁻¹(Lᵀ P - YᵀV),
+    //
+    // and BV = δV - δS P - Y Z.
+
+    const length_t k = current_history(), K = V.cols();
+    const real_t δ   = 1 / γ;
+    if (compact.WᵀQ.cols() < K)
+        compact.resize_rhs(compact.D.size(), K);
+
+    auto W   = sto.sto.map().topLeftCorner(n(), 2 * k);
+    auto WᵀV = compact.WᵀQ.topLeftCorner(2 * k, K);
+    // First pass over the history
+    par.matmul_tn(W, V, WᵀV);
 
+    // The factorization only depends on the Gram matrix and on γ, so it is
+    // reused until the next update
+    auto L = compact.L.topLeftCorner(k, k);
+    auto D = compact.D.topRows(k);
+    if (not(compact.C_γ == γ)) {
+        auto C    = compact.DγYᵀY.topLeftCorner(k, k);
+        index_t c = 0;
+        foreach_fwd([&](index_t i) {
+            index_t r = 0;
+            foreach_fwd([&](index_t j) {
+                L(r, c) = r > c ? compact.sᵀy(j, i) : real_t(0);
+                C(r, c) = δ * compact.sᵀs(j, i);
+                ++r;
+            });
+            D(c) = compact.sᵀy(i, i);
+            ++c;
+        });
+        C += L * D.asDiagonal().inverse() * L.transpose();
+        compact.C.compute(C);
+        compact.C_γ = γ;
+    }
+
+    // Gather the right-hand sides in chronological order
+    auto P    = compact.U.topLeftCorner(k, K);
+    auto YᵀV  = compact.YᵀQ.topLeftCorner(k, K);
+    index_t c = 0;
     foreach_fwd([&](index_t i) {
-        real_t β = ρ(i) * y(i).dot(q);
-        q -= (β - α(i)) * s(i);
+        P.row(c)   = δ * WᵀV.row(2 * i);
+        YᵀV.row(c) = WᵀV.row(2 * i + 1);
+        ++c;
     });
+    P += L * D.asDiagonal().inverse() * YᵀV;
+    compact.C.solveInPlace(P);
+    // Z = D⁻¹(Lᵀ P - YᵀV), overwrites YᵀV
+    YᵀV = D.asDiagonal().inverse() * (L.transpose() * P - YᵀV);
+
+    // Scatter the coefficients back to the order of the storage
+    c = 0;
+    foreach_fwd([&](index_t i) {
+        WᵀV.row(2 * i)     = -δ * P.row(c);
+        WᵀV.row(2 * i + 1) = -YᵀV.row(c);
+        ++c;
+    });
+
+    // V ← δV + W [coefficients]
+    par.foreach_chunk(
+        [&](index_t i, length_t bs, mat &) { V.middleRows(i, bs) *= δ; });
+    // Second pass over the history
+    par.matmul_add(W, WᵀV, V);
 
     return true;
 }
 
+template <class Real, class StorageReal, length_t N, length_t M>
+template <class IndexVec, class>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply(rvec q, real_t γ,
+                                                const IndexVec &J) {
+    QUALA_STATS(OpTimer timer(stats.masked_apply));
+    // Only apply if we have previous vectors s and y
+    if (idx == 0 && not full)
+        return false;
+    QUALA_STATS(add_apply_cost(stats.masked_apply, J.size(), 1));
+    return with_index_ranges(J, work.J, [&](const auto &J) {
+        if (uses_diagonal_h0(γ))
+            return apply_masked(q, crvec(diag.d), J);
+        return apply_masked(q, γ, J);
+    });
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
 template <class IndexVec>
-bool LBFGS::apply(rvec q, real_t γ, const IndexVec &J) {
+bool BasicLBFGS<Real, StorageReal, N, M>::apply(rvec q, crvec d,
+                                                const IndexVec &J) {
+    if (d.size() != n())
+        throw std::invalid_argument("LBFGS::apply: diagonal of H₀ must have "
+                                    "size n");
+    QUALA_STATS(OpTimer timer(stats.masked_apply));
     // Only apply if we have previous vectors s and y
     if (idx == 0 && not full)
         return false;
-    const bool fullJ = q.size() == static_cast<index_t>(J.size());
+    QUALA_STATS(add_apply_cost(stats.masked_apply, J.size(), 1));
+    return with_index_ranges(
+        J, work.J, [&](const auto &J) { return apply_masked(q, d, J); });
+}
 
+template <class Real, class StorageReal, length_t N, length_t M>
+template <class IndexVec>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply(rvec q, real_t γ,
+                                                const IndexVec &J,
+                                                Workspace &ws) const {
+    // Only apply if we have previous vectors s and y
+    if (idx == 0 && not full)
+        return false;
     if (params.cbfgs)
         throw std::invalid_argument("CBFGS check not supported when using "
                                     "masked version of LBFGS::apply()");
+    if (ws.α.size() < history())
+        ws.resize(history());
+    return with_index_ranges(J, ws.J, [&](const auto &J) {
+        if (uses_diagonal_h0(γ))
+            return apply_masked_two_loop(par.serial(), q, crvec(diag.d), J,
+                                         ws);
+        return apply_masked_two_loop(par.serial(), q, γ, J, ws);
+    });
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+template <class IndexVec, class F>
+bool BasicLBFGS<Real, StorageReal, N, M>::with_index_ranges(
+    const IndexVec &J, IndexRanges &J_ranges, const F &f) {
+    if constexpr (std::is_same_v<IndexVec, IndexRanges>) {
+        return f(J);
+    } else {
+        // Segment operations only pay off if the runs are long enough
+        constexpr length_t min_run_length = 8;
+        J_ranges.assign(J);
+        if (J_ranges.num_ranges() * min_run_length <= J_ranges.size())
+            return f(J_ranges);
+        return f(J);
+    }
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+template <class H0, class IndexVec>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply_masked(rvec q, H0 h0,
+                                                       const IndexVec &J) {
+    // Only apply if we have previous vectors s and y
+    if (idx == 0 && not full)
+        return false;
+    if (params.cbfgs)
+        throw std::invalid_argument("CBFGS check not supported when using "
+                                    "masked version of LBFGS::apply()");
+    // Pairs are never stored sparsely if the cache is used, see
+    // supports_sparse
+    if (params.cache_masked_apply)
+        return apply_masked_cached(q, h0, J);
+    // The workspace is only allocated when it is first needed, so the
+    // static-size L-BFGS doesn't allocate unless the masked version is used
+    if (work.α.size() < history())
+        work.resize(history());
+    return apply_masked_two_loop(par, q, h0, J, work);
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+template <class Kernels, class H0, class IndexVec>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply_masked_two_loop(
+    Kernels &&ker, rvec q, H0 h0, const IndexVec &J,
+    Workspace &ws) const {
+    const bool fullJ = q.size() == static_cast<index_t>(J.size());
+    // If J is run-length compressed, each range is a contiguous segment
+    constexpr bool runs = std::is_same_v<IndexVec, IndexRanges>;
 
     // Eigen 3.3.9 doesn't yet support indexing using a vector of indices
     // so we'll have to do it manually.
@@ -110,101 +697,590 @@ bool LBFGS::apply(rvec q, real_t γ, const IndexVec &J) {
     // Dot product of two vectors, adding only the indices in set J
     const auto dotJ = [&J, fullJ](const auto &a, const auto &b) {
         if (fullJ) {
-            return a.dot(b);
+            return a.template cast<real_t>().dot(b.template cast<real_t>());
         } else {
             real_t acc = 0;
-            for (auto j : J)
-                acc += a(j) * b(j);
+            if constexpr (runs)
+                for (const auto &r : J.ranges())
+                    acc += a.segment(r.begin, r.size())
+                               .template cast<real_t>()
+                               .dot(b.segment(r.begin, r.size())
+                                        .template cast<real_t>());
+            else
+                for (auto j : J)
+                    acc += static_cast<real_t>(a(j)) *
+                           static_cast<real_t>(b(j));
             return acc;
         }
     };
     // y -= a x, scaling and subtracting only the indices in set J
     const auto axmyJ = [&J, fullJ](real_t a, const auto &x, auto &y) {
         if (fullJ) {
-            y -= a * x;
+            y -= a * x.template cast<real_t>();
+        } else if constexpr (runs) {
+            for (const auto &r : J.ranges())
+                y.segment(r.begin, r.size()) -=
+                    a * x.segment(r.begin, r.size()).template cast<real_t>();
         } else {
             for (auto j : J)
-                y(j) -= a * x(j);
+                y(j) -= a * static_cast<real_t>(x(j));
         }
     };
-    // x *= a, scaling only the indices in set J
-    const auto scalJ = [&J, fullJ](real_t a, auto &x) {
-        if (fullJ) {
-            x *= a;
+    // x ← H₀ x, scaling only the indices in set J
+    const auto scalJ = [&J, fullJ](const H0 &h0, auto &x) {
+        if constexpr (std::is_arithmetic_v<H0>) {
+            if (fullJ) {
+                x *= h0;
+            } else if constexpr (runs) {
+                for (const auto &r : J.ranges())
+                    x.segment(r.begin, r.size()) *= h0;
+            } else {
+                for (auto j : J)
+                    x(j) *= h0;
+            }
         } else {
-            for (auto j : J)
-                x(j) *= a;
+            if (fullJ) {
+                x = h0.cwiseProduct(x);
+            } else if constexpr (runs) {
+                for (const auto &r : J.ranges())
+                    x.segment(r.begin, r.size()).array() *=
+                        h0.segment(r.begin, r.size()).array();
+            } else {
+                for (auto j : J)
+                    x(j) *= h0(j);
+            }
         }
     };
+    // Whether the step size still has to be computed from the newest valid
+    // pair
+    const auto needs_γ = [&h0] {
+        if constexpr (std::is_arithmetic_v<H0>)
+            return h0 < 0;
+        else
+            return false;
+    };
+
+    // Pairs that are stored sparsely use sparse-dense kernels, which only
+    // include the nonzeros whose indices are marked in ws.in_J
+    const bool mark = sparse.count > 0 && not fullJ;
+    const auto mark_J = [&](bool value) {
+        if constexpr (runs)
+            for (const auto &r : J.ranges())
+                std::fill_n(ws.in_J.begin() + r.begin, r.size(), value);
+        else
+            for (auto j : J)
+                ws.in_J[j] = value;
+    };
+    if (mark) {
+        if (ws.in_J.size() != static_cast<size_t>(q.size()))
+            ws.in_J.assign(q.size(), false);
+        mark_J(true);
+    }
+    const auto in_J = [&](index_t j) { return fullJ || ws.in_J[j]; };
+    // Inner product of vector c with vector d (s = 0, y = 1) of pair i
+    const auto dot_pair = [&](index_t i, index_t c, index_t d) {
+        if (sparse.is_sparse(i))
+            return sparse.dot_pair(i, c, d, in_J);
+        return dotJ(c == 0 ? s(i) : y(i), d == 0 ? s(i) : y(i));
+    };
+    // Inner product of vector c of pair i with q
+    const auto dot_q = [&](index_t i, index_t c) {
+        if (sparse.is_sparse(i))
+            return sparse.dot(i, c, q, in_J);
+        return dotJ(c == 0 ? s(i) : y(i), q);
+    };
+    // q -= a v, where v is vector c of pair i
+    const auto axmy_q = [&](index_t i, index_t c, real_t a) {
+        if (sparse.is_sparse(i))
+            sparse.axpy(i, c, -a, q, in_J);
+        else
+            axmyJ(a, c == 0 ? s(i) : y(i), q);
+    };
 
     foreach_rev([&](index_t i) {
+        // All inner products of this pair, in a single reduction if the
+        // vectors are distributed: yᵀs, sᵀs, sᵀq and yᵀy (if needed for γ)
+        real_t dots[4];
+        dots[0] = dot_pair(i, 0, 1);
+        dots[1] = dot_pair(i, 0, 0);
+        dots[2] = dot_q(i, 0);
+        dots[3] = needs_γ() ? dot_pair(i, 1, 1) : 0;
+        ker.global_sum(dots, needs_γ() ? 4 : 3);
         // Recompute ρ, it depends on the index set J. Note that even if ρ was
         // positive for the full vectors s and y, that's not necessarily the
         // case for the smaller vectors s(J) and y(J).
-        real_t yᵀs = dotJ(s(i), y(i));
-        real_t sᵀs = dotJ(s(i), s(i));
-        ρ(i)       = 1 / yᵀs;
+        const real_t yᵀs = dots[0], sᵀs = dots[1];
+        ws.ρ(i) = 1 / yᵀs;
         // Check if we should include this pair of vectors
         if (not update_valid(params, yᵀs, sᵀs, 0)) {
-            ρ(i) = NaN;
+            ws.ρ(i) = NaN;
             return;
         }
 
-        α(i) = ρ(i) * dotJ(s(i), q); // αᵢ = ρᵢ〈sᵢ, q〉
-        axmyJ(α(i), y(i), q);        // q -= αᵢ yᵢ
+        ws.α(i) = ws.ρ(i) * dots[2]; // αᵢ = ρᵢ〈sᵢ, q〉
+        axmy_q(i, 1, ws.α(i));       // q -= αᵢ yᵢ
 
-        if (γ < 0) {
-            // Compute step size based on most recent valid yᵀs/yᵀy
-            real_t yᵀy = dotJ(y(i), y(i));
-            γ          = 1 / (ρ(i) * yᵀy);
+        if constexpr (std::is_arithmetic_v<H0>) {
+            if (h0 < 0) {
+                // Compute step size based on most recent valid yᵀs/yᵀy
+                real_t yᵀy = dots[3];
+                h0         = 1 / (ws.ρ(i) * yᵀy);
+            }
         }
     });
 
     // If all ρ == 0, fail
-    if (γ < 0)
+    if (needs_γ()) {
+        if (mark)
+            mark_J(false);
         return false;
+    }
 
     // r ← H₀ q
-    scalJ(γ, q); // q *= γ
+    scalJ(h0, q);
 
     foreach_fwd([&](index_t i) {
-        if (std::isnan(ρ(i)))
+        if (std::isnan(ws.ρ(i)))
             return;
-        real_t β = ρ(i) * dotJ(y(i), q); // βᵢ = ρᵢ〈yᵢ, q〉
-        axmyJ(β - α(i), s(i), q);        // q -= (βᵢ - αᵢ) sᵢ
+        real_t yᵀq = dot_q(i, 1);
+        ker.global_sum(&yᵀq, 1);
+        real_t β = ws.ρ(i) * yᵀq;       // βᵢ = ρᵢ〈yᵢ, q〉
+        axmy_q(i, 0, β - ws.α(i));      // q -= (βᵢ - αᵢ) sᵢ
     });
 
+    if (mark)
+        mark_J(false);
     return true;
 }
 
-inline void LBFGS::reset() {
+template <class Real, class StorageReal, length_t N, length_t M>
+template <class H0, class IndexVec>
+bool BasicLBFGS<Real, StorageReal, N, M>::apply_masked_cached(
+    rvec q, H0 h0, const IndexVec &J) {
+    const length_t nJ = J.size();
+    // Gather the elements J of vector a into the packed vector aJ, using
+    // contiguous segments if J is run-length compressed
+    const auto gather = [&J](const auto &a, auto &&aJ) {
+        index_t r = 0;
+        if constexpr (std::is_same_v<IndexVec, IndexRanges>) {
+            for (const auto &rg : J.ranges()) {
+                aJ.segment(r, rg.size()) =
+                    a.segment(rg.begin, rg.size()).template cast<real_t>();
+                r += rg.size();
+            }
+        } else {
+            for (auto j : J)
+                aJ(r++) = static_cast<real_t>(a(j));
+        }
+    };
+    // If the index set changed, all packed vectors have to be gathered again
+    const bool same_J = nJ == masked.J.size() &&
+                        std::equal(J.begin(), J.end(), masked.J.begin());
+    if (not same_J) {
+        masked.J.resize(nJ);
+        std::copy(J.begin(), J.end(), masked.J.begin());
+        masked.sto.resize(nJ, 2 * masked.ρ.size());
+        masked.q.resize(nJ);
+        masked.invalidate();
+    }
+
+    // Gather the rows J of the pairs that were added since the last call. The
+    // inner products of the new pairs are packed in the first columns of
+    // masked.dots, in the same order as the pairs.
+    index_t num_new = 0;
+    foreach_fwd([&](index_t i) {
+        if (masked.valid[i])
+            return;
+        auto sJ = masked.s(i), yJ = masked.y(i);
+        gather(s(i), sJ);
+        gather(y(i), yJ);
+        masked.dots.col(num_new++) << yJ.dot(sJ), sJ.squaredNorm(),
+            yJ.squaredNorm();
+    });
+    // The inner products of all new pairs are summed in a single reduction
+    if (num_new > 0)
+        par.global_sum(masked.dots.data(), 3 * num_new);
+    index_t c = 0;
+    foreach_fwd([&](index_t i) {
+        if (masked.valid[i])
+            return;
+        // Recompute ρ, it depends on the index set J. Note that even if ρ was
+        // positive for the full vectors s and y, that's not necessarily the
+        // case for the smaller vectors s(J) and y(J).
+        real_t yᵀs = masked.dots(0, c);
+        real_t sᵀs = masked.dots(1, c);
+        // Check if we should include this pair of vectors
+        masked.ρ(i)     = update_valid(params, yᵀs, sᵀs, 0) ? 1 / yᵀs : NaN;
+        masked.yᵀy(i)   = masked.dots(2, c);
+        masked.valid[i] = true;
+        ++c;
+    });
+
+    // Gather q(J)
+    auto &qJ = masked.q;
+    gather(q, qJ);
+
+    // Standard two-loop recursion, on the packed vectors
+    foreach_rev([&](index_t i) {
+        if (std::isnan(masked.ρ(i)))
+            return;
+        real_t sᵀq = masked.s(i).dot(qJ);
+        par.global_sum(&sᵀq, 1);
+        masked.α(i) = masked.ρ(i) * sᵀq;  // αᵢ = ρᵢ〈sᵢ, q〉
+        qJ -= masked.α(i) * masked.y(i); // q -= αᵢ yᵢ
+        // Compute step size based on most recent valid yᵀs/yᵀy
+        if constexpr (std::is_arithmetic_v<H0>)
+            if (h0 < 0)
+                h0 = 1 / (masked.ρ(i) * masked.yᵀy(i));
+    });
+
+    // r ← H₀ q
+    if constexpr (std::is_arithmetic_v<H0>) {
+        // If all ρ == 0, fail
+        if (h0 < 0)
+            return false;
+        qJ *= h0;
+    } else if constexpr (std::is_same_v<IndexVec, IndexRanges>) {
+        index_t r = 0;
+        for (const auto &rg : J.ranges()) {
+            qJ.segment(r, rg.size()).array() *=
+                h0.segment(rg.begin, rg.size()).array();
+            r += rg.size();
+        }
+    } else {
+        index_t r = 0;
+        for (auto j : J)
+            qJ(r++) *= h0(j);
+    }
+
+    foreach_fwd([&](index_t i) {
+        if (std::isnan(masked.ρ(i)))
+            return;
+        real_t yᵀq = masked.y(i).dot(qJ);
+        par.global_sum(&yᵀq, 1);
+        real_t β = masked.ρ(i) * yᵀq;          // βᵢ = ρᵢ〈yᵢ, q〉
+        qJ -= (β - masked.α(i)) * masked.s(i); // q -= (βᵢ - αᵢ) sᵢ
+    });
+
+    // Scatter the result back to q(J)
+    index_t r = 0;
+    if constexpr (std::is_same_v<IndexVec, IndexRanges>) {
+        for (const auto &rg : J.ranges()) {
+            q.segment(rg.begin, rg.size()) = qJ.segment(r, rg.size());
+            r += rg.size();
+        }
+    } else {
+        for (auto j : J)
+            q(j) = qJ(r++);
+    }
+
+    return true;
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::add_apply_cost(
+    OpStats &op, length_t n, length_t num_rhs) const {
+    const double k = current_history(), nn = n, c = num_rhs;
+    // Each pair costs two inner products and two updates per right-hand side.
+    // The two-loop recursion streams the history twice, and every right-hand
+    // side once per pair, the compact representation only streams them once.
+    const double hist_bytes = (uses_compact() ? 2 : 4) * nn * k;
+    const double rhs_bytes  = uses_compact() ? 3 * nn : (6 * k + 2) * nn;
+    op.add_cost(c * (8 * k + 1) * nn, hist_bytes * sizeof(storage_real_t) +
+                                          c * rhs_bytes * sizeof(real_t));
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::reset() {
     idx  = 0;
     full = false;
+    undo.end();
+    sparse.clear();
+    compact.invalidate_hessian();
+    if (params.diagonal_h0)
+        diag.reset();
 }
 
-inline void LBFGS::resize(length_t n) {
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::resize(length_t n) {
+    if constexpr (N != Eigen::Dynamic)
+        if (n != N)
+            throw std::invalid_argument("LBFGS: n must be equal to the "
+                                        "compile-time dimension N");
+    if constexpr (M != Eigen::Dynamic)
+        params.memory = M;
     if (params.memory < 1)
         throw std::invalid_argument("LBFGS::Params::memory must be >= 1");
-    sto.resize(n, params.memory);
+    sto.resize(n, params.memory, params.storage_dir);
+    par.resize(n, params.num_threads, params.chunk_size);
+    if (keeps_gram())
+        compact.resize(params.memory);
+    if (params.cache_masked_apply)
+        masked.resize(params.memory);
+    sparse.resize(params.memory);
+    if (params.diagonal_h0)
+        diag.resize(n);
     reset();
 }
 
-inline void LBFGSStorage::resize(length_t n, length_t history) {
-    sto.resize(n + 1, history * 2);
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::set_memory(length_t m) {
+    if constexpr (M != Eigen::Dynamic)
+        if (m != M)
+            throw std::invalid_argument("LBFGS: memory must be equal to the "
+                                        "compile-time history length M");
+    if (m < 1)
+        throw std::invalid_argument("LBFGS::Params::memory must be >= 1");
+    undo.end();
+    densify();
+    // Rotate the pairs in use such that the newest k_new ones come first,
+    // oldest first
+    const length_t k = current_history(), k_new = std::min(k, m);
+    if (k > 0) {
+        const index_t r = ((full ? idx : 0) + k - k_new) % k;
+        vec_util::rotate_cols(sto.sto.map(), 2 * k, 2 * r);
+        vec_util::rotate_cols(sto.ρα, k, r);
+        if (keeps_gram()) {
+            auto G  = compact.gram.topLeftCorner(2 * k, 2 * k);
+            auto Gᵀ = G.transpose();
+            vec_util::rotate_cols(G, 2 * k, 2 * r);
+            vec_util::rotate_cols(Gᵀ, 2 * k, 2 * r);
+        }
+    }
+    params.memory = m;
+    sto.set_history(m, k_new, params.storage_dir);
+    if (keeps_gram())
+        compact.set_history(m);
+    if (params.cache_masked_apply)
+        masked.set_history(m);
+    sparse.resize(m);
+    idx  = k_new == m ? 0 : k_new;
+    full = k_new == m;
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGSStorage<Real, StorageReal, N, M>::resize(
+    length_t n, length_t history, const std::string &dir) {
+    sto.resize(n, history * 2, dir);
+    ρα.resize(2, history);
+    hist = history;
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGSStorage<Real, StorageReal, N, M>::set_history(
+    length_t history, length_t keep, const std::string &dir) {
+    if (2 * history > sto.cols()) {
+        MappableMatrix<storage_t> grown;
+        grown.resize(n(), 2 * history, dir);
+        grown.map().leftCols(2 * keep) = sto.map().leftCols(2 * keep);
+        sto = std::move(grown);
+    }
+    if (history > ρα.cols())
+        ρα.conservativeResize(2, history);
+    hist = history;
+}
+
+template <class Real>
+void BasicLBFGSMaskedCache<Real>::resize(length_t history) {
+    J.resize(0);
+    sto.resize(0, 2 * history);
+    ρ.resize(history);
+    yᵀy.resize(history);
+    α.resize(history);
+    dots.resize(3, history);
+    valid.resize(history);
+    invalidate();
 }
 
-inline void LBFGS::scale_y(real_t factor) {
-    if (full) {
-        for (index_t i = 0; i < history(); ++i) {
-            y(i) *= factor;
-            ρ(i) *= 1 / factor;
+template <class Real>
+void BasicLBFGSMaskedCache<Real>::set_history(length_t history) {
+    if (history > ρ.size())
+        return resize(history);
+    invalidate();
+}
+
+template <class Real>
+void BasicLBFGSCompactStorage<Real>::resize(length_t history) {
+    gram.resize(2 * history, 2 * history);
+    R.resize(history, history);
+    DγYᵀY.resize(history, history);
+    L.resize(history, history);
+    D.resize(history);
+    invalidate_hessian();
+    resize_rhs(history, 1);
+}
+
+template <class Real>
+void BasicLBFGSCompactStorage<Real>::set_history(length_t history) {
+    // Only the top left blocks are used, so the storage only has to grow
+    if (history > D.size()) {
+        gram.conservativeResize(2 * history, 2 * history);
+        R.resize(history, history);
+        DγYᵀY.resize(history, history);
+        L.resize(history, history);
+        D.resize(history);
+        resize_rhs(history, WᵀQ.cols());
+    }
+    invalidate_hessian();
+}
+
+template <class Real>
+void BasicLBFGSCompactStorage<Real>::resize_rhs(length_t history,
+                                                length_t num_rhs) {
+    WᵀQ.resize(2 * history, num_rhs);
+    U.resize(history, num_rhs);
+    YᵀQ.resize(history, num_rhs);
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::scale_y(real_t factor) {
+    undo.end();
+    const length_t k = current_history();
+    par.foreach_chunk([&](index_t i, length_t bs, mat &) {
+        for (index_t j = 0; j < k; ++j)
+            if (not sparse.is_sparse(j))
+                y(j).segment(i, bs) *= static_cast<storage_real_t>(factor);
+    });
+    for (index_t j = 0; j < k; ++j)
+        if (sparse.is_sparse(j))
+            sparse.scale(j, 1, factor);
+    for (index_t i = 0; i < k; ++i)
+        ρ(i) *= 1 / factor;
+    if (keeps_gram()) {
+        // Scales sᵀy by the factor and yᵀy by the factor squared
+        auto G = compact.gram.topLeftCorner(2 * k, 2 * k);
+        for (index_t i = 0; i < k; ++i) {
+            G.col(2 * i + 1) *= factor;
+            G.row(2 * i + 1) *= factor;
         }
+        compact.invalidate_hessian();
+    }
+    if (params.diagonal_h0)
+        diag.scale_y(factor);
+    if (params.cache_masked_apply)
+        masked.invalidate();
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::densify() {
+    if (sparse.count == 0)
+        return;
+    foreach_fwd([&](index_t i) {
+        if (sparse.is_sparse(i))
+            sparse.densify(i, sto.s(i), sto.y(i));
+    });
+    sparse.clear();
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::begin_transaction() {
+    if (undo.active)
+        throw std::logic_error("LBFGS::begin_transaction: transaction already "
+                               "in progress");
+    // Only dense pairs are saved when they are overwritten
+    densify();
+    undo.begin(idx, full, history());
+    if (keeps_gram())
+        undo_gram = compact.gram;
+    if (params.diagonal_h0)
+        undo_diag = diag;
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::rollback() {
+    if (not undo.active)
+        throw std::logic_error("LBFGS::rollback: no transaction in progress");
+    undo.foreach_saved([&](index_t i, auto s, auto y, real_t ρ) {
+        sto.s(i) = s;
+        sto.y(i) = y;
+        sto.ρ(i) = ρ;
+    });
+    idx  = undo.idx;
+    full = undo.full;
+    undo.end();
+    if (keeps_gram()) {
+        compact.gram = undo_gram;
+        compact.invalidate_hessian();
+    }
+    if (params.diagonal_h0)
+        diag = undo_diag;
+    if (params.cache_masked_apply)
+        masked.invalidate();
+}
+
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::save(CheckpointWriter &w) const {
+    const length_t k = current_history();
+    w.header(CheckpointKind::LBFGS, sizeof(real_t), sizeof(storage_real_t));
+    w.scalar<std::int64_t>(n());
+    w.scalar<std::int64_t>(history());
+    w.scalar<std::int64_t>(idx);
+    w.scalar<std::uint8_t>(full);
+    // Only the first k pairs are in use
+    if (sparse.count > 0) {
+        // Sparse pairs are written as dense vectors
+        Eigen::Matrix<storage_real_t, N, Eigen::Dynamic> W =
+            sto.sto.map().leftCols(2 * k);
+        for (index_t i = 0; i < k; ++i)
+            if (sparse.is_sparse(i))
+                sparse.scatter(i, W.col(2 * i), W.col(2 * i + 1));
+        w.matrix(W);
     } else {
-        for (index_t i = 0; i < idx; ++i) {
-            y(i) *= factor;
-            ρ(i) *= 1 / factor;
-        }
+        w.matrix(sto.sto.map().leftCols(2 * k));
     }
+    w.matrix(sto.ρα.row(0).leftCols(k));
 }
 
+template <class Real, class StorageReal, length_t N, length_t M>
+void BasicLBFGS<Real, StorageReal, N, M>::load(CheckpointReader &r) {
+    r.header(CheckpointKind::LBFGS, sizeof(real_t), sizeof(storage_real_t));
+    if (r.scalar<std::int64_t>() != n())
+        throw std::invalid_argument("LBFGS::load: dimension mismatch");
+    if (r.scalar<std::int64_t>() != history())
+        throw std::invalid_argument("LBFGS::load: history length mismatch");
+    reset();
+    const index_t new_idx = r.index(history() - 1);
+    const bool new_full   = r.scalar<std::uint8_t>() != 0;
+    const length_t k      = new_full ? history() : new_idx;
+    r.matrix(sto.sto.map().leftCols(2 * k));
+    r.matrix(sto.ρα.row(0).leftCols(k));
+    idx  = new_idx;
+    full = new_full;
+    if (keeps_gram()) {
+        auto W = sto.sto.map().leftCols(2 * k);
+        par.matmul_tn(W, W, compact.gram.topLeftCorner(2 * k, 2 * k));
+        compact.invalidate_hessian();
+    }
+    if (params.diagonal_h0) {
+        // Add the restored pairs to the diagonal estimate of H₀, oldest first
+        const real_t β = 1 - real_t(1) / history();
+        foreach_fwd([&](index_t i) {
+            const real_t γ = 1 / (ρ(i) * par.dot(y(i), y(i)));
+            diag.update(0, n(), s(i).template cast<real_t>(),
+                        y(i).template cast<real_t>(), β, γ,
+                        params.diagonal_h0_bound);
+        });
+    }
+    if (params.cache_masked_apply)
+        masked.invalidate();
+}
+
+// Explicit instantiations in lbfgs.cpp
+extern template class BasicLBFGS<float>;
+extern template class BasicLBFGS<double>;
+extern template class BasicLBFGS<long double>;
+extern template struct BasicLBFGSStorage<float>;
+extern template struct BasicLBFGSStorage<double>;
+extern template struct BasicLBFGSStorage<long double>;
+extern template class BasicLBFGS<double, float>;
+extern template class BasicLBFGS<double, Eigen::bfloat16>;
+extern template struct BasicLBFGSStorage<double, float>;
+extern template struct BasicLBFGSStorage<double, Eigen::bfloat16>;
+extern template struct BasicLBFGSCompactStorage<float>;
+extern template struct BasicLBFGSCompactStorage<double>;
+extern template struct BasicLBFGSCompactStorage<long double>;
+extern template struct BasicLBFGSMaskedCache<float>;
+extern template struct BasicLBFGSMaskedCache<double>;
+extern template struct BasicLBFGSMaskedCache<long double>;
+
 } // namespace quala
\ No newline at end of file
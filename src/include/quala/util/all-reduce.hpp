@@ -0,0 +1,29 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <functional>
+
+namespace quala {
+
+/// Global sum of partial results, for vectors that are distributed over
+/// multiple processes.
+///
+/// When the accelerators operate on local shards of the vectors, all inner
+/// products and norms are first computed locally. The partial results are
+/// gathered in a contiguous buffer and passed to this function, which has to
+/// overwrite each of the @p count elements of @p data by its sum over all
+/// processes, e.g. using
+/// `MPI_Allreduce(MPI_IN_PLACE, data, count, MPI_DOUBLE, MPI_SUM, comm)`.
+/// All processes call it the same number of times, with the same counts.
+/// The accelerators batch independent inner products into a single call, so
+/// the number of calls is the number of synchronization points.
+///
+/// An empty function means that the vectors are not distributed.
+template <class Real>
+using BasicAllReduce = std::function<void(Real *data, length_t count)>;
+
+/// @ref BasicAllReduce for the default floating point type.
+using AllReduce = BasicAllReduce<real_t>;
+
+} // namespace quala
@@ -10,13 +10,21 @@
 
 namespace quala {
 
-class vec_allocator {
+/// Allocator for a fixed number of vectors of the same size, backed by a
+/// single contiguous buffer.
+/// @tparam Real
+///         Floating point type.
+template <class Real>
+class basic_vec_allocator {
+  public:
+    USING_QUALA_TYPES(Real);
+
   private:
     size_t num_vec;
     Eigen::Index n;
     std::vector<real_t> storage;
     struct findstack : std::stack<real_t *, std::vector<real_t *>> {
-        using stack::stack;
+        using std::stack<real_t *, std::vector<real_t *>>::stack;
 
         auto begin() { return this->c.begin(); }
         auto begin() const { return this->c.begin(); }
@@ -37,25 +45,26 @@ class vec_allocator {
     size_t highwatermark = 0;
 
   public:
-    vec_allocator(size_t num_vec, Eigen::Index n)
+    basic_vec_allocator(size_t num_vec, Eigen::Index n)
         : num_vec(num_vec), n(n), storage(num_vec * n, NaN) {
         for (auto it = storage.begin(); it != storage.end(); it += n)
             stack.push(&*it);
     }
 
-    vec_allocator(const vec_allocator &) = delete;
-    vec_allocator(vec_allocator &&)      = delete;
-    vec_allocator &operator=(const vec_allocator &) = delete;
-    vec_allocator &operator=(vec_allocator &&) = delete;
+    basic_vec_allocator(const basic_vec_allocator &) = delete;
+    basic_vec_allocator(basic_vec_allocator &&)      = delete;
+    basic_vec_allocator &operator=(const basic_vec_allocator &) = delete;
+    basic_vec_allocator &operator=(basic_vec_allocator &&) = delete;
 
     struct alloc_raii_wrapper {
         using mvec = Eigen::Map<vec>;
         mvec v;
-        vec_allocator *alloc;
+        basic_vec_allocator *alloc;
 
-        alloc_raii_wrapper(real_t *dptr, Eigen::Index n, vec_allocator *alloc)
+        alloc_raii_wrapper(real_t *dptr, Eigen::Index n,
+                           basic_vec_allocator *alloc)
             : v{dptr, n}, alloc{alloc} {}
-        alloc_raii_wrapper(mvec &&v, vec_allocator *alloc)
+        alloc_raii_wrapper(mvec &&v, basic_vec_allocator *alloc)
             : v{std::move(v)}, alloc{alloc} {}
         ~alloc_raii_wrapper() {
             assert(alloc);
@@ -115,4 +124,7 @@ class vec_allocator {
     size_t highwater() const { return highwatermark; }
 };
 
+/// @ref basic_vec_allocator for the default floating point type.
+using vec_allocator = basic_vec_allocator<real_t>;
+
 } // namespace quala
\ No newline at end of file
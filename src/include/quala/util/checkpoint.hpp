@@ -0,0 +1,202 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace quala {
+
+/// Type of the accelerator whose state is stored in a checkpoint.
+enum class CheckpointKind : std::uint32_t {
+    LBFGS           = 1,
+    BroydenGood     = 2,
+    LimitedMemoryQR = 3,
+    AndersonAccel   = 4,
+};
+
+/// Version of the binary checkpoint format written by @ref CheckpointWriter.
+constexpr std::uint32_t checkpoint_version = 1;
+
+/// Writes the state of an accelerator to a binary stream, see e.g.
+/// @ref BasicLBFGS::save.
+///
+/// Each record starts with a header containing a magic number, the format
+/// version, a byte order mark, the @ref CheckpointKind and the sizes of the
+/// floating point types, followed by the indices of the circular buffers and
+/// the matrices of the history. Matrices are stored as their number of rows
+/// and columns, followed by the raw values in column-major order. Only the
+/// columns of the history that are in use are written. Multiple records can
+/// be written to the same stream.
+class CheckpointWriter {
+  public:
+    explicit CheckpointWriter(std::ostream &os) : os(os) {}
+
+    /// Write the header of a record.
+    void header(CheckpointKind kind, length_t real_size,
+                length_t storage_real_size) {
+        write(magic, sizeof(magic));
+        scalar(checkpoint_version);
+        scalar(byte_order_mark);
+        scalar(static_cast<std::uint32_t>(kind));
+        scalar(static_cast<std::uint32_t>(real_size));
+        scalar(static_cast<std::uint32_t>(storage_real_size));
+    }
+
+    /// Write a trivially copyable value.
+    template <class T>
+    void scalar(const T &t) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write(&t, sizeof(t));
+    }
+
+    /// Write the dimensions and the values of a matrix.
+    template <class Derived>
+    void matrix(const Eigen::DenseBase<Derived> &M) {
+        using Scalar = typename Derived::Scalar;
+        scalar(static_cast<std::int64_t>(M.rows()));
+        scalar(static_cast<std::int64_t>(M.cols()));
+        for (index_t c = 0; c < M.cols(); ++c) {
+            auto col = M.derived().col(c);
+            if (col.innerStride() == 1 || col.rows() == 1)
+                write(col.data(), sizeof(Scalar) * col.rows());
+            else
+                for (index_t r = 0; r < col.rows(); ++r)
+                    scalar(col.coeff(r));
+        }
+    }
+
+  private:
+    void write(const void *data, std::size_t size) {
+        os.write(static_cast<const char *>(data),
+                 static_cast<std::streamsize>(size));
+        if (not os)
+            throw std::runtime_error("Checkpoint: write failed");
+    }
+
+    std::ostream &os;
+
+  public:
+    static constexpr char magic[8]                 = {'Q', 'U', 'A', 'L',
+                                                      'A', 'C', 'K', 'P'};
+    static constexpr std::uint32_t byte_order_mark = 0x01020304;
+};
+
+/// Reads the state of an accelerator from a binary stream or from a block of
+/// memory, see @ref CheckpointWriter.
+///
+/// Reading from memory (e.g. from a @ref MappedFile) copies the history
+/// directly into the storage of the accelerator, without intermediate
+/// buffering.
+/// Corrupt or truncated data results in a `std::runtime_error`, while a
+/// checkpoint of an accelerator with different dimensions or floating point
+/// types results in a `std::invalid_argument`.
+class CheckpointReader {
+  public:
+    explicit CheckpointReader(std::istream &is) : is(&is) {}
+    CheckpointReader(const void *data, std::size_t size)
+        : cur(static_cast<const char *>(data)), end(cur + size) {}
+
+    /// Read and check the header of a record.
+    void header(CheckpointKind kind, length_t real_size,
+                length_t storage_real_size) {
+        char magic[sizeof(CheckpointWriter::magic)];
+        read(magic, sizeof(magic));
+        if (std::memcmp(magic, CheckpointWriter::magic, sizeof(magic)) != 0)
+            throw std::runtime_error("Checkpoint: invalid magic number");
+        if (scalar<std::uint32_t>() > checkpoint_version)
+            throw std::runtime_error("Checkpoint: unsupported version");
+        if (scalar<std::uint32_t>() != CheckpointWriter::byte_order_mark)
+            throw std::runtime_error("Checkpoint: byte order mismatch");
+        if (scalar<std::uint32_t>() != static_cast<std::uint32_t>(kind))
+            throw std::invalid_argument("Checkpoint: type mismatch");
+        if (scalar<std::uint32_t>() != static_cast<std::uint32_t>(real_size) ||
+            scalar<std::uint32_t>() !=
+                static_cast<std::uint32_t>(storage_real_size))
+            throw std::invalid_argument("Checkpoint: precision mismatch");
+    }
+
+    /// Read a trivially copyable value.
+    template <class T>
+    T scalar() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T t;
+        read(&t, sizeof(t));
+        return t;
+    }
+
+    /// Read a length or index, and check that it lies in [0, max].
+    length_t index(length_t max) {
+        auto i = scalar<std::int64_t>();
+        if (i < 0 || i > max)
+            throw std::runtime_error("Checkpoint: index out of range");
+        return static_cast<length_t>(i);
+    }
+
+    /// Read a matrix into @p M, which must have the same dimensions.
+    template <class Derived>
+    void matrix(const Eigen::DenseBase<Derived> &M_) {
+        using Scalar = typename Derived::Scalar;
+        auto &M      = M_.const_cast_derived();
+        if (scalar<std::int64_t>() != M.rows() ||
+            scalar<std::int64_t>() != M.cols())
+            throw std::runtime_error("Checkpoint: dimension mismatch");
+        for (index_t c = 0; c < M.cols(); ++c) {
+            auto col = M.col(c);
+            if (col.innerStride() == 1 || col.rows() == 1)
+                read(col.data(), sizeof(Scalar) * col.rows());
+            else
+                for (index_t r = 0; r < col.rows(); ++r)
+                    col.coeffRef(r) = scalar<Scalar>();
+        }
+    }
+
+  private:
+    void read(void *data, std::size_t size) {
+        if (is) {
+            is->read(static_cast<char *>(data),
+                     static_cast<std::streamsize>(size));
+            if (not *is)
+                throw std::runtime_error("Checkpoint: unexpected end of data");
+        } else {
+            if (static_cast<std::size_t>(end - cur) < size)
+                throw std::runtime_error("Checkpoint: unexpected end of data");
+            std::memcpy(data, cur, size);
+            cur += size;
+        }
+    }
+
+    std::istream *is = nullptr;
+    const char *cur  = nullptr;
+    const char *end  = nullptr;
+};
+
+/// Read-only memory mapping of a checkpoint file, to be passed to
+/// @ref CheckpointReader. Falls back to reading the file into memory on
+/// platforms without `mmap`.
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &)            = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const void *data() const { return ptr; }
+    std::size_t size() const { return len; }
+    /// Get a reader for the full contents of the file.
+    CheckpointReader reader() const { return {ptr, len}; }
+
+  private:
+    const void *ptr = nullptr;
+    std::size_t len = 0;
+    /// Contents of the file if it could not be mapped.
+    std::unique_ptr<char[]> buffer;
+};
+
+} // namespace quala
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+namespace quala {
+
+/// Sequence of indices stored as half-open ranges [begin, end) of consecutive
+/// indices, i.e. a run-length compressed index vector.
+///
+/// Index sets that consist of a few long runs (e.g. the free variables of a
+/// bound-constrained problem) can then be processed using contiguous segment
+/// operations instead of element-wise gathers and scatters, see
+/// @ref BasicLBFGS::apply(rvec, real_t, const IndexVec &).
+/// Iterating over an IndexRanges object yields the individual indices, in the
+/// same order as the original index vector (which doesn't have to be sorted).
+class IndexRanges {
+  public:
+    /// Half-open range [begin, end) of consecutive indices.
+    struct Range {
+        index_t begin;
+        index_t end;
+        length_t size() const { return end - begin; }
+        bool operator==(const Range &o) const {
+            return begin == o.begin && end == o.end;
+        }
+        bool operator!=(const Range &o) const { return !(*this == o); }
+    };
+
+    /// Forward iterator over the individual indices.
+    class iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = index_t;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const index_t *;
+        using reference         = index_t;
+
+        iterator() = default;
+        iterator(const Range *r, const Range *r_end)
+            : r(r), r_end(r_end), j(r != r_end ? r->begin : 0) {}
+
+        index_t operator*() const { return j; }
+        iterator &operator++() {
+            if (++j == r->end)
+                j = ++r != r_end ? r->begin : 0;
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        bool operator==(const iterator &o) const {
+            return r == o.r && j == o.j;
+        }
+        bool operator!=(const iterator &o) const { return !(*this == o); }
+
+      private:
+        const Range *r = nullptr, *r_end = nullptr;
+        index_t j = 0;
+    };
+
+    IndexRanges() = default;
+    /// Compress the given sequence of indices: runs of consecutive increasing
+    /// indices are merged into a single range.
+    template <class IndexVec,
+              class = std::enable_if_t<
+                  not std::is_same_v<std::decay_t<IndexVec>, IndexRanges>>>
+    IndexRanges(const IndexVec &J) {
+        assign(J);
+    }
+
+    /// Replace the contents by the compressed sequence of indices @p J.
+    /// Doesn't allocate if the number of ranges doesn't exceed the capacity.
+    template <class IndexVec>
+    void assign(const IndexVec &J) {
+        clear();
+        for (auto j : J)
+            push_back(static_cast<index_t>(j));
+    }
+    /// Append a single index, merging it with the last range if possible.
+    void push_back(index_t j) {
+        if (not rs.empty() && rs.back().end == j)
+            ++rs.back().end;
+        else
+            rs.push_back({j, j + 1});
+        ++count;
+    }
+    /// Append the range [@p begin, @p end).
+    void push_back(index_t begin, index_t end) {
+        if (begin >= end)
+            return;
+        if (not rs.empty() && rs.back().end == begin)
+            rs.back().end = end;
+        else
+            rs.push_back({begin, end});
+        count += end - begin;
+    }
+    /// Remove all indices.
+    void clear() {
+        rs.clear();
+        count = 0;
+    }
+
+    /// Get the total number of indices.
+    length_t size() const { return count; }
+    /// Get the number of ranges.
+    length_t num_ranges() const { return static_cast<length_t>(rs.size()); }
+    /// Get the ranges.
+    const std::vector<Range> &ranges() const { return rs; }
+
+    iterator begin() const { return {rs.data(), rs.data() + rs.size()}; }
+    iterator end() const {
+        return {rs.data() + rs.size(), rs.data() + rs.size()};
+    }
+
+    bool operator==(const IndexRanges &o) const { return rs == o.rs; }
+    bool operator!=(const IndexRanges &o) const { return rs != o.rs; }
+
+  private:
+    std::vector<Range> rs;
+    length_t count = 0;
+};
+
+} // namespace quala
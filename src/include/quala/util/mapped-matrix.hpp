@@ -0,0 +1,154 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace quala {
+
+/// Read-write memory mapping of an unnamed temporary file, used as backing
+/// storage for data that doesn't fit in memory.
+///
+/// The file is created in the given directory and unlinked immediately, so it
+/// is removed automatically when the mapping is destroyed. The operating
+/// system pages the data in and out as needed, the whole region is marked for
+/// sequential access. Only supported on POSIX systems, throws a
+/// `std::runtime_error` otherwise.
+class MappedBuffer {
+  public:
+    /// Create a temporary file of @p size bytes in directory @p dir, and map
+    /// it into memory.
+    MappedBuffer(const std::string &dir, std::size_t size);
+    ~MappedBuffer();
+    MappedBuffer(const MappedBuffer &)            = delete;
+    MappedBuffer &operator=(const MappedBuffer &) = delete;
+
+    void *data() const { return ptr; }
+    std::size_t size() const { return len; }
+    /// Hint that the @p size bytes starting at @p begin will be accessed soon,
+    /// so they can be read from the file in the background.
+    void will_need(const void *begin, std::size_t size) const;
+
+  private:
+    void *ptr       = nullptr;
+    std::size_t len = 0;
+};
+
+/// Column-major matrix whose coefficients are stored either in memory (as a
+/// regular `Eigen::Matrix`) or in a @ref MappedBuffer, i.e. in a memory mapped
+/// temporary file.
+///
+/// The coefficients are accessed through @ref map, an `Eigen::Map` of the
+/// storage, which can be used in expressions like any other matrix. Copies
+/// have the same kind of storage as the original.
+/// @tparam Matrix
+///         Type of the in-memory storage.
+template <class Matrix>
+class MappableMatrix {
+  public:
+    using Scalar = typename Matrix::Scalar;
+    using Map =
+        Eigen::Map<Matrix, Matrix::SizeAtCompileTime == Eigen::Dynamic
+                               ? Eigen::AlignedMax
+                               : Eigen::Unaligned>;
+
+    MappableMatrix() { reseat(); }
+    MappableMatrix(const MappableMatrix &other) {
+        if (other.mapped)
+            resize(other.rows(), other.cols(), other.dir);
+        else
+            resize(other.rows(), other.cols());
+        map() = other.map();
+    }
+    MappableMatrix(MappableMatrix &&other) noexcept
+        : buffer(std::move(other.buffer)), mapped(std::move(other.mapped)),
+          dir(std::move(other.dir)) {
+        reseat(other.rows(), other.cols());
+        other.reseat();
+    }
+    MappableMatrix &operator=(const MappableMatrix &other) {
+        if (this != &other)
+            *this = MappableMatrix(other);
+        return *this;
+    }
+    MappableMatrix &operator=(MappableMatrix &&other) noexcept {
+        const length_t rows = other.rows(), cols = other.cols();
+        buffer              = std::move(other.buffer);
+        mapped              = std::move(other.mapped);
+        dir                 = std::move(other.dir);
+        reseat(rows, cols);
+        other.reseat();
+        return *this;
+    }
+
+    /// Get the `Eigen::Map` of the storage. It is invalidated by @ref resize
+    /// and by assigning or moving from this matrix.
+    Map &map() { return *std::launder(reinterpret_cast<Map *>(&storage)); }
+    /// @copydoc map()
+    const Map &map() const {
+        return *std::launder(reinterpret_cast<const Map *>(&storage));
+    }
+
+    length_t rows() const { return map().rows(); }
+    length_t cols() const { return map().cols(); }
+    Scalar *data() { return map().data(); }
+    const Scalar *data() const { return map().data(); }
+
+    /// Re-allocate the storage in memory. The contents are lost.
+    void resize(length_t rows, length_t cols) {
+        mapped.reset();
+        dir.clear();
+        buffer.resize(rows, cols);
+        reseat();
+    }
+    /// Re-allocate the storage in a temporary file in directory @p directory,
+    /// or in memory if @p directory is empty. The contents are lost.
+    void resize(length_t rows, length_t cols, const std::string &directory) {
+        if (directory.empty())
+            return resize(rows, cols);
+        mapped.reset();
+        if constexpr (Matrix::SizeAtCompileTime == Eigen::Dynamic)
+            buffer.resize(0, 0); // release the memory
+        mapped = std::make_unique<MappedBuffer>(
+            directory, sizeof(Scalar) * static_cast<std::size_t>(rows * cols));
+        dir = directory;
+        reseat(rows, cols);
+    }
+
+    /// Check whether the storage is backed by a file.
+    bool is_mapped() const { return mapped != nullptr; }
+    /// Hint that columns [c, c + num_cols) will be accessed soon (no-op if the
+    /// storage is in memory).
+    void will_need(index_t c, length_t num_cols) const {
+        if (mapped)
+            mapped->will_need(data() + c * rows(),
+                              sizeof(Scalar) *
+                                  static_cast<std::size_t>(num_cols * rows()));
+    }
+
+  private:
+    /// Point the map to the file mapping or to the in-memory buffer.
+    /// An `Eigen::Map` cannot be re-pointed, so a new one is constructed in
+    /// its storage (it is trivially destructible).
+    void reseat(length_t rows, length_t cols) {
+        static_assert(std::is_trivially_destructible_v<Map>);
+        Scalar *p = mapped ? static_cast<Scalar *>(mapped->data())
+                           : buffer.data();
+        new (&storage) Map(p, rows, cols);
+    }
+    /// Point the map to the in-memory buffer.
+    void reseat() { reseat(buffer.rows(), buffer.cols()); }
+
+    Matrix buffer;
+    std::unique_ptr<MappedBuffer> mapped;
+    std::string dir;
+    /// Storage for the `Eigen::Map` returned by @ref map.
+    alignas(Map) unsigned char storage[sizeof(Map)];
+};
+
+} // namespace quala
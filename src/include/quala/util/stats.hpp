@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/// Collect the performance counters in @ref quala::AccelStats. Enabled by the
+/// CMake option `QUALA_WITH_STATS`. If zero, the counters are never updated
+/// and all instrumentation is compiled out.
+#ifndef QUALA_WITH_STATS
+#define QUALA_WITH_STATS 0
+#endif
+
+/// Only compile the given statement if @ref QUALA_WITH_STATS is enabled.
+#if QUALA_WITH_STATS
+#define QUALA_STATS(...) __VA_ARGS__
+#else
+#define QUALA_STATS(...)
+#endif
+
+namespace quala {
+
+/// Whether the library was compiled with @ref QUALA_WITH_STATS.
+inline constexpr bool with_stats = QUALA_WITH_STATS;
+
+/// Counters for a single kind of operation of an accelerator.
+struct OpStats {
+    /// Number of calls.
+    std::uint64_t count = 0;
+    /// Accumulated wall-clock time, in nanoseconds.
+    std::uint64_t time_ns = 0;
+    /// Estimated number of floating point operations.
+    double flops = 0;
+    /// Estimated number of bytes read and written. Assumes that every vector
+    /// operation streams its operands from memory.
+    double bytes = 0;
+
+    /// Add the cost estimate of a single call.
+    void add_cost(double flops, double bytes) {
+        this->flops += flops;
+        this->bytes += bytes;
+    }
+};
+
+/// Outcome of an update of a quasi-Newton accelerator.
+enum class UpdateStatus {
+    Accepted,  ///< The update was used.
+    SmallStep, ///< The step @f$ s @f$ was too small.
+    NonFinite, ///< The curvature was infinite or NaN.
+    Curvature, ///< The curvature condition was not satisfied.
+    CBFGS,     ///< The cautious BFGS condition was not satisfied.
+};
+
+/// Performance counters of an accelerator, only updated if the library was
+/// compiled with @ref QUALA_WITH_STATS.
+struct AccelStats {
+    /// Calls to `update_sy` (`compute` for Anderson acceleration).
+    OpStats update;
+    /// Calls to `apply` with the full vector.
+    OpStats apply;
+    /// Calls to `apply` with an index set.
+    OpStats masked_apply;
+
+    /// Number of updates that were accepted.
+    std::uint64_t accepted = 0;
+    /// Number of updates rejected because of @ref UpdateStatus::SmallStep.
+    std::uint64_t rejected_small_step = 0;
+    /// Number of updates rejected because of @ref UpdateStatus::NonFinite.
+    std::uint64_t rejected_non_finite = 0;
+    /// Number of updates rejected because of @ref UpdateStatus::Curvature.
+    std::uint64_t rejected_curvature = 0;
+    /// Number of updates rejected because of @ref UpdateStatus::CBFGS.
+    std::uint64_t rejected_cbfgs = 0;
+    /// Number of reorthogonalizations in the QR factorization.
+    std::uint64_t reorthogonalizations = 0;
+    /// Number of small diagonal elements of R that were skipped when solving
+    /// the least squares problem.
+    std::uint64_t skipped_diagonals = 0;
+
+    /// Count the outcome of an update.
+    void count(UpdateStatus s) {
+        switch (s) {
+            case UpdateStatus::Accepted: ++accepted; break;
+            case UpdateStatus::SmallStep: ++rejected_small_step; break;
+            case UpdateStatus::NonFinite: ++rejected_non_finite; break;
+            case UpdateStatus::Curvature: ++rejected_curvature; break;
+            case UpdateStatus::CBFGS: ++rejected_cbfgs; break;
+            default: break;
+        }
+    }
+    /// Total number of rejected updates.
+    std::uint64_t rejected() const {
+        return rejected_small_step + rejected_non_finite + rejected_curvature +
+               rejected_cbfgs;
+    }
+    /// Set all counters to zero.
+    void reset() { *this = {}; }
+};
+
+/// Increments the call count of an @ref OpStats, and adds the wall-clock time
+/// until the end of its scope. If @p count is false, only the time is added,
+/// and the caller increments the count once it knows that the call is not
+/// handed off to another function that is timed as well.
+class OpTimer {
+  public:
+    using clock = std::chrono::steady_clock;
+    OpTimer(OpStats &op, bool count = true) : op(op), t0(clock::now()) {
+        op.count += count;
+    }
+    ~OpTimer() {
+        auto t = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock::now() - t0);
+        op.time_ns += static_cast<std::uint64_t>(t.count());
+    }
+    OpTimer(const OpTimer &)            = delete;
+    OpTimer &operator=(const OpTimer &) = delete;
+
+  private:
+    OpStats &op;
+    clock::time_point t0;
+};
+
+} // namespace quala
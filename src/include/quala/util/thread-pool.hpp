@@ -0,0 +1,71 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace quala {
+
+/// Fixed set of worker threads for fork-join parallelism.
+///
+/// @ref run distributes a number of independent tasks over the workers and
+/// the calling thread, and returns when all of them are done. Tasks are handed
+/// out dynamically, so which thread executes which task is unspecified: tasks
+/// should write their results to task-specific locations if the results have
+/// to be deterministic.
+class ThreadPool {
+  public:
+    /// @param  num_threads
+    ///         The total number of threads that execute tasks, including the
+    ///         thread calling @ref run. A pool with a single thread doesn't
+    ///         start any workers.
+    explicit ThreadPool(length_t num_threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &)            = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /// Get the total number of threads, including the calling thread.
+    length_t num_threads() const { return workers.size() + 1; }
+
+    /// Call `f(task, thread)` for all tasks in [0, @p num_tasks), and wait
+    /// for them to finish. The thread index is in [0, @ref num_threads), and
+    /// no two tasks with the same thread index run concurrently, so it can be
+    /// used to select a thread-local workspace.
+    /// Concurrent calls from different threads are serialized.
+    /// @note   @p f must not throw.
+    template <class F>
+    void run(index_t num_tasks, F &&f) {
+        using Fn = std::remove_reference_t<F>;
+        run_impl(num_tasks,
+                 [](void *ctx, index_t task, index_t thread) {
+                     (*static_cast<Fn *>(ctx))(task, thread);
+                 },
+                 const_cast<void *>(static_cast<const void *>(&f)));
+    }
+
+  private:
+    using task_t = void (*)(void *ctx, index_t task, index_t thread);
+    void run_impl(index_t num_tasks, task_t task, void *ctx);
+    void work(index_t thread);
+    void worker_loop(index_t thread);
+
+    std::vector<std::thread> workers;
+    std::mutex run_mtx; ///< Serializes calls to @ref run.
+    std::mutex mtx;     ///< Protects the members below.
+    std::condition_variable cv_start, cv_done;
+    unsigned long generation = 0; ///< Incremented for every call to @ref run.
+    length_t busy            = 0; ///< Number of workers still working.
+    bool stop                = false;
+    task_t task              = nullptr;
+    void *ctx                = nullptr;
+    index_t num_tasks        = 0;
+    std::atomic<index_t> next_task{0};
+};
+
+} // namespace quala
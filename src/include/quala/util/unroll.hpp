@@ -0,0 +1,24 @@
+#pragma once
+
+#include <quala/util/vec.hpp>
+
+#include <utility>
+
+namespace quala {
+
+namespace detail {
+template <class F, index_t... Is>
+void static_for_impl(F &&f, std::integer_sequence<index_t, Is...>) {
+    (f(std::integral_constant<index_t, Is>{}), ...);
+}
+} // namespace detail
+
+/// Call @p f with the indices 0, 1, ..., @p N - 1 (as
+/// `std::integral_constant<index_t, i>`), fully unrolled at compile time.
+template <index_t N, class F>
+void static_for(F &&f) {
+    detail::static_for_impl(std::forward<F>(f),
+                            std::make_integer_sequence<index_t, N>());
+}
+
+} // namespace quala
@@ -2,26 +2,9 @@
 
 #include <Eigen/Core>
 
-namespace quala {
+#include <limits>
 
-/// Default floating point type
-using real_t = double; // TODO: make template?
-/// Default type for floating point vectors.
-using realvec = Eigen::Matrix<real_t, Eigen::Dynamic, 1>;
-/// Default type for floating point matrices.
-using realmat = Eigen::Matrix<real_t, Eigen::Dynamic, Eigen::Dynamic>;
-/// Default type for vectors.
-using vec = realvec;
-/// Default type for mutable references to vectors.
-using rvec = Eigen::Ref<vec>;
-/// Default type for immutable references to vectors.
-using crvec = Eigen::Ref<const vec>;
-/// Default type for matrices.
-using mat = realmat;
-/// Default type for mutable references to matrices.
-using rmat = Eigen::Ref<mat>;
-/// Default type for immutable references to matrices.
-using crmat = Eigen::Ref<const mat>;
+namespace quala {
 
 /// Default type for vector indices.
 using index_t = Eigen::Index;
@@ -35,14 +18,76 @@ using ridvec = Eigen::Ref<idvec>;
 /// Immutable reference to vector indices.
 using cridvec = Eigen::Ref<const idvec>;
 
+/// Type for a vector of flags, e.g. a mask of the instances of a batch.
+using boolvec = Eigen::Array<bool, Eigen::Dynamic, 1>;
+/// Immutable reference to a vector of flags.
+using crboolvec = Eigen::Ref<const boolvec>;
+
+/// Types and constants for a given floating point type.
+/// @tparam RealT
+///         Floating point type (e.g. `float`, `double` or `long double`).
+template <class RealT>
+struct EigenConfig {
+    /// Floating point type.
+    using real_t = RealT;
+    /// Type for floating point vectors.
+    using vec = Eigen::Matrix<real_t, Eigen::Dynamic, 1>;
+    /// Type for mutable references to vectors.
+    using rvec = Eigen::Ref<vec>;
+    /// Type for immutable references to vectors.
+    using crvec = Eigen::Ref<const vec>;
+    /// Type for floating point matrices.
+    using mat = Eigen::Matrix<real_t, Eigen::Dynamic, Eigen::Dynamic>;
+    /// Type for mutable references to matrices.
+    using rmat = Eigen::Ref<mat>;
+    /// Type for immutable references to matrices.
+    using crmat = Eigen::Ref<const mat>;
+    /// @f$ \infty @f$
+    static constexpr real_t inf = std::numeric_limits<real_t>::infinity();
+    /// Not a number.
+    static constexpr real_t NaN = std::numeric_limits<real_t>::quiet_NaN();
+};
+
+/// Declare the types and constants of @ref EigenConfig for the floating point
+/// type @p Real in the current (class) scope.
+#define USING_QUALA_TYPES(Real)                                                \
+    using real_t = typename ::quala::EigenConfig<Real>::real_t;               \
+    using vec    = typename ::quala::EigenConfig<Real>::vec;                  \
+    using rvec   = typename ::quala::EigenConfig<Real>::rvec;                 \
+    using crvec  = typename ::quala::EigenConfig<Real>::crvec;                \
+    using mat    = typename ::quala::EigenConfig<Real>::mat;                  \
+    using rmat   = typename ::quala::EigenConfig<Real>::rmat;                 \
+    using crmat  = typename ::quala::EigenConfig<Real>::crmat;                \
+    static constexpr real_t inf = ::quala::EigenConfig<Real>::inf;            \
+    static constexpr real_t NaN = ::quala::EigenConfig<Real>::NaN
+
+/// Default floating point type
+using real_t = double;
+/// Default type for floating point vectors.
+using realvec = EigenConfig<real_t>::vec;
+/// Default type for floating point matrices.
+using realmat = EigenConfig<real_t>::mat;
+/// Default type for vectors.
+using vec = realvec;
+/// Default type for mutable references to vectors.
+using rvec = EigenConfig<real_t>::rvec;
+/// Default type for immutable references to vectors.
+using crvec = EigenConfig<real_t>::crvec;
+/// Default type for matrices.
+using mat = realmat;
+/// Default type for mutable references to matrices.
+using rmat = EigenConfig<real_t>::rmat;
+/// Default type for immutable references to matrices.
+using crmat = EigenConfig<real_t>::crmat;
+
 /// Generic type for vector and matrix arguments.
 template <class Derived>
 using anymat = Eigen::MatrixBase<Derived>;
 
 /// @f$ \infty @f$
-constexpr real_t inf = std::numeric_limits<real_t>::infinity();
+constexpr real_t inf = EigenConfig<real_t>::inf;
 /// Not a number.
-constexpr real_t NaN = std::numeric_limits<real_t>::quiet_NaN();
+constexpr real_t NaN = EigenConfig<real_t>::NaN;
 
 namespace vec_util {
 
@@ -56,17 +101,32 @@ auto norm_squared_weighted(V &&v, M &&Σ) {
 /// Get the maximum or infinity-norm of the given vector.
 /// @returns @f$ \left\|v\right\|_\infty @f$
 template <class Vec>
-real_t norm_inf(const Vec &v) {
+auto norm_inf(const Vec &v) {
     return v.template lpNorm<Eigen::Infinity>();
 }
 
 /// Get the 1-norm of the given vector.
 /// @returns @f$ \left\|v\right\|_1 @f$
 template <class Vec>
-real_t norm_1(const Vec &v) {
+auto norm_1(const Vec &v) {
     return v.template lpNorm<1>();
 }
 
+/// Rotate the first @p k columns of @p A in place, such that column @p r
+/// becomes the first one, like `std::rotate`. Used to bring the columns of a
+/// circular buffer in chronological order.
+template <class Derived>
+void rotate_cols(Eigen::DenseBase<Derived> &A, length_t k, index_t r) {
+    // Three reversals, so no temporary storage is needed
+    const auto reverse = [&A](index_t first, index_t last) {
+        while (first < --last)
+            A.col(first++).swap(A.col(last));
+    };
+    reverse(0, r);
+    reverse(r, k);
+    reverse(0, k);
+}
+
 } // namespace vec_util
 
 } // namespace quala
\ No newline at end of file
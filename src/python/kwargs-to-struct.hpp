@@ -104,41 +104,53 @@ T var_kwargs_to_struct(const std::variant<T, py::dict> &p) {
 
 #include <quala/lbfgs.hpp>
 
-template <>
-inline const kwargs_to_struct_table_t<quala::LBFGSParams>
-    kwargs_to_struct_table<quala::LBFGSParams>{
-        {"memory", &quala::LBFGSParams::memory},
-        {"min_div_fac", &quala::LBFGSParams::min_div_fac},
-        {"min_abs_s", &quala::LBFGSParams::min_abs_s},
-        {"force_pos_def", &quala::LBFGSParams::force_pos_def},
-        {"cbfgs", &quala::LBFGSParams::cbfgs},
+template <class Real>
+inline const kwargs_to_struct_table_t<quala::BasicLBFGSParams<Real>>
+    kwargs_to_struct_table<quala::BasicLBFGSParams<Real>>{
+        {"memory", &quala::BasicLBFGSParams<Real>::memory},
+        {"min_div_fac", &quala::BasicLBFGSParams<Real>::min_div_fac},
+        {"min_abs_s", &quala::BasicLBFGSParams<Real>::min_abs_s},
+        {"force_pos_def", &quala::BasicLBFGSParams<Real>::force_pos_def},
+        {"cbfgs", &quala::BasicLBFGSParams<Real>::cbfgs},
+        {"apply_method", &quala::BasicLBFGSParams<Real>::apply_method},
+        {"cache_masked_apply", &quala::BasicLBFGSParams<Real>::cache_masked_apply},
+        {"num_threads", &quala::BasicLBFGSParams<Real>::num_threads},
+        {"chunk_size", &quala::BasicLBFGSParams<Real>::chunk_size},
+        {"hessian_products", &quala::BasicLBFGSParams<Real>::hessian_products},
+        {"storage_dir", &quala::BasicLBFGSParams<Real>::storage_dir},
+        {"diagonal_h0", &quala::BasicLBFGSParams<Real>::diagonal_h0},
+        {"diagonal_h0_bound", &quala::BasicLBFGSParams<Real>::diagonal_h0_bound},
     };
 
-template <>
-inline const kwargs_to_struct_table_t<decltype(quala::LBFGSParams::cbfgs)>
-    kwargs_to_struct_table<decltype(quala::LBFGSParams::cbfgs)>{
-        {"α", &decltype(quala::LBFGSParams::cbfgs)::α},
-        {"ϵ", &decltype(quala::LBFGSParams::cbfgs)::ϵ},
+template <class Real>
+inline const kwargs_to_struct_table_t<quala::BasicCBFGSParams<Real>>
+    kwargs_to_struct_table<quala::BasicCBFGSParams<Real>>{
+        {"α", &quala::BasicCBFGSParams<Real>::α},
+        {"ϵ", &quala::BasicCBFGSParams<Real>::ϵ},
     };
 
 #include <quala/anderson-acceleration.hpp>
 
-template <>
-inline const kwargs_to_struct_table_t<quala::AndersonAccelParams>
-    kwargs_to_struct_table<quala::AndersonAccelParams>{
-        {"memory", &quala::AndersonAccelParams::memory},
-        {"min_div", &quala::AndersonAccelParams::min_div},
+template <class Real>
+inline const kwargs_to_struct_table_t<quala::BasicAndersonAccelParams<Real>>
+    kwargs_to_struct_table<quala::BasicAndersonAccelParams<Real>>{
+        {"memory", &quala::BasicAndersonAccelParams<Real>::memory},
+        {"min_div", &quala::BasicAndersonAccelParams<Real>::min_div},
+        {"regularization", &quala::BasicAndersonAccelParams<Real>::regularization},
     };
 
 #include <quala/broyden-good.hpp>
 
-template <>
-inline const kwargs_to_struct_table_t<quala::BroydenGoodParams>
-    kwargs_to_struct_table<quala::BroydenGoodParams>{
-        {"memory", &quala::BroydenGoodParams::memory},
-        {"min_div_abs", &quala::BroydenGoodParams::min_div_abs},
-        {"force_pos_def", &quala::BroydenGoodParams::force_pos_def},
-        {"restarted", &quala::BroydenGoodParams::restarted},
-        {"powell_damping_factor", &quala::BroydenGoodParams::powell_damping_factor},
-        {"min_stepsize", &quala::BroydenGoodParams::min_stepsize},
+template <class Real>
+inline const kwargs_to_struct_table_t<quala::BasicBroydenGoodParams<Real>>
+    kwargs_to_struct_table<quala::BasicBroydenGoodParams<Real>>{
+        {"memory", &quala::BasicBroydenGoodParams<Real>::memory},
+        {"min_div_abs", &quala::BasicBroydenGoodParams<Real>::min_div_abs},
+        {"force_pos_def", &quala::BasicBroydenGoodParams<Real>::force_pos_def},
+        {"restarted", &quala::BasicBroydenGoodParams<Real>::restarted},
+        {"powell_damping_factor", &quala::BasicBroydenGoodParams<Real>::powell_damping_factor},
+        {"min_stepsize", &quala::BasicBroydenGoodParams<Real>::min_stepsize},
+        {"storage_dir", &quala::BasicBroydenGoodParams<Real>::storage_dir},
+        {"diagonal_h0", &quala::BasicBroydenGoodParams<Real>::diagonal_h0},
+        {"diagonal_h0_bound", &quala::BasicBroydenGoodParams<Real>::diagonal_h0_bound},
     };
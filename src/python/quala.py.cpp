@@ -27,30 +27,101 @@
 
 namespace py = pybind11;
 
-PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
+/// Register a scoped enum in the given scope. The enums are shared by all
+/// floating point types, so they are only registered once, the classes for
+/// the other floating point types simply get a reference to the existing
+/// Python type (and its exported values).
+template <class Enum, class F>
+void register_enum(py::handle scope, const char *name, F &&register_fun) {
+    if (auto *tinfo = py::detail::get_type_info(typeid(Enum))) {
+        py::handle type{reinterpret_cast<PyObject *>(tinfo->type)};
+        scope.attr(name) = type;
+        for (auto &&[key, val] : py::dict(type.attr("__members__")))
+            scope.attr(key) = val;
+    } else {
+        register_fun(scope);
+    }
+}
+
+/// Pickling support for the parameter structs. The state is a dict with the
+/// values of all members, nested structs are pickled recursively.
+template <class Params>
+auto pickle_params() {
+    return py::pickle(
+        [](const Params &params) {
+            py::dict d;
+            for (auto &&[key, val] : kwargs_to_struct_table<Params>)
+                d[key.c_str()] = val.get(params);
+            return d;
+        },
+        [](py::dict d) { return kwargs_to_struct<Params>(d); });
+}
+
+/// Pickling support for the accelerators. The state consists of the
+/// parameters, the problem dimension and the binary checkpoint written by the
+/// accelerator's `save` method.
+template <class Accel>
+auto pickle_accel() {
+    return py::pickle(
+        [](const Accel &self) {
+            std::ostringstream os;
+            quala::CheckpointWriter w{os};
+            self.save(w);
+            return py::make_tuple(self.get_params(), self.n(), py::bytes(os.str()));
+        },
+        [](py::tuple t) {
+            if (t.size() != 3)
+                throw std::runtime_error("Invalid state");
+            Accel self{t[0].cast<typename Accel::Params>(), t[1].cast<quala::length_t>()};
+            std::string blob = t[2].cast<py::bytes>();
+            quala::CheckpointReader r{blob.data(), blob.size()};
+            self.load(r);
+            return self;
+        });
+}
+
+/// Convert the performance counters of an accelerator to a dict, with a
+/// nested dict for each kind of operation.
+inline py::dict stats_to_dict(const quala::AccelStats &stats) {
+    auto op_to_dict = [](const quala::OpStats &op) {
+        py::dict d;
+        d["count"]   = op.count;
+        d["time_ns"] = op.time_ns;
+        d["flops"]   = op.flops;
+        d["bytes"]   = op.bytes;
+        return d;
+    };
+    py::dict d;
+    d["update"]               = op_to_dict(stats.update);
+    d["apply"]                = op_to_dict(stats.apply);
+    d["masked_apply"]         = op_to_dict(stats.masked_apply);
+    d["accepted"]             = stats.accepted;
+    d["rejected_small_step"]  = stats.rejected_small_step;
+    d["rejected_non_finite"]  = stats.rejected_non_finite;
+    d["rejected_curvature"]   = stats.rejected_curvature;
+    d["rejected_cbfgs"]       = stats.rejected_cbfgs;
+    d["reorthogonalizations"] = stats.reorthogonalizations;
+    d["skipped_diagonals"]    = stats.skipped_diagonals;
+    return d;
+}
+
+/// Register all classes for the given floating point type in module @p m.
+template <class Real>
+void register_classes(py::module_ &m) {
     using py::operator""_a;
-    using quala::crmat;
-    using quala::crvec;
+    USING_QUALA_TYPES(Real);
+    using quala::cridvec;
     using quala::index_t;
     using quala::length_t;
-    using quala::mat;
-    using quala::real_t;
-    using quala::rmat;
-    using quala::rvec;
-    using quala::vec;
-
-    py::options options;
-    options.enable_function_signatures();
-    options.enable_user_defined_docstrings();
-
-    m.doc() = "Quala Quasi-Newton algorithms";
+    using CBFGSParams         = quala::BasicCBFGSParams<Real>;
+    using LBFGSParams         = quala::BasicLBFGSParams<Real>;
+    using LBFGS               = quala::BasicLBFGS<Real>;
+    using AndersonAccelParams = quala::BasicAndersonAccelParams<Real>;
+    using AndersonAccel       = quala::BasicAndersonAccel<Real>;
+    using BroydenGoodParams   = quala::BasicBroydenGoodParams<Real>;
+    using BroydenGood         = quala::BasicBroydenGood<Real>;
 
-#ifdef QUALA_VERSION_INFO
-    m.attr("__version__") = QUALA_VERSION_INFO;
-#else
-    m.attr("__version__") = "dev";
-#endif
-    using quala::LimitedMemoryQR;
+    using LimitedMemoryQR = quala::BasicLimitedMemoryQR<Real>;
     py::class_<LimitedMemoryQR>(m, "LimitedMemoryQR")
         .def(py::init<>())
         .def(py::init<length_t, length_t>(), "n"_a, "m"_a)
@@ -58,7 +129,7 @@ PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
         .def_property_readonly("m", &LimitedMemoryQR::m)
         .def_property_readonly("size", &LimitedMemoryQR::size)
         .def_property_readonly("history", &LimitedMemoryQR::history)
-        .def("add_column", &LimitedMemoryQR::add_column<crvec>, "v"_a)
+        .def("add_column", &LimitedMemoryQR::template add_column<crvec>, "v"_a)
         .def("remove_column", &LimitedMemoryQR::remove_column)
         .def(
             "solve",
@@ -81,53 +152,90 @@ PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
         .def_property_readonly("max_eig", &LimitedMemoryQR::get_max_eig)
         .def_property_readonly("current_history", &LimitedMemoryQR::current_history)
         .def_property_readonly("reorth_count", &LimitedMemoryQR::get_reorth_count)
-        .def("clear_reorth_count", &LimitedMemoryQR::clear_reorth_count);
+        .def_property_readonly("skip_count", &LimitedMemoryQR::get_skip_count)
+        .def("clear_reorth_count", &LimitedMemoryQR::clear_reorth_count)
+        .def(py::pickle(
+            [](const LimitedMemoryQR &self) {
+                std::ostringstream os;
+                quala::CheckpointWriter w{os};
+                self.save(w);
+                return py::make_tuple(self.n(), self.m(), py::bytes(os.str()));
+            },
+            [](py::tuple t) {
+                if (t.size() != 3)
+                    throw std::runtime_error("Invalid state");
+                LimitedMemoryQR self{t[0].cast<length_t>(), t[1].cast<length_t>()};
+                std::string blob = t[2].cast<py::bytes>();
+                quala::CheckpointReader r{blob.data(), blob.size()};
+                self.load(r);
+                return self;
+            }));
 
-    py::class_<quala::LBFGSParams::CBFGSParams>(
+    py::class_<CBFGSParams>(
         m, "LBFGSParamsCBFGS", "C++ documentation: :cpp:member:`quala::LBFGSParams::CBFGSParams `")
         .def(py::init())
-        .def(py::init(&kwargs_to_struct<quala::LBFGSParams::CBFGSParams>))
-        .def("to_dict", &struct_to_dict<quala::LBFGSParams::CBFGSParams>)
-        .def_readwrite("α", &quala::LBFGSParams::CBFGSParams::α)
-        .def_readwrite("ϵ", &quala::LBFGSParams::CBFGSParams::ϵ)
-        .def("__bool__", &quala::LBFGSParams::CBFGSParams::operator bool);
+        .def(py::init(&kwargs_to_struct<CBFGSParams>))
+        .def("to_dict", &struct_to_dict<CBFGSParams>)
+        .def_readwrite("α", &CBFGSParams::α)
+        .def_readwrite("ϵ", &CBFGSParams::ϵ)
+        .def("__bool__", &CBFGSParams::operator bool)
+        .def(pickle_params<CBFGSParams>());
 
-    py::class_<quala::LBFGSParams>(m, "LBFGSParams",
-                                   "C++ documentation: :cpp:class:`quala::LBFGSParams`")
+    auto lbfgsparams = py::class_<LBFGSParams>(
+        m, "LBFGSParams", "C++ documentation: :cpp:class:`quala::LBFGSParams`");
+    register_enum<quala::LBFGSApplyMethod>(lbfgsparams, "ApplyMethod", [](py::handle scope) {
+        py::enum_<quala::LBFGSApplyMethod>(
+            scope, "ApplyMethod", "C++ documentation :cpp:enum:`quala::LBFGSApplyMethod`")
+            .value("TwoLoop", quala::LBFGSApplyMethod::TwoLoop)
+            .value("Compact", quala::LBFGSApplyMethod::Compact)
+            .export_values();
+    });
+    lbfgsparams //
         .def(py::init())
-        .def(py::init(&kwargs_to_struct<quala::LBFGSParams>))
-        .def("to_dict", &struct_to_dict<quala::LBFGSParams>)
-        .def_readwrite("memory", &quala::LBFGSParams::memory)
-        .def_readwrite("min_div_fac", &quala::LBFGSParams::min_div_fac)
-        .def_readwrite("min_abs_s", &quala::LBFGSParams::min_abs_s)
-        .def_readwrite("force_pos_def", &quala::LBFGSParams::force_pos_def)
-        .def_readwrite("cbfgs", &quala::LBFGSParams::cbfgs);
+        .def(py::init(&kwargs_to_struct<LBFGSParams>))
+        .def("to_dict", &struct_to_dict<LBFGSParams>)
+        .def_readwrite("memory", &LBFGSParams::memory)
+        .def_readwrite("min_div_fac", &LBFGSParams::min_div_fac)
+        .def_readwrite("min_abs_s", &LBFGSParams::min_abs_s)
+        .def_readwrite("force_pos_def", &LBFGSParams::force_pos_def)
+        .def_readwrite("cbfgs", &LBFGSParams::cbfgs)
+        .def_readwrite("apply_method", &LBFGSParams::apply_method)
+        .def_readwrite("cache_masked_apply", &LBFGSParams::cache_masked_apply)
+        .def_readwrite("num_threads", &LBFGSParams::num_threads)
+        .def_readwrite("chunk_size", &LBFGSParams::chunk_size)
+        .def_readwrite("hessian_products", &LBFGSParams::hessian_products)
+        .def_readwrite("storage_dir", &LBFGSParams::storage_dir)
+        .def_readwrite("diagonal_h0", &LBFGSParams::diagonal_h0)
+        .def_readwrite("diagonal_h0_bound", &LBFGSParams::diagonal_h0_bound)
+        .def_readwrite("sparse_max_density", &LBFGSParams::sparse_max_density)
+        .def(pickle_params<LBFGSParams>());
 
     auto lbfgs =
-        py::class_<quala::LBFGS>(m, "LBFGS", "C++ documentation: :cpp:class:`quala::LBFGS`");
-    auto lbfgssign = py::enum_<quala::LBFGS::Sign>(
-        lbfgs, "Sign", "C++ documentation :cpp:enum:`quala::LBFGS::Sign`");
-    lbfgssign //
-        .value("Positive", quala::LBFGS::Sign::Positive)
-        .value("Negative", quala::LBFGS::Sign::Negative)
-        .export_values();
+        py::class_<LBFGS>(m, "LBFGS", "C++ documentation: :cpp:class:`quala::LBFGS`");
+    register_enum<quala::LBFGSSign>(lbfgs, "Sign", [](py::handle scope) {
+        py::enum_<quala::LBFGSSign>(scope, "Sign",
+                                    "C++ documentation :cpp:enum:`quala::LBFGSSign`")
+            .value("Positive", quala::LBFGSSign::Positive)
+            .value("Negative", quala::LBFGSSign::Negative)
+            .export_values();
+    });
     lbfgs //
-        .def(py::init<quala::LBFGS::Params>(), "params"_a)
-        .def(py::init([](py::dict params) -> quala::LBFGS {
-                 return {kwargs_to_struct<quala::LBFGS::Params>(params)};
+        .def(py::init<LBFGSParams>(), "params"_a)
+        .def(py::init([](py::dict params) -> LBFGS {
+                 return {kwargs_to_struct<LBFGSParams>(params)};
              }),
              "params"_a)
-        .def(py::init<quala::LBFGS::Params, length_t>(), "params"_a, "n"_a)
-        .def(py::init([](py::dict params, length_t n) -> quala::LBFGS {
-                 return {kwargs_to_struct<quala::LBFGS::Params>(params), n};
+        .def(py::init<LBFGSParams, length_t>(), "params"_a, "n"_a)
+        .def(py::init([](py::dict params, length_t n) -> LBFGS {
+                 return {kwargs_to_struct<LBFGSParams>(params), n};
              }),
              "params"_a, "n"_a)
-        .def_static("update_valid", quala::LBFGS::update_valid, "params"_a, "yᵀs"_a, "sᵀs"_a,
+        .def_static("update_valid", LBFGS::update_valid, "params"_a, "yᵀs"_a, "sᵀs"_a,
                     "pᵀp"_a)
         .def(
             "update",
-            [](quala::LBFGS &self, crvec xk, crvec xkp1, crvec pk, crvec pkp1,
-               quala::LBFGS::Sign sign, bool forced) {
+            [](LBFGS &self, crvec xk, crvec xkp1, crvec pk, crvec pkp1,
+               quala::LBFGSSign sign, bool forced) {
                 if (xk.size() != self.n())
                     throw std::invalid_argument("xk dimension mismatch");
                 if (xkp1.size() != self.n())
@@ -138,11 +246,11 @@ PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
                     throw std::invalid_argument("pkp1 dimension mismatch");
                 return self.update(xk, xkp1, pk, pkp1, sign, forced);
             },
-            "xk"_a, "xkp1"_a, "pk"_a, "pkp1"_a, "sign"_a = quala::LBFGS::Sign::Positive,
+            "xk"_a, "xkp1"_a, "pk"_a, "pkp1"_a, "sign"_a = quala::LBFGSSign::Positive,
             "forced"_a = false)
         .def(
             "update_sy",
-            [](quala::LBFGS &self, crvec sk, crvec yk, real_t pkp1Tpkp1, bool forced) {
+            [](LBFGS &self, crvec sk, crvec yk, real_t pkp1Tpkp1, bool forced) {
                 if (sk.size() != self.n())
                     throw std::invalid_argument("sk dimension mismatch");
                 if (yk.size() != self.n())
@@ -150,9 +258,21 @@ PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
                 return self.update_sy(sk, yk, pkp1Tpkp1, forced);
             },
             "sk"_a, "yk"_a, "pkp1Tpkp1"_a, "forced"_a = false)
+        .def(
+            "update_sy_sparse",
+            [](LBFGS &self, cridvec J, crvec sJ, crvec yJ, real_t pkp1Tpkp1, bool forced) {
+                if (sJ.size() != J.size() || yJ.size() != J.size())
+                    throw std::invalid_argument("sJ/yJ dimension mismatch");
+                if (J.size() > 0 && (J.minCoeff() < 0 || J.maxCoeff() >= self.n()))
+                    throw std::invalid_argument("J index out of range");
+                return self.update_sy_sparse(J, sJ, yJ, pkp1Tpkp1, forced);
+            },
+            "J"_a, "sJ"_a, "yJ"_a, "pkp1Tpkp1"_a, "forced"_a = false)
+        .def("densify", &LBFGS::densify)
+        .def_property_readonly("num_sparse", &LBFGS::num_sparse)
         .def(
             "apply",
-            [](quala::LBFGS &self, rvec q, real_t γ) {
+            [](LBFGS &self, rvec q, real_t γ) {
                 if (q.size() != self.n())
                     throw std::invalid_argument("q dimension mismatch");
                 return self.apply(q, γ);
@@ -160,45 +280,95 @@ PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
             "q"_a, "γ"_a)
         .def(
             "apply",
-            [](quala::LBFGS &self, rvec q, real_t γ, const std::vector<vec::Index> &J) {
+            [](LBFGS &self, rmat Q, real_t γ) {
+                if (Q.rows() != self.n())
+                    throw std::invalid_argument("Q dimension mismatch");
+                return self.apply(Q, γ);
+            },
+            "Q"_a, "γ"_a)
+        .def(
+            "apply",
+            [](LBFGS &self, rvec q, real_t γ, const std::vector<index_t> &J) {
                 return self.apply(q, γ, J);
             },
             "q"_a, "γ"_a, "J"_a)
-        .def("reset", &quala::LBFGS::reset)
-        .def("current_history", &quala::LBFGS::current_history)
-        .def("resize", &quala::LBFGS::resize, "n"_a)
-        .def("scale_y", &quala::LBFGS::scale_y, "factor"_a)
-        .def_property_readonly("n", &quala::LBFGS::n)
-        .def("s", [](quala::LBFGS &self, index_t i) -> rvec { return self.s(i); })
-        .def("y", [](quala::LBFGS &self, index_t i) -> rvec { return self.y(i); })
-        .def("ρ", [](quala::LBFGS &self, index_t i) -> real_t & { return self.ρ(i); })
-        .def("α", [](quala::LBFGS &self, index_t i) -> real_t & { return self.α(i); })
-        .def_property_readonly("params", &quala::LBFGS::get_params);
+        .def(
+            "apply",
+            [](LBFGS &self, rvec q, crvec d) {
+                if (q.size() != self.n())
+                    throw std::invalid_argument("q dimension mismatch");
+                return self.apply(q, d);
+            },
+            "q"_a, "d"_a)
+        .def(
+            "apply",
+            [](LBFGS &self, rvec q, crvec d, const std::vector<index_t> &J) {
+                return self.apply(q, d, J);
+            },
+            "q"_a, "d"_a, "J"_a)
+        .def_property_readonly("diagonal_h0", &LBFGS::diagonal_h0)
+        .def(
+            "apply_hessian",
+            [](LBFGS &self, rmat V, real_t γ) {
+                if (V.rows() != self.n())
+                    throw std::invalid_argument("V dimension mismatch");
+                return self.apply_hessian(V, γ);
+            },
+            "V"_a, "γ"_a = -1)
+        .def("reset", &LBFGS::reset)
+        .def("current_history", &LBFGS::current_history)
+        .def("resize", &LBFGS::resize, "n"_a)
+        .def("set_memory", &LBFGS::set_memory, "m"_a)
+        .def_property_readonly(
+            "stats", [](const LBFGS &self) { return stats_to_dict(self.get_stats()); })
+        .def("reset_stats", &LBFGS::reset_stats)
+        .def("begin_transaction", &LBFGS::begin_transaction)
+        .def("commit", &LBFGS::commit)
+        .def("rollback", &LBFGS::rollback)
+        .def_property_readonly("in_transaction", &LBFGS::in_transaction)
+        .def("scale_y", &LBFGS::scale_y, "factor"_a)
+        .def_property_readonly("n", &LBFGS::n)
+        .def("s", [](LBFGS &self, index_t i) -> rvec { return self.s(i); })
+        .def("y", [](LBFGS &self, index_t i) -> rvec { return self.y(i); })
+        .def("ρ", [](LBFGS &self, index_t i) -> real_t & { return self.ρ(i); })
+        .def("α", [](LBFGS &self, index_t i) -> real_t & { return self.α(i); })
+        .def_property_readonly("params", &LBFGS::get_params)
+        .def(pickle_accel<LBFGS>());
 
-    py::class_<quala::AndersonAccelParams>(
+    py::class_<AndersonAccelParams>(
         m, "AndersonAccelParams", "C++ documentation: :cpp:class:`quala::AndersonAccelParams`")
         .def(py::init())
-        .def(py::init(&kwargs_to_struct<quala::AndersonAccelParams>))
-        .def("to_dict", &struct_to_dict<quala::AndersonAccelParams>)
-        .def_readwrite("memory", &quala::AndersonAccelParams::memory)
-        .def_readwrite("min_div", &quala::AndersonAccelParams::min_div);
+        .def(py::init(&kwargs_to_struct<AndersonAccelParams>))
+        .def("to_dict", &struct_to_dict<AndersonAccelParams>)
+        .def_readwrite("memory", &AndersonAccelParams::memory)
+        .def_readwrite("min_div", &AndersonAccelParams::min_div)
+        .def_readwrite("regularization", &AndersonAccelParams::regularization)
+        .def(pickle_params<AndersonAccelParams>());
 
-    py::class_<quala::AndersonAccel>(m, "AndersonAccel",
+    py::class_<AndersonAccel>(m, "AndersonAccel",
                                      "C++ documentation: :cpp:class:`quala::AndersonAccel`")
-        .def(py::init<quala::AndersonAccel::Params>(), "params"_a)
-        .def(py::init([](py::dict params) -> quala::AndersonAccel {
-                 return {kwargs_to_struct<quala::AndersonAccel::Params>(params)};
+        .def(py::init<AndersonAccelParams>(), "params"_a)
+        .def(py::init([](py::dict params) -> AndersonAccel {
+                 return {kwargs_to_struct<AndersonAccelParams>(params)};
              }),
              "params"_a)
-        .def(py::init<quala::AndersonAccel::Params, length_t>(), "params"_a, "n"_a)
-        .def(py::init([](py::dict params, length_t n) -> quala::AndersonAccel {
-                 return {kwargs_to_struct<quala::AndersonAccel::Params>(params), n};
+        .def(py::init<AndersonAccelParams, length_t>(), "params"_a, "n"_a)
+        .def(py::init([](py::dict params, length_t n) -> AndersonAccel {
+                 return {kwargs_to_struct<AndersonAccelParams>(params), n};
              }),
              "params"_a, "n"_a)
-        .def("resize", &quala::AndersonAccel::resize, "n"_a)
+        .def("resize", &AndersonAccel::resize, "n"_a)
+        .def("set_memory", &AndersonAccel::set_memory, "m"_a)
+        .def_property_readonly(
+            "stats", [](const AndersonAccel &self) { return stats_to_dict(self.get_stats()); })
+        .def("reset_stats", &AndersonAccel::reset_stats)
+        .def("begin_transaction", &AndersonAccel::begin_transaction)
+        .def("commit", &AndersonAccel::commit)
+        .def("rollback", &AndersonAccel::rollback)
+        .def_property_readonly("in_transaction", &AndersonAccel::in_transaction)
         .def(
             "initialize",
-            [](quala::AndersonAccel &self, crvec g_0, vec r_0) {
+            [](AndersonAccel &self, crvec g_0, vec r_0) {
                 if (g_0.size() != self.n())
                     throw std::invalid_argument("g_0 dimension mismatch");
                 if (r_0.size() != self.n())
@@ -208,7 +378,7 @@ PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
             "g_0"_a, "r_0"_a)
         .def(
             "compute_inplace",
-            [](quala::AndersonAccel &self, crvec g_k, vec r_k, rvec x_k_aa) {
+            [](AndersonAccel &self, crvec g_k, vec r_k, rvec x_k_aa) {
                 if (g_k.size() != self.n())
                     throw std::invalid_argument("g_k dimension mismatch");
                 if (r_k.size() != self.n())
@@ -220,48 +390,62 @@ PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
             "g_k"_a, "r_k"_a, "x_k_aa"_a)
         .def(
             "compute",
-            [](quala::AndersonAccel &self, crvec g_k, vec r_k) {
+            [](AndersonAccel &self, crvec g_k, vec r_k) {
                 if (g_k.size() != self.n())
                     throw std::invalid_argument("g_k dimension mismatch");
                 if (r_k.size() != self.n())
                     throw std::invalid_argument("r_k dimension mismatch");
-                quala::vec x_k_aa(self.n());
+                vec x_k_aa(self.n());
                 self.compute(g_k, std::move(r_k), x_k_aa);
                 return x_k_aa;
             },
             "g_k"_a, "r_k"_a)
-        .def("reset", &quala::AndersonAccel::reset)
-        .def("current_history", &quala::AndersonAccel::current_history)
-        .def_property_readonly("params", &quala::AndersonAccel::get_params);
+        .def("reset", &AndersonAccel::reset)
+        .def("current_history", &AndersonAccel::current_history)
+        .def_property_readonly("params", &AndersonAccel::get_params)
+        .def(pickle_accel<AndersonAccel>());
 
-    py::class_<quala::BroydenGoodParams>(m, "BroydenGoodParams",
+    py::class_<BroydenGoodParams>(m, "BroydenGoodParams",
                                          "C++ documentation: :cpp:class:`quala::BroydenGoodParams`")
         .def(py::init())
-        .def(py::init(&kwargs_to_struct<quala::BroydenGoodParams>))
-        .def("to_dict", &struct_to_dict<quala::BroydenGoodParams>)
-        .def_readwrite("memory", &quala::BroydenGoodParams::memory)
-        .def_readwrite("min_div_abs", &quala::BroydenGoodParams::min_div_abs)
-        .def_readwrite("force_pos_def", &quala::BroydenGoodParams::force_pos_def)
-        .def_readwrite("restarted", &quala::BroydenGoodParams::restarted)
-        .def_readwrite("powell_damping_factor", &quala::BroydenGoodParams::powell_damping_factor)
-        .def_readwrite("min_stepsize", &quala::BroydenGoodParams::min_stepsize);
+        .def(py::init(&kwargs_to_struct<BroydenGoodParams>))
+        .def("to_dict", &struct_to_dict<BroydenGoodParams>)
+        .def_readwrite("memory", &BroydenGoodParams::memory)
+        .def_readwrite("min_div_abs", &BroydenGoodParams::min_div_abs)
+        .def_readwrite("force_pos_def", &BroydenGoodParams::force_pos_def)
+        .def_readwrite("restarted", &BroydenGoodParams::restarted)
+        .def_readwrite("powell_damping_factor", &BroydenGoodParams::powell_damping_factor)
+        .def_readwrite("min_stepsize", &BroydenGoodParams::min_stepsize)
+        .def_readwrite("storage_dir", &BroydenGoodParams::storage_dir)
+        .def_readwrite("diagonal_h0", &BroydenGoodParams::diagonal_h0)
+        .def_readwrite("diagonal_h0_bound", &BroydenGoodParams::diagonal_h0_bound)
+        .def_readwrite("sparse_max_density", &BroydenGoodParams::sparse_max_density)
+        .def(pickle_params<BroydenGoodParams>());
 
-    py::class_<quala::BroydenGood>(m, "BroydenGood",
+    py::class_<BroydenGood>(m, "BroydenGood",
                                    "C++ documentation: :cpp:class:`quala::BroydenGood`")
-        .def(py::init<quala::BroydenGood::Params>(), "params"_a)
-        .def(py::init([](py::dict params) -> quala::BroydenGood {
-                 return {kwargs_to_struct<quala::BroydenGood::Params>(params)};
+        .def(py::init<BroydenGoodParams>(), "params"_a)
+        .def(py::init([](py::dict params) -> BroydenGood {
+                 return {kwargs_to_struct<BroydenGoodParams>(params)};
              }),
              "params"_a)
-        .def(py::init<quala::BroydenGood::Params, length_t>(), "params"_a, "n"_a)
-        .def(py::init([](py::dict params, length_t n) -> quala::BroydenGood {
-                 return {kwargs_to_struct<quala::BroydenGood::Params>(params), n};
+        .def(py::init<BroydenGoodParams, length_t>(), "params"_a, "n"_a)
+        .def(py::init([](py::dict params, length_t n) -> BroydenGood {
+                 return {kwargs_to_struct<BroydenGoodParams>(params), n};
              }),
              "params"_a, "n"_a)
-        .def("resize", &quala::BroydenGood::resize, "n"_a)
+        .def("resize", &BroydenGood::resize, "n"_a)
+        .def("set_memory", &BroydenGood::set_memory, "m"_a)
+        .def_property_readonly(
+            "stats", [](const BroydenGood &self) { return stats_to_dict(self.get_stats()); })
+        .def("reset_stats", &BroydenGood::reset_stats)
+        .def("begin_transaction", &BroydenGood::begin_transaction)
+        .def("commit", &BroydenGood::commit)
+        .def("rollback", &BroydenGood::rollback)
+        .def_property_readonly("in_transaction", &BroydenGood::in_transaction)
         .def(
             "update",
-            [](quala::BroydenGood &self, crvec xk, crvec xkp1, crvec pk, crvec pkp1, bool forced) {
+            [](BroydenGood &self, crvec xk, crvec xkp1, crvec pk, crvec pkp1, bool forced) {
                 if (xk.size() != self.n())
                     throw std::invalid_argument("xk dimension mismatch");
                 if (xkp1.size() != self.n())
@@ -275,7 +459,7 @@ PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
             "xk"_a, "xkp1"_a, "pk"_a, "pkp1"_a, "forced"_a = false)
         .def(
             "update_sy",
-            [](quala::BroydenGood &self, crvec sk, crvec yk, bool forced) {
+            [](BroydenGood &self, crvec sk, crvec yk, bool forced) {
                 if (sk.size() != self.n())
                     throw std::invalid_argument("sk dimension mismatch");
                 if (yk.size() != self.n())
@@ -283,15 +467,57 @@ PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
                 return self.update_sy(sk, yk, forced);
             },
             "sk"_a, "yk"_a, "forced"_a = false)
+        .def(
+            "update_sy_sparse",
+            [](BroydenGood &self, cridvec J, crvec sJ, crvec yJ, bool forced) {
+                if (sJ.size() != J.size() || yJ.size() != J.size())
+                    throw std::invalid_argument("sJ/yJ dimension mismatch");
+                if (J.size() > 0 && (J.minCoeff() < 0 || J.maxCoeff() >= self.n()))
+                    throw std::invalid_argument("J index out of range");
+                return self.update_sy_sparse(J, sJ, yJ, forced);
+            },
+            "J"_a, "sJ"_a, "yJ"_a, "forced"_a = false)
+        .def("densify", &BroydenGood::densify)
+        .def_property_readonly("num_sparse", &BroydenGood::num_sparse)
         .def(
             "apply",
-            [](quala::BroydenGood &self, rvec q, real_t γ) {
+            [](BroydenGood &self, rvec q, real_t γ) {
                 if (q.size() != self.n())
                     throw std::invalid_argument("q dimension mismatch");
                 return self.apply(q, γ);
             },
             "q"_a, "γ"_a = -1)
-        .def("reset", &quala::BroydenGood::reset)
-        .def("current_history", &quala::BroydenGood::current_history)
-        .def_property_readonly("params", &quala::BroydenGood::get_params);
+        .def(
+            "apply",
+            [](BroydenGood &self, rvec q, crvec d) {
+                if (q.size() != self.n())
+                    throw std::invalid_argument("q dimension mismatch");
+                return self.apply(q, d);
+            },
+            "q"_a, "d"_a)
+        .def_property_readonly("diagonal_h0", &BroydenGood::diagonal_h0)
+        .def("reset", &BroydenGood::reset)
+        .def("current_history", &BroydenGood::current_history)
+        .def_property_readonly("params", &BroydenGood::get_params)
+        .def(pickle_accel<BroydenGood>());
+}
+
+PYBIND11_MODULE(QUALA_MODULE_NAME, m) {
+    py::options options;
+    options.enable_function_signatures();
+    options.enable_user_defined_docstrings();
+
+    m.doc() = "Quala Quasi-Newton algorithms";
+
+#ifdef QUALA_VERSION_INFO
+    m.attr("__version__") = QUALA_VERSION_INFO;
+#else
+    m.attr("__version__") = "dev";
+#endif
+
+    m.attr("with_stats") = quala::with_stats;
+
+    register_classes<double>(m);
+    auto m_float32 = m.def_submodule("float32", "Single precision versions of all classes");
+    register_classes<float>(m_float32);
 }
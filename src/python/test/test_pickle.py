@@ -0,0 +1,52 @@
+import pickle
+import numpy as np
+import numpy.random as nprand
+import quala as qa
+
+n = 8  # problem dimension
+rng = nprand.default_rng(seed=321)
+A = rng.random(size=(n, n))
+H = A.T @ A + np.eye(n)
+
+
+def test_pickle_lbfgs():
+    params = {'memory': 3, 'apply_method': qa.LBFGSParams.Compact}
+    lbfgs = qa.LBFGS(params, n)
+    for _ in range(5):
+        s = rng.normal(size=(n, ))
+        assert lbfgs.update_sy(s, H @ s, 0)
+    restored = pickle.loads(pickle.dumps(lbfgs))
+    assert restored.params.memory == 3
+    assert restored.params.apply_method == qa.LBFGSParams.Compact
+    assert restored.current_history() == lbfgs.current_history()
+    q = rng.normal(size=(n, ))
+    q_restored = q.copy()
+    assert lbfgs.apply(q, -1)
+    assert restored.apply(q_restored, -1)
+    assert np.allclose(q, q_restored, rtol=0, atol=1e-14 * np.linalg.norm(q))
+
+
+def test_pickle_broyden():
+    broyden = qa.BroydenGood({'memory': 4, 'restarted': False}, n)
+    for _ in range(6):
+        s = rng.normal(size=(n, ))
+        assert broyden.update_sy(s, H @ s)
+    restored = pickle.loads(pickle.dumps(broyden))
+    q = rng.normal(size=(n, ))
+    q_restored = q.copy()
+    assert broyden.apply(q, -1)
+    assert restored.apply(q_restored, -1)
+    assert np.array_equal(q, q_restored)
+
+
+def test_pickle_anderson():
+    aa = qa.AndersonAccel({'memory': 3}, n)
+    g = rng.normal(size=(n, ))
+    aa.initialize(g, g - rng.normal(size=(n, )))
+    for _ in range(5):
+        g = rng.normal(size=(n, ))
+        aa.compute(g, g - rng.normal(size=(n, )))
+    restored = pickle.loads(pickle.dumps(aa))
+    g = rng.normal(size=(n, ))
+    r = g - rng.normal(size=(n, ))
+    assert np.array_equal(aa.compute(g, r), restored.compute(g, r))
@@ -79,3 +79,22 @@ def test_broyden_good():
     print(f"x:    {x}")
     print(f"r:    {r}")
     assert np.allclose(x, [1, 1], rtol=ε, atol=ε)
+
+
+def test_lbfgs_float32():
+    A32, b32 = A.astype(np.float32), b.astype(np.float32)
+    x = b32.copy()
+    r = A32 @ x - b32
+    lbfgs = qa.float32.LBFGS({'memory': 2 * n}, n)
+    for i in range(1 + 2 * n + 2):
+        q = r.copy()
+        lbfgs.apply(q, -1)
+        x_new = x - q
+        r_new = A32 @ x_new - b32
+        lbfgs.update(x, x_new, r, r_new, qa.float32.LBFGS.Sign.Positive)
+        x = x_new
+        r = r_new
+
+    assert x.dtype == np.float32
+    ε32 = 1e2 * np.finfo(np.float32).eps
+    assert np.allclose(x, [1, 1], rtol=ε32, atol=ε32)
@@ -0,0 +1,56 @@
+#include <quala/util/checkpoint.hpp>
+
+#include <fstream>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define QUALA_HAVE_MMAP 1
+#else
+#define QUALA_HAVE_MMAP 0
+#endif
+
+namespace quala {
+
+MappedFile::MappedFile(const std::string &path) {
+#if QUALA_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("MappedFile: cannot open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("MappedFile: cannot stat " + path);
+    }
+    len = static_cast<std::size_t>(st.st_size);
+    if (len > 0) {
+        void *p = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+            ptr = p;
+    }
+    ::close(fd);
+    if (ptr || len == 0)
+        return;
+#endif
+    // Fall back to reading the whole file
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    if (not f)
+        throw std::runtime_error("MappedFile: cannot open " + path);
+    len    = static_cast<std::size_t>(f.tellg());
+    buffer = std::make_unique<char[]>(len);
+    f.seekg(0);
+    if (not f.read(buffer.get(), static_cast<std::streamsize>(len)))
+        throw std::runtime_error("MappedFile: cannot read " + path);
+    ptr = buffer.get();
+}
+
+MappedFile::~MappedFile() {
+#if QUALA_HAVE_MMAP
+    if (ptr && not buffer)
+        ::munmap(const_cast<void *>(ptr), len);
+#endif
+}
+
+} // namespace quala
@@ -1 +1,22 @@
 #include <quala/lbfgs.hpp>
+
+namespace quala {
+
+template class BasicLBFGS<float>;
+template class BasicLBFGS<double>;
+template class BasicLBFGS<long double>;
+template struct BasicLBFGSStorage<float>;
+template struct BasicLBFGSStorage<double>;
+template struct BasicLBFGSStorage<long double>;
+template class BasicLBFGS<double, float>;
+template class BasicLBFGS<double, Eigen::bfloat16>;
+template struct BasicLBFGSStorage<double, float>;
+template struct BasicLBFGSStorage<double, Eigen::bfloat16>;
+template struct BasicLBFGSCompactStorage<float>;
+template struct BasicLBFGSCompactStorage<double>;
+template struct BasicLBFGSCompactStorage<long double>;
+template struct BasicLBFGSMaskedCache<float>;
+template struct BasicLBFGSMaskedCache<double>;
+template struct BasicLBFGSMaskedCache<long double>;
+
+} // namespace quala
@@ -0,0 +1,82 @@
+#include <quala/util/mapped-matrix.hpp>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define QUALA_HAVE_MMAP 1
+#else
+#define QUALA_HAVE_MMAP 0
+#endif
+
+namespace quala {
+
+#if QUALA_HAVE_MMAP
+
+MappedBuffer::MappedBuffer(const std::string &dir, std::size_t size)
+    : len(size) {
+    auto error = [&](const char *what) {
+        return std::runtime_error("MappedBuffer: " + std::string(what) + " " +
+                                  dir + ": " + std::strerror(errno));
+    };
+    std::string path = dir + "/quala-XXXXXX";
+    std::vector<char> tmpl(path.begin(), path.end());
+    tmpl.push_back('\0');
+    int fd = ::mkstemp(tmpl.data());
+    if (fd < 0)
+        throw error("cannot create temporary file in");
+    // The file is removed as soon as it is no longer mapped
+    ::unlink(tmpl.data());
+    if (::ftruncate(fd, static_cast<off_t>(len)) != 0) {
+        auto e = error("cannot allocate temporary file in");
+        ::close(fd);
+        throw e;
+    }
+    if (len > 0) {
+        ptr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            ptr    = nullptr;
+            auto e = error("cannot map temporary file in");
+            ::close(fd);
+            throw e;
+        }
+        // Each column is read front to back, so aggressive read-ahead helps,
+        // and pages can be dropped soon after they have been accessed
+        ::madvise(ptr, len, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+}
+
+MappedBuffer::~MappedBuffer() {
+    if (ptr)
+        ::munmap(ptr, len);
+}
+
+void MappedBuffer::will_need(const void *begin, std::size_t size) const {
+    // madvise requires a page-aligned start address
+    static const auto page = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+    auto first = reinterpret_cast<std::uintptr_t>(begin) & ~(page - 1);
+    auto last  = reinterpret_cast<std::uintptr_t>(begin) + size;
+    ::madvise(reinterpret_cast<void *>(first), last - first, MADV_WILLNEED);
+}
+
+#else
+
+MappedBuffer::MappedBuffer(const std::string &, std::size_t) {
+    throw std::runtime_error("MappedBuffer: memory mapped files are not "
+                             "supported on this platform");
+}
+
+MappedBuffer::~MappedBuffer() = default;
+
+void MappedBuffer::will_need(const void *, std::size_t) const {}
+
+#endif
+
+} // namespace quala
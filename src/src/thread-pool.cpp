@@ -0,0 +1,73 @@
+#include <quala/util/thread-pool.hpp>
+
+#include <algorithm>
+
+namespace quala {
+
+ThreadPool::ThreadPool(length_t num_threads) {
+    workers.reserve(std::max<length_t>(num_threads, 1) - 1);
+    for (index_t t = 1; t < num_threads; ++t)
+        workers.emplace_back([this, t] { worker_loop(t); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        stop = true;
+    }
+    cv_start.notify_all();
+    for (auto &w : workers)
+        w.join();
+}
+
+void ThreadPool::run_impl(index_t num_tasks, task_t task, void *ctx) {
+    // Not worth waking up the workers
+    if (workers.empty() || num_tasks <= 1) {
+        for (index_t i = 0; i < num_tasks; ++i)
+            task(ctx, i, 0);
+        return;
+    }
+    std::lock_guard<std::mutex> run_lck(run_mtx);
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        this->task      = task;
+        this->ctx       = ctx;
+        this->num_tasks = num_tasks;
+        next_task.store(0, std::memory_order_relaxed);
+        busy = static_cast<length_t>(workers.size());
+        ++generation;
+    }
+    cv_start.notify_all();
+    work(0);
+    // All workers have to check in, so none of them can pick up tasks of the
+    // next call to run
+    std::unique_lock<std::mutex> lck(mtx);
+    cv_done.wait(lck, [this] { return busy == 0; });
+}
+
+void ThreadPool::work(index_t thread) {
+    for (index_t i; (i = next_task.fetch_add(1, std::memory_order_relaxed)) <
+                    num_tasks;)
+        task(ctx, i, thread);
+}
+
+void ThreadPool::worker_loop(index_t thread) {
+    unsigned long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            cv_start.wait(lck, [&] { return stop || generation != seen; });
+            if (stop)
+                return;
+            seen = generation;
+        }
+        work(thread);
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            if (--busy == 0)
+                cv_done.notify_one();
+        }
+    }
+}
+
+} // namespace quala
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <gtest/gtest.h>
+
+/// @file
+/// Floating point types used by the typed tests of the accelerators.
+
+using FloatTypes = ::testing::Types<float, double>;
@@ -0,0 +1,270 @@
+#include <quala/anderson-acceleration.hpp>
+#include <quala/broyden-good.hpp>
+#include <quala/lbfgs.hpp>
+
+#include "eigen-matchers.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using quala::index_t;
+using quala::length_t;
+using quala::mat;
+using quala::real_t;
+using quala::vec;
+
+/// Stand-in for a group of MPI processes, where each rank is simulated by a
+/// thread, and @ref quala::AllReduce is implemented using a barrier.
+class SimulatedRanks {
+  public:
+    explicit SimulatedRanks(int P) : P{P}, contrib(P) {}
+
+    /// Run `f(rank)` on all ranks, and wait for them to finish.
+    template <class F>
+    void run(F f) {
+        std::vector<std::thread> threads;
+        for (int p = 0; p < P; ++p)
+            threads.emplace_back(f, p);
+        for (auto &t : threads)
+            t.join();
+    }
+
+    /// Get the all-reduce function for the given rank, counting the number of
+    /// calls in @p count.
+    quala::AllReduce all_reduce(int rank, unsigned *count = nullptr) {
+        return [this, rank, count](real_t *data, length_t n) {
+            if (count)
+                ++*count;
+            reduce(rank, data, n);
+        };
+    }
+
+    /// Get the offset and size of the shard of a vector of size @p n that
+    /// belongs to the given rank.
+    std::pair<index_t, length_t> shard(int rank, length_t n) const {
+        index_t begin = n * rank / P, end = n * (rank + 1) / P;
+        return {begin, end - begin};
+    }
+
+    /// Check whether all ranks always passed the same number of elements.
+    bool consistent() const { return not mismatch; }
+
+  private:
+    void reduce(int rank, real_t *data, length_t n) {
+        std::unique_lock<std::mutex> lck(mtx);
+        // Wait for all ranks to read the result of the previous reduction
+        cv.wait(lck, [&] { return readers == 0; });
+        contrib[rank].assign(data, data + n);
+        if (++arrived == P) {
+            // Sum in rank order, so the results are deterministic
+            sum = contrib[0];
+            for (int p = 1; p < P; ++p) {
+                mismatch |= contrib[p].size() != sum.size();
+                for (size_t i = 0; i < std::min(sum.size(), contrib[p].size());
+                     ++i)
+                    sum[i] += contrib[p][i];
+            }
+            arrived = 0;
+            readers = P;
+            ++generation;
+            cv.notify_all();
+        } else {
+            auto gen = generation;
+            cv.wait(lck, [&] { return generation != gen; });
+        }
+        std::copy_n(sum.begin(), std::min<size_t>(n, sum.size()), data);
+        if (--readers == 0)
+            cv.notify_all();
+    }
+
+    int P;
+    std::vector<std::vector<real_t>> contrib;
+    std::vector<real_t> sum;
+    std::mutex mtx;
+    std::condition_variable cv;
+    int arrived = 0, readers = 0;
+    unsigned long generation = 0;
+    bool mismatch            = false;
+};
+
+TEST(AllReduce, LBFGS) {
+    const length_t n = 41, m = 4, K = 3 * m, P = 3;
+    std::srand(97531);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+    mat S = mat::Random(n, K), Y = H * S, Q = mat::Random(n, K);
+    std::vector<index_t> J;
+    for (index_t i = 0; i < n; ++i)
+        if (i % 3 != 1)
+            J.push_back(i);
+
+    constexpr real_t ε = 1e-12;
+    for (auto method : {quala::LBFGSParams::ApplyMethod::TwoLoop,
+                        quala::LBFGSParams::ApplyMethod::Compact}) {
+        quala::LBFGSParams param;
+        param.memory       = m;
+        param.apply_method = method;
+        param.cbfgs.ϵ      = 1e-6;
+
+        // Reference: full vectors
+        mat R_ref(n, K), R_J_ref(n, K);
+        quala::LBFGS lbfgs_ref(param, n);
+        param.cbfgs.ϵ = 0; // not supported by masked apply
+        quala::LBFGS lbfgs_J_ref(param, n);
+        for (index_t k = 0; k < K; ++k) {
+            vec x0 = vec::Zero(n), p0 = vec::Zero(n);
+            lbfgs_ref.update(x0, S.col(k), p0, Y.col(k));
+            lbfgs_J_ref.update_sy(S.col(k), Y.col(k), 0);
+            R_ref.col(k) = Q.col(k);
+            lbfgs_ref.apply(R_ref.col(k), -1);
+            R_J_ref.col(k) = Q.col(k);
+            lbfgs_J_ref.apply(R_J_ref.col(k), -1, J);
+        }
+
+        // Distributed: each rank only stores its shard
+        for (bool cached : {false, true}) {
+            SimulatedRanks ranks(P);
+            mat R(n, K), R_J(n, K);
+            unsigned count_update = 0, count_apply = 0;
+            length_t max_masked = 0;
+            ranks.run([&](int rank) {
+                auto [off, n_loc] = ranks.shard(rank, n);
+                std::vector<index_t> J_loc;
+                for (auto j : J)
+                    if (j >= off && j < off + n_loc)
+                        J_loc.push_back(j - off);
+                unsigned cnt_update = 0, cnt_apply = 0;
+                length_t max_reduce = 0;
+                auto par    = param;
+                par.cbfgs.ϵ = 1e-6;
+                quala::LBFGS lbfgs(par, n_loc);
+                lbfgs.set_all_reduce(ranks.all_reduce(rank));
+                par.cbfgs.ϵ            = 0;
+                par.cache_masked_apply = cached;
+                quala::LBFGS lbfgs_J(par, n_loc);
+                lbfgs_J.set_all_reduce(ranks.all_reduce(rank));
+                for (index_t k = 0; k < K; ++k) {
+                    vec x0 = vec::Zero(n_loc), p0 = vec::Zero(n_loc);
+                    lbfgs.set_all_reduce(ranks.all_reduce(rank, &cnt_update));
+                    lbfgs.update(x0, S.col(k).segment(off, n_loc), p0,
+                                 Y.col(k).segment(off, n_loc));
+                    lbfgs_J.update_sy(S.col(k).segment(off, n_loc),
+                                      Y.col(k).segment(off, n_loc), 0);
+                    vec q = Q.col(k).segment(off, n_loc);
+                    lbfgs.set_all_reduce(ranks.all_reduce(rank, &cnt_apply));
+                    lbfgs.apply(q, -1);
+                    R.col(k).segment(off, n_loc) = q;
+                    q = Q.col(k).segment(off, n_loc);
+                    // Track the size of the largest reduction
+                    lbfgs_J.set_all_reduce(
+                        [&, f = ranks.all_reduce(rank)](real_t *d, length_t n) {
+                            max_reduce = std::max(max_reduce, n);
+                            f(d, n);
+                        });
+                    lbfgs_J.apply(q, -1, J_loc);
+                    lbfgs_J.set_all_reduce(ranks.all_reduce(rank));
+                    R_J.col(k).segment(off, n_loc) = q;
+                }
+                if (rank == 0) {
+                    count_update = cnt_update;
+                    count_apply  = cnt_apply;
+                    max_masked   = max_reduce;
+                }
+            });
+            EXPECT_TRUE(ranks.consistent());
+            EXPECT_THAT(print_wrap(R),
+                        EigenAlmostEqual(print_wrap(R_ref), ε * R_ref.norm()));
+            EXPECT_THAT(print_wrap(R_J), EigenAlmostEqual(print_wrap(R_J_ref),
+                                                          ε * R_J_ref.norm()));
+            // Only the inner products of the single new pair of each
+            // iteration are reduced by the cached masked apply
+            if (cached)
+                EXPECT_EQ(max_masked, 3);
+            // Check that the reductions are batched
+            if (method == quala::LBFGSParams::ApplyMethod::Compact) {
+                // pᵀp for CBFGS, yᵀs and sᵀs, Gram matrix
+                EXPECT_EQ(count_update, 3 * K);
+                // WᵀQ
+                EXPECT_EQ(count_apply, K);
+            } else {
+                EXPECT_EQ(count_update, 2 * K);
+            }
+        }
+    }
+}
+
+TEST(AllReduce, BroydenGood) {
+    const length_t n = 37, m = 5, K = 2 * m, P = 4;
+    std::srand(8642);
+    mat A = mat::Random(n, n) + 4 * mat::Identity(n, n);
+    mat S = mat::Random(n, K), Y = A * S, Q = mat::Random(n, K);
+
+    quala::BroydenGoodParams param;
+    param.memory                = m;
+    param.restarted             = false;
+    param.powell_damping_factor = 0.2;
+
+    mat R_ref(n, K);
+    quala::BroydenGood broyden_ref(param, n);
+    for (index_t k = 0; k < K; ++k) {
+        broyden_ref.update_sy(S.col(k), Y.col(k));
+        R_ref.col(k) = Q.col(k);
+        broyden_ref.apply(R_ref.col(k), -1);
+    }
+
+    SimulatedRanks ranks(P);
+    mat R(n, K);
+    ranks.run([&](int rank) {
+        auto [off, n_loc] = ranks.shard(rank, n);
+        quala::BroydenGood broyden(param, n_loc);
+        broyden.set_all_reduce(ranks.all_reduce(rank));
+        for (index_t k = 0; k < K; ++k) {
+            broyden.update_sy(S.col(k).segment(off, n_loc),
+                              Y.col(k).segment(off, n_loc));
+            vec q = Q.col(k).segment(off, n_loc);
+            broyden.apply(q, -1);
+            R.col(k).segment(off, n_loc) = q;
+        }
+    });
+    EXPECT_TRUE(ranks.consistent());
+    EXPECT_THAT(print_wrap(R),
+                EigenAlmostEqual(print_wrap(R_ref), 1e-12 * R_ref.norm()));
+}
+
+TEST(AllReduce, AndersonAccel) {
+    const length_t n = 29, m = 4, K = 3 * m, P = 3;
+    std::srand(1928);
+    mat G = mat::Random(n, K + 1), X = mat::Random(n, K + 1);
+
+    quala::AndersonAccelParams param;
+    param.memory = m;
+
+    mat X_ref(n, K);
+    quala::AndersonAccel aa_ref(param, n);
+    aa_ref.initialize(G.col(0), G.col(0) - X.col(0));
+    for (index_t k = 0; k < K; ++k) {
+        vec g = G.col(k + 1), r = g - X.col(k + 1);
+        aa_ref.compute(g, r, X_ref.col(k));
+    }
+
+    SimulatedRanks ranks(P);
+    mat X_aa(n, K);
+    ranks.run([&](int rank) {
+        auto [off, n_loc] = ranks.shard(rank, n);
+        quala::AndersonAccel aa(param, n_loc);
+        aa.set_all_reduce(ranks.all_reduce(rank));
+        auto G_loc = G.middleRows(off, n_loc), X_loc = X.middleRows(off, n_loc);
+        aa.initialize(G_loc.col(0), G_loc.col(0) - X_loc.col(0));
+        for (index_t k = 0; k < K; ++k) {
+            vec g = G_loc.col(k + 1), r = g - X_loc.col(k + 1), x_aa(n_loc);
+            aa.compute(g, r, x_aa);
+            X_aa.col(k).segment(off, n_loc) = x_aa;
+        }
+    });
+    EXPECT_TRUE(ranks.consistent());
+    EXPECT_THAT(print_wrap(X_aa),
+                EigenAlmostEqual(print_wrap(X_ref), 1e-10 * X_ref.norm()));
+}
@@ -50,4 +50,15 @@ TEST(Alloc, raii) {
         EXPECT_EQ(alloc.size(), 2);
     }
     EXPECT_EQ(alloc.size(), 3);
-}
\ No newline at end of file
+}
+
+TEST(Alloc, float) {
+    quala::basic_vec_allocator<float> alloc{3, 2};
+    {
+        auto v0 = alloc.alloc_raii();
+        v0      = Eigen::VectorXf::Constant(2, 1.5f);
+        EXPECT_EQ(v0.v(1), 1.5f);
+        EXPECT_EQ(alloc.size(), 2);
+    }
+    EXPECT_EQ(alloc.size(), 3);
+}
@@ -1,4 +1,5 @@
 #include "eigen-matchers.hpp"
+#include "float-types.hpp"
 #include <gtest/gtest.h>
 
 #include <Eigen/QR>
@@ -369,3 +370,228 @@ TEST(Anderson, matrix2) {
     EXPECT_NEAR(xₖ(0), 1, 1e-10);
     EXPECT_NEAR(xₖ(1), 1, 1e-10);
 }
+
+template <class Real>
+class AndersonTyped : public ::testing::Test {};
+TYPED_TEST_SUITE(AndersonTyped, FloatTypes);
+
+TYPED_TEST(AndersonTyped, matrix) {
+    using Conf = quala::EigenConfig<TypeParam>;
+    using mat  = typename Conf::mat;
+    using vec  = typename Conf::vec;
+    const auto ε =
+        TypeParam(100) * std::numeric_limits<TypeParam>::epsilon();
+
+    mat A(2, 2);
+    A << 20, -10, -10, 30;
+    vec xₖ(2), b(2);
+    b << 9, 19;
+    xₖ = -b;
+    auto g = [&](const vec &x) -> vec { return A * x - b; };
+
+    quala::BasicAndersonAccel<TypeParam> aa({2}, 2);
+    for (size_t i = 0; i < 5; ++i) {
+        vec gₖ = g(xₖ), rₖ = gₖ - xₖ, xₙₑₓₜ(2);
+        if (i == 0) {
+            aa.initialize(gₖ, rₖ);
+            xₙₑₓₜ = gₖ;
+        } else {
+            aa.compute(gₖ, rₖ, xₙₑₓₜ);
+        }
+        xₖ = std::move(xₙₑₓₜ);
+    }
+    EXPECT_NEAR(xₖ(0), 1, ε);
+    EXPECT_NEAR(xₖ(1), 1, ε);
+}
+
+TEST(Anderson, setMemory) {
+    const quala::length_t n = 10, m = 4, K = 16;
+    std::srand(1357);
+    std::vector<vec> g, r;
+    for (quala::index_t k = 0; k < K; ++k) {
+        g.push_back(vec::Random(n));
+        r.push_back(vec::Random(n));
+    }
+    quala::AndersonAccelParams params;
+    params.memory = m;
+    quala::AndersonAccel aa(params, n);
+    aa.initialize(g[0], r[0]);
+    vec x(n), x_ref(n);
+    // Compare to an accelerator that only saw the iterates [first, last)
+    // and then check the iterates [last, end)
+    auto expect_equal = [&](quala::length_t mem, quala::index_t first,
+                            quala::index_t last, quala::index_t end) {
+        params.memory = mem;
+        quala::AndersonAccel ref(params, n);
+        ref.initialize(g[first], r[first]);
+        for (auto k = first + 1; k < last; ++k)
+            ref.compute(g[k], r[k], x_ref);
+        EXPECT_EQ(aa.history(), ref.history());
+        EXPECT_EQ(aa.current_history(), ref.current_history());
+        for (auto k = last; k < end; ++k) {
+            aa.compute(g[k], r[k], x);
+            ref.compute(g[k], r[k], x_ref);
+            EXPECT_THAT(print_wrap(x),
+                        EigenAlmostEqual(print_wrap(x_ref), 1e-10));
+        }
+    };
+    // Fill the buffer and wrap around
+    for (quala::index_t k = 1; k < 7; ++k)
+        aa.compute(g[k], r[k], x);
+    // Shrink a full buffer
+    aa.set_memory(2);
+    expect_equal(2, 4, 7, 9);
+    // Grow a full buffer: the oldest column is dropped
+    aa.set_memory(5);
+    EXPECT_EQ(aa.current_history(), 1);
+    expect_equal(5, 7, 9, 11);
+    // Shrink a partially filled buffer
+    aa.set_memory(2);
+    expect_equal(2, 8, 11, 12);
+    // Grow beyond the dimension
+    aa.set_memory(n + 5);
+    EXPECT_EQ(aa.history(), n + 5);
+    expect_equal(n + 5, 10, 12, K);
+}
+
+TEST(Anderson, computeSwap) {
+    const quala::length_t n = 12, m = 4, K = 20;
+    std::srand(2468);
+    quala::AndersonAccelParams params;
+    params.memory = m;
+    quala::AndersonAccel aa(params, n), ref(params, n);
+    vec g0 = vec::Random(n), r0 = vec::Random(n);
+    aa.initialize(g0, r0);
+    ref.initialize(g0, r0);
+
+    vec x(n), x_ref(n), g(n), r(n);
+    for (quala::index_t k = 1; k < K; ++k) {
+        // Write the new function value and residual into the buffers that
+        // were handed back by the previous call
+        vec g_ref = vec::Random(n), r_ref = vec::Random(n);
+        g = g_ref, r = r_ref;
+        if (k == 8) {
+            aa.begin_transaction();
+            vec g_spec = vec::Random(n), r_spec = vec::Random(n);
+            aa.compute_swap(g_spec, r_spec, x);
+            aa.rollback();
+        }
+        if (k == 11) {
+            aa.set_memory(m - 1);
+            ref.set_memory(m - 1);
+        }
+        if (k == 15) {
+            aa.reset();
+            ref.reset();
+        }
+        aa.compute_swap(g, r, x);
+        ref.compute(g_ref, r_ref, x_ref);
+        EXPECT_EQ(g.size(), n);
+        EXPECT_EQ(r.size(), n);
+        EXPECT_THAT(print_wrap(x), EigenAlmostEqual(print_wrap(x_ref), 1e-10));
+    }
+    vec g_short(n - 1);
+    EXPECT_THROW(aa.compute_swap(g_short, r, x), std::invalid_argument);
+}
+
+TEST(Anderson, memoryLargerThanDim) {
+    const quala::length_t n = 4, m = 9, K = 40;
+    std::srand(8642);
+    // Small, stiff nonlinear fixed-point map
+    mat A = mat::Random(n, n);
+    A     = 0.95 * A / A.norm();
+    vec b = vec::Random(n);
+    auto g = [&](crvec x) -> vec {
+        return A * x + 0.05 * x.array().sin().matrix() + b;
+    };
+
+    quala::AndersonAccelParams params;
+    params.memory = m;
+    quala::AndersonAccel aa(params, n), ref(params, n);
+    EXPECT_EQ(aa.history(), m);
+    vec x = vec::Zero(n), gₖ = g(x), x_aa(n), x_ref(n);
+    aa.initialize(gₖ, gₖ - x);
+    ref.initialize(gₖ, gₖ - x);
+    x = gₖ;
+    real_t res = 0;
+    for (quala::index_t k = 0; k < K; ++k) {
+        gₖ     = g(x);
+        vec rₖ = gₖ - x;
+        res    = rₖ.norm();
+        if (res < 1e-12)
+            break;
+        // Speculative steps with a full, wide history are rolled back
+        if (k == 2 * m) {
+            aa.begin_transaction();
+            for (int i = 0; i < 3; ++i) {
+                vec g_spec = vec::Random(n), r_spec = vec::Random(n);
+                aa.compute(g_spec, r_spec, x_aa);
+            }
+            aa.rollback();
+        }
+        aa.compute(gₖ, rₖ, x_aa);
+        ref.compute(gₖ, rₖ, x_ref);
+        EXPECT_THAT(print_wrap(x_aa),
+                    EigenAlmostEqual(print_wrap(x_ref), 1e-8));
+        x = x_ref;
+    }
+    EXPECT_LT(res, 1e-12);
+}
+
+TEST(Anderson, regularization) {
+    const quala::length_t n = 12, m = 4, K = 20;
+    std::srand(9753);
+    quala::AndersonAccelParams params;
+    params.memory = m;
+    quala::AndersonAccel plain(params, n);
+    params.regularization = 1e-14;
+    quala::AndersonAccel tiny(params, n);
+    params.regularization = 1e-1;
+    quala::AndersonAccel aa(params, n), ref(params, n);
+    vec g0 = vec::Random(n), r0 = vec::Random(n);
+    for (auto *a : {&plain, &tiny, &aa, &ref})
+        a->initialize(g0, r0);
+
+    vec x(n), x_ref(n), x_plain(n), x_tiny(n);
+    for (quala::index_t k = 1; k < K; ++k) {
+        // Rolling back restores the regularized factorization as well
+        if (k % 5 == 0) {
+            aa.begin_transaction();
+            vec g_spec = vec::Random(n), r_spec = vec::Random(n);
+            aa.compute(g_spec, r_spec, x);
+            aa.rollback();
+        }
+        vec g = vec::Random(n), r = vec::Random(n);
+        aa.compute(g, r, x);
+        ref.compute(g, r, x_ref);
+        plain.compute(g, r, x_plain);
+        tiny.compute(g, r, x_tiny);
+        EXPECT_THAT(print_wrap(x), EigenAlmostEqual(print_wrap(x_ref), 1e-10));
+        // A negligible regularization gives the same iterates
+        EXPECT_THAT(print_wrap(x_tiny),
+                    EigenAlmostEqual(print_wrap(x_plain), 1e-8));
+    }
+}
+
+TEST(Anderson, repeatedResidual) {
+    const quala::length_t n = 8, m = 3;
+    std::srand(4321);
+    for (double λ : {0., 1e-8}) {
+        quala::AndersonAccelParams params;
+        params.memory         = m;
+        params.regularization = λ;
+        quala::AndersonAccel aa(params, n);
+        aa.initialize(vec::Random(n), vec::Random(n));
+        // The same residual twice gives a zero column Δr
+        vec g1 = vec::Random(n), r1 = vec::Random(n), x(n);
+        aa.compute(g1, r1, x);
+        aa.compute(g1, r1, x);
+        EXPECT_TRUE(x.allFinite());
+        // Also after the zero column was removed from the history
+        for (quala::index_t k = 0; k < 2 * m; ++k) {
+            vec g = vec::Random(n), r = vec::Random(n);
+            aa.compute(g, r, x);
+            EXPECT_TRUE(x.allFinite());
+        }
+    }
+}
@@ -0,0 +1,237 @@
+#include <quala/anderson-batch.hpp>
+#include <quala/lbfgs-batch.hpp>
+#include <quala/lbfgs.hpp>
+
+#include "eigen-matchers.hpp"
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+using quala::boolvec;
+using quala::index_t;
+using quala::length_t;
+using quala::mat;
+using quala::vec;
+
+TEST(Batch, AndersonAccel) {
+    // More instances than fit in a single block
+    const length_t n = 10, m = 4, B = 70;
+    std::srand(2718);
+    std::vector<mat> A(B);
+    mat c = mat::Random(B, n);
+    for (auto &Ab : A) {
+        Ab = mat::Random(n, n);
+        Ab = 0.9 * Ab / Ab.norm();
+    }
+    // Function values of all instances, one per row
+    const auto g = [&](const mat &X) {
+        mat G(B, n);
+        for (index_t b = 0; b < B; ++b)
+            G.row(b) = (A[b] * X.row(b).transpose() +
+                        0.1 * X.row(b).transpose().array().sin().matrix())
+                           .transpose() +
+                       c.row(b);
+        return G;
+    };
+
+    quala::AndersonAccelParams params;
+    params.memory = m;
+    quala::AndersonAccelBatch aa(params, n, B);
+    std::vector<quala::AndersonAccel> ref(B, quala::AndersonAccel(params, n));
+    mat X = mat::Zero(B, n), G = g(X);
+    EXPECT_THROW(aa.compute(G, G, X), std::logic_error);
+    aa.initialize(G, G - X);
+    for (index_t b = 0; b < B; ++b)
+        ref[b].initialize(G.row(b).transpose(), (G - X).row(b).transpose());
+    X = G;
+    for (index_t k = 0; k < 5 * m; ++k) {
+        // Different history lengths: some instances are reset or
+        // re-initialized, and some are not updated
+        if (k == 2 * m)
+            for (index_t b = 0; b < B; b += 7) {
+                aa.reset(b);
+                ref[b].reset();
+            }
+        if (k == 3 * m) {
+            vec x = vec::Random(n), gx = g(X).row(3).transpose();
+            aa.initialize(3, gx, gx - x);
+            ref[3].initialize(gx, gx - x);
+        }
+        boolvec mask(B);
+        for (index_t b = 0; b < B; ++b)
+            mask(b) = (b + k) % 5 != 0;
+        G            = g(X);
+        mat R        = G - X;
+        mat X_aa     = X;
+        aa.compute(G, R, X_aa, mask);
+        for (index_t b = 0; b < B; ++b) {
+            if (not mask(b)) {
+                EXPECT_THAT(print_wrap(X_aa.row(b)),
+                            EigenEqual(print_wrap(X.row(b))));
+                continue;
+            }
+            vec gb = G.row(b).transpose(), rb = R.row(b).transpose(), x_ref(n);
+            ref[b].compute(gb, rb, x_ref);
+            EXPECT_EQ(aa.current_history(b), ref[b].current_history());
+            EXPECT_THAT(print_wrap(X_aa.row(b).transpose()),
+                        EigenAlmostEqual(print_wrap(x_ref), 1e-10));
+        }
+        X = X_aa;
+    }
+    // All instances, until convergence
+    for (index_t k = 0; k < 20; ++k) {
+        G        = g(X);
+        mat R    = G - X;
+        mat X_aa = X;
+        aa.compute(G, R, X_aa);
+        for (index_t b = 0; b < B; ++b) {
+            vec gb = G.row(b).transpose(), rb = R.row(b).transpose(), x_ref(n);
+            ref[b].compute(gb, rb, x_ref);
+            EXPECT_THAT(print_wrap(X_aa.row(b).transpose()),
+                        EigenAlmostEqual(print_wrap(x_ref), 1e-10));
+        }
+        X = X_aa;
+    }
+    EXPECT_LT((g(X) - X).norm(), 1e-10);
+
+    // Unsupported parameters
+    params.memory = n + 1;
+    EXPECT_THROW(quala::AndersonAccelBatch(params, n, B),
+                 std::invalid_argument);
+    params.memory         = m;
+    params.regularization = 1e-8;
+    EXPECT_THROW(quala::AndersonAccelBatch(params, n, B),
+                 std::invalid_argument);
+}
+
+TEST(Batch, AndersonAccelRepeatedResidual) {
+    const length_t n = 4, m = 3, B = 3;
+    std::srand(1618);
+    quala::AndersonAccelParams params;
+    params.memory = m;
+    quala::AndersonAccelBatch aa(params, n, B);
+    std::vector<quala::AndersonAccel> ref(B, quala::AndersonAccel(params, n));
+    mat G = mat::Random(B, n), R = mat::Random(B, n);
+    aa.initialize(G, R);
+    for (index_t b = 0; b < B; ++b)
+        ref[b].initialize(G.row(b).transpose(), R.row(b).transpose());
+    const auto compute = [&] {
+        mat X_aa(B, n);
+        aa.compute(G, R, X_aa);
+        for (index_t b = 0; b < B; ++b) {
+            vec gb = G.row(b).transpose(), rb = R.row(b).transpose(), x_ref(n);
+            ref[b].compute(gb, rb, x_ref);
+            EXPECT_TRUE(x_ref.allFinite());
+            EXPECT_THAT(print_wrap(X_aa.row(b).transpose()),
+                        EigenAlmostEqual(print_wrap(x_ref), 1e-10));
+        }
+    };
+    G = mat::Random(B, n), R = mat::Random(B, n);
+    compute();
+    // The same residual twice gives a zero column Δr, for some instances
+    mat G_new = mat::Random(B, n), R_new = mat::Random(B, n);
+    G_new.row(1) = G.row(1), R_new.row(1) = R.row(1);
+    G = G_new, R = R_new;
+    compute();
+    // Also after the zero column was removed from the history
+    for (index_t k = 0; k < 2 * m; ++k) {
+        G = mat::Random(B, n), R = mat::Random(B, n);
+        compute();
+    }
+}
+
+TEST(Batch, LBFGS) {
+    const length_t n = 12, m = 5, B = 70;
+    std::srand(3141);
+    // Positive definite Hessians of quadratic problems
+    std::vector<mat> H(B);
+    for (auto &Hb : H) {
+        Hb = mat::Random(n, n);
+        Hb = Hb * Hb.transpose() + mat::Identity(n, n);
+    }
+
+    quala::LBFGSParams params;
+    params.memory = m;
+    quala::LBFGSBatch lbfgs(params, n, B);
+    std::vector<quala::LBFGS> ref(B, quala::LBFGS(params, n));
+    const auto check_apply = [&](const boolvec &mask) {
+        for (double γ : {-1., 0.5}) {
+            mat Q = mat::Random(B, n), Q_orig = Q;
+            boolvec applied = lbfgs.apply(Q, γ, mask);
+            for (index_t b = 0; b < B; ++b) {
+                vec q = Q_orig.row(b).transpose();
+                bool ok = mask(b) && ref[b].apply(q, γ);
+                EXPECT_EQ(applied(b), ok);
+                if (not ok) {
+                    EXPECT_THAT(print_wrap(Q.row(b)),
+                                EigenEqual(print_wrap(Q_orig.row(b))));
+                    continue;
+                }
+                EXPECT_THAT(print_wrap(Q.row(b).transpose()),
+                            EigenAlmostEqual(print_wrap(q), 1e-10));
+            }
+        }
+    };
+    boolvec all = boolvec::Constant(B, true);
+    check_apply(all);
+    for (index_t k = 0; k < 4 * m; ++k) {
+        // Different history lengths and positions in the circular buffers:
+        // some instances are reset, some updates are rejected, and some
+        // instances are not updated
+        if (k == 2 * m)
+            for (index_t b = 0; b < B; b += 7) {
+                lbfgs.reset(b);
+                ref[b].reset();
+            }
+        boolvec mask(B);
+        mat S = mat::Random(B, n), Y(B, n);
+        vec pᵀp = vec::Random(B).cwiseAbs();
+        for (index_t b = 0; b < B; ++b) {
+            mask(b)  = (b + k) % 5 != 0;
+            Y.row(b) = S.row(b) * H[b];
+            if ((b + 2 * k) % 11 == 0)
+                Y.row(b) = -Y.row(b);
+        }
+        boolvec accepted = lbfgs.update_sy(S, Y, pᵀp, mask);
+        for (index_t b = 0; b < B; ++b) {
+            vec s = S.row(b).transpose(), y = Y.row(b).transpose();
+            EXPECT_EQ(accepted(b), mask(b) && ref[b].update_sy(s, y, pᵀp(b)));
+            EXPECT_EQ(lbfgs.current_history(b), ref[b].current_history());
+        }
+        check_apply(mask);
+    }
+    check_apply(all);
+
+    // Cautious BFGS and indefinite approximations
+    params.cbfgs.ϵ        = 1e-1;
+    params.force_pos_def  = false;
+    quala::LBFGSBatch cbfgs(params, n, B);
+    std::vector<quala::LBFGS> ref_cbfgs(B, quala::LBFGS(params, n));
+    for (index_t k = 0; k < 2 * m; ++k) {
+        mat S = mat::Random(B, n), Y(B, n);
+        vec pᵀp = 1e4 * vec::Random(B).cwiseAbs();
+        for (index_t b = 0; b < B; ++b)
+            Y.row(b) = ((b + k) % 3 == 0 ? -1 : 1) * S.row(b) * H[b];
+        boolvec accepted = cbfgs.update_sy(S, Y, pᵀp);
+        for (index_t b = 0; b < B; ++b) {
+            vec s = S.row(b).transpose(), y = Y.row(b).transpose();
+            EXPECT_EQ(accepted(b), ref_cbfgs[b].update_sy(s, y, pᵀp(b)));
+        }
+        mat Q = mat::Random(B, n), Q_orig = Q;
+        cbfgs.apply(Q);
+        for (index_t b = 0; b < B; ++b) {
+            vec q = Q_orig.row(b).transpose();
+            if (ref_cbfgs[b].apply(q))
+                EXPECT_THAT(print_wrap(Q.row(b).transpose()),
+                            EigenAlmostEqual(print_wrap(q), 1e-10));
+        }
+    }
+
+    // Unsupported parameters
+    params.memory = 0;
+    EXPECT_THROW(quala::LBFGSBatch(params, n, B), std::invalid_argument);
+    params.memory      = m;
+    params.diagonal_h0 = true;
+    EXPECT_THROW(quala::LBFGSBatch(params, n, B), std::invalid_argument);
+}
@@ -0,0 +1,129 @@
+#include <quala/broyden-good.hpp>
+
+#include "eigen-matchers.hpp"
+#include "float-types.hpp"
+
+#include <cmath>
+#include <initializer_list>
+#include <limits>
+#include <utility>
+
+using quala::index_t;
+using quala::length_t;
+using quala::real_t;
+using quala::vec;
+
+TEST(BroydenGood, diagonalH0) {
+    // Badly scaled diagonal system: the coordinate-wise secant equations are
+    // satisfied exactly by H₀ = A⁻¹
+    const length_t n = 40, m = 4;
+    vec a(n);
+    for (index_t i = 0; i < n; ++i)
+        a(i) = std::pow(1e3, real_t(i) / real_t(n - 1));
+    std::srand(97531);
+
+    quala::BroydenGoodParams param;
+    param.memory            = m;
+    param.restarted         = false;
+    param.diagonal_h0       = true;
+    param.diagonal_h0_bound = 1e6;
+    quala::BroydenGood broyden(param, n);
+    for (index_t k = 0; k < m + 2; ++k) {
+        vec s = vec::Random(n), y = a.cwiseProduct(s);
+        EXPECT_TRUE(broyden.update_sy(s, y));
+    }
+    vec a_inv = a.cwiseInverse();
+    EXPECT_THAT(print_wrap(broyden.diagonal_h0()),
+                EigenAlmostEqual(print_wrap(a_inv), 1e-12));
+
+    // Automatic and user-supplied diagonal
+    vec q = vec::Random(n), q_auto = q, q_d = q;
+    EXPECT_TRUE(broyden.apply(q_auto, -1));
+    EXPECT_TRUE(broyden.apply(q_d, a_inv));
+    EXPECT_THAT(print_wrap(q_d), EigenAlmostEqual(print_wrap(q_auto), 1e-14));
+    // A constant diagonal is the same as a scalar
+    vec q_γ = q;
+    q_d     = q;
+    EXPECT_TRUE(broyden.apply(q_γ, 0.3));
+    EXPECT_TRUE(broyden.apply(q_d, vec::Constant(n, 0.3)));
+    EXPECT_THAT(print_wrap(q_d), EigenAlmostEqual(print_wrap(q_γ), 1e-14));
+    EXPECT_THROW(broyden.apply(q, vec::Ones(n - 1)), std::invalid_argument);
+}
+
+TEST(BroydenGood, setMemory) {
+    const length_t n = 15, m = 3;
+    std::srand(2468);
+    quala::mat A = quala::mat::Random(n, n) + 4 * quala::mat::Identity(n, n);
+
+    quala::BroydenGoodParams param;
+    param.memory    = m;
+    param.restarted = false;
+    quala::BroydenGood broyden(param, n);
+    auto update = [&](std::initializer_list<quala::BroydenGood *> bs) {
+        vec s = vec::Random(n), y = A * s;
+        for (auto *b : bs)
+            EXPECT_TRUE(b->update_sy(s, y));
+    };
+    auto expect_equal = [&](auto &a, auto &b) {
+        EXPECT_EQ(a.current_history(), b.current_history());
+        vec q = vec::Random(n), q_b = q;
+        EXPECT_TRUE(a.apply(q, -1));
+        EXPECT_TRUE(b.apply(q_b, -1));
+        EXPECT_THAT(print_wrap(q), EigenAlmostEqual(print_wrap(q_b), 1e-12));
+    };
+    // Wrapped around circular buffer
+    for (index_t k = 0; k < m + 2; ++k)
+        update({&broyden});
+    // Growing keeps all pairs, in order
+    quala::BroydenGood grown = broyden;
+    grown.set_memory(m + 2);
+    EXPECT_EQ(grown.history(), m + 2);
+    expect_equal(grown, broyden);
+    // Shrinking back drops nothing if no new pairs were added
+    grown.set_memory(m);
+    expect_equal(grown, broyden);
+    update({&grown, &broyden});
+    expect_equal(grown, broyden);
+    // Shrinking keeps the newest pairs, new pairs overwrite the oldest ones
+    quala::BroydenGood shrunk = broyden;
+    shrunk.set_memory(1);
+    EXPECT_EQ(shrunk.current_history(), 1);
+    for (index_t k = 0; k < 3; ++k)
+        update({&shrunk});
+    EXPECT_EQ(shrunk.current_history(), 1);
+    EXPECT_THROW(shrunk.set_memory(0), std::invalid_argument);
+}
+
+template <class Real>
+class BroydenGoodTyped : public ::testing::Test {};
+TYPED_TEST_SUITE(BroydenGoodTyped, FloatTypes);
+
+TYPED_TEST(BroydenGoodTyped, linear) {
+    using Conf = quala::EigenConfig<TypeParam>;
+    using mat  = typename Conf::mat;
+    using vec  = typename Conf::vec;
+    const auto ε =
+        TypeParam(100) * std::numeric_limits<TypeParam>::epsilon();
+
+    // Broyden's method solves a linear system in at most 2n iterations
+    mat A(2, 2);
+    A << 2, -1, -1, 3;
+    quala::BasicBroydenGoodParams<TypeParam> param;
+    param.memory = 5;
+    quala::BasicBroydenGood<TypeParam> broyden(param, 2);
+    vec x(2);
+    x << 10, -5;
+    vec r = A * x;
+    for (size_t i = 0; i < 10; ++i) {
+        vec d = r;
+        if (i > 0)
+            broyden.apply(d, 1);
+        vec x_new = x - d;
+        vec r_new = A * x_new;
+        broyden.update(x, x_new, r, r_new);
+        r = std::move(r_new);
+        x = std::move(x_new);
+    }
+    EXPECT_NEAR(x(0), 0, ε);
+    EXPECT_NEAR(x(1), 0, ε);
+}
@@ -0,0 +1,236 @@
+#include <quala/anderson-acceleration.hpp>
+#include <quala/broyden-good.hpp>
+#include <quala/lbfgs.hpp>
+
+#include "eigen-matchers.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using quala::index_t;
+using quala::length_t;
+using quala::mat;
+using quala::real_t;
+using quala::vec;
+
+TEST(Checkpoint, LBFGS) {
+    const length_t n = 19, m = 4;
+    std::srand(13579);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+
+    for (auto method : {quala::LBFGSParams::ApplyMethod::TwoLoop,
+                        quala::LBFGSParams::ApplyMethod::Compact}) {
+        quala::LBFGSParams param;
+        param.memory             = m;
+        param.apply_method       = method;
+        param.cache_masked_apply = true;
+        // Partially filled and wrapped around circular buffers
+        for (index_t K : {m - 1, 2 * m + 1}) {
+            quala::LBFGS lbfgs(param, n);
+            for (index_t k = 0; k < K; ++k) {
+                vec s = vec::Random(n), y = H * s;
+                lbfgs.update_sy(s, y, 0);
+            }
+            std::stringstream ss;
+            quala::CheckpointWriter w{ss};
+            lbfgs.save(w);
+
+            quala::LBFGS restored(param, n);
+            quala::CheckpointReader r{ss};
+            restored.load(r);
+            EXPECT_EQ(restored.current_history(), lbfgs.current_history());
+
+            // Both should continue identically (up to rounding errors of the
+            // Gram matrix, which is recomputed as a whole)
+            std::vector<index_t> J{0, 2, 3, 7, 11, 12};
+            for (index_t k = 0; k < m; ++k) {
+                vec q = vec::Random(n), q_restored = q;
+                EXPECT_TRUE(lbfgs.apply(q, -1));
+                EXPECT_TRUE(restored.apply(q_restored, -1));
+                EXPECT_THAT(print_wrap(q_restored),
+                            EigenAlmostEqual(print_wrap(q), 1e-14 * q.norm()));
+                q = q_restored = vec::Random(n);
+                EXPECT_TRUE(lbfgs.apply(q, -1, J));
+                EXPECT_TRUE(restored.apply(q_restored, -1, J));
+                EXPECT_THAT(print_wrap(q_restored), EigenEqual(print_wrap(q)));
+                vec s = vec::Random(n), y = H * s;
+                lbfgs.update_sy(s, y, 0);
+                restored.update_sy(s, y, 0);
+            }
+        }
+    }
+}
+
+TEST(Checkpoint, LBFGSMixed) {
+    using LBFGS      = quala::BasicLBFGS<double, float>;
+    const length_t n = 15, m = 3;
+    std::srand(97531);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+
+    LBFGS::Params param;
+    param.memory = m;
+    LBFGS lbfgs(param, n);
+    for (index_t k = 0; k < 2 * m; ++k) {
+        vec s = vec::Random(n), y = H * s;
+        lbfgs.update_sy(s, y, 0);
+    }
+    std::stringstream ss;
+    quala::CheckpointWriter w{ss};
+    lbfgs.save(w);
+    std::string blob = ss.str();
+
+    LBFGS restored(param, n);
+    quala::CheckpointReader r{blob.data(), blob.size()};
+    restored.load(r);
+    vec q = vec::Random(n), q_restored = q;
+    EXPECT_TRUE(lbfgs.apply(q, -1));
+    EXPECT_TRUE(restored.apply(q_restored, -1));
+    EXPECT_THAT(print_wrap(q_restored), EigenEqual(print_wrap(q)));
+
+    // The precision of the storage is checked
+    quala::LBFGS other(param, n);
+    quala::CheckpointReader r_other{blob.data(), blob.size()};
+    EXPECT_THROW(other.load(r_other), std::invalid_argument);
+}
+
+TEST(Checkpoint, BroydenGood) {
+    const length_t n = 17, m = 5;
+    std::srand(2468);
+    mat A = mat::Random(n, n) + 4 * mat::Identity(n, n);
+
+    quala::BroydenGoodParams param;
+    param.memory    = m;
+    param.restarted = false;
+    quala::BroydenGood broyden(param, n);
+    for (index_t k = 0; k < m + 2; ++k) {
+        vec s = vec::Random(n), y = A * s;
+        broyden.update_sy(s, y);
+    }
+    std::stringstream ss;
+    quala::CheckpointWriter w{ss};
+    broyden.save(w);
+
+    quala::BroydenGood restored(param, n);
+    quala::CheckpointReader r{ss};
+    restored.load(r);
+    for (index_t k = 0; k < m; ++k) {
+        vec q = vec::Random(n), q_restored = q;
+        EXPECT_TRUE(broyden.apply(q, -1));
+        EXPECT_TRUE(restored.apply(q_restored, -1));
+        EXPECT_THAT(print_wrap(q_restored), EigenEqual(print_wrap(q)));
+        vec s = vec::Random(n), y = A * s;
+        broyden.update_sy(s, y);
+        restored.update_sy(s, y);
+    }
+}
+
+TEST(Checkpoint, AndersonAccel) {
+    const length_t n = 13, m = 4;
+    std::srand(1928);
+    mat G = mat::Random(n, 4 * m), X = mat::Random(n, 4 * m);
+
+    quala::AndersonAccelParams param;
+    param.memory = m;
+    // Partially filled and wrapped around circular buffers
+    for (index_t K : {m - 2, 2 * m + 1}) {
+        quala::AndersonAccel aa(param, n);
+        aa.initialize(G.col(0), G.col(0) - X.col(0));
+        vec x_aa(n), x_restored(n);
+        index_t k = 1;
+        for (; k <= K; ++k) {
+            vec g = G.col(k), r = g - X.col(k);
+            aa.compute(g, r, x_aa);
+        }
+
+        // Use a file and a memory mapping
+        std::string path = ::testing::TempDir() + "quala-checkpoint-aa.bin";
+        {
+            std::ofstream f(path, std::ios::binary);
+            quala::CheckpointWriter w{f};
+            aa.save(w);
+        }
+        quala::AndersonAccel restored(param, n);
+        {
+            quala::MappedFile f(path);
+            auto r = f.reader();
+            restored.load(r);
+        }
+        std::remove(path.c_str());
+        EXPECT_EQ(restored.current_history(), aa.current_history());
+
+        for (; k < 4 * m; ++k) {
+            vec g = G.col(k), r = g - X.col(k);
+            aa.compute(g, r, x_aa);
+            restored.compute(g, r, x_restored);
+            EXPECT_THAT(print_wrap(x_restored), EigenEqual(print_wrap(x_aa)));
+        }
+    }
+}
+
+TEST(Checkpoint, errors) {
+    const length_t n = 11, m = 3;
+    quala::LBFGSParams param;
+    param.memory = m;
+    quala::LBFGS lbfgs(param, n);
+    for (index_t k = 0; k < m; ++k) {
+        vec s = vec::Random(n);
+        lbfgs.update_sy(s, 2 * s, 0);
+    }
+    std::stringstream ss;
+    quala::CheckpointWriter w{ss};
+    lbfgs.save(w);
+    std::string blob = ss.str();
+    auto load        = [&](auto &&acc, size_t size) {
+        quala::CheckpointReader r{blob.data(), size};
+        acc.load(r);
+    };
+
+    // Different dimensions
+    EXPECT_THROW(load(quala::LBFGS(param, n + 1), blob.size()),
+                 std::invalid_argument);
+    param.memory = m + 1;
+    EXPECT_THROW(load(quala::LBFGS(param, n), blob.size()),
+                 std::invalid_argument);
+    param.memory = m;
+    // Different type of accelerator
+    quala::BroydenGoodParams bparam;
+    bparam.memory = m;
+    EXPECT_THROW(load(quala::BroydenGood(bparam, n), blob.size()),
+                 std::invalid_argument);
+    // Truncated data
+    EXPECT_THROW(load(quala::LBFGS(param, n), blob.size() - 1),
+                 std::runtime_error);
+    // Corrupt data
+    blob[0] = 'X';
+    EXPECT_THROW(load(quala::LBFGS(param, n), blob.size()),
+                 std::runtime_error);
+}
+
+TEST(Checkpoint, multipleRecords) {
+    const length_t n = 9;
+    quala::LBFGSParams lparam;
+    lparam.memory = 2;
+    quala::BroydenGoodParams bparam;
+    bparam.memory = 3;
+    quala::LBFGS lbfgs(lparam, n);
+    quala::BroydenGood broyden(bparam, n);
+    vec s = vec::Random(n);
+    lbfgs.update_sy(s, 3 * s, 0);
+    broyden.update_sy(s, 3 * s);
+
+    std::stringstream ss;
+    quala::CheckpointWriter w{ss};
+    lbfgs.save(w);
+    broyden.save(w);
+
+    quala::LBFGS lbfgs_restored(lparam, n);
+    quala::BroydenGood broyden_restored(bparam, n);
+    quala::CheckpointReader r{ss};
+    lbfgs_restored.load(r);
+    broyden_restored.load(r);
+    EXPECT_EQ(lbfgs_restored.current_history(), 1);
+    EXPECT_EQ(broyden_restored.current_history(), 1);
+}
@@ -0,0 +1,90 @@
+#include <quala/lbfgs.hpp>
+#include <quala/util/index-ranges.hpp>
+
+#include "eigen-matchers.hpp"
+
+#include <algorithm>
+#include <vector>
+
+using quala::index_t;
+using quala::IndexRanges;
+using quala::length_t;
+using quala::mat;
+using quala::vec;
+
+TEST(IndexRanges, compress) {
+    std::vector<index_t> J{0, 1, 2, 5, 7, 8, 3, 4, 9};
+    IndexRanges R = J;
+    EXPECT_EQ(R.size(), 9);
+    ASSERT_EQ(R.num_ranges(), 5);
+    EXPECT_EQ(R.ranges()[0], (IndexRanges::Range{0, 3}));
+    EXPECT_EQ(R.ranges()[1], (IndexRanges::Range{5, 6}));
+    EXPECT_EQ(R.ranges()[2], (IndexRanges::Range{7, 9}));
+    EXPECT_EQ(R.ranges()[3], (IndexRanges::Range{3, 5}));
+    EXPECT_EQ(R.ranges()[4], (IndexRanges::Range{9, 10}));
+    // Iteration gives back the original indices, in order
+    std::vector<index_t> J2(R.begin(), R.end());
+    EXPECT_EQ(J2, J);
+
+    IndexRanges R2;
+    R2.push_back(0, 3);
+    R2.push_back(5);
+    R2.push_back(7, 9);
+    R2.push_back(9, 9); // empty
+    R2.push_back(9);    // merged with the previous range
+    EXPECT_EQ(R2.size(), 7);
+    EXPECT_EQ(R2.num_ranges(), 3);
+    R2.clear();
+    EXPECT_EQ(R2.size(), 0);
+    EXPECT_EQ(R2.begin(), R2.end());
+}
+
+TEST(LBFGS, maskedRanges) {
+    const length_t n = 47, m = 4;
+    std::srand(5678);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+    // Short runs are processed element by element, long runs as segments
+    std::vector<index_t> J_short{0, 2, 3, 7, 9, 10, 11, 20, 30, 31, 46};
+    std::vector<index_t> J_long;
+    for (index_t i = 3; i < 20; ++i)
+        J_long.push_back(i);
+    for (index_t i = 25; i < 45; ++i)
+        J_long.push_back(i);
+
+    for (bool cached : {false, true}) {
+        for (bool diag : {false, true}) {
+            quala::LBFGSParams param;
+            param.memory             = m;
+            param.cache_masked_apply = cached;
+            param.diagonal_h0        = diag;
+            quala::LBFGS lbfgs(param, n);
+            for (index_t k = 0; k < m + 1; ++k) {
+                vec s = vec::Random(n), y = H * s;
+                lbfgs.update_sy(s, y, 0);
+            }
+            for (const auto &J : {J_short, J_long}) {
+                IndexRanges R = J;
+                vec q = vec::Random(n), q_ranges = q, q_ref = q;
+                EXPECT_TRUE(lbfgs.apply(q, -1, J));
+                EXPECT_TRUE(lbfgs.apply(q_ranges, -1, R));
+                EXPECT_THAT(print_wrap(q_ranges),
+                            EigenAlmostEqual(print_wrap(q), 1e-12));
+                // Reference: element-wise on an equivalent index set that
+                // isn't converted to ranges (a list without runs)
+                std::vector<index_t> J_ref;
+                for (auto it = J.rbegin(); it != J.rend(); ++it)
+                    J_ref.push_back(*it);
+                EXPECT_TRUE(lbfgs.apply(q_ref, -1, J_ref));
+                EXPECT_THAT(print_wrap(q),
+                            EigenAlmostEqual(print_wrap(q_ref), 1e-10));
+                // Elements outside of J are not touched
+                vec d = vec::Constant(n, 0.7), q_d = q;
+                EXPECT_TRUE(lbfgs.apply(q_d, d, R));
+                for (index_t i = 0; i < n; ++i)
+                    if (std::find(J.begin(), J.end(), i) == J.end())
+                        EXPECT_EQ(q_d(i), q(i));
+            }
+        }
+    }
+}
@@ -1,8 +1,13 @@
 #include <quala/lbfgs.hpp>
 
+#include <cmath>
 #include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "eigen-matchers.hpp"
+#include "float-types.hpp"
 #include <Eigen/LU>
 
 TEST(LBFGS, quadratic) {
@@ -129,3 +134,610 @@ TEST(BFGS, matrix) {
     EXPECT_NEAR(xₖ(0), 1, 1e-10);
     EXPECT_NEAR(xₖ(1), 1, 1e-10);
 }
+
+TEST(LBFGS, compact) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::real_t;
+    using quala::vec;
+
+    const length_t n = 31, m = 5;
+    std::srand(1234);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+
+    quala::LBFGSParams param;
+    param.memory = m;
+    quala::LBFGS lbfgs_2l(param, n);
+    param.apply_method = quala::LBFGSParams::ApplyMethod::Compact;
+    quala::LBFGS lbfgs_cp(param, n);
+
+    constexpr real_t ε = 1e-12;
+    // Fill the history more than once to test the circular buffer
+    for (index_t k = 0; k < 3 * m; ++k) {
+        vec s = vec::Random(n);
+        vec y = H * s;
+        EXPECT_TRUE(lbfgs_2l.update_sy(s, y, 0));
+        EXPECT_TRUE(lbfgs_cp.update_sy(s, y, 0));
+        if (k == m + 1) { // Scaling should be applied to the Gram matrices
+            lbfgs_2l.scale_y(0.5);
+            lbfgs_cp.scale_y(0.5);
+        }
+        for (real_t γ : {-1., 0.7}) {
+            vec q      = vec::Random(n);
+            vec q_2l   = q, q_cp = q;
+            EXPECT_TRUE(lbfgs_2l.apply(q_2l, γ));
+            EXPECT_TRUE(lbfgs_cp.apply(q_cp, γ));
+            EXPECT_THAT(print_wrap(q_cp),
+                        EigenAlmostEqual(print_wrap(q_2l), ε * q_2l.norm()));
+        }
+    }
+}
+
+TEST(LBFGS, applyHessian) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::real_t;
+    using quala::vec;
+
+    const length_t n = 27, m = 4, K = 2;
+    std::srand(2468);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+
+    constexpr real_t ε = 1e-10;
+    for (auto method : {quala::LBFGSParams::ApplyMethod::TwoLoop,
+                        quala::LBFGSParams::ApplyMethod::Compact}) {
+        quala::LBFGSParams param;
+        param.memory           = m;
+        param.apply_method     = method;
+        param.hessian_products = true;
+        quala::LBFGS lbfgs(param, n);
+        mat V = mat::Random(n, K);
+        EXPECT_FALSE(lbfgs.apply_hessian(V, -1));
+        // Fill the history more than once to test the circular buffer
+        for (index_t k = 0; k < 3 * m; ++k) {
+            vec s = vec::Random(n);
+            vec y = H * s;
+            EXPECT_TRUE(lbfgs.update_sy(s, y, 0));
+            if (k == m + 1) // Scaling should invalidate the factorization
+                lbfgs.scale_y(0.5);
+            for (real_t γ : {-1., 0.7, 0.7}) {
+                // B H V = V
+                mat V = mat::Random(n, K), HV = V;
+                EXPECT_TRUE(lbfgs.apply(HV, γ));
+                EXPECT_TRUE(lbfgs.apply_hessian(HV, γ));
+                EXPECT_THAT(print_wrap(HV),
+                            EigenAlmostEqual(print_wrap(V), ε * V.norm()));
+                // Compare to the dense BFGS update of B
+                if (γ > 0) {
+                    mat B = mat::Identity(n, n) / γ;
+                    lbfgs.foreach_fwd([&](index_t i) {
+                        vec s = lbfgs.s(i), y = lbfgs.y(i), Bs = B * s;
+                        B += y * y.transpose() / y.dot(s) -
+                             Bs * Bs.transpose() / s.dot(Bs);
+                    });
+                    mat BV_ref = B * V, BV = V;
+                    EXPECT_TRUE(lbfgs.apply_hessian(BV, γ));
+                    EXPECT_THAT(print_wrap(BV),
+                                EigenAlmostEqual(print_wrap(BV_ref),
+                                                 ε * BV_ref.norm()));
+                }
+            }
+        }
+    }
+    quala::LBFGSParams param;
+    quala::LBFGS lbfgs(param, n);
+    mat V = mat::Random(n, K);
+    EXPECT_THROW(lbfgs.apply_hessian(V), std::logic_error);
+}
+
+TEST(LBFGS, applyMatrix) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::real_t;
+    using quala::vec;
+
+    const length_t n = 23, m = 4, K = 3;
+    std::srand(4321);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+
+    constexpr real_t ε = 1e-12;
+    for (auto method : {quala::LBFGSParams::ApplyMethod::TwoLoop,
+                        quala::LBFGSParams::ApplyMethod::Compact}) {
+        quala::LBFGSParams param;
+        param.memory       = m;
+        param.apply_method = method;
+        quala::LBFGS lbfgs(param, n);
+        mat Q = mat::Random(n, K);
+        EXPECT_FALSE(lbfgs.apply(Q, -1));
+        for (index_t k = 0; k < 2 * m + 1; ++k) {
+            vec s = vec::Random(n);
+            vec y = H * s;
+            EXPECT_TRUE(lbfgs.update_sy(s, y, 0));
+            for (real_t γ : {-1., 0.7}) {
+                mat Q     = mat::Random(n, K);
+                mat Q_ref = Q;
+                for (index_t c = 0; c < K; ++c)
+                    EXPECT_TRUE(lbfgs.apply(Q_ref.col(c), γ));
+                EXPECT_TRUE(lbfgs.apply(Q, γ));
+                EXPECT_THAT(print_wrap(Q),
+                            EigenAlmostEqual(print_wrap(Q_ref),
+                                             ε * Q_ref.norm()));
+            }
+        }
+    }
+}
+
+TEST(LBFGS, maskedCache) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::real_t;
+    using quala::vec;
+
+    const length_t n = 29, m = 4;
+    std::srand(2468);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+
+    quala::LBFGSParams param;
+    param.memory = m;
+    quala::LBFGS lbfgs_ref(param, n);
+    param.cache_masked_apply = true;
+    quala::LBFGS lbfgs_cached(param, n);
+
+    std::vector<index_t> J1, J2;
+    for (index_t i = 0; i < n; ++i)
+        (i % 3 == 0 ? J1 : J2).push_back(i);
+
+    constexpr real_t ε = 1e-12;
+    for (index_t k = 0; k < 3 * m; ++k) {
+        vec s = vec::Random(n);
+        vec y = H * s;
+        EXPECT_TRUE(lbfgs_ref.update_sy(s, y, 0));
+        EXPECT_TRUE(lbfgs_cached.update_sy(s, y, 0));
+        if (k == m + 1) {
+            lbfgs_ref.scale_y(0.5);
+            lbfgs_cached.scale_y(0.5);
+        }
+        // Apply a couple of times with the same index set (hits the cache),
+        // then switch to a different one (invalidates the cache)
+        for (const auto *J : {&J1, &J1, &J2, &J2, &J1}) {
+            for (real_t γ : {-1., 0.7}) {
+                vec q     = vec::Random(n);
+                vec q_ref = q;
+                bool ok_ref    = lbfgs_ref.apply(q_ref, γ, *J);
+                bool ok_cached = lbfgs_cached.apply(q, γ, *J);
+                EXPECT_EQ(ok_ref, ok_cached);
+                EXPECT_THAT(print_wrap(q),
+                            EigenAlmostEqual(print_wrap(q_ref),
+                                             ε * q_ref.norm()));
+            }
+        }
+    }
+}
+
+TEST(LBFGS, parallel) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::real_t;
+    using quala::vec;
+
+    const length_t n = 203, m = 4, K = 3;
+    std::srand(1357);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+
+    constexpr real_t ε = 1e-12;
+    for (auto method : {quala::LBFGSParams::ApplyMethod::TwoLoop,
+                        quala::LBFGSParams::ApplyMethod::Compact}) {
+        quala::LBFGSParams param;
+        param.memory       = m;
+        param.apply_method = method;
+        quala::LBFGS lbfgs_ref(param, n);
+        // Chunks that don't divide n
+        param.chunk_size = 16;
+        std::vector<quala::LBFGS> lbfgs_par;
+        for (length_t num_threads : {1, 2, 3, 8}) {
+            param.num_threads = num_threads;
+            lbfgs_par.emplace_back(param, n);
+        }
+        for (index_t k = 0; k < 2 * m + 1; ++k) {
+            vec s = vec::Random(n);
+            vec y = H * s;
+            EXPECT_TRUE(lbfgs_ref.update_sy(s, y, 0));
+            for (auto &lbfgs : lbfgs_par)
+                EXPECT_TRUE(lbfgs.update_sy(s, y, 0));
+            if (k == m + 1) {
+                lbfgs_ref.scale_y(0.5);
+                for (auto &lbfgs : lbfgs_par)
+                    lbfgs.scale_y(0.5);
+            }
+            for (real_t γ : {-1., 0.7}) {
+                vec q     = vec::Random(n);
+                mat Q     = mat::Random(n, K);
+                vec q_ref = q;
+                mat Q_ref = Q;
+                EXPECT_TRUE(lbfgs_ref.apply(q_ref, γ));
+                EXPECT_TRUE(lbfgs_ref.apply(Q_ref, γ));
+                vec q_1;
+                mat Q_1;
+                for (auto &lbfgs : lbfgs_par) {
+                    vec q_par = q;
+                    mat Q_par = Q;
+                    EXPECT_TRUE(lbfgs.apply(q_par, γ));
+                    EXPECT_TRUE(lbfgs.apply(Q_par, γ));
+                    EXPECT_THAT(print_wrap(q_par),
+                                EigenAlmostEqual(print_wrap(q_ref),
+                                                 ε * q_ref.norm()));
+                    EXPECT_THAT(print_wrap(Q_par),
+                                EigenAlmostEqual(print_wrap(Q_ref),
+                                                 ε * Q_ref.norm()));
+                    // Results must not depend on the number of threads
+                    if (q_1.size() == 0) {
+                        q_1 = q_par;
+                        Q_1 = Q_par;
+                    }
+                    EXPECT_THAT(print_wrap(q_par),
+                                EigenAlmostEqual(print_wrap(q_1), 0));
+                    EXPECT_THAT(print_wrap(Q_par),
+                                EigenAlmostEqual(print_wrap(Q_1), 0));
+                }
+            }
+        }
+    }
+}
+
+TEST(LBFGS, diagonalH0) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::real_t;
+    using quala::vec;
+
+    // Badly scaled diagonal problem: the coordinate-wise secant equations
+    // are satisfied exactly by H₀ = A⁻¹
+    const length_t n = 50, m = 5;
+    vec a(n);
+    for (index_t i = 0; i < n; ++i)
+        a(i) = std::pow(1e4, real_t(i) / real_t(n - 1));
+    std::srand(8642);
+
+    quala::LBFGSParams param;
+    param.memory            = m;
+    param.diagonal_h0       = true;
+    param.diagonal_h0_bound = 1e6;
+    quala::LBFGS lbfgs(param, n);
+    param.cache_masked_apply = true;
+    quala::LBFGS lbfgs_cached(param, n);
+    param.cache_masked_apply = false;
+    param.num_threads        = 2;
+    param.chunk_size         = 16;
+    quala::LBFGS lbfgs_par(param, n);
+    for (index_t k = 0; k < m + 2; ++k) {
+        vec s = vec::Random(n), y = a.cwiseProduct(s);
+        EXPECT_TRUE(lbfgs.update_sy(s, y, 0));
+        EXPECT_TRUE(lbfgs_cached.update_sy(s, y, 0));
+        EXPECT_TRUE(lbfgs_par.update_sy(s, y, 0));
+    }
+    vec a_inv = a.cwiseInverse();
+    EXPECT_THAT(print_wrap(lbfgs.diagonal_h0()),
+                EigenAlmostEqual(print_wrap(a_inv), 1e-12));
+    EXPECT_THAT(print_wrap(lbfgs_par.diagonal_h0()),
+                EigenAlmostEqual(print_wrap(a_inv), 1e-12));
+    // With H₀ = A⁻¹, all secant equations hold for H = H₀ as well
+    vec q = vec::Random(n), q_diag = q, q_exact = a_inv.cwiseProduct(q);
+    EXPECT_TRUE(lbfgs.apply(q_diag, -1));
+    EXPECT_THAT(print_wrap(q_diag),
+                EigenAlmostEqual(print_wrap(q_exact), 1e-10));
+    // The given γ takes precedence over the estimate
+    vec q_γ = q, q_d = q;
+    EXPECT_TRUE(lbfgs.apply(q_γ, 0.3));
+    EXPECT_TRUE(lbfgs.apply(q_d, vec::Constant(n, 0.3)));
+    EXPECT_THAT(print_wrap(q_d), EigenAlmostEqual(print_wrap(q_γ), 1e-14));
+    // Matrix version and threads
+    mat Q = mat::Random(n, 3), Q_ref = Q;
+    for (index_t c = 0; c < Q.cols(); ++c)
+        EXPECT_TRUE(lbfgs.apply(Q_ref.col(c), -1));
+    EXPECT_TRUE(lbfgs.apply(Q, -1));
+    EXPECT_THAT(print_wrap(Q), EigenAlmostEqual(print_wrap(Q_ref), 1e-12));
+    vec q_par = q;
+    EXPECT_TRUE(lbfgs_par.apply(q_par, -1));
+    EXPECT_THAT(print_wrap(q_par),
+                EigenAlmostEqual(print_wrap(q_diag), 1e-12));
+    // Masked versions, with and without cache
+    std::vector<index_t> J;
+    for (index_t i = 0; i < n; i += 3)
+        J.push_back(i);
+    vec q_J = q, q_J_cached = q;
+    EXPECT_TRUE(lbfgs.apply(q_J, -1, J));
+    EXPECT_TRUE(lbfgs_cached.apply(q_J_cached, -1, J));
+    EXPECT_THAT(print_wrap(q_J_cached),
+                EigenAlmostEqual(print_wrap(q_J), 1e-12));
+    for (index_t i = 0; i < n; ++i)
+        EXPECT_NEAR(q_J(i), i % 3 == 0 ? q_exact(i) : q(i), 1e-10);
+    EXPECT_THROW(lbfgs.apply(q, vec::Ones(n + 1)), std::invalid_argument);
+
+    // Minimize ½ xᵀAx - bᵀx with an exact line search
+    auto count_iterations = [&](bool diagonal_h0) {
+        quala::LBFGSParams param;
+        param.memory      = m;
+        param.diagonal_h0 = diagonal_h0;
+        quala::LBFGS lbfgs(param, n);
+        vec b = vec::Ones(n), x = vec::Zero(n), g = -b;
+        for (unsigned k = 0; k < 1000; ++k) {
+            if (g.norm() < 1e-10)
+                return k;
+            vec d = g;
+            if (not lbfgs.apply(d, -1))
+                d *= 1e-4;
+            real_t t = g.dot(d) / d.dot(a.cwiseProduct(d));
+            vec s = -t * d, y = a.cwiseProduct(s);
+            lbfgs.update_sy(s, y, 0);
+            x += s;
+            g += y;
+        }
+        return 1000u;
+    };
+    unsigned k_scalar = count_iterations(false);
+    unsigned k_diag   = count_iterations(true);
+    std::cout << "Iterations: scalar H₀: " << k_scalar
+              << ", diagonal H₀: " << k_diag << std::endl;
+    EXPECT_LT(k_diag, k_scalar);
+}
+
+template <class StorageReal>
+class LBFGSMixed : public ::testing::Test {};
+using StorageTypes = ::testing::Types<float, Eigen::bfloat16>;
+TYPED_TEST_SUITE(LBFGSMixed, StorageTypes);
+
+TYPED_TEST(LBFGSMixed, apply) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::real_t;
+    using quala::vec;
+
+    // Larger than the block size used for the conversions
+    const length_t n = 1100, m = 4, K = 3;
+    std::srand(1357);
+    vec d = vec::Random(n).cwiseAbs() + vec::Constant(n, 0.5);
+
+    // The reference uses full precision storage, but is given vectors that
+    // were rounded to the storage precision, so apart from rounding errors in
+    // the accumulation, the results should be identical.
+    const auto round = [](const vec &v) {
+        return vec(v.template cast<TypeParam>().template cast<real_t>());
+    };
+    std::vector<index_t> J;
+    for (index_t i = 0; i < n; i += 3)
+        J.push_back(i);
+
+    constexpr real_t ε = 1e-11;
+    for (auto method : {quala::LBFGSParams::ApplyMethod::TwoLoop,
+                        quala::LBFGSParams::ApplyMethod::Compact}) {
+        quala::LBFGSParams param;
+        param.memory       = m;
+        param.apply_method = method;
+        quala::LBFGS lbfgs_ref(param, n);
+        quala::BasicLBFGS<real_t, TypeParam> lbfgs(param, n);
+        for (index_t k = 0; k < 2 * m + 1; ++k) {
+            vec s = vec::Random(n);
+            vec y = d.asDiagonal() * s;
+            EXPECT_TRUE(lbfgs_ref.update_sy(round(s), round(y), 0));
+            EXPECT_TRUE(lbfgs.update_sy(s, y, 0));
+            for (real_t γ : {-1., 0.7}) {
+                mat Q     = mat::Random(n, K);
+                mat Q_ref = Q;
+                EXPECT_TRUE(lbfgs_ref.apply(Q_ref.col(0), γ));
+                EXPECT_TRUE(lbfgs.apply(Q.col(0), γ));
+                EXPECT_TRUE(lbfgs_ref.apply(Q_ref.rightCols(K - 1), γ));
+                EXPECT_TRUE(lbfgs.apply(Q.rightCols(K - 1), γ));
+                EXPECT_THAT(print_wrap(Q),
+                            EigenAlmostEqual(print_wrap(Q_ref),
+                                             ε * Q_ref.norm()));
+                vec q = vec::Random(n), q_ref = q;
+                EXPECT_TRUE(lbfgs_ref.apply(q_ref, γ, J));
+                EXPECT_TRUE(lbfgs.apply(q, γ, J));
+                EXPECT_THAT(print_wrap(q),
+                            EigenAlmostEqual(print_wrap(q_ref),
+                                             ε * q_ref.norm()));
+            }
+        }
+    }
+}
+
+template <class Real>
+class LBFGSTyped : public ::testing::Test {};
+TYPED_TEST_SUITE(LBFGSTyped, FloatTypes);
+
+TYPED_TEST(LBFGSTyped, quadratic) {
+    using Conf = quala::EigenConfig<TypeParam>;
+    using mat  = typename Conf::mat;
+    using vec  = typename Conf::vec;
+    const auto ε =
+        TypeParam(100) * std::numeric_limits<TypeParam>::epsilon();
+
+    mat H(2, 2);
+    H << 2, -1, -1, 3;
+    using Method = quala::LBFGSApplyMethod;
+    for (auto method : {Method::TwoLoop, Method::Compact}) {
+        quala::BasicLBFGSParams<TypeParam> param;
+        param.memory       = 5;
+        param.apply_method = method;
+        quala::BasicLBFGS<TypeParam> lbfgs(param, 2);
+        vec x(2);
+        x << 10, -5;
+        vec r = H * x;
+        for (size_t i = 0; i < 10; ++i) {
+            vec d = r;
+            if (i > 0)
+                lbfgs.apply(d, 1);
+            vec x_new = x - d;
+            vec r_new = H * x_new;
+            lbfgs.update(x, x_new, r, r_new);
+            r = std::move(r_new);
+            x = std::move(x_new);
+        }
+        EXPECT_NEAR(x(0), 0, ε);
+        EXPECT_NEAR(x(1), 0, ε);
+    }
+}
+
+TEST(LBFGS, setMemory) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::vec;
+
+    const length_t n = 20, m = 5;
+    std::srand(1234);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+    std::vector<vec> S, Y;
+    for (index_t k = 0; k < 3 * m; ++k) {
+        S.push_back(vec::Random(n));
+        Y.push_back(H * S.back());
+    }
+    std::vector<index_t> J{1, 2, 3, 7, 11, 12, 19};
+
+    for (auto method : {quala::LBFGSParams::ApplyMethod::TwoLoop,
+                        quala::LBFGSParams::ApplyMethod::Compact}) {
+        quala::LBFGSParams param;
+        param.apply_method       = method;
+        param.cache_masked_apply = true;
+        param.memory             = m;
+        quala::LBFGS lbfgs(param, n);
+        // Compare to an L-BFGS that only saw the pairs [first, last)
+        auto expect_equal = [&](length_t mem, index_t first, index_t last) {
+            param.memory = mem;
+            quala::LBFGS ref(param, n);
+            for (index_t k = first; k < last; ++k)
+                EXPECT_TRUE(ref.update_sy(S[k], Y[k], 0));
+            EXPECT_EQ(lbfgs.current_history(), ref.current_history());
+            vec q = vec::Random(n), q_ref = q;
+            EXPECT_TRUE(lbfgs.apply(q, -1));
+            EXPECT_TRUE(ref.apply(q_ref, -1));
+            EXPECT_THAT(print_wrap(q),
+                        EigenAlmostEqual(print_wrap(q_ref), 1e-12));
+            q = q_ref = vec::Random(n);
+            EXPECT_TRUE(lbfgs.apply(q, -1, J));
+            EXPECT_TRUE(ref.apply(q_ref, -1, J));
+            EXPECT_THAT(print_wrap(q),
+                        EigenAlmostEqual(print_wrap(q_ref), 1e-12));
+        };
+        // Wrapped around circular buffer
+        for (index_t k = 0; k < m + 2; ++k)
+            EXPECT_TRUE(lbfgs.update_sy(S[k], Y[k], 0));
+        // Shrink
+        lbfgs.set_memory(3);
+        EXPECT_EQ(lbfgs.history(), 3);
+        expect_equal(3, m - 1, m + 2);
+        // Grow, then fill the buffer and wrap around again
+        lbfgs.set_memory(m + 1);
+        expect_equal(m + 1, m - 1, m + 2);
+        for (index_t k = m + 2; k < 2 * m + 1; ++k)
+            EXPECT_TRUE(lbfgs.update_sy(S[k], Y[k], 0));
+        expect_equal(m + 1, m, 2 * m + 1);
+        // Shrink a partially filled buffer
+        lbfgs.set_memory(m + 3);
+        EXPECT_TRUE(lbfgs.update_sy(S[2 * m + 1], Y[2 * m + 1], 0));
+        lbfgs.set_memory(2);
+        expect_equal(2, 2 * m, 2 * m + 2);
+        // Grow again within the existing storage, and wrap around
+        lbfgs.set_memory(m);
+        expect_equal(m, 2 * m, 2 * m + 2);
+        for (index_t k = 2 * m + 2; k < 3 * m; ++k)
+            EXPECT_TRUE(lbfgs.update_sy(S[k], Y[k], 0));
+        expect_equal(m, 2 * m, 3 * m);
+        EXPECT_THROW(lbfgs.set_memory(0), std::invalid_argument);
+    }
+}
+
+TEST(LBFGS, constApply) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::real_t;
+    using quala::vec;
+
+    const length_t n = 31, m = 4, num_q = 6;
+    std::srand(9753);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+
+    std::vector<index_t> J1{0, 1, 2}, J2;
+    for (index_t i = 3; i < n; ++i)
+        J2.push_back(i);
+
+    quala::LBFGSParams param;
+    param.memory = m;
+    quala::LBFGS lbfgs(param, n), ref(param, n);
+    for (index_t k = 0; k < m + 2; ++k) {
+        vec s = vec::Random(n), y = H * s;
+        // This pair is rejected by the masked apply with index set J1
+        if (k == m)
+            y.head(3) = -s.head(3);
+        EXPECT_TRUE(lbfgs.update_sy(s, y, 0));
+        EXPECT_TRUE(ref.update_sy(s, y, 0));
+    }
+
+    // Reference results using the non-const apply, alternating between full
+    // and masked applies (which must not affect each other)
+    std::vector<vec> Q, Q_full, Q_J1, Q_J2;
+    for (index_t i = 0; i < num_q; ++i) {
+        Q.push_back(vec::Random(n));
+        Q_full.push_back(Q.back());
+        Q_J1.push_back(Q.back());
+        Q_J2.push_back(Q.back());
+        EXPECT_TRUE(ref.apply(Q_J1.back(), -1, J1));
+        EXPECT_TRUE(ref.apply(Q_full.back(), -1));
+        EXPECT_TRUE(ref.apply(Q_J2.back(), 0.8, J2));
+    }
+    vec q_fresh = Q[0];
+    EXPECT_TRUE(lbfgs.apply(q_fresh, -1));
+    EXPECT_THAT(print_wrap(q_fresh),
+                EigenAlmostEqual(print_wrap(Q_full[0]), 1e-12));
+
+    // Many threads applying the same approximation, each with their own
+    // workspace
+    const quala::LBFGS &clbfgs = lbfgs;
+    std::vector<std::thread> threads;
+    std::vector<int> ok(4, 0);
+    for (index_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            quala::LBFGSWorkspace ws;
+            int count = 0;
+            for (index_t r = 0; r < 50; ++r) {
+                for (index_t i = 0; i < num_q; ++i) {
+                    vec q_full = Q[i], q_J1 = Q[i], q_J2 = Q[i];
+                    count += clbfgs.apply(q_J1, -1, J1, ws);
+                    count += clbfgs.apply(q_full, -1, ws);
+                    count += clbfgs.apply(q_J2, 0.8, J2, ws);
+                    count += (q_full - Q_full[i]).norm() < 1e-12;
+                    count += (q_J1 - Q_J1[i]).norm() < 1e-12;
+                    count += (q_J2 - Q_J2[i]).norm() < 1e-12;
+                }
+            }
+            ok[t] = count;
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    for (int count : ok)
+        EXPECT_EQ(count, 50 * num_q * 6);
+
+    // An empty history is not applied
+    quala::LBFGS empty(param, n);
+    quala::LBFGSWorkspace ws(m);
+    vec q = Q[0];
+    EXPECT_FALSE(std::as_const(empty).apply(q, -1, ws));
+    EXPECT_FALSE(std::as_const(empty).apply(q, -1, J1, ws));
+    EXPECT_EQ(q, Q[0]);
+}
@@ -1,8 +1,11 @@
 #include "eigen-matchers.hpp"
+#include "float-types.hpp"
 #include <gtest/gtest.h>
 
+#include <Eigen/Cholesky>
 #include <iomanip>
 #include <iostream>
+#include <stdexcept>
 
 #include <quala/util/vec.hpp>
 #include <quala/detail/limited-memory-qr.hpp>
@@ -219,4 +222,172 @@ TEST(LimitedMemoryQR, scale_R) {
     qr.scale_R(0.5);
     EXPECT_THAT(print_wrap(qr.get_Q() * qr.get_R()),
                 EigenAlmostEqual(print_wrap(0.5 * A.block(0, 0, 4, 3)), ε));
-}
\ No newline at end of file
+}
+
+template <class Real>
+class LimitedMemoryQRTyped : public ::testing::Test {};
+TYPED_TEST_SUITE(LimitedMemoryQRTyped, FloatTypes);
+
+TYPED_TEST(LimitedMemoryQRTyped, addingremoving) {
+    using mat = typename quala::EigenConfig<TypeParam>::mat;
+    using vec = typename quala::EigenConfig<TypeParam>::vec;
+
+    mat A(4, 3);
+    A << 3, 3, 2, //
+        4, 4, 1,  //
+        0, 6, 2,  //
+        0, 8, 1;
+
+    const auto ε = TypeParam(10) * std::numeric_limits<TypeParam>::epsilon();
+    quala::BasicLimitedMemoryQR<TypeParam> qr(4, 3);
+
+    qr.add_column(vec::Constant(4, 13));
+    qr.add_column(A.col(0));
+    qr.add_column(A.col(1));
+    qr.remove_column();
+    qr.add_column(A.col(2));
+    mat QR = qr.get_Q() * qr.get_R();
+    EXPECT_THAT(print_wrap(QR), EigenAlmostEqual(print_wrap(A), 100 * ε));
+}
+
+TEST(LimitedMemoryQR, wide) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::vec;
+
+    const length_t n = 4;
+    std::srand(97);
+    for (length_t m : {n + 1, n + 3}) {
+        mat A = mat::Random(n, 3 * m);
+        quala::LimitedMemoryQR qr(n, m);
+        quala::LimitedMemoryQR::UndoRecord u;
+        for (index_t k = 0; k < 3 * m; ++k) {
+            // A speculative update that is undone, with a full buffer
+            if (k == 2 * m) {
+                qr.begin_undo(u);
+                qr.remove_column(&u);
+                qr.add_column(vec::Random(n));
+                qr.undo(u);
+            }
+            if (qr.num_columns() == qr.m())
+                qr.remove_column();
+            qr.add_column(A.col(k));
+            const index_t first = std::max<index_t>(0, k + 1 - m);
+            mat Ak              = A.middleCols(first, k + 1 - first);
+            EXPECT_THAT(print_wrap(qr.get_Q() * qr.get_R()),
+                        EigenAlmostEqual(print_wrap(Ak), 1e-12));
+            // Minimum-norm solution of the underdetermined system
+            vec b = vec::Random(n), x(m);
+            qr.solve_col(b, x);
+            vec x_exp = Ak.completeOrthogonalDecomposition().solve(b);
+            vec x_k   = x.topRows(Ak.cols());
+            EXPECT_THAT(print_wrap(x_k),
+                        EigenAlmostEqual(print_wrap(x_exp), 1e-10));
+        }
+    }
+}
+
+TEST(LimitedMemoryQR, regularized) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::real_t;
+    using quala::vec;
+
+    const length_t n = 6;
+    const real_t λ   = 0.1;
+    std::srand(131);
+    // Tall and wide matrices A
+    for (length_t m : {length_t(4), n + 3}) {
+        mat A = mat::Random(n, 4 * m);
+        quala::LimitedMemoryQR qr(n, m);
+        qr.set_regularization(λ);
+        EXPECT_EQ(qr.get_regularization(), λ);
+        quala::LimitedMemoryQR::UndoRecord u;
+        index_t first = 0;
+        for (index_t k = 0; k < 4 * m; ++k) {
+            if (k == 2 * m) {
+                qr.begin_undo(u);
+                qr.remove_column(&u);
+                qr.add_column(vec::Random(n));
+                qr.undo(u);
+            }
+            if (k == 3 * m) {
+                qr.set_history(m - 1);
+                first = k - (m - 1);
+            }
+            if (k == 3 * m + 2) {
+                qr.scale_R(-2);
+                A *= -2;
+            }
+            if (qr.num_columns() == qr.m())
+                qr.remove_column();
+            qr.add_column(A.col(k));
+            first = std::max<index_t>(first, k + 1 - qr.m());
+            mat Ak = A.middleCols(first, k + 1 - first);
+            // Solution of the regularized normal equations
+            mat H     = Ak.transpose() * Ak;
+            vec b     = vec::Random(n), x(m);
+            vec x_exp = (H + λ * mat(H.diagonal().asDiagonal()))
+                            .llt()
+                            .solve(Ak.transpose() * b);
+            qr.solve_col_regularized(b, x);
+            vec x_k = x.topRows(Ak.cols());
+            EXPECT_THAT(print_wrap(x_k),
+                        EigenAlmostEqual(print_wrap(x_exp), 1e-10));
+        }
+    }
+    quala::LimitedMemoryQR qr(n, 3);
+    EXPECT_THROW(qr.set_regularization(-1), std::invalid_argument);
+}
+
+TEST(LimitedMemoryQR, zeroColumn) {
+    using quala::index_t;
+    using quala::length_t;
+    using quala::mat;
+    using quala::real_t;
+    using quala::vec;
+
+    const length_t n = 6, m = 4, K = 12;
+    const real_t λ   = 1e-8;
+    std::srand(271);
+    // Every third column of A is zero
+    mat A = mat::Random(n, K);
+    for (index_t k = 1; k < K; k += 3)
+        A.col(k).setZero();
+    quala::LimitedMemoryQR qr(n, m), qr_reg(n, m);
+    qr_reg.set_regularization(λ);
+    quala::LimitedMemoryQR::UndoRecord u;
+    for (index_t k = 0; k < K; ++k) {
+        if (k == 2 * m) {
+            qr_reg.begin_undo(u);
+            qr_reg.remove_column(&u);
+            qr_reg.add_column(vec::Zero(n));
+            qr_reg.undo(u);
+        }
+        for (auto *q : {&qr, &qr_reg}) {
+            if (q->num_columns() == q->m())
+                q->remove_column();
+            q->add_column(A.col(k));
+        }
+        const index_t first = std::max<index_t>(0, k + 1 - m);
+        mat Ak              = A.middleCols(first, k + 1 - first);
+        EXPECT_THAT(print_wrap(qr.get_Q() * qr.get_R()),
+                    EigenAlmostEqual(print_wrap(Ak), 1e-12));
+        // The coefficients of the zero columns are zero
+        mat H  = Ak.transpose() * Ak;
+        vec d  = H.diagonal();
+        vec d0 = (d.array() == 0).cast<real_t>();
+        vec b = vec::Random(n), x(m), x_reg(m);
+        vec x_exp = (H + mat((λ * d + d0).asDiagonal()))
+                        .llt()
+                        .solve(Ak.transpose() * b);
+        qr.solve_col(b, x, 1e-10 * qr.get_max_eig());
+        qr_reg.solve_col_regularized(b, x_reg);
+        EXPECT_TRUE(x.topRows(Ak.cols()).allFinite());
+        vec x_k = x_reg.topRows(Ak.cols());
+        EXPECT_THAT(print_wrap(x_k),
+                    EigenAlmostEqual(print_wrap(x_exp), 1e-10));
+    }
+}
@@ -0,0 +1,104 @@
+#include <quala/broyden-good.hpp>
+#include <quala/lbfgs.hpp>
+#include <quala/util/mapped-matrix.hpp>
+
+#include "eigen-matchers.hpp"
+
+using quala::index_t;
+using quala::length_t;
+using quala::mat;
+using quala::real_t;
+using quala::vec;
+
+TEST(MappableMatrix, copyMove) {
+    quala::MappableMatrix<mat> A;
+    A.resize(7, 5, ::testing::TempDir());
+    ASSERT_TRUE(A.is_mapped());
+    mat R = mat::Random(7, 5);
+    A.map() = R;
+    EXPECT_THAT(print_wrap(A.map()), EigenEqual(print_wrap(R)));
+
+    // Copies have their own file
+    quala::MappableMatrix<mat> B = A;
+    EXPECT_TRUE(B.is_mapped());
+    EXPECT_NE(B.data(), A.data());
+    EXPECT_THAT(print_wrap(B.map()), EigenEqual(print_wrap(R)));
+    B.map()(0, 0) = 42;
+    EXPECT_EQ(A.map()(0, 0), R(0, 0));
+
+    // Moving transfers the mapping
+    const real_t *p              = A.data();
+    quala::MappableMatrix<mat> C = std::move(A);
+    EXPECT_TRUE(C.is_mapped());
+    EXPECT_EQ(C.data(), p);
+    EXPECT_THAT(print_wrap(C.map()), EigenEqual(print_wrap(R)));
+
+    // Back to memory
+    C.resize(3, 2);
+    EXPECT_FALSE(C.is_mapped());
+    C.map() = mat::Ones(3, 2);
+    B = C;
+    EXPECT_FALSE(B.is_mapped());
+    EXPECT_THAT(print_wrap(B.map()), EigenEqual(print_wrap(mat::Ones(3, 2))));
+}
+
+TEST(MappableMatrix, invalidDirectory) {
+    quala::MappableMatrix<mat> A;
+    EXPECT_THROW(A.resize(3, 3, "/nonexistent/quala"), std::runtime_error);
+}
+
+TEST(LBFGS, mapped) {
+    const length_t n = 23, m = 5;
+    std::srand(31415);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+    std::vector<index_t> J{0, 1, 4, 5, 6, 13, 20};
+
+    for (auto method : {quala::LBFGSParams::ApplyMethod::TwoLoop,
+                        quala::LBFGSParams::ApplyMethod::Compact}) {
+        quala::LBFGSParams param;
+        param.memory             = m;
+        param.apply_method       = method;
+        param.cache_masked_apply = true;
+        quala::LBFGS lbfgs(param, n);
+        param.storage_dir = ::testing::TempDir();
+        quala::LBFGS mapped(param, n);
+
+        for (index_t k = 0; k < 3 * m; ++k) {
+            vec s = vec::Random(n), y = H * s;
+            lbfgs.update_sy(s, y, 0);
+            mapped.update_sy(s, y, 0);
+            vec q = vec::Random(n), q_mapped = q;
+            EXPECT_TRUE(lbfgs.apply(q, -1));
+            EXPECT_TRUE(mapped.apply(q_mapped, -1));
+            EXPECT_THAT(print_wrap(q_mapped), EigenEqual(print_wrap(q)));
+            q = q_mapped = vec::Random(n);
+            EXPECT_TRUE(lbfgs.apply(q, -1, J));
+            EXPECT_TRUE(mapped.apply(q_mapped, -1, J));
+            EXPECT_THAT(print_wrap(q_mapped), EigenEqual(print_wrap(q)));
+        }
+    }
+}
+
+TEST(BroydenGood, mapped) {
+    const length_t n = 19, m = 4;
+    std::srand(27182);
+    mat A = mat::Random(n, n) + 4 * mat::Identity(n, n);
+
+    quala::BroydenGoodParams param;
+    param.memory    = m;
+    param.restarted = false;
+    quala::BroydenGood broyden(param, n);
+    param.storage_dir = ::testing::TempDir();
+    quala::BroydenGood mapped(param, n);
+
+    for (index_t k = 0; k < 3 * m; ++k) {
+        vec s = vec::Random(n), y = A * s;
+        broyden.update_sy(s, y);
+        mapped.update_sy(s, y);
+        vec q = vec::Random(n), q_mapped = q;
+        EXPECT_TRUE(broyden.apply(q, -1));
+        EXPECT_TRUE(mapped.apply(q_mapped, -1));
+        EXPECT_THAT(print_wrap(q_mapped), EigenEqual(print_wrap(q)));
+    }
+}
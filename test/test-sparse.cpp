@@ -0,0 +1,187 @@
+#include <quala/broyden-good.hpp>
+#include <quala/lbfgs.hpp>
+
+#include "eigen-matchers.hpp"
+
+#include <Eigen/SparseCore>
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+using quala::idvec;
+using quala::index_t;
+using quala::length_t;
+using quala::mat;
+using quala::vec;
+
+/// Random sorted index set with @p nnz distinct elements in [0, n).
+static idvec random_pattern(length_t n, length_t nnz) {
+    std::vector<index_t> J;
+    while (static_cast<length_t>(J.size()) < nnz) {
+        index_t j = std::rand() % n;
+        if (std::find(J.begin(), J.end(), j) == J.end())
+            J.push_back(j);
+    }
+    std::sort(J.begin(), J.end());
+    return Eigen::Map<idvec>(J.data(), nnz);
+}
+
+TEST(Sparse, LBFGS) {
+    const length_t n = 200, m = 4;
+    std::srand(1234);
+    vec D = vec::Random(n).cwiseAbs() + vec::Constant(n, 0.5);
+
+    quala::LBFGSParams param;
+    param.memory = m;
+    quala::LBFGS lbfgs(param, n), ref(param, n);
+    quala::LBFGSWorkspace ws;
+    const auto check_apply = [&] {
+        for (double γ : {-1., 0.5}) {
+            vec q = vec::Random(n), q_ref = q, q_ws = q;
+            EXPECT_TRUE(lbfgs.apply(q, γ));
+            EXPECT_TRUE(ref.apply(q_ref, γ));
+            EXPECT_TRUE(lbfgs.apply(q_ws, γ, ws));
+            EXPECT_THAT(print_wrap(q),
+                        EigenAlmostEqual(print_wrap(q_ref), 1e-12));
+            EXPECT_THAT(print_wrap(q_ws), EigenAlmostEqual(print_wrap(q), 0));
+        }
+        vec q = vec::Random(n), q_ref = q;
+        EXPECT_TRUE(lbfgs.apply(q, D));
+        EXPECT_TRUE(ref.apply(q_ref, D));
+        EXPECT_THAT(print_wrap(q),
+                    EigenAlmostEqual(print_wrap(q_ref), 1e-12));
+    };
+
+    // Sparse pairs, wrapping around the circular buffer
+    for (index_t k = 0; k < m + 2; ++k) {
+        idvec J = random_pattern(n, 15);
+        vec s_J = vec::Random(J.size()), y_J(J.size());
+        for (index_t i = 0; i < J.size(); ++i)
+            y_J(i) = D(J(i)) * s_J(i);
+        vec s = vec::Zero(n), y = vec::Zero(n);
+        s(J) = s_J, y(J) = y_J;
+        EXPECT_TRUE(lbfgs.update_sy_sparse(J, s_J, y_J, 0));
+        EXPECT_TRUE(ref.update_sy(s, y, 0));
+        EXPECT_EQ(lbfgs.num_sparse(), std::min(k + 1, m));
+        check_apply();
+    }
+
+    // Pairs that are too dense are stored densely
+    idvec J = random_pattern(n, 30);
+    vec s_J = vec::Random(J.size()), y_J = 2 * s_J;
+    vec s = vec::Zero(n), y = vec::Zero(n);
+    s(J) = s_J, y(J) = y_J;
+    EXPECT_TRUE(lbfgs.update_sy_sparse(J, s_J, y_J, 0));
+    EXPECT_TRUE(ref.update_sy(s, y, 0));
+    EXPECT_EQ(lbfgs.num_sparse(), m - 1);
+    check_apply();
+
+    // Eigen sparse vectors
+    Eigen::SparseVector<double> s_sp = s.sparseView(), y_sp(n);
+    y_sp.insert(J(0))    = 1;
+    s_sp.coeffRef(J(0))  = 0.5;
+    s_sp.coeffRef(n - 1) = 0.25; // not in the pattern of y
+    s = s_sp, y = y_sp;
+    EXPECT_TRUE(lbfgs.update_sy(s_sp, y_sp, 0));
+    EXPECT_TRUE(ref.update_sy(s, y, 0));
+    check_apply();
+
+    // The masked versions use the sparse pairs as well, for scattered
+    // indices, long runs of indices (see IndexRanges) and all indices
+    std::vector<index_t> scattered{1, 2, 3, 10, 11, 12, 13, 100, 150}, runs,
+        all(n);
+    for (index_t j = 0; j < n; ++j)
+        if (j < 50 || (j >= 120 && j < 160))
+            runs.push_back(j);
+    std::iota(all.begin(), all.end(), index_t(0));
+    const length_t num_sparse = lbfgs.num_sparse();
+    for (const auto &mask : {scattered, runs, all}) {
+        for (double γ : {-1., 0.5}) {
+            vec q = vec::Random(n), q_ref = q, q_ws = q;
+            EXPECT_TRUE(lbfgs.apply(q, γ, mask));
+            EXPECT_TRUE(ref.apply(q_ref, γ, mask));
+            EXPECT_TRUE(lbfgs.apply(q_ws, γ, mask, ws));
+            EXPECT_THAT(print_wrap(q),
+                        EigenAlmostEqual(print_wrap(q_ref), 1e-12));
+            EXPECT_THAT(print_wrap(q_ws), EigenAlmostEqual(print_wrap(q), 0));
+        }
+    }
+    EXPECT_EQ(lbfgs.num_sparse(), num_sparse);
+    check_apply();
+
+    // Configurations that require dense pairs
+    param.diagonal_h0 = true;
+    quala::LBFGS diag(param, n);
+    EXPECT_TRUE(
+        diag.update_sy_sparse(J.head(5), s_J.head(5), y_J.head(5), 0));
+    EXPECT_EQ(diag.num_sparse(), 0);
+    EXPECT_THROW(diag.update_sy_sparse(J, s_J.head(5), y_J, 0),
+                 std::invalid_argument);
+
+    // Indices that are out of range, unsorted or duplicated
+    idvec J_bad(3);
+    vec v_bad = vec::Ones(3);
+    for (auto J_ : {std::array<index_t, 3>{1, 5, n}, {1, -1, 5}, {5, 1, 7},
+                    {1, 5, 5}}) {
+        std::copy(J_.begin(), J_.end(), J_bad.begin());
+        EXPECT_THROW(lbfgs.update_sy_sparse(J_bad, v_bad, v_bad, 0),
+                     std::invalid_argument);
+    }
+}
+
+TEST(Sparse, BroydenGood) {
+    const length_t n = 300, m = 3;
+    std::srand(4321);
+    // Tridiagonal Jacobian
+    mat A = 3 * mat::Identity(n, n);
+    for (index_t i = 0; i + 1 < n; ++i)
+        A(i, i + 1) = A(i + 1, i) = 0.5;
+
+    for (bool restarted : {false, true}) {
+        quala::BroydenGoodParams param;
+        param.memory             = m;
+        param.restarted          = restarted;
+        param.sparse_max_density = 0.2;
+        quala::BroydenGood broyden(param, n), ref(param, n);
+        length_t num_sparse = 0;
+        for (index_t k = 0; k < 3 * m; ++k) {
+            // The fill-in grows with the number of pairs
+            idvec J = random_pattern(n, 5);
+            vec s   = vec::Zero(n);
+            s(J)    = vec::Random(J.size());
+            Eigen::SparseVector<double> s_sp = s.sparseView(),
+                                        y_sp = (A * s).sparseView();
+            EXPECT_TRUE(broyden.update_sy(s_sp, y_sp));
+            EXPECT_TRUE(ref.update_sy(s, A * s));
+            num_sparse = std::max(num_sparse, broyden.num_sparse());
+            for (double γ : {-1., 1.}) {
+                vec q = vec::Random(n), q_ref = q;
+                EXPECT_TRUE(broyden.apply(q, γ));
+                EXPECT_TRUE(ref.apply(q_ref, γ));
+                EXPECT_THAT(print_wrap(q),
+                            EigenAlmostEqual(print_wrap(q_ref), 1e-10));
+            }
+        }
+        EXPECT_GT(num_sparse, 0);
+        idvec J_bad(2);
+        J_bad << 3, n;
+        EXPECT_THROW(broyden.update_sy_sparse(J_bad, vec::Ones(2),
+                                              vec::Ones(2)),
+                     std::invalid_argument);
+
+        // A dense pair after sparse ones
+        vec s = vec::Random(n);
+        EXPECT_TRUE(broyden.update_sy(s, A * s));
+        EXPECT_TRUE(ref.update_sy(s, A * s));
+        broyden.densify();
+        EXPECT_EQ(broyden.num_sparse(), 0);
+        vec q = vec::Random(n), q_ref = q;
+        EXPECT_TRUE(broyden.apply(q, -1));
+        EXPECT_TRUE(ref.apply(q_ref, -1));
+        EXPECT_THAT(print_wrap(q), EigenAlmostEqual(print_wrap(q_ref), 1e-10));
+    }
+}
@@ -0,0 +1,225 @@
+#include <quala/anderson-acceleration.hpp>
+#include <quala/lbfgs.hpp>
+
+#include "eigen-matchers.hpp"
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdlib>
+
+// Count the number of heap allocations by interposing malloc (glibc only, all
+// other allocation functions, such as operator new and Eigen's aligned
+// allocator, end up here as well). This file is compiled into its own test
+// executable, so the counter only sees the allocations of these tests.
+// The sanitizers interpose malloc themselves, so counting is disabled when
+// they are enabled.
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) ||     \
+    __has_feature(memory_sanitizer)
+#define QUALA_SANITIZER 1
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define QUALA_SANITIZER 1
+#endif
+
+#if defined(__GLIBC__) && !defined(QUALA_SANITIZER)
+static std::atomic<unsigned> malloc_count{0};
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *malloc(size_t size) {
+    malloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+#define QUALA_COUNT_MALLOC(expr)                                               \
+    [&] {                                                                      \
+        unsigned count_before = malloc_count;                                  \
+        expr;                                                                  \
+        return malloc_count - count_before;                                    \
+    }()
+#else
+#define QUALA_COUNT_MALLOC(expr)                                               \
+    [&] {                                                                      \
+        expr;                                                                  \
+        return 0u;                                                             \
+    }()
+#endif
+
+TEST(Static, LBFGS) {
+    constexpr quala::length_t n = 6, m = 3;
+    quala::LBFGSParams params;
+    params.memory = m;
+    quala::LBFGS lbfgs(params, n);
+    // Neither the construction nor the updates allocate any memory
+    using StaticLBFGS = quala::StaticLBFGS<n, m>;
+    EXPECT_EQ(QUALA_COUNT_MALLOC(StaticLBFGS tmp(params)), 0u);
+    StaticLBFGS lbfgs_s(params);
+    using vec_s = Eigen::Matrix<quala::real_t, n, 1>;
+    static_assert(sizeof(lbfgs_s) > sizeof(quala::real_t) * n * 2 * m);
+
+    std::srand(1);
+    for (unsigned k = 0; k < 5; ++k) {
+        vec_s s = vec_s::Random();
+        vec_s y = s + 0.1 * vec_s::Random();
+        bool ok_s;
+        EXPECT_EQ(QUALA_COUNT_MALLOC(ok_s = lbfgs_s.update_sy(s, y, 1)), 0u);
+        EXPECT_EQ(ok_s, lbfgs.update_sy(s, y, 1));
+
+        vec_s q = vec_s::Random();
+        quala::vec q_dyn = q;
+        EXPECT_EQ(QUALA_COUNT_MALLOC(lbfgs_s.apply(q, 0.5)), 0u);
+        lbfgs.apply(q_dyn, 0.5);
+        EXPECT_THAT(print_wrap(q), EigenAlmostEqual(print_wrap(q_dyn), 1e-14));
+    }
+    EXPECT_EQ(lbfgs_s.current_history(), m);
+    EXPECT_EQ(lbfgs_s.get_params().memory, m);
+    EXPECT_THROW(lbfgs_s.resize(n + 1), std::invalid_argument);
+}
+
+TEST(Static, LimitedMemoryQR) {
+    constexpr quala::length_t n = 5, m = 3;
+    quala::LimitedMemoryQR qr(n, m);
+    using StaticQR = quala::StaticLimitedMemoryQR<n, m>;
+    EXPECT_EQ(QUALA_COUNT_MALLOC(StaticQR tmp(n, m)), 0u);
+    StaticQR qr_s(n, m);
+    using vec_s = Eigen::Matrix<quala::real_t, n, 1>;
+    using vec_m = Eigen::Matrix<quala::real_t, m, 1>;
+
+    std::srand(2);
+    for (unsigned k = 0; k < 6; ++k) {
+        vec_s v = vec_s::Random();
+        vec_m x, x_dyn;
+        auto count = QUALA_COUNT_MALLOC({
+            if (qr_s.num_columns() == qr_s.m())
+                qr_s.remove_column();
+            qr_s.add_column(v);
+            qr_s.solve_col(v, x);
+        });
+        EXPECT_EQ(count, 0u);
+        if (qr.num_columns() == qr.m())
+            qr.remove_column();
+        qr.add_column(v);
+        qr.solve_col(v, x_dyn);
+        auto c = qr.num_columns();
+        EXPECT_THAT(print_wrap(x.topRows(c)),
+                    EigenAlmostEqual(print_wrap(x_dyn.topRows(c)), 1e-12));
+    }
+}
+
+TEST(Static, AndersonAccel) {
+    constexpr quala::length_t n = 2, m = 2;
+    using vec_s = Eigen::Matrix<quala::real_t, n, 1>;
+    Eigen::Matrix<quala::real_t, n, n> A;
+    A << 20, -10, -10, 30;
+    vec_s b;
+    b << 9, 19;
+    auto g = [&](const vec_s &x) -> vec_s { return A * x - b; };
+
+    quala::AndersonAccelParams params;
+    params.memory = 5; // ignored
+    using StaticAA = quala::StaticAndersonAccel<n, m>;
+    EXPECT_EQ(QUALA_COUNT_MALLOC(StaticAA tmp(params)), 0u);
+    StaticAA aa(params);
+    EXPECT_EQ(aa.history(), m);
+    vec_s x = -b, gₖ = g(x), x_aa;
+    aa.initialize(gₖ, gₖ - x);
+    x = gₖ;
+    for (unsigned k = 0; k < 5; ++k) {
+        gₖ       = g(x);
+        vec_s rₖ = gₖ - x;
+        EXPECT_EQ(QUALA_COUNT_MALLOC(aa.compute(gₖ, rₖ, x_aa)), 0u);
+        x = x_aa;
+    }
+    EXPECT_NEAR(x(0), 1, 1e-10);
+    EXPECT_NEAR(x(1), 1, 1e-10);
+}
+
+TEST(Static, AndersonAccelWide) {
+    constexpr quala::length_t n = 2, m = 4;
+    using vec_s = Eigen::Matrix<quala::real_t, n, 1>;
+    Eigen::Matrix<quala::real_t, n, n> A;
+    A << 0.5, -0.4, 0.3, 0.6;
+    vec_s b;
+    b << 1, -2;
+    auto g = [&](const vec_s &x) -> vec_s {
+        return A * x + 0.1 * x.array().sin().matrix() + b;
+    };
+
+    quala::AndersonAccelParams params;
+    quala::StaticAndersonAccel<n, m> aa(params);
+    quala::AndersonAccel ref(params, n);
+    ref.set_memory(m);
+    EXPECT_EQ(aa.history(), m);
+    vec_s x = vec_s::Zero(), gₖ = g(x), x_aa;
+    quala::vec x_ref(n);
+    aa.initialize(gₖ, gₖ - x);
+    ref.initialize(gₖ, gₖ - x);
+    x = gₖ;
+    for (unsigned k = 0; k < 2 * m; ++k) {
+        gₖ       = g(x);
+        vec_s rₖ = gₖ - x;
+        // The history becomes longer than the problem dimension
+        EXPECT_EQ(QUALA_COUNT_MALLOC(aa.compute(gₖ, rₖ, x_aa)), 0u);
+        ref.compute(quala::vec(gₖ), quala::vec(rₖ), x_ref);
+        EXPECT_THAT(print_wrap(x_aa),
+                    EigenAlmostEqual(print_wrap(x_ref), 1e-10));
+        x = x_aa;
+    }
+    EXPECT_LT((g(x) - x).norm(), 1e-8);
+}
+
+TEST(StaticHistory, LimitedMemoryQR) {
+    constexpr quala::length_t n = 50, m = 4;
+    quala::LimitedMemoryQR qr(n, m);
+    quala::StaticHistoryLimitedMemoryQR<m> qr_s(n, m);
+
+    std::srand(3);
+    for (unsigned k = 0; k < 11; ++k) {
+        quala::vec v = quala::vec::Random(n);
+        if (qr.num_columns() == qr.m()) {
+            qr.remove_column();
+            qr_s.remove_column();
+        }
+        qr.add_column(v);
+        qr_s.add_column(v);
+        EXPECT_THAT(print_wrap(qr_s.get_Q()),
+                    EigenAlmostEqual(print_wrap(qr.get_Q()), 1e-14));
+        EXPECT_THAT(print_wrap(qr_s.get_R()),
+                    EigenAlmostEqual(print_wrap(qr.get_R()), 1e-14));
+        quala::vec x(m), x_s(m);
+        qr.solve_col(v, x);
+        qr_s.solve_col(v, x_s);
+        auto c = qr.num_columns();
+        EXPECT_THAT(print_wrap(x_s.topRows(c)),
+                    EigenAlmostEqual(print_wrap(x.topRows(c)), 1e-14));
+        // Tolerance on the diagonal of R
+        qr.solve_col(v, x, 1e3);
+        qr_s.solve_col(v, x_s, 1e3);
+        EXPECT_THAT(print_wrap(x_s.topRows(c)),
+                    EigenAlmostEqual(print_wrap(x.topRows(c)), 0));
+    }
+}
+
+TEST(StaticHistory, AndersonAccel) {
+    constexpr quala::length_t n = 20, m = 3;
+    quala::mat A = quala::mat::Random(n, n) / (4 * n);
+    quala::vec b = quala::vec::Random(n);
+    auto g       = [&](quala::crvec x) -> quala::vec { return A * x - b; };
+
+    quala::AndersonAccelParams params;
+    params.memory = m;
+    quala::AndersonAccel aa(params, n);
+    quala::StaticHistoryAndersonAccel<m> aa_s(params, n);
+    quala::vec x = quala::vec::Zero(n), gₖ = g(x), x_aa(n), x_aa_s(n);
+    aa.initialize(gₖ, gₖ - x);
+    aa_s.initialize(gₖ, gₖ - x);
+    x = gₖ;
+    for (unsigned k = 0; k < 8; ++k) {
+        gₖ            = g(x);
+        quala::vec rₖ = gₖ - x;
+        aa.compute(gₖ, rₖ, x_aa);
+        aa_s.compute(gₖ, rₖ, x_aa_s);
+        EXPECT_THAT(print_wrap(x_aa_s),
+                    EigenAlmostEqual(print_wrap(x_aa), 1e-12));
+        x = x_aa;
+    }
+}
@@ -0,0 +1,135 @@
+#include <quala/anderson-acceleration.hpp>
+#include <quala/broyden-good.hpp>
+#include <quala/lbfgs.hpp>
+
+#include "eigen-matchers.hpp"
+
+#include <limits>
+
+using quala::index_t;
+using quala::length_t;
+using quala::real_t;
+using quala::vec;
+
+TEST(Stats, LBFGS) {
+    const length_t n = 10;
+    std::srand(4321);
+    quala::LBFGSParams param;
+    param.memory = 3;
+    quala::LBFGS lbfgs(param, n);
+
+    vec s = vec::Random(n), y = 2 * s, q = vec::Random(n);
+    EXPECT_TRUE(lbfgs.update_sy(s, y, 0));
+    EXPECT_TRUE(lbfgs.update_sy(y, 2 * y, 0));
+    EXPECT_FALSE(lbfgs.update_sy(vec::Zero(n), y, 0));
+    vec y_nan = y;
+    y_nan(0)  = std::numeric_limits<real_t>::quiet_NaN();
+    EXPECT_FALSE(lbfgs.update_sy(s, y_nan, 0));
+    EXPECT_FALSE(lbfgs.update_sy(s, -y, 0));
+    EXPECT_TRUE(lbfgs.apply(q, -1));
+    EXPECT_TRUE(lbfgs.apply(q, -1, std::vector<index_t>{1, 2, 5}));
+
+    const auto &st = lbfgs.get_stats();
+    if constexpr (quala::with_stats) {
+        EXPECT_EQ(st.update.count, 5u);
+        EXPECT_EQ(st.accepted, 2u);
+        EXPECT_EQ(st.rejected_small_step, 1u);
+        EXPECT_EQ(st.rejected_non_finite, 1u);
+        EXPECT_EQ(st.rejected_curvature, 1u);
+        EXPECT_EQ(st.rejected(), 3u);
+        EXPECT_EQ(st.apply.count, 1u);
+        EXPECT_EQ(st.masked_apply.count, 1u);
+        // Two pairs, eight flops per element per pair, and scaling by H₀
+        EXPECT_EQ(st.apply.flops, (8 * 2 + 1) * n);
+        EXPECT_LT(st.masked_apply.flops, st.apply.flops);
+        EXPECT_GT(st.apply.bytes, 0);
+    } else {
+        EXPECT_EQ(st.update.count, 0u);
+        EXPECT_EQ(st.apply.count, 0u);
+        EXPECT_EQ(st.accepted, 0u);
+    }
+    lbfgs.reset_stats();
+    EXPECT_EQ(lbfgs.get_stats().update.count, 0u);
+    EXPECT_EQ(lbfgs.get_stats().apply.time_ns, 0u);
+}
+
+TEST(Stats, BroydenGood) {
+    const length_t n = 8;
+    std::srand(8765);
+    quala::BroydenGoodParams param;
+    param.memory = 4;
+    quala::BroydenGood broyden(param, n);
+
+    vec s = vec::Random(n), q = vec::Random(n);
+    EXPECT_TRUE(broyden.update_sy(s, 3 * s));
+    EXPECT_FALSE(broyden.update_sy(s, vec::Zero(n)));
+    EXPECT_TRUE(broyden.apply(q, -1));
+
+    const auto &st = broyden.get_stats();
+    if constexpr (quala::with_stats) {
+        EXPECT_EQ(st.update.count, 2u);
+        EXPECT_EQ(st.accepted, 1u);
+        EXPECT_EQ(st.rejected_curvature, 1u);
+        EXPECT_EQ(st.apply.count, 1u);
+        EXPECT_EQ(st.apply.flops, 5 * n);
+    } else {
+        EXPECT_EQ(st.update.count, 0u);
+        EXPECT_EQ(st.rejected(), 0u);
+    }
+}
+
+TEST(Stats, BroydenGoodSparse) {
+    const length_t n = 8;
+    quala::BroydenGoodParams param;
+    param.memory             = 4;
+    param.sparse_max_density = 0.5;
+    quala::BroydenGood broyden(param, n);
+
+    // The first two pairs are stored sparsely, the fill-in of the third one
+    // is too large, so it falls back to a dense update
+    for (index_t i = 0; i < 3; ++i) {
+        Eigen::SparseVector<real_t> s(n);
+        s.insert(2 * i)     = 1;
+        s.insert(2 * i + 1) = -2;
+        EXPECT_TRUE(broyden.update_sy(s, 3 * s));
+    }
+
+    const auto &st = broyden.get_stats();
+    if constexpr (quala::with_stats) {
+        EXPECT_EQ(st.update.count, 3u);
+        EXPECT_EQ(st.accepted, 3u);
+        EXPECT_EQ(st.rejected(), 0u);
+    } else {
+        EXPECT_EQ(st.update.count, 0u);
+    }
+}
+
+TEST(Stats, AndersonAccel) {
+    const length_t n = 6, m = 3;
+    std::srand(1928);
+    quala::AndersonAccelParams param;
+    param.memory = m;
+    quala::AndersonAccel aa(param, n);
+
+    vec x(n);
+    aa.initialize(vec::Random(n), vec::Random(n));
+    for (index_t k = 0; k < 5; ++k) {
+        vec g = vec::Random(n), r = vec::Random(n);
+        aa.compute(g, r, x);
+    }
+    // The same residual twice gives a zero column, which is skipped
+    vec g = vec::Random(n), r = vec::Random(n);
+    aa.compute(g, r, x);
+    aa.compute(g, r, x);
+
+    const auto &st = aa.get_stats();
+    if constexpr (quala::with_stats) {
+        EXPECT_EQ(st.update.count, 7u);
+        EXPECT_EQ(st.accepted, 7u);
+        EXPECT_GE(st.skipped_diagonals, 1u);
+        EXPECT_GT(st.update.flops, 0);
+    } else {
+        EXPECT_EQ(st.update.count, 0u);
+        EXPECT_EQ(st.skipped_diagonals, 0u);
+    }
+}
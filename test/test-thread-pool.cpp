@@ -0,0 +1,41 @@
+#include <quala/util/thread-pool.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(ThreadPool, allTasksOnce) {
+    for (quala::length_t num_threads : {1, 2, 5}) {
+        quala::ThreadPool pool{num_threads};
+        EXPECT_EQ(pool.num_threads(), num_threads);
+        // Run multiple times to check that the workers are reused correctly
+        for (unsigned rep = 0; rep < 20; ++rep) {
+            std::vector<std::atomic<int>> count(37);
+            std::atomic<bool> bad_thread{false};
+            pool.run(count.size(), [&](quala::index_t task,
+                                       quala::index_t thread) {
+                ++count[task];
+                if (thread < 0 || thread >= num_threads)
+                    bad_thread = true;
+            });
+            for (auto &c : count)
+                EXPECT_EQ(c, 1);
+            EXPECT_FALSE(bad_thread);
+        }
+    }
+}
+
+TEST(ThreadPool, concurrentRuns) {
+    quala::ThreadPool pool{3};
+    std::atomic<int> total{0};
+    auto job = [&] {
+        for (unsigned rep = 0; rep < 50; ++rep)
+            pool.run(10, [&](quala::index_t, quala::index_t) { ++total; });
+    };
+    std::thread t1{job}, t2{job};
+    t1.join();
+    t2.join();
+    EXPECT_EQ(total, 2 * 50 * 10);
+}
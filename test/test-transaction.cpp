@@ -0,0 +1,147 @@
+#include <quala/anderson-acceleration.hpp>
+#include <quala/broyden-good.hpp>
+#include <quala/lbfgs.hpp>
+
+#include "eigen-matchers.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+using quala::index_t;
+using quala::length_t;
+using quala::mat;
+using quala::vec;
+
+TEST(Transaction, LBFGS) {
+    const length_t n = 17, m = 4;
+    std::srand(3141);
+    mat A = mat::Random(n, n);
+    mat H = A.transpose() * A + mat::Identity(n, n);
+    std::vector<index_t> J{0, 1, 2, 5, 8, 9, 10, 16};
+
+    for (auto method : {quala::LBFGSParams::ApplyMethod::TwoLoop,
+                        quala::LBFGSParams::ApplyMethod::Compact}) {
+        for (length_t num_updates : {length_t(1), length_t(2), m + 2}) {
+            quala::LBFGSParams param;
+            param.memory             = m;
+            param.apply_method       = method;
+            param.diagonal_h0        = true;
+            param.cache_masked_apply = true;
+            quala::LBFGS lbfgs(param, n), ref(param, n);
+            // Partially filled buffer, and a buffer that wraps around
+            for (index_t k = 0; k < m + 1; ++k) {
+                vec s = vec::Random(n), y = H * s;
+                EXPECT_TRUE(lbfgs.update_sy(s, y, 0));
+                EXPECT_TRUE(ref.update_sy(s, y, 0));
+                vec q = vec::Random(n), q_ref = q;
+                EXPECT_TRUE(lbfgs.apply(q, -1, J));
+                EXPECT_TRUE(ref.apply(q_ref, -1, J));
+                if (k == 1 || k == m) {
+                    lbfgs.begin_transaction();
+                    EXPECT_TRUE(lbfgs.in_transaction());
+                    EXPECT_THROW(lbfgs.begin_transaction(), std::logic_error);
+                    for (index_t i = 0; i < num_updates; ++i) {
+                        vec s = vec::Random(n), y = H * s;
+                        EXPECT_TRUE(lbfgs.update_sy(s, y, 0));
+                    }
+                    lbfgs.rollback();
+                    EXPECT_FALSE(lbfgs.in_transaction());
+                }
+                EXPECT_EQ(lbfgs.current_history(), ref.current_history());
+                EXPECT_EQ(lbfgs.diagonal_h0(), ref.diagonal_h0());
+                q = q_ref = vec::Random(n);
+                EXPECT_TRUE(lbfgs.apply(q, -1));
+                EXPECT_TRUE(ref.apply(q_ref, -1));
+                EXPECT_THAT(print_wrap(q),
+                            EigenAlmostEqual(print_wrap(q_ref), 1e-12));
+                q = q_ref = vec::Random(n);
+                EXPECT_TRUE(lbfgs.apply(q, 0.5, J));
+                EXPECT_TRUE(ref.apply(q_ref, 0.5, J));
+                EXPECT_THAT(print_wrap(q),
+                            EigenAlmostEqual(print_wrap(q_ref), 1e-12));
+            }
+        }
+    }
+
+    // Committed updates are kept
+    quala::LBFGSParams param;
+    param.memory = m;
+    quala::LBFGS lbfgs(param, n);
+    EXPECT_THROW(lbfgs.rollback(), std::logic_error);
+    lbfgs.begin_transaction();
+    vec s = vec::Random(n), y = H * s;
+    EXPECT_TRUE(lbfgs.update_sy(s, y, 0));
+    lbfgs.commit();
+    EXPECT_EQ(lbfgs.current_history(), 1);
+    EXPECT_THROW(lbfgs.rollback(), std::logic_error);
+    // Reset ends the transaction
+    lbfgs.begin_transaction();
+    lbfgs.reset();
+    EXPECT_FALSE(lbfgs.in_transaction());
+}
+
+TEST(Transaction, BroydenGood) {
+    const length_t n = 9, m = 3;
+    std::srand(2718);
+    mat A = mat::Random(n, n) + 3 * mat::Identity(n, n);
+
+    for (bool restarted : {false, true}) {
+        quala::BroydenGoodParams param;
+        param.memory      = m;
+        param.restarted   = restarted;
+        param.diagonal_h0 = true;
+        quala::BroydenGood broyden(param, n), ref(param, n);
+        for (index_t k = 0; k < 2 * m; ++k) {
+            broyden.begin_transaction();
+            for (index_t i = 0; i < m; ++i) {
+                vec s = vec::Random(n);
+                EXPECT_TRUE(broyden.update_sy(s, A * s));
+            }
+            broyden.rollback();
+            vec s = vec::Random(n);
+            EXPECT_TRUE(broyden.update_sy(s, A * s));
+            EXPECT_TRUE(ref.update_sy(s, A * s));
+            EXPECT_EQ(broyden.current_history(), ref.current_history());
+            EXPECT_EQ(broyden.diagonal_h0(), ref.diagonal_h0());
+            vec q = vec::Random(n), q_ref = q;
+            EXPECT_TRUE(broyden.apply(q, -1));
+            EXPECT_TRUE(ref.apply(q_ref, -1));
+            EXPECT_EQ(q, q_ref);
+        }
+    }
+}
+
+TEST(Transaction, AndersonAccel) {
+    const length_t n = 12, m = 4;
+    std::srand(1618);
+
+    quala::AndersonAccelParams param;
+    param.memory = m;
+    quala::AndersonAccel aa(param, n), ref(param, n);
+    vec g0 = vec::Random(n), r0 = vec::Random(n);
+    aa.initialize(g0, r0);
+    ref.initialize(g0, r0);
+
+    vec x(n), x_ref(n);
+    for (index_t k = 0; k < 3 * m; ++k) {
+        // A few speculative steps, some of which remove columns from the QR
+        // factorization
+        aa.begin_transaction();
+        for (index_t i = 0; i < k % 3 + 1; ++i) {
+            vec g = vec::Random(n), r = vec::Random(n);
+            aa.compute(g, r, x);
+        }
+        aa.rollback();
+        EXPECT_FALSE(aa.in_transaction());
+        EXPECT_EQ(aa.current_history(), ref.current_history());
+        vec g = vec::Random(n), r = vec::Random(n);
+        aa.compute(g, r, x);
+        ref.compute(g, r, x_ref);
+        EXPECT_THAT(print_wrap(x), EigenAlmostEqual(print_wrap(x_ref), 1e-10));
+    }
+    EXPECT_THROW(aa.rollback(), std::logic_error);
+    aa.begin_transaction();
+    EXPECT_THROW(aa.begin_transaction(), std::logic_error);
+    aa.reset();
+    EXPECT_FALSE(aa.in_transaction());
+}